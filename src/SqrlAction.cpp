@@ -23,26 +23,41 @@ namespace libsqrl
 
     struct Sqrl_action_List *SQRL_action_LIST = NULL;
 
-    SqrlAction::SqrlAction()
+    SqrlAction::SqrlAction( int priority )
         : user( NULL ),
         uri( NULL ),
 		tag( NULL ),
         state( 0 ),
         status( SQRL_ACTION_RUNNING ),
-        shouldCancel( false ) {
+        shouldCancel( false ),
+        started( false ),
+        rapid( false ),
+        priority( priority ),
+        deadline( 0 ),
+        queuedAt( 0 ),
+        pass( 0 ) {
+        if( this->priority < 0 || this->priority >= SQRL_ACTION_PRIORITY_COUNT ) {
+            this->priority = SQRL_ACTION_PRIORITY_NORMAL;
+        }
         SqrlClient *client = SqrlClient::getClient();
         if( !client ) {
             exit( 1 );
         }
-        SQRL_MUTEX_LOCK( &client->actionMutex )
-            client->actions.push_back( this );
-        SQRL_MUTEX_UNLOCK( &client->actionMutex )
+        client->actionCreated( this );
+    }
+
+    void SqrlAction::start() {
+        if( this->started ) return;
+        this->started = true;
+        // Not from the constructor: once queued, the action may be stepped on another thread, and
+        // until a derived constructor has returned, run() isn't yet the derived class's.
+        SqrlClient::getClient()->addAction( this );
     }
 
 	SqrlAction::~SqrlAction() {
         SqrlClient *client = SqrlClient::getClient();
 		if( client ) {
-			client->actions.erase( this );
+			client->removeAction( this );
 		}
 
             this->onRelease();
@@ -62,15 +77,41 @@ namespace libsqrl
             delete this;
             return false;
         } else {
+            this->rapid = false;
             this->state = this->run( this->state );
-			SqrlClient *client = SqrlClient::getClient();
-			if( client ) {
-				client->actions.push_back( this );
-			}
             return true;
         }
     }
 
+    /// <summary>The class this action is scheduled as: its priority, or INTERACTIVE once its deadline
+    /// has passed.</summary>
+    int SqrlAction::urgency( double now ) {
+        if( this->deadline && now >= this->deadline ) return SQRL_ACTION_PRIORITY_INTERACTIVE;
+        return this->priority;
+    }
+
+    void SqrlAction::setPriority( int priority ) {
+        if( priority < 0 || priority >= SQRL_ACTION_PRIORITY_COUNT ) return;
+        SqrlClient *client = SqrlClient::getClient();
+        if( client && this->started ) {
+            client->actionPriorityChanged( this, priority );
+        } else {
+            this->priority = priority;
+        }
+    }
+
+    int SqrlAction::getPriority() {
+        return this->priority;
+    }
+
+    void SqrlAction::setDeadline( double seconds ) {
+        this->deadline = seconds > 0 ? sqrl_get_real_time() + seconds : 0;
+    }
+
+    double SqrlAction::getDeadline() {
+        return this->deadline;
+    }
+
     void SqrlAction::onRelease() {
     }
 
@@ -79,12 +120,26 @@ namespace libsqrl
         client->callProgress( this, progress );
     }
 
+    void SqrlAction::send( SqrlString *url, SqrlString *payload, bool movePayload ) {
+        SqrlClient *client = SqrlClient::getClient();
+        client->callSend( this, url, payload, movePayload );
+    }
+
     void SqrlAction::setUser( SqrlUser *u ) {
+        SQRL_MUTEX_LOCK( &this->userMutex )
         this->user = u;
+        SQRL_MUTEX_UNLOCK( &this->userMutex )
+        this->queuedAt = sqrl_get_real_time();
+        SqrlClient *client = SqrlClient::getClient();
+        if( client ) client->wake();
     }
 
     SqrlUser *SqrlAction::getUser() {
-        return this->user;
+        SqrlUser *u;
+        SQRL_MUTEX_LOCK( &this->userMutex )
+        u = this->user;
+        SQRL_MUTEX_UNLOCK( &this->userMutex )
+        return u;
     }
 
     SqrlUri *SqrlAction::getUri() {
@@ -107,21 +162,28 @@ namespace libsqrl
 	}
 
     void SqrlAction::authenticate( Sqrl_Credential_Type credentialType, const char *credential, size_t length ) {
-        if( !this->user ) return;
-        switch( credentialType ) {
-        case SQRL_CREDENTIAL_HINT:
-            break;
-        case SQRL_CREDENTIAL_PASSWORD:
-            break;
-        case SQRL_CREDENTIAL_NEW_PASSWORD:
-            this->user->setPassword( credential, length );
-            break;
-        case SQRL_CREDENTIAL_RESCUE_CODE:
-            break;
+        SqrlClient *client = SqrlClient::getClient();
+        if( this->user ) {
+            switch( credentialType ) {
+            case SQRL_CREDENTIAL_HINT:
+                break;
+            case SQRL_CREDENTIAL_PASSWORD:
+                break;
+            case SQRL_CREDENTIAL_NEW_PASSWORD:
+                this->user->setPassword( credential, length );
+                break;
+            case SQRL_CREDENTIAL_RESCUE_CODE:
+                break;
+            }
         }
+        // Whatever the action was waiting for, it can look again now.
+        this->queuedAt = sqrl_get_real_time();
+        if( client ) client->wake();
     }
 
     void SqrlAction::cancel() {
         this->shouldCancel = true;
+        SqrlClient *client = SqrlClient::getClient();
+        if( client ) client->wake();
     }
 }
\ No newline at end of file
@@ -11,6 +11,10 @@
 
 #include <climits>
 #include "sqrl.h"
+#include "SqrlString.h"
+#if defined(WITH_THREADS)
+#include <atomic>
+#endif
 
 namespace libsqrl
 {
@@ -22,16 +26,28 @@ namespace libsqrl
 
 #define SQRL_ACTION_STATE_DELETE INT_MIN
 
+
+// Priority classes, most urgent first.  See SqrlAction::setPriority().
+#define SQRL_ACTION_PRIORITY_INTERACTIVE 0
+#define SQRL_ACTION_PRIORITY_NORMAL 1
+#define SQRL_ACTION_PRIORITY_BACKGROUND 2
+#define SQRL_ACTION_PRIORITY_COUNT 3
+
     ////////////////////////////////////////////////////////////////////////////////////////////////////
     /// <summary>An Action, typically initiated by the user and managed by the SqrlClient.</summary>
     ///
     /// <remarks>
     /// For Implementers:
     ///   - Children of SqrlAction must override the run() method, to process the requested action.
+    ///   - run() is not called until start(), so it never sees a partly constructed action.
     ///
     /// For Consumers:
     ///   - Starting a new SqrlAction:
-    ///     - Call '''new SqrlAction();''' to start a SqrlAction.  Disregard the pointer.
+    ///     - Call '''(new SqrlAction())->start();''' to start a SqrlAction.  After start(), the
+    ///       action may run (and finish, and be deleted) on another thread at any time.
+    ///     - Constructing an action no longer starts it.  Code written as '''new SqrlAction();'''
+    ///       still compiles, but the action never runs; SqrlClient::loop() reports such actions on
+    ///       stderr, and the client deletes them when it is deleted.
     ///     - Do not use SqrlActions as global or local variables.
     /// 	- Ending a SqrlAction:
     /// 	  - Do not attempt to delete a SqrlAction.  Instead, call SqrlAction::cancel(). It will
@@ -44,12 +60,20 @@ namespace libsqrl
     {
         friend class SqrlClient;
         friend class SqrlClientAsync;
+        friend class SqrlActionExecutor;
         friend class SqrlUser;
         friend class SqrlIdentityAction;
         friend class SqrlCrypt;
 
     public:
-        SqrlAction();
+        SqrlAction( int priority = SQRL_ACTION_PRIORITY_NORMAL );
+
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        /// <summary>Hands this action to the client, which gives it its first step.</summary>
+        ///
+        /// <remarks>Call once, after construction; a second call does nothing.</remarks>
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        void start();
 
         /// <summary>	Cancels this action. </summary>
         void cancel();
@@ -105,6 +129,36 @@ namespace libsqrl
 		/// <param name="tag">[in] Sets the tag, or if NULL, unsets the tag.</param>
 		////////////////////////////////////////////////////////////////////////////////////////////////////
 		void setTag( void *tag );
+
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        /// <summary>Sets how urgent this action is.</summary>
+        ///
+        /// <remarks>
+        /// The client steps the most urgent action first.  An action only gets a step while no action
+        /// of a more urgent class is making progress, so BACKGROUND work (such as SqrlActionSave) waits
+        /// while an INTERACTIVE action (such as SqrlActionIdent) is moving, and carries on whenever that
+        /// one is waiting on the user or the network.</remarks>
+        ///
+        /// <param name="priority">A SQRL_ACTION_PRIORITY_* class.</param>
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        void setPriority( int priority );
+        int getPriority();
+
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        /// <summary>Sets a time by which this action should be stepped.</summary>
+        ///
+        /// <remarks>
+        /// Within a priority class, the action with the earliest deadline goes first.  Once its deadline
+        /// has passed, an action is treated as INTERACTIVE, so it can't be starved by busier classes.
+        /// </remarks>
+        ///
+        /// <param name="seconds">Seconds from now, or 0 for no deadline.</param>
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        void setDeadline( double seconds );
+
+        /// <summary>Gets the deadline, as a sqrl_get_real_time() value, or 0 for none.</summary>
+        double getDeadline();
+
     protected:
         virtual ~SqrlAction();
 
@@ -133,10 +187,14 @@ namespace libsqrl
         ////////////////////////////////////////////////////////////////////////////////////////////////////
         /// <summary>Called from the SqrlClient to initiate a step of the state machine.</summary>
         ///
-        /// <returns>true if action should continue, false if action is complete.</returns>
+        /// <remarks>The caller queues the action again for its next step.</remarks>
+        ///
+        /// <returns>true if action should continue, false if action is complete (and deleted).</returns>
         ////////////////////////////////////////////////////////////////////////////////////////////////////
         bool exec();
 
+        int urgency( double now );
+
         ////////////////////////////////////////////////////////////////////////////////////////////////////
         /// <summary>Called when an action is about to be deleted, to clean up any memory allocations,
         /// etc...</summary>
@@ -150,12 +208,42 @@ namespace libsqrl
         ////////////////////////////////////////////////////////////////////////////////////////////////////
         virtual void onProgress( int progress );
 
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        /// <summary>Asks the client to send a query for this action (SqrlClient::onSend()).</summary>
+        ///
+        /// <param name="url">        The url to send to.</param>
+        /// <param name="payload">    [in,out] The data to send.</param>
+        /// <param name="movePayload">If true, the payload is handed over rather than copied, and left
+        ///                           empty.</param>
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        void send( SqrlString *url, SqrlString *payload, bool movePayload = false );
+
         SqrlUser *user;
         SqrlUri *uri;
 		void *tag;
         int state;
         int status;
         bool shouldCancel;
+        bool started;
+        /// <summary>Set in run() to be stepped again at once, though the state is unchanged.</summary>
+        bool rapid;
+        int priority;
+        double deadline;
+        /// <summary>When the action became ready for its next step (sqrl_get_real_time()), or 0 while
+        /// it is waiting on something other than the client.  Set by the thread answering it, too.
+        /// Before start(), when it was created, or 0 once SqrlClient::reportUnstarted() has named it.
+        /// </summary>
+#if defined(WITH_THREADS)
+        std::atomic<double> queuedAt;
+#else
+        double queuedAt;
+#endif
+        /// <summary>The SqrlClient::loop() pass this action last had a step in.</summary>
+        unsigned int pass;
+#if defined(WITH_THREADS)
+        /// <summary>Guards 'user' while setUser() may be called from outside the action's step.</summary>
+        std::mutex userMutex;
+#endif
     };
 }
 #endif // SQRLACTION_H
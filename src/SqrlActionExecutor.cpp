@@ -0,0 +1,290 @@
+/** \file SqrlActionExecutor.cpp
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#include "sqrl_internal.h"
+
+#include "SqrlActionExecutor.h"
+#include "SqrlAction.h"
+#include "SqrlClient.h"
+
+#if defined(WITH_THREADS)
+namespace libsqrl
+{
+    typedef std::chrono::steady_clock Sqrl_Executor_Clock;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Constructor.  Starts the workers.</summary>
+    ///
+    /// <param name="client"> The client the actions belong to.</param>
+    /// <param name="workers">The number of worker threads, from 1 to SQRL_EXECUTOR_MAX_WORKERS.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    SqrlActionExecutor::SqrlActionExecutor( SqrlClient *client, size_t workers ) :
+        client( client ),
+        next( 0 ),
+        pending( 0 ),
+        sleeping( 0 ),
+        stopping( false ),
+        wakes( 0 ),
+        pollAt( 0 ),
+        steps( 0 ),
+        steals( 0 ),
+        parks( 0 ) {
+        for( int i = 0; i < SQRL_ACTION_PRIORITY_COUNT; i++ ) this->pendingClass[i] = 0;
+        if( workers < 1 ) workers = 1;
+        if( workers > SQRL_EXECUTOR_MAX_WORKERS ) workers = SQRL_EXECUTOR_MAX_WORKERS;
+        this->workerCount = workers;
+        this->workers = new struct Worker[workers];
+        for( size_t i = 0; i < workers; i++ ) {
+            this->workers[i].thread = NULL;
+            this->workers[i].running = NULL;
+        }
+        for( size_t i = 0; i < workers; i++ ) {
+            this->workers[i].thread = new std::thread( SqrlActionExecutor::workerThread, this, i );
+        }
+    }
+
+    SqrlActionExecutor::~SqrlActionExecutor() {
+        this->stop();
+        delete[] this->workers;
+    }
+
+    /// <summary>Queues a new action.  Thread safe.</summary>
+    void SqrlActionExecutor::submit( SqrlAction *action ) {
+        this->put( this->next++ % this->workerCount, action, action->urgency( sqrl_get_real_time() ) );
+    }
+
+    /// <summary>Queues every parked action again.  Thread safe.</summary>
+    void SqrlActionExecutor::wake() {
+        SqrlDeque<SqrlAction*> woken;
+        SQRL_MUTEX_LOCK( &this->parkMutex )
+        this->wakes++;
+        this->pollAt = 0;
+        SqrlAction *action;
+        while( (action = this->parked.pop()) ) {
+            woken.push_back( action );
+        }
+        SQRL_MUTEX_UNLOCK( &this->parkMutex )
+        while( (action = woken.pop()) ) {
+            this->submit( action );
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Stops and joins the workers.</summary>
+    ///
+    /// <remarks>Actions still queued are dropped, not deleted; SqrlClient keeps its own list of them.
+    /// </remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlActionExecutor::stop() {
+        SQRL_MUTEX_LOCK( &this->idleMutex )
+        this->stopping = true;
+        SQRL_MUTEX_UNLOCK( &this->idleMutex )
+        this->idleCondition.notify_all();
+        for( size_t i = 0; i < this->workerCount; i++ ) {
+            struct Worker *w = &this->workers[i];
+            if( w->thread ) {
+                w->thread->join();
+                delete w->thread;
+                w->thread = NULL;
+            }
+            for( int c = 0; c < SQRL_ACTION_PRIORITY_COUNT; c++ ) {
+                while( w->queue[c].pop() );
+                this->pendingClass[c] = 0;
+            }
+        }
+        while( this->parked.pop() );
+        this->pending = 0;
+    }
+
+    size_t SqrlActionExecutor::getWorkerCount() {
+        return this->workerCount;
+    }
+
+    /// <summary>Gets the number of actions queued for a step, not counting those parked or running.</summary>
+    size_t SqrlActionExecutor::getPending() {
+        return this->pending;
+    }
+
+    /// <summary>Gets the number of steps run so far.</summary>
+    uint64_t SqrlActionExecutor::getSteps() {
+        return this->steps;
+    }
+
+    /// <summary>Gets the number of actions a worker has taken from another's queue.</summary>
+    uint64_t SqrlActionExecutor::getSteals() {
+        return this->steals;
+    }
+
+    /// <summary>Gets the number of times an action was parked for making no progress.</summary>
+    uint64_t SqrlActionExecutor::getParks() {
+        return this->parks;
+    }
+
+    void SqrlActionExecutor::workerThread( SqrlActionExecutor *executor, size_t index ) {
+        while( !executor->stopping ) {
+            Sqrl_Executor_Clock::time_point now = Sqrl_Executor_Clock::now();
+            long long at = executor->pollAt;
+            if( at && now.time_since_epoch().count() >= at ) {
+                executor->wake();
+            }
+            int urgency;
+            SqrlAction *action = executor->take( index, &urgency );
+            if( !action ) {
+                executor->idle();
+                continue;
+            }
+            // Its user is busy on another worker: look again later.
+            if( !executor->claim( index, action ) ) {
+                executor->put( index, action, urgency );
+                std::this_thread::yield();
+                continue;
+            }
+            executor->client->actionStarting( action, sqrl_get_real_time() );
+            int before = action->state;
+            uint64_t wakes = executor->wakes;
+            bool alive = action->exec();
+            executor->release( index );
+            executor->steps++;
+            if( !alive ) continue;
+            if( action->state != before || action->rapid ) {
+                double done = sqrl_get_real_time();
+                action->queuedAt = done;
+                executor->put( index, action, action->urgency( done ) );
+            } else {
+                action->queuedAt = 0;
+                if( !executor->park( action, wakes ) ) {
+                    executor->put( index, action, action->urgency( sqrl_get_real_time() ) );
+                }
+            }
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Takes the next action of the most urgent class queued: from the front of this worker's
+    /// queue, or else from the end of another's.</summary>
+    ///
+    /// <param name="index">  The worker.</param>
+    /// <param name="urgency">[out] The class it was queued as.</param>
+    ///
+    /// <returns>The action, or NULL if none is queued.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    SqrlAction *SqrlActionExecutor::take( size_t index, int *urgency ) {
+        if( this->pending == 0 ) return NULL;
+        SqrlAction *action = NULL;
+        for( int c = 0; !action && c < SQRL_ACTION_PRIORITY_COUNT; c++ ) {
+            if( this->pendingClass[c] == 0 ) continue;
+            struct Worker *w = &this->workers[index];
+            SQRL_MUTEX_LOCK( &w->mutex )
+            action = w->queue[c].pop();
+            if( action ) {
+                this->pendingClass[c]--;
+                this->pending--;
+            }
+            SQRL_MUTEX_UNLOCK( &w->mutex )
+            for( size_t i = 1; !action && i < this->workerCount; i++ ) {
+                struct Worker *victim = &this->workers[(index + i) % this->workerCount];
+                SQRL_MUTEX_LOCK( &victim->mutex )
+                action = victim->queue[c].pop_back();
+                if( action ) {
+                    this->pendingClass[c]--;
+                    this->pending--;
+                }
+                SQRL_MUTEX_UNLOCK( &victim->mutex )
+                if( action ) this->steals++;
+            }
+            if( action ) *urgency = c;
+        }
+        return action;
+    }
+
+    /// <summary>Puts an action on the end of a worker's queue for its class, and wakes a worker if any
+    /// are idle.</summary>
+    void SqrlActionExecutor::put( size_t index, SqrlAction *action, int urgency ) {
+        struct Worker *w = &this->workers[index];
+        SQRL_MUTEX_LOCK( &w->mutex )
+        w->queue[urgency].push_back( action );
+        // Counted under the lock, so a take() never counts an action before its put().
+        this->pendingClass[urgency]++;
+        this->pending++;
+        SQRL_MUTEX_UNLOCK( &w->mutex )
+        if( this->sleeping > 0 ) {
+            // Taking the lock makes sure a worker that saw nothing pending is already waiting.
+            SQRL_MUTEX_LOCK( &this->idleMutex )
+            SQRL_MUTEX_UNLOCK( &this->idleMutex )
+            this->idleCondition.notify_one();
+        }
+    }
+
+    /// <summary>Marks the action's user as in use by this worker; false if another worker has it.</summary>
+    bool SqrlActionExecutor::claim( size_t index, SqrlAction *action ) {
+        // The user may be changed by setUser() on another thread, so not a plain read.
+        SqrlUser *user = action->getUser();
+        if( !user ) return true;
+        SQRL_MUTEX_LOCK( &this->claimMutex )
+        for( size_t i = 0; i < this->workerCount; i++ ) {
+            if( i != index && this->workers[i].running == user ) {
+                SQRL_MUTEX_UNLOCK( &this->claimMutex )
+                return false;
+            }
+        }
+        this->workers[index].running = user;
+        SQRL_MUTEX_UNLOCK( &this->claimMutex )
+        return true;
+    }
+
+    void SqrlActionExecutor::release( size_t index ) {
+        if( !this->workers[index].running ) return;
+        SQRL_MUTEX_LOCK( &this->claimMutex )
+        this->workers[index].running = NULL;
+        SQRL_MUTEX_UNLOCK( &this->claimMutex )
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Sets an action aside until the next wake(), unless one has come since its step began.
+    /// </summary>
+    ///
+    /// <remarks>Such a wake() found nothing parked, so the action's answer may already be in; parking
+    /// it would leave it waiting for the next poll.</remarks>
+    ///
+    /// <param name="action">The action, which made no progress.</param>
+    /// <param name="wakes"> 'wakes' as the step began.</param>
+    ///
+    /// <returns>false if the action wasn't parked, and should be queued again.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlActionExecutor::park( SqrlAction *action, uint64_t wakes ) {
+        SQRL_MUTEX_LOCK( &this->parkMutex )
+        if( this->wakes != wakes ) {
+            SQRL_MUTEX_UNLOCK( &this->parkMutex )
+            return false;
+        }
+        if( this->parked.empty() ) {
+            Sqrl_Executor_Clock::time_point at = Sqrl_Executor_Clock::now() + std::chrono::milliseconds( SQRL_CLIENT_POLL_MS );
+            this->pollAt = (long long)at.time_since_epoch().count();
+        }
+        this->parked.push_back( action );
+        SQRL_MUTEX_UNLOCK( &this->parkMutex )
+        this->parks++;
+        return true;
+    }
+
+    /// <summary>Waits for an action to be queued, or until it is time to look at parked actions.</summary>
+    void SqrlActionExecutor::idle() {
+        std::unique_lock<std::mutex> lock( this->idleMutex );
+        this->sleeping++;
+        auto ready = [this] { return this->pending > 0 || this->stopping; };
+        long long at = this->pollAt;
+        if( at ) {
+            Sqrl_Executor_Clock::time_point until = Sqrl_Executor_Clock::time_point( Sqrl_Executor_Clock::duration( at ) );
+            this->idleCondition.wait_until( lock, until, ready );
+        } else {
+            this->idleCondition.wait( lock, ready );
+        }
+        this->sleeping--;
+    }
+}
+#endif // WITH_THREADS
@@ -0,0 +1,101 @@
+/** \file SqrlActionExecutor.h
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#ifndef SQRLACTIONEXECUTOR_H
+#define SQRLACTIONEXECUTOR_H
+
+#include "sqrl.h"
+#include "SqrlDeque.h"
+#include "SqrlAction.h"
+
+#if defined(WITH_THREADS)
+#include <atomic>
+#include <condition_variable>
+
+namespace libsqrl
+{
+// The most worker threads a SqrlActionExecutor will start.
+#define SQRL_EXECUTOR_MAX_WORKERS 64
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Steps a SqrlClient's actions on a pool of worker threads.</summary>
+    ///
+    /// <remarks>
+    /// Each worker has a queue of its own for each priority class.  It takes the front action of the
+    /// most urgent class it can find, from its own queues or else from the end of another worker's,
+    /// and puts the action back on the end after each step.  New actions are handed to the workers in
+    /// turn.  The class is SqrlAction::urgency() as the action is queued; deadlines don't otherwise
+    /// reorder a class here.  A worker with nothing more urgent to do runs a less urgent action even
+    /// while another worker has a more urgent one moving.
+    ///
+    /// Steps of actions with the same SqrlUser never run at the same time, so an action can use its
+    /// user as it could on SqrlClient::loop(); actions for different users (or none) run in parallel.
+    /// That is judged by the user an action has as a step begins.
+    ///
+    /// An action whose step made no progress (its state is unchanged, and it didn't ask to be
+    /// stepped again at once) is parked until SqrlClient::wake(), or for at most SQRL_CLIENT_POLL_MS.
+    /// If a wake() came while the step ran, the action is queued again instead.
+    ///
+    /// Callbacks are still delivered by SqrlClient::loop().  Created by SqrlClient::setActionWorkers().
+    /// </remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    class DLL_PUBLIC SqrlActionExecutor
+    {
+    public:
+        SqrlActionExecutor( SqrlClient *client, size_t workers );
+        ~SqrlActionExecutor();
+
+        void submit( SqrlAction *action );
+        void wake();
+        void stop();
+
+        size_t getWorkerCount();
+        size_t getPending();
+        uint64_t getSteps();
+        uint64_t getSteals();
+        uint64_t getParks();
+
+    private:
+        struct Worker
+        {
+            std::mutex mutex;
+            SqrlDeque<SqrlAction*> queue[SQRL_ACTION_PRIORITY_COUNT];
+            std::thread *thread;
+            SqrlUser *running;
+        };
+
+        static void workerThread( SqrlActionExecutor *executor, size_t index );
+        SqrlAction *take( size_t index, int *urgency );
+        void put( size_t index, SqrlAction *action, int urgency );
+        bool claim( size_t index, SqrlAction *action );
+        void release( size_t index );
+        bool park( SqrlAction *action, uint64_t wakes );
+        void idle();
+
+        SqrlClient *client;
+        struct Worker *workers;
+        size_t workerCount;
+        std::atomic<size_t> next;
+        std::atomic<size_t> pending;
+        std::atomic<size_t> pendingClass[SQRL_ACTION_PRIORITY_COUNT];
+        std::atomic<int> sleeping;
+        std::atomic<bool> stopping;
+        std::mutex claimMutex;
+        std::mutex idleMutex;
+        std::condition_variable idleCondition;
+        std::mutex parkMutex;
+        SqrlDeque<SqrlAction*> parked;
+        std::atomic<uint64_t> wakes;
+        std::atomic<long long> pollAt;
+        std::atomic<uint64_t> steps;
+        std::atomic<uint64_t> steals;
+        std::atomic<uint64_t> parks;
+    };
+}
+#endif // WITH_THREADS
+#endif // SQRLACTIONEXECUTOR_H
@@ -18,17 +18,28 @@
 #define SAS_T1 100
 #define SAS_T2 200
 #define SAS_T3 300
+#define SAS_TP 400
 
 namespace libsqrl
 {
     SqrlActionSave::SqrlActionSave( SqrlUser *user, SqrlUri *uri, Sqrl_Export exportType, Sqrl_Encoding encodingType )
-        : SqrlIdentityAction( user ),
+        : SqrlIdentityAction( user, SQRL_ACTION_PRIORITY_BACKGROUND ),
         exportType( exportType ),
         encodingType( encodingType ),
         buffer( NULL ),
         buffer_len( 0 ),
         crypt(NULL),
-        block(NULL) {
+        block(NULL),
+        rescueCrypt(NULL),
+        rescueBlock(NULL)
+#if defined(WITH_THREADS)
+        , t1Thread(NULL),
+        t2Thread(NULL),
+        t1Progress(0),
+        t2Progress(0),
+        abortWorkers(false)
+#endif
+    {
         if( uri ) {
             this->uri = new SqrlUri( uri );
         } else {
@@ -39,7 +50,13 @@ namespace libsqrl
         double total = t1ms + t2ms;
         this->t1per = t1ms / total;
         this->t2per = t2ms / total;
-
+        this->lastProgress = 0;
+#if defined(WITH_THREADS)
+        // Only worth running T1 and T2 side by side when they won't compete for one core.
+        this->parallel = std::thread::hardware_concurrency() > 1;
+#else
+        this->parallel = false;
+#endif
     }
 
     SqrlActionSave::SqrlActionSave( SqrlUser *user, const char *path, Sqrl_Export exportType, Sqrl_Encoding encodingType )
@@ -53,8 +70,13 @@ namespace libsqrl
     }
 
     SqrlActionSave::~SqrlActionSave() {
+#if defined(WITH_THREADS)
+        this->stopWorkers();
+#endif
         if( this->crypt ) delete this->crypt;
         if( this->block ) delete this->block;
+        if( this->rescueCrypt ) delete this->rescueCrypt;
+        if( this->rescueBlock ) delete this->rescueBlock;
     }
 
     int SqrlActionSave::run( int cs ) {
@@ -89,6 +111,11 @@ namespace libsqrl
             if( this->user->storage == NULL ) {
                 this->user->storage = new SqrlStorage();
             }
+#if defined(WITH_THREADS)
+            if( this->parallel ) {
+                TO_STATE( SAS_TP );
+            }
+#endif
             TO_STATE( SAS_T1 );
         case 100:
             if( (this->user->flags & USER_FLAG_T1_CHANGED) == USER_FLAG_T1_CHANGED ||
@@ -102,7 +129,7 @@ namespace libsqrl
             TO_STATE( SAS_T2 );
         case 101:
             if( this->crypt->genKey_step( this ) ) {
-                client->rapid = true;
+                this->rapid = true;
                 SAME_STATE( cs );
             } else {
                 NEXT_STATE( cs );
@@ -127,17 +154,17 @@ namespace libsqrl
             }
             TO_STATE( SAS_T3 );
         case 201:
-            if( this->crypt->genKey_step( this ) ) {
-                client->rapid = true;
+            if( this->rescueCrypt->genKey_step( this ) ) {
+                this->rapid = true;
                 SAME_STATE( cs );
             } else {
                 NEXT_STATE( cs );
             }
         case 202:
             if( this->t2_finalize() ) {
-                this->user->storage->putBlock( this->block );
-                delete this->block;
-                this->block = NULL;
+                this->user->storage->putBlock( this->rescueBlock );
+                delete this->rescueBlock;
+                this->rescueBlock = NULL;
                 TO_STATE( SAS_T3 );
             } else {
                 COMPLETE( SQRL_ACTION_FAIL );
@@ -173,6 +200,39 @@ namespace libsqrl
             NEXT_STATE( cs );
         case 302:
             COMPLETE( this->status );
+#if defined(WITH_THREADS)
+        case 400:
+            if( this->startWorkers() ) {
+                NEXT_STATE( cs );
+            } else {
+                COMPLETE( SQRL_ACTION_FAIL );
+            }
+        case 401:
+            if( this->t1Progress < 100 || this->t2Progress < 100 ) {
+                this->onProgress( 0 );
+                SAME_STATE( cs );
+            }
+            this->stopWorkers();
+            NEXT_STATE( cs );
+        case 402:
+            if( this->crypt ) {
+                if( !this->t1_finalize() ) {
+                    COMPLETE( SQRL_ACTION_FAIL );
+                }
+                this->user->storage->putBlock( this->block );
+                delete this->block;
+                this->block = NULL;
+            }
+            if( this->rescueCrypt ) {
+                if( !this->t2_finalize() ) {
+                    COMPLETE( SQRL_ACTION_FAIL );
+                }
+                this->user->storage->putBlock( this->rescueBlock );
+                delete this->rescueBlock;
+                this->rescueBlock = NULL;
+            }
+            TO_STATE( SAS_T3 );
+#endif
         default:
             // Invalid State
             COMPLETE( SQRL_ACTION_FAIL );
@@ -252,10 +312,10 @@ namespace libsqrl
     bool SqrlActionSave::t2_init() {
         if( !this->user || !this->user->hasKey( SQRL_KEY_RESCUE_CODE ) ) return false;
 
-        if( this->crypt ) delete this->crypt;
-        if( this->block ) delete this->block;
+        if( this->rescueCrypt ) delete this->rescueCrypt;
+        if( this->rescueBlock ) delete this->rescueBlock;
 
-        struct t2scratch *t2s = (struct t2scratch*)this->user->scratch()->data();
+        struct t2scratch *t2s = this->t2_scratch();
         SqrlFixedString *iuk = this->user->key( this, SQRL_KEY_IUK );
         SqrlFixedString *str = NULL;
 
@@ -265,47 +325,47 @@ namespace libsqrl
             return false;
         }
 
-        this->crypt = new SqrlCrypt();
-        this->crypt->plain_text = t2s->iuk;
-        this->crypt->text_len = SQRL_KEY_SIZE;
-        this->crypt->key = t2s->key;
+        this->rescueCrypt = new SqrlCrypt();
+        this->rescueCrypt->plain_text = t2s->iuk;
+        this->rescueCrypt->text_len = SQRL_KEY_SIZE;
+        this->rescueCrypt->key = t2s->key;
 
-        this->block = new SqrlBlock();
-        this->block->init( 2, 73 );
-        SqrlEntropy::bytes( this->block->getDataPointer( true ), 16 );
-        this->block->seek( 16, true );
-        this->crypt->nFactor = SQRL_DEFAULT_N_FACTOR;
-        this->block->writeInt8( this->crypt->nFactor );
-        this->crypt->flags = SQRL_ENCRYPT | SQRL_MILLIS;
-        this->crypt->count = SQRL_RESCUE_ENSCRYPT_SECONDS * SQRL_MILLIS_PER_SECOND;
+        this->rescueBlock = new SqrlBlock();
+        this->rescueBlock->init( 2, 73 );
+        SqrlEntropy::bytes( this->rescueBlock->getDataPointer( true ), 16 );
+        this->rescueBlock->seek( 16, true );
+        this->rescueCrypt->nFactor = SQRL_DEFAULT_N_FACTOR;
+        this->rescueBlock->writeInt8( this->rescueCrypt->nFactor );
+        this->rescueCrypt->flags = SQRL_ENCRYPT | SQRL_MILLIS;
+        this->rescueCrypt->count = SQRL_RESCUE_ENSCRYPT_SECONDS * SQRL_MILLIS_PER_SECOND;
 
-        this->crypt->add = this->block->getDataPointer();
-        this->crypt->add_len = 25;
-        this->crypt->iv = NULL;
-        this->crypt->salt = this->crypt->add + 4;
-        this->crypt->cipher_text = this->crypt->add + this->crypt->add_len;
-        this->crypt->tag = this->crypt->cipher_text + this->crypt->text_len;
+        this->rescueCrypt->add = this->rescueBlock->getDataPointer();
+        this->rescueCrypt->add_len = 25;
+        this->rescueCrypt->iv = NULL;
+        this->rescueCrypt->salt = this->rescueCrypt->add + 4;
+        this->rescueCrypt->cipher_text = this->rescueCrypt->add + this->rescueCrypt->add_len;
+        this->rescueCrypt->tag = this->rescueCrypt->cipher_text + this->rescueCrypt->text_len;
 
         str = this->user->key( this, SQRL_KEY_RESCUE_CODE );
-        return this->crypt->genKey_init( this, str );
+        return this->rescueCrypt->genKey_init( this, str );
     }
 
     bool SqrlActionSave::t2_finalize() {
-        if( !this->crypt || !this->block ) return false;
-        if( this->crypt->genKey_finalize( this ) ) {
-            this->block->seek( 21 );
-            this->block->writeInt32( this->crypt->count );
+        if( !this->rescueCrypt || !this->rescueBlock ) return false;
+        if( this->rescueCrypt->genKey_finalize( this ) ) {
+            this->rescueBlock->seek( 21 );
+            this->rescueBlock->writeInt32( this->rescueCrypt->count );
 
             // Cipher Text
-            this->crypt->flags = SQRL_ENCRYPT | SQRL_ITERATIONS;
+            this->rescueCrypt->flags = SQRL_ENCRYPT | SQRL_ITERATIONS;
             SqrlFixedString *iuk = this->user->key( this, SQRL_KEY_IUK );
             if( iuk ) {
-                memcpy( this->crypt->plain_text, iuk->data(), this->crypt->text_len );
-                if( this->crypt->doCrypt() ) {
+                memcpy( this->rescueCrypt->plain_text, iuk->data(), this->rescueCrypt->text_len );
+                if( this->rescueCrypt->doCrypt() ) {
                     // Save unique id
-                    SqrlString tstr( (char*)this->crypt->cipher_text, SQRL_KEY_SIZE );
+                    SqrlString tstr( (char*)this->rescueCrypt->cipher_text, SQRL_KEY_SIZE );
                     SqrlBase64().encode( &this->user->uniqueId, &tstr );
-                    sqrl_memzero( this->user->scratch()->data(), sizeof( struct t2scratch ) );
+                    sqrl_memzero( this->rescueCrypt->plain_text, sizeof( struct t2scratch ) );
                     return true;
                 }
             }
@@ -313,7 +373,98 @@ namespace libsqrl
         return false;
     }
     
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Gets the scratch area used by the type 2 block.</summary>
+    ///
+    /// <remarks>When T1 and T2 run in parallel, the type 2 scratch follows the type 1 scratch, so the
+    ///          two never overlap.</remarks>
+    ///
+    /// <returns>Pointer into the user's scratch buffer.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    struct t2scratch *SqrlActionSave::t2_scratch() {
+        uint8_t *ptr = this->user->scratch()->data();
+        if( this->parallel ) {
+            ptr += sizeof( struct t1scratch );
+        }
+        return (struct t2scratch*)ptr;
+    }
+
+#if defined(WITH_THREADS)
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Runs an EnScrypt chain to completion on a worker thread.</summary>
+    ///
+    /// <remarks>Progress is published through 'progress' and only reaches 100 once the chain is
+    ///          finished.  The client thread reports it; workers never queue callbacks.</remarks>
+    ///
+    /// <param name="crypt">   The SqrlCrypt, after genKey_init().</param>
+    /// <param name="progress">[out] Progress of this chain (percentage between 0 and 100).</param>
+    /// <param name="abort">   Set to stop the chain early.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlActionSave::enscryptWorker( SqrlCrypt *crypt, std::atomic<int> *progress, std::atomic<bool> *abort ) {
+        SqrlEnScrypt *es = crypt->enscrypt;
+        while( !*abort && !es->update() ) {
+            int p = es->getCurrentProgress();
+            progress->store( p < 100 ? p : 99 );
+        }
+        progress->store( 100 );
+        SqrlClient *client = SqrlClient::getClient();
+        if( client ) client->wake();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Initializes the type 1 and type 2 blocks that need saving, and starts a worker thread
+    ///          for each.</summary>
+    ///
+    /// <returns>true if it succeeds, false if it fails.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlActionSave::startWorkers() {
+        this->abortWorkers = false;
+        this->t1Progress = 100;
+        this->t2Progress = 100;
+        if( (this->user->flags & USER_FLAG_T1_CHANGED) == USER_FLAG_T1_CHANGED ||
+            !this->user->storage->hasBlock( SQRL_BLOCK_USER ) ) {
+            if( !this->t1_init() ) return false;
+            this->t1Progress = 0;
+            this->t1Thread = new std::thread( SqrlActionSave::enscryptWorker, this->crypt, &this->t1Progress, &this->abortWorkers );
+        }
+        if( (this->user->flags & USER_FLAG_T2_CHANGED) == USER_FLAG_T2_CHANGED ||
+            !this->user->storage->hasBlock( SQRL_BLOCK_RESCUE ) ) {
+            if( !this->t2_init() ) return false;
+            this->t2Progress = 0;
+            this->t2Thread = new std::thread( SqrlActionSave::enscryptWorker, this->rescueCrypt, &this->t2Progress, &this->abortWorkers );
+        }
+        return true;
+    }
+
+    /// <summary>Stops and joins any running worker threads.</summary>
+    void SqrlActionSave::stopWorkers() {
+        if( this->t1Progress < 100 || this->t2Progress < 100 ) {
+            this->abortWorkers = true;
+        }
+        if( this->t1Thread ) {
+            this->t1Thread->join();
+            delete this->t1Thread;
+            this->t1Thread = NULL;
+        }
+        if( this->t2Thread ) {
+            this->t2Thread->join();
+            delete this->t2Thread;
+            this->t2Thread = NULL;
+        }
+    }
+#endif
+
     void SqrlActionSave::onProgress( int progress ) {
+#if defined(WITH_THREADS)
+        if( this->state >= SAS_TP ) {
+            // Both chains run at once; merge them with the same weighting.
+            progress = (int)((this->t1Progress * this->t1per) + (this->t2Progress * this->t2per));
+            if( progress <= this->lastProgress ) return;
+            this->lastProgress = progress;
+            SqrlClient::getClient()->callProgress( this, progress );
+            return;
+        }
+#endif
         if( this->state < SAS_T2 ) {
             progress = (int)(progress * this->t1per);
         } else {
@@ -323,6 +474,27 @@ namespace libsqrl
         client->callProgress( this, progress );
     }
 
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Query if the type 1 and type 2 EnScrypt operations run in parallel.</summary>
+    ///
+    /// <returns>true if parallel, false if one after the other.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlActionSave::getParallel() {
+        return this->parallel;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Sets whether the type 1 and type 2 EnScrypt operations run on separate worker threads.
+    ///          Must be called before the action starts saving.  Ignored without thread support.</summary>
+    ///
+    /// <param name="parallel">true to run in parallel.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlActionSave::setParallel( bool parallel ) {
+#if defined(WITH_THREADS)
+        this->parallel = parallel;
+#endif
+    }
+
     Sqrl_Export SqrlActionSave::getExportType() {
         return this->exportType;
     }
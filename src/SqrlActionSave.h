@@ -13,6 +13,9 @@
 #include "SqrlIdentityAction.h"
 #include "SqrlCrypt.h"
 #include "SqrlBlock.h"
+#if defined(WITH_THREADS)
+#include <atomic>
+#endif
 
 namespace libsqrl
 {
@@ -28,6 +31,8 @@ namespace libsqrl
         void setEncodingType( Sqrl_Encoding type );
         size_t getString( char * buf, size_t * len );
         void setString( const char * buf, size_t len );
+        bool getParallel();
+        void setParallel( bool parallel );
 
         int run( int cs );
 
@@ -36,8 +41,11 @@ namespace libsqrl
         bool t1_finalize();
         bool t2_init();
         bool t2_finalize();
+        struct t2scratch *t2_scratch();
         virtual void onProgress( int progress ) override;
         double t1per, t2per;
+        bool parallel;
+        int lastProgress;
 
         Sqrl_Export exportType;
         Sqrl_Encoding encodingType;
@@ -45,7 +53,21 @@ namespace libsqrl
         size_t buffer_len;
         SqrlCrypt *crypt;
         SqrlBlock *block;
+        SqrlCrypt *rescueCrypt;
+        SqrlBlock *rescueBlock;
         void onRelease();
+
+#if defined(WITH_THREADS)
+        static void enscryptWorker( SqrlCrypt *crypt, std::atomic<int> *progress, std::atomic<bool> *abort );
+        bool startWorkers();
+        void stopWorkers();
+
+        std::thread *t1Thread;
+        std::thread *t2Thread;
+        std::atomic<int> t1Progress;
+        std::atomic<int> t2Progress;
+        std::atomic<bool> abortWorkers;
+#endif
     };
 }
 #endif // SQRLACTIONSAVE_H
@@ -10,10 +10,15 @@
 
 #include "SqrlClient.h"
 #include "SqrlAction.h"
+#include "SqrlActionExecutor.h"
 #include "SqrlUser.h"
 #include "SqrlEntropy.h"
+#include "SqrlEnScryptArena.h"
 #include "gcm.h"
 
+#include <stdio.h>
+#include <utility>
+
 namespace libsqrl
 {
     template class SqrlDeque<SqrlClient::CallbackInfo *>;
@@ -27,14 +32,36 @@ namespace libsqrl
 #define SQRL_CALLBACK_ASK 6
 #define SQRL_CALLBACK_PROGRESS 7
 
+// CallbackInfo::position of a record allocated because the ring was full.
+#define SQRL_CALLBACK_OVERFLOW ((size_t)-1)
+// CallbackInfo::inlineLength of a string kept in CallbackInfo::str instead.
+#define SQRL_CALLBACK_NOT_INLINE ((size_t)-1)
+
+#if defined(WITH_THREADS)
+    // Set while this thread is inside SqrlClient::loop(), which delivers any callbacks queued from it
+    // before returning.
+    static thread_local bool sqrl_in_loop = false;
+#endif
+
     SqrlClient *SqrlClient::client = NULL;
 #if defined(WITH_THREADS)
 	std::mutex *SqrlClient::clientMutex = NULL;
 #endif
 
     SqrlClient::SqrlClient() :
-        rapid(false)
+        wakePending(false),
+        progressed(false),
+        pass(0),
+        executor(NULL)
     {
+        memset( this->actionStats, 0, sizeof( this->actionStats ) );
+        this->callbackRing = new struct CallbackInfo[SQRL_CALLBACK_QUEUE_SIZE];
+        for( size_t i = 0; i < SQRL_CALLBACK_QUEUE_SIZE; i++ ) {
+            this->callbackRing[i].sequence = i;
+        }
+        this->callbackHead = 0;
+        this->callbackTail = 0;
+        this->overflowCount = 0;
 #if defined(WITH_THREADS)
 		if( SqrlClient::clientMutex == nullptr ) {
 			SqrlClient::clientMutex = new std::mutex();
@@ -54,6 +81,13 @@ namespace libsqrl
 
     SqrlClient::~SqrlClient() {
 		this->onClientIsStopping();
+#if defined(WITH_THREADS)
+        // Workers may still be stepping actions, which expect a client.
+        if( this->executor ) {
+            delete this->executor;
+            this->executor = NULL;
+        }
+#endif
         SQRL_MUTEX_LOCK( SqrlClient::clientMutex )
         SqrlClient::client = NULL;
 		SQRL_MUTEX_UNLOCK( SqrlClient::clientMutex )
@@ -70,6 +104,15 @@ namespace libsqrl
 				delete action;
 			}
 		} while( action );
+        // Actions that were created but never started; reportUnstarted() has already named them.
+		do {
+			SQRL_MUTEX_LOCK( &this->actionMutex );
+			action = this->unstarted.pop();
+			SQRL_MUTEX_UNLOCK( &this->actionMutex );
+			if( action ) {
+				delete action;
+			}
+		} while( action );
 		do {
 			SQRL_MUTEX_LOCK( &this->userMutex );
 			user = this->users.pop();
@@ -78,6 +121,8 @@ namespace libsqrl
 				delete user;
 			}
 		} while( user );
+        this->clearCallbacks();
+        delete[] this->callbackRing;
     }
 
     SqrlClient *SqrlClient::getClient() {
@@ -103,13 +148,425 @@ namespace libsqrl
     void SqrlClient::onLoop() {
     }
 
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Delivers queued callbacks, then gives queued actions a step each, most urgent first.
+    /// </summary>
+    ///
+    /// <remarks>
+    /// Actions are taken by SqrlAction::urgency(), then deadline, then queue order.  Once an action
+    /// has made progress, less urgent classes sit this pass out (see SqrlAction::setPriority()).
+    /// With setActionWorkers(), the actions are stepped by the workers instead.</remarks>
+    ///
+    /// <returns>true if actions or callbacks remain queued.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
     bool SqrlClient::loop() {
 		if( SqrlClient::getClient() != this ) return false;
+#if defined(WITH_THREADS)
+        sqrl_in_loop = true;
+#endif
         this->onLoop();
+        this->progressed = false;
+        this->dispatchCallbacks();
+
         SqrlAction *action;
-        while( !this->callbackQueue.empty() ) {
-            struct CallbackInfo *info = this->callbackQueue.pop();
+        int urgency, limit = SQRL_ACTION_PRIORITY_COUNT - 1;
+        this->pass++;
+        while( !this->executor ) {
+            double now = sqrl_get_real_time();
+			SQRL_MUTEX_LOCK( &this->actionMutex );
+            action = this->nextAction( now, limit, &urgency );
+			SQRL_MUTEX_UNLOCK( &this->actionMutex );
+            if( !action ) break;
+            action->pass = this->pass;
+            this->actionStarting( action, now );
+            int before = action->state;
+            if( !action->exec() ) {
+                this->progressed = true;
+                if( urgency < limit ) limit = urgency;
+                continue;
+            }
+            if( action->state != before || action->rapid ) {
+                this->progressed = true;
+                action->queuedAt = sqrl_get_real_time();
+                if( urgency < limit ) limit = urgency;
+            } else {
+                action->queuedAt = 0;
+            }
+			SQRL_MUTEX_LOCK( &this->actionMutex );
+			this->actions.push_back( action );
+			SQRL_MUTEX_UNLOCK( &this->actionMutex );
+        }
+        this->dispatchCallbacks();
+#if defined(WITH_THREADS)
+        sqrl_in_loop = false;
+#endif
+        this->reportUnstarted( sqrl_get_real_time() );
 
+		SQRL_MUTEX_LOCK( &this->actionMutex );
+        bool none = this->actions.empty();
+		SQRL_MUTEX_UNLOCK( &this->actionMutex );
+#if defined(WITH_SCRYPT)
+        // With no actions left, nothing is about to reuse EnScrypt's scratch memory.
+        if( none && SqrlEnScryptArena::getCachedBytes() ) SqrlEnScryptArena::trim();
+#endif
+        bool idle = (this->executor || none) && this->callbackHead == this->callbackTail && this->overflowCount == 0;
+        return !idle;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Tells the client there is something new for loop() to do.</summary>
+    ///
+    /// <remarks>
+    /// libsqrl calls this when an action is started, when a callback is queued from outside loop(),
+    /// and when the user answers an action (SqrlAction::authenticate(), SqrlAction::setUser()).
+    /// SqrlClientAsync sleeps until it is called.  Thread safe.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlClient::wake() {
+#if defined(WITH_THREADS)
+        if( this->executor ) this->executor->wake();
+#endif
+        this->wakeLoop();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Steps actions on worker threads, rather than in loop().</summary>
+    ///
+    /// <remarks>
+    /// Call before the first action is created; from then on, loop() only delivers callbacks, so it
+    /// must still be called (as SqrlClientAsync does).  See SqrlActionExecutor.</remarks>
+    ///
+    /// <param name="workers">The number of worker threads.</param>
+    ///
+    /// <returns>false if actions or workers already exist, or libsqrl was built without threads.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlClient::setActionWorkers( size_t workers ) {
+#if defined(WITH_THREADS)
+        if( workers == 0 ) return false;
+		SQRL_MUTEX_LOCK( &this->actionMutex );
+        bool ok = !this->executor && this->actions.empty();
+        if( ok ) this->executor = new SqrlActionExecutor( this, workers );
+		SQRL_MUTEX_UNLOCK( &this->actionMutex );
+        return ok;
+#else
+        return false;
+#endif
+    }
+
+    /// <summary>Gets the executor set up by setActionWorkers(), or NULL.</summary>
+    SqrlActionExecutor *SqrlClient::getActionExecutor() {
+        return this->executor;
+    }
+
+    /// <summary>Wakes the thread calling loop().</summary>
+    void SqrlClient::wakeLoop() {
+		SQRL_MUTEX_LOCK( &this->wakeMutex );
+        this->wakePending = true;
+		SQRL_MUTEX_UNLOCK( &this->wakeMutex );
+#if defined(WITH_THREADS)
+        this->wakeCondition.notify_one();
+#endif
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Waits for wake(), or for timeoutUs to pass.</summary>
+    ///
+    /// <remarks>Returns at once if wake() was called since the last wait.</remarks>
+    ///
+    /// <param name="timeoutUs">The longest to wait, in microseconds; negative to wait for wake().</param>
+    ///
+    /// <returns>true if woken, false if the time ran out.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlClient::waitForWork( long timeoutUs ) {
+#if defined(WITH_THREADS)
+        std::unique_lock<std::mutex> lock( this->wakeMutex );
+        if( timeoutUs < 0 ) {
+            this->wakeCondition.wait( lock, [this] { return this->wakePending; } );
+        } else {
+            this->wakeCondition.wait_for( lock, std::chrono::microseconds( timeoutUs ), [this] { return this->wakePending; } );
+        }
+#else
+        if( !this->wakePending ) sqrl_sleep( timeoutUs < 0 ? SQRL_CLIENT_POLL_MS : (int)((timeoutUs + 999) / 1000) );
+#endif
+        bool woken = this->wakePending;
+        this->wakePending = false;
+        return woken;
+    }
+
+    /// <summary>Whether this thread is inside loop().</summary>
+    bool SqrlClient::isLoopThread() {
+#if defined(WITH_THREADS)
+        return sqrl_in_loop;
+#else
+        return true;
+#endif
+    }
+
+    /// <summary>Notes an action that has been created, but not yet started.</summary>
+    void SqrlClient::actionCreated( SqrlAction *action ) {
+        action->queuedAt = sqrl_get_real_time();
+		SQRL_MUTEX_LOCK( &this->actionMutex );
+        this->unstarted.push_back( action );
+		SQRL_MUTEX_UNLOCK( &this->actionMutex );
+    }
+
+    /// <summary>Queues a new action for its first step.  See SqrlAction::start().</summary>
+    void SqrlClient::addAction( SqrlAction *action ) {
+        double now = sqrl_get_real_time();
+		SQRL_MUTEX_LOCK( &this->actionMutex );
+        this->unstarted.erase( action );
+        action->queuedAt = now;
+        this->actions.push_back( action );
+        this->actionStats[action->priority].queued++;
+		SQRL_MUTEX_UNLOCK( &this->actionMutex );
+#if defined(WITH_THREADS)
+        if( this->executor ) {
+            this->executor->submit( action );
+            return;
+        }
+#endif
+        this->wakeLoop();
+    }
+
+    /// <summary>Forgets an action that is being deleted.</summary>
+    void SqrlClient::removeAction( SqrlAction *action ) {
+		SQRL_MUTEX_LOCK( &this->actionMutex );
+        if( action->started ) {
+            this->actions.erase( action );
+            this->actionStats[action->priority].queued--;
+        } else {
+            this->unstarted.erase( action );
+        }
+		SQRL_MUTEX_UNLOCK( &this->actionMutex );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Reports, once each, actions created more than SQRL_ACTION_START_GRACE_S ago that
+    /// haven't been started.</summary>
+    ///
+    /// <remarks>
+    /// Constructing an action used to queue it.  Now SqrlAction::start() does, so a caller still
+    /// written as '''new SqrlActionIdent( ... );''' gets an action that never runs.
+    /// Such an action is held here until it is started or deleted, or the client is.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlClient::reportUnstarted( double now ) {
+        size_t late = 0;
+		SQRL_MUTEX_LOCK( &this->actionMutex );
+        size_t n = this->unstarted.count();
+        for( size_t i = 0; i < n; i++ ) {
+            SqrlAction *action = this->unstarted.peek( i );
+            double created = action->queuedAt;
+            if( created == 0 || now - created < SQRL_ACTION_START_GRACE_S ) continue;
+            // Until start(), queuedAt is the creation time; 0 marks an action already reported.
+            action->queuedAt = 0;
+            late++;
+        }
+		SQRL_MUTEX_UNLOCK( &this->actionMutex );
+        if( late ) {
+            fprintf( stderr, "libsqrl: %u action(s) created but never started; "
+                "call SqrlAction::start() after constructing an action.\n", (unsigned int)late );
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Takes the most urgent action that is due a step in this pass off the queue.  Call with
+    /// actionMutex held.</summary>
+    ///
+    /// <param name="now">	  sqrl_get_real_time().</param>
+    /// <param name="limit">  The least urgent class to consider.</param>
+    /// <param name="urgency">[out] The class the action was taken as.</param>
+    ///
+    /// <returns>The action, or NULL if none is due.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    SqrlAction *SqrlClient::nextAction( double now, int limit, int *urgency ) {
+        SqrlAction *best = NULL;
+        int bestUrgency = 0;
+        size_t n = this->actions.count();
+        for( size_t i = 0; i < n; i++ ) {
+            SqrlAction *action = this->actions.peek( i );
+            if( action->pass == this->pass ) continue;
+            int u = action->urgency( now );
+            if( u > limit ) continue;
+            if( best ) {
+                if( u > bestUrgency ) continue;
+                // Earlier deadlines first; then first come, first served.
+                if( u == bestUrgency && (!action->deadline ||
+                    (best->deadline && best->deadline <= action->deadline)) ) continue;
+            }
+            best = action;
+            bestUrgency = u;
+        }
+        if( best ) {
+            this->actions.erase( best );
+            *urgency = bestUrgency;
+        }
+        return best;
+    }
+
+    /// <summary>Records the wait before a step of this action, which begins now.</summary>
+    void SqrlClient::actionStarting( SqrlAction *action, double now ) {
+        // Deleting a finished action isn't a step.
+        if( action->state == SQRL_ACTION_STATE_DELETE ) return;
+        struct Sqrl_Action_Stats *stats = &this->actionStats[action->priority];
+		SQRL_MUTEX_LOCK( &this->statsMutex );
+        stats->steps++;
+        double queuedAt = action->queuedAt;
+        if( queuedAt ) {
+            double wait = now > queuedAt ? now - queuedAt : 0;
+            stats->waits++;
+            stats->waitTotal += wait;
+            if( wait > stats->waitMax ) stats->waitMax = wait;
+        }
+        if( action->deadline && now > action->deadline ) stats->missedDeadlines++;
+		SQRL_MUTEX_UNLOCK( &this->statsMutex );
+    }
+
+    void SqrlClient::actionPriorityChanged( SqrlAction *action, int priority ) {
+		SQRL_MUTEX_LOCK( &this->actionMutex );
+        this->actionStats[action->priority].queued--;
+        this->actionStats[priority].queued++;
+        action->priority = priority;
+		SQRL_MUTEX_UNLOCK( &this->actionMutex );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Gets how one priority class of actions is being served.</summary>
+    ///
+    /// <param name="priority">A SQRL_ACTION_PRIORITY_* class.</param>
+    /// <param name="stats">   [out] The figures since the client started, or resetActionStats().</param>
+    ///
+    /// <returns>false if 'priority' isn't a class.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlClient::getActionStats( int priority, struct Sqrl_Action_Stats *stats ) {
+        if( priority < 0 || priority >= SQRL_ACTION_PRIORITY_COUNT || !stats ) return false;
+        struct Sqrl_Action_Stats *from = &this->actionStats[priority];
+		SQRL_MUTEX_LOCK( &this->statsMutex );
+        stats->steps = from->steps;
+        stats->waits = from->waits;
+        stats->waitTotal = from->waitTotal;
+        stats->waitMax = from->waitMax;
+        stats->missedDeadlines = from->missedDeadlines;
+		SQRL_MUTEX_UNLOCK( &this->statsMutex );
+		SQRL_MUTEX_LOCK( &this->actionMutex );
+        stats->queued = from->queued;
+		SQRL_MUTEX_UNLOCK( &this->actionMutex );
+        return true;
+    }
+
+    /// <summary>Zeroes the step and wait figures.  Queue depths are left alone.</summary>
+    void SqrlClient::resetActionStats() {
+		SQRL_MUTEX_LOCK( &this->statsMutex );
+        for( int i = 0; i < SQRL_ACTION_PRIORITY_COUNT; i++ ) {
+            struct Sqrl_Action_Stats *stats = &this->actionStats[i];
+            stats->steps = 0;
+            stats->waits = 0;
+            stats->waitTotal = 0;
+            stats->waitMax = 0;
+            stats->missedDeadlines = 0;
+        }
+		SQRL_MUTEX_UNLOCK( &this->statsMutex );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Gets an empty callback record to fill in and hand to queueCallback().  Thread safe.
+    /// </summary>
+    ///
+    /// <remarks>
+    /// Records are slots of a ring, claimed without locking; loop() is the only reader.  Once the ring
+    /// is full, records are allocated and go on an overflow list instead, and keep doing so until
+    /// loop() has delivered every one of them, so callbacks queued from one thread stay in order.
+    /// </remarks>
+    ///
+    /// <returns>The record.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    struct SqrlClient::CallbackInfo *SqrlClient::claimCallback() {
+        if( this->overflowCount == 0 ) {
+            size_t pos = this->callbackHead;
+            while( true ) {
+                struct CallbackInfo *info = &this->callbackRing[pos & (SQRL_CALLBACK_QUEUE_SIZE - 1)];
+                size_t seq = info->sequence;
+                if( seq == pos ) {
+#if defined(WITH_THREADS)
+                    // On failure, pos is reloaded with the current head.
+                    if( !this->callbackHead.compare_exchange_weak( pos, pos + 1 ) ) continue;
+#else
+                    this->callbackHead = pos + 1;
+#endif
+                    info->position = pos;
+                    return info;
+                }
+                // The slot from the last time around hasn't been delivered yet: the ring is full.
+                if( (ptrdiff_t)(seq - pos) < 0 ) break;
+                pos = this->callbackHead;
+            }
+        }
+        this->overflowCount++;
+        struct CallbackInfo *info = new struct CallbackInfo();
+        info->position = SQRL_CALLBACK_OVERFLOW;
+        return info;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Queues a callback from claimCallback() for loop() to deliver, and wakes it unless this
+    /// is its thread.</summary>
+    ///
+    /// <remarks>Only the loop is woken: a callback is no news to actions parked on a worker.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlClient::queueCallback( struct CallbackInfo *info ) {
+        if( info->position == SQRL_CALLBACK_OVERFLOW ) {
+			SQRL_MUTEX_LOCK( &this->callbackMutex );
+            this->callbackOverflow.push_back( info );
+			SQRL_MUTEX_UNLOCK( &this->callbackMutex );
+        } else {
+            info->sequence = info->position + 1;
+        }
+        if( SqrlClient::isLoopThread() ) return;
+        this->wakeLoop();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Takes the next queued callback, in the order they were queued.  Only one thread may
+    /// call this at a time: loop(), or its owner once the loop has stopped.</summary>
+    ///
+    /// <returns>The record, to hand back to releaseCallback(), or NULL if none is ready.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    struct SqrlClient::CallbackInfo *SqrlClient::nextCallback() {
+        size_t pos = this->callbackTail;
+        struct CallbackInfo *info = &this->callbackRing[pos & (SQRL_CALLBACK_QUEUE_SIZE - 1)];
+        if( info->sequence == pos + 1 ) {
+            this->callbackTail = pos + 1;
+            return info;
+        }
+        // A slot still being filled in holds up the overflow list too, which was queued after it.
+        if( this->overflowCount == 0 || this->callbackHead != pos ) return NULL;
+		SQRL_MUTEX_LOCK( &this->callbackMutex );
+        info = this->callbackOverflow.pop();
+		SQRL_MUTEX_UNLOCK( &this->callbackMutex );
+        return info;
+    }
+
+    /// <summary>Frees a record from nextCallback() for reuse.</summary>
+    void SqrlClient::releaseCallback( struct CallbackInfo *info ) {
+        info->reset();
+        if( info->position == SQRL_CALLBACK_OVERFLOW ) {
+            delete info;
+            this->overflowCount--;
+            return;
+        }
+        info->sequence = info->position + SQRL_CALLBACK_QUEUE_SIZE;
+    }
+
+    /// <summary>Drops queued callbacks without delivering them.</summary>
+    void SqrlClient::clearCallbacks() {
+        struct CallbackInfo *info;
+        while( (info = this->nextCallback()) ) {
+            this->releaseCallback( info );
+        }
+    }
+
+    void SqrlClient::dispatchCallbacks() {
+        SqrlAction *action;
+        struct CallbackInfo *info;
+        while( (info = this->nextCallback()) ) {
             switch( info->cbType ) {
             case SQRL_CALLBACK_SAVE_SUGGESTED:
                 this->onSaveSuggested( (SqrlUser*)info->ptr );
@@ -132,28 +589,19 @@ namespace libsqrl
                 break;
             case SQRL_CALLBACK_SEND:
                 action = (SqrlAction*)info->ptr;
-                this->onSend( action, *info->str[0], *info->str[1] );
+                this->onSend( action, info->takeString( 0 ), info->takeString( 1 ) );
                 break;
             case SQRL_CALLBACK_ASK:
                 action = (SqrlAction*)info->ptr;
-                this->onAsk( action, *info->str[0], *info->str[1], *info->str[2] );
+                this->onAsk( action, info->takeString( 0 ), info->takeString( 1 ), info->takeString( 2 ) );
                 break;
             case SQRL_CALLBACK_PROGRESS:
                 action = (SqrlAction*)info->ptr;
                 this->onProgress( action, info->progress );
                 break;
             }
-            delete info;
+            this->releaseCallback( info );
         }
-		SQRL_MUTEX_LOCK( &this->actionMutex );
-		action = this->actions.pop();
-		SQRL_MUTEX_UNLOCK( &this->actionMutex );
-        if( action ) action->exec();
-
-        if( this->actions.empty() && this->callbackQueue.empty() ) {
-            return false;
-        }
-        return true;
     }
 
 	SqrlUser * SqrlClient::getUser( const SqrlString * uniqueId ) {
@@ -188,66 +636,78 @@ namespace libsqrl
 	}
 
     void SqrlClient::callSaveSuggested( SqrlUser * user ) {
-        struct CallbackInfo *info = new struct CallbackInfo();
+        struct CallbackInfo *info = this->claimCallback();
         info->cbType = SQRL_CALLBACK_SAVE_SUGGESTED;
         info->ptr = user;
-        this->callbackQueue.push( info );
+        this->queueCallback( info );
     }
 
     void SqrlClient::callSelectUser( SqrlAction * action ) {
-        struct CallbackInfo *info = new struct CallbackInfo();
+        struct CallbackInfo *info = this->claimCallback();
         info->cbType = SQRL_CALLBACK_SELECT_USER;
         info->ptr = action;
-        this->callbackQueue.push( info );
+        this->queueCallback( info );
     }
 
     void SqrlClient::callSelectAlternateIdentity( SqrlAction * action ) {
-        struct CallbackInfo *info = new struct CallbackInfo();
+        struct CallbackInfo *info = this->claimCallback();
         info->cbType = SQRL_CALLBACK_SELECT_ALT;
         info->ptr = action;
-        this->callbackQueue.push( info );
+        this->queueCallback( info );
     }
 
     void SqrlClient::callActionComplete( SqrlAction * action ) {
-        struct CallbackInfo *info = new struct CallbackInfo();
+        struct CallbackInfo *info = this->claimCallback();
         info->cbType = SQRL_CALLBACK_ACTION_COMPLETE;
         info->ptr = action;
-        this->callbackQueue.push( info );
+        this->queueCallback( info );
     }
 
     void SqrlClient::callProgress( SqrlAction * action, int progress ) {
-        struct CallbackInfo *info = new struct CallbackInfo();
+        struct CallbackInfo *info = this->claimCallback();
         info->cbType = SQRL_CALLBACK_PROGRESS;
         info->ptr = action;
         info->progress = progress;
-        this->callbackQueue.push_back( info );
+        this->queueCallback( info );
     }
 
     void SqrlClient::callAuthenticationRequired( SqrlAction * action, Sqrl_Credential_Type credentialType ) {
-        struct CallbackInfo *info = new struct CallbackInfo();
+        struct CallbackInfo *info = this->claimCallback();
         info->cbType = SQRL_CALLBACK_AUTH_REQUIRED;
         info->ptr = action;
         info->credentialType = credentialType;
-        this->callbackQueue.push( info );
+        this->queueCallback( info );
     }
 
-    void SqrlClient::callSend( SqrlAction * action, SqrlString *url, SqrlString * payload ) {
-        struct CallbackInfo *info = new struct CallbackInfo();
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Queues an onSend() callback.</summary>
+    ///
+    /// <param name="action">     The action.</param>
+    /// <param name="url">        The url to send to.  It is copied.</param>
+    /// <param name="payload">    [in,out] The data to send.</param>
+    /// <param name="movePayload">If true, the payload is taken rather than copied, and left empty.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlClient::callSend( SqrlAction * action, SqrlString *url, SqrlString * payload, bool movePayload ) {
+        struct CallbackInfo *info = this->claimCallback();
         info->cbType = SQRL_CALLBACK_SEND;
         info->ptr = action;
-        info->str[0] = new SqrlString( *url );
-        info->str[1] = new SqrlString( *payload );
-        this->callbackQueue.push( info );
+        info->setString( 0, url );
+        if( movePayload ) {
+            info->moveString( 1, payload );
+        } else {
+            info->setString( 1, payload );
+        }
+        this->queueCallback( info );
     }
 
     void SqrlClient::callAsk( SqrlAction * action, SqrlString * message, SqrlString * firstButton, SqrlString * secondButton ) {
-        struct CallbackInfo *info = new struct CallbackInfo();
+        struct CallbackInfo *info = this->claimCallback();
         info->cbType = SQRL_CALLBACK_ASK;
         info->ptr = action;
-        info->str[0] = new SqrlString( *message );
-        info->str[1] = new SqrlString( *firstButton );
-        info->str[2] = new SqrlString( *secondButton );
-        this->callbackQueue.push( info );
+        info->setString( 0, message );
+        info->setString( 1, firstButton );
+        info->setString( 2, secondButton );
+        this->queueCallback( info );
     }
 
     SqrlClient::CallbackInfo::CallbackInfo() {
@@ -255,16 +715,59 @@ namespace libsqrl
         this->progress = 0;
         this->credentialType = SQRL_CREDENTIAL_PASSWORD;
         this->ptr = NULL;
-        this->str[0] = NULL;
-        this->str[1] = NULL;
-        this->str[2] = NULL;
+        this->inlineLength[0] = 0;
+        this->inlineLength[1] = 0;
+        this->position = 0;
+        this->sequence = 0;
     }
 
-    SqrlClient::CallbackInfo::~CallbackInfo() {
-        for( int i = 0; i < 3; i++ ) {
-            if( this->str[i] ) {
-                delete this->str[i];
+    /// <summary>Empties the record for reuse, keeping any memory its strings have.</summary>
+    void SqrlClient::CallbackInfo::reset() {
+        this->cbType = 0;
+        this->progress = 0;
+        this->credentialType = SQRL_CREDENTIAL_PASSWORD;
+        this->ptr = NULL;
+        for( int i = 0; i < 2; i++ ) {
+            if( this->inlineLength[i] != SQRL_CALLBACK_NOT_INLINE ) {
+                memset( this->inlineString[i], 0, this->inlineLength[i] );
             }
+            this->inlineLength[i] = 0;
+        }
+        for( int i = 0; i < 3; i++ ) {
+            this->str[i].clear();
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Copies a string into the record: in place if it is short enough, otherwise into str[].
+    /// </summary>
+    ///
+    /// <param name="index">Which string: 0 and 1 may be kept in place, 2 never is.</param>
+    /// <param name="in">   [in] The string, or NULL for an empty one.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlClient::CallbackInfo::setString( int index, const SqrlString *in ) {
+        size_t len = in ? in->length() : 0;
+        if( index < 2 && len <= SQRL_CALLBACK_INLINE_STRING ) {
+            if( len ) memcpy( this->inlineString[index], in->cdata(), len );
+            this->inlineLength[index] = len;
+            return;
+        }
+        if( index < 2 ) this->inlineLength[index] = SQRL_CALLBACK_NOT_INLINE;
+        if( in ) this->str[index].append( in );
+    }
+
+    /// <summary>Takes a string into str[], leaving 'in' empty.</summary>
+    void SqrlClient::CallbackInfo::moveString( int index, SqrlString *in ) {
+        if( index < 2 ) this->inlineLength[index] = SQRL_CALLBACK_NOT_INLINE;
+        this->str[index] = std::move( *in );
+    }
+
+    /// <summary>Gets a string for delivery: built from the bytes kept in place, or moved out of str[].
+    /// </summary>
+    SqrlString SqrlClient::CallbackInfo::takeString( int index ) {
+        if( index < 2 && this->inlineLength[index] != SQRL_CALLBACK_NOT_INLINE ) {
+            return SqrlString( this->inlineString[index], this->inlineLength[index] );
         }
+        return std::move( this->str[index] );
     }
-}
\ No newline at end of file
+}
@@ -12,13 +12,52 @@
 #include "sqrl.h"
 #include "SqrlString.h"
 #include "SqrlDeque.h"
+#include "SqrlAction.h"
+#if defined(WITH_THREADS)
+#include <atomic>
+#include <condition_variable>
+#endif
 
 namespace libsqrl
 {
+// How often SqrlClientAsync looks at actions that are waiting without having said what for.
+#define SQRL_CLIENT_POLL_MS 50
+// Callback slots a SqrlClient keeps ready.  Must be a power of two.
+#define SQRL_CALLBACK_QUEUE_SIZE 32
+// The longest url or payload a callback slot holds without allocating.
+#define SQRL_CALLBACK_INLINE_STRING 512
+// How long, in seconds, an action may go from construction without SqrlAction::start() before
+// loop() reports it.
+#define SQRL_ACTION_START_GRACE_S 1.0
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>How one priority class of actions is being served.  See SqrlClient::getActionStats().
+    /// </summary>
+    ///
+    /// <remarks>
+    /// A wait runs from when an action is ready for a step (created, answered through authenticate()
+    /// or setUser(), or its last step made progress) until that step begins.  Steps of an action that
+    /// is still waiting on something else aren't counted as waits.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    struct Sqrl_Action_Stats
+    {
+        /// <summary>Actions of this class the client holds now.</summary>
+        size_t queued;
+        /// <summary>Steps run.</summary>
+        uint64_t steps;
+        /// <summary>Steps that were waited for, and the total and longest waits, in seconds.</summary>
+        uint64_t waits;
+        double waitTotal;
+        double waitMax;
+        /// <summary>Steps begun after the action's deadline.</summary>
+        uint64_t missedDeadlines;
+    };
+
     class DLL_PUBLIC SqrlClient
     {
         friend class SqrlClientAsync;
         friend class SqrlAction;
+        friend class SqrlActionExecutor;
         friend class SqrlUser;
         friend class SqrlActionSave;
         friend class SqrlActionGenerate;
@@ -32,12 +71,15 @@ namespace libsqrl
         ~SqrlClient();
         static SqrlClient *getClient();
         bool loop();
+        void wake();
+        bool setActionWorkers( size_t workers );
+        SqrlActionExecutor *getActionExecutor();
+        bool getActionStats( int priority, struct Sqrl_Action_Stats *stats );
+        void resetActionStats();
 		SqrlUser *getUser( const SqrlString *uniqueId );
 		SqrlUser *getUser( void *tag );
 
     protected:
-        bool rapid;
-
         virtual int getUserIdleSeconds();
         virtual bool isScreenLocked();
         virtual bool isUserChanged();
@@ -61,29 +103,82 @@ namespace libsqrl
             SqrlAction *action ) = 0;
 		virtual void onClientIsStopping() {}
 
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        /// <summary>A queued callback.  Slots are reused, so strings up to SQRL_CALLBACK_INLINE_STRING
+        /// long are kept in place; longer ones, the ask texts, and moved payloads use str[].</summary>
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
         struct CallbackInfo
         {
             CallbackInfo();
-            ~CallbackInfo();
+
+            void reset();
+            void setString( int index, const SqrlString *in );
+            void moveString( int index, SqrlString *in );
+            SqrlString takeString( int index );
 
             int cbType;
             int progress;
             Sqrl_Credential_Type credentialType;
             void *ptr;
-            SqrlString* str[3];
+            SqrlString str[3];
+            size_t inlineLength[2];
+            char inlineString[2][SQRL_CALLBACK_INLINE_STRING];
+            // Ring position, or (size_t)-1 for a record from the overflow list.
+            size_t position;
+#if defined(WITH_THREADS)
+            std::atomic<size_t> sequence;
+#else
+            size_t sequence;
+#endif
         };
 
     private:
 		static SqrlClient *client;
 
-        SqrlDeque<struct CallbackInfo*> callbackQueue;
+        struct CallbackInfo *callbackRing;
+        size_t callbackTail;
+        SqrlDeque<struct CallbackInfo*> callbackOverflow;
+#if defined(WITH_THREADS)
+        std::atomic<size_t> callbackHead;
+        std::atomic<size_t> overflowCount;
+#else
+        size_t callbackHead;
+        size_t overflowCount;
+#endif
         SqrlDeque<SqrlAction *>actions;
+        SqrlDeque<SqrlAction *>unstarted;
 		SqrlDeque<SqrlUser*>users;
 #if defined(WITH_THREADS)
 		static std::mutex *clientMutex;
         std::mutex actionMutex;
         std::mutex userMutex;
+        std::mutex callbackMutex;
+        std::mutex statsMutex;
+        std::mutex wakeMutex;
+        std::condition_variable wakeCondition;
 #endif
+        bool wakePending;
+        bool progressed;
+        unsigned int pass;
+        SqrlActionExecutor *executor;
+        struct Sqrl_Action_Stats actionStats[SQRL_ACTION_PRIORITY_COUNT];
+
+        static bool isLoopThread();
+        bool waitForWork( long timeoutUs );
+        void wakeLoop();
+        void actionCreated( SqrlAction *action );
+        void addAction( SqrlAction *action );
+        void reportUnstarted( double now );
+        void removeAction( SqrlAction *action );
+        SqrlAction *nextAction( double now, int limit, int *urgency );
+        void actionStarting( SqrlAction *action, double now );
+        void actionPriorityChanged( SqrlAction *action, int priority );
+        struct CallbackInfo *claimCallback();
+        void queueCallback( struct CallbackInfo *info );
+        struct CallbackInfo *nextCallback();
+        void releaseCallback( struct CallbackInfo *info );
+        void dispatchCallbacks();
+        void clearCallbacks();
 
         void callSaveSuggested(
             SqrlUser *user );
@@ -99,7 +194,7 @@ namespace libsqrl
             SqrlAction *action,
             Sqrl_Credential_Type credentialType );
         void callSend(
-            SqrlAction *t, SqrlString *url, SqrlString *payload );
+            SqrlAction *t, SqrlString *url, SqrlString *payload, bool movePayload = false );
         void callAsk(
             SqrlAction *action,
             SqrlString *message, SqrlString *firstButton, SqrlString *secondButton );
@@ -17,37 +17,43 @@
 
 namespace libsqrl
 {
-	SqrlClientAsync::SqrlClientAsync() : SqrlClient() {
+	SqrlClientAsync::SqrlClientAsync() : SqrlClient(), stopping( false ) {
 		this->myThread = new std::thread( SqrlClientAsync::clientThread );
 	}
 
 	SqrlClientAsync::~SqrlClientAsync() {
+		// Only in case the subclass didn't; ~SqrlClient() can only reach its own onClientIsStopping().
+		this->stop();
 	}
 
 	void SqrlClientAsync::onClientIsStopping() {
+		this->stop();
+	}
+
+	void SqrlClientAsync::stop() {
 		this->stopping = true;
+		this->wake();
 		if( this->myThread ) {
 			this->myThread->join();
 			delete this->myThread;
+			this->myThread = NULL;
 		}
 	}
 
 	void SqrlClientAsync::clientThread() {
 		SqrlClientAsync *client = (SqrlClientAsync*)SqrlClient::getClient();
-		while( client && !client->stopping ) {
-			if( client->loop() ) {
-				if( client->rapid ) {
-					client->rapid = false;
-				} else {
-					sqrl_sleep( 50 );
-				}
-			} else {
-				sqrl_sleep( 100 );
-			}
-		}
-		while( !client->callbackQueue.empty() ) {
-			struct CallbackInfo *info = client->callbackQueue.pop();
-			delete info;
+		if( !client ) return;
+		// There is nothing to do until the first action; waiting also keeps loop() from calling into
+		// a subclass that is still being constructed.
+		client->waitForWork( -1 );
+		while( !client->stopping ) {
+			bool busy = client->loop();
+			if( busy && client->progressed ) continue;
+			// Nothing can move until something changes.  With nothing queued, that takes a wake();
+			// actions that are waiting are looked at now and then, in case what they wait on can't
+			// wake the client.
+			client->waitForWork( busy ? SQRL_CLIENT_POLL_MS * 1000L : -1 );
 		}
+		client->clearCallbacks();
 	}
 }
@@ -9,17 +9,38 @@
 #ifndef SQRLCLIENTASYNC_H
 #define SQRLCLIENTASYNC_H
 
+#include <atomic>
 #include "sqrl.h"
 #include "SqrlClient.h"
 
 namespace libsqrl
 {
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>A SqrlClient that runs loop() on a thread of its own.</summary>
+    ///
+    /// <remarks>
+    /// The thread sleeps until SqrlClient::wake() says there is something to do, so an idle client
+    /// costs nothing, and a new action gets its first step as soon as it is started.  While actions
+    /// are waiting on the user, they are still stepped every SQRL_CLIENT_POLL_MS.
+    ///
+    /// Subclasses must call stop() from their destructor.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
     class DLL_PUBLIC SqrlClientAsync : public SqrlClient
     {
     public:
         SqrlClientAsync();
 		~SqrlClientAsync();
 
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        /// <summary>Stops the client's thread, and waits for it to finish.</summary>
+        ///
+        /// <remarks>
+        /// The thread calls the subclass's callbacks and onLoop() until it stops, so a subclass must
+        /// call this first thing in its destructor; ~SqrlClientAsync() is too late.  Calling it again
+        /// does nothing.</remarks>
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        void stop();
+
     protected:
 		virtual void onClientIsStopping() override;
 
@@ -28,7 +49,7 @@ namespace libsqrl
 #if defined(WITH_THREADS)
         std::thread *myThread;
 #endif
-        bool stopping = false;
+        std::atomic<bool> stopping;
 
     };
 }
@@ -13,6 +13,9 @@
 #include "SqrlEntropy.h"
 #include "aes.h"
 #include "gcm.h"
+#include "gcm_aesni.h"
+#include "enhash_simd.h"
+#include "ed25519_batch.h"
 #ifdef ARDUINO
 #include <Crypto.h>
 #include <SHA256.h>
@@ -51,6 +54,13 @@ namespace libsqrl
     }
 
     int SqrlCrypt::enHash( uint64_t *out, const uint64_t *in ) {
+#if !defined(ARDUINO) && defined(SQRL_X86)
+        // Taken before anything is copied to the stack, which only the portable path locks and wipes.
+        if( sqrl_cpu_has_sha() ) {
+            sqrl_enhash_shani( (uint8_t*)out, (const uint8_t*)in );
+            return 0;
+        }
+#endif
         uint64_t trans[4];
         uint64_t tmp[4];
         memset( out, 0, 32 );
@@ -85,6 +95,42 @@ namespace libsqrl
         return 0;
     }
 
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Performs EnHash on many independent inputs.</summary>
+    ///
+    /// <remarks>
+    /// Equivalent to calling enHash( out[i], in[i] ) for each i, but runs 4, 8 or 16 inputs at a time
+    /// through multi-buffer SHA-256 when the CPU supports it.  Intended for bulk work, such as deriving
+    /// master keys for many identity unlock keys.</remarks>
+    ///
+    /// <param name="out">Array of 'n' 32 byte outputs.</param>
+    /// <param name="in"> Array of 'n' 32 byte inputs.</param>
+    /// <param name="n">  Number of inputs.</param>
+    ///
+    /// <returns>0.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    int SqrlCrypt::enHashBatch( uint64_t *const *out, const uint64_t *const *in, size_t n ) {
+        size_t lanes = 1;
+        size_t i = 0;
+#if !defined(ARDUINO)
+        sqrl_enhash_mb_t kernel = sqrl_enhash_mb_select( &lanes );
+        if( kernel ) {
+            for( ; i + lanes <= n; i += lanes ) {
+                kernel( (uint8_t *const *)(out + i), (const uint8_t *const *)(in + i), lanes );
+            }
+            // A short tail is cheaper in a part-filled kernel call than one at a time.
+            if( n - i > 1 ) {
+                kernel( (uint8_t *const *)(out + i), (const uint8_t *const *)(in + i), n - i );
+                i = n;
+            }
+        }
+#endif
+        for( ; i < n; i++ ) {
+            SqrlCrypt::enHash( out[i], in[i] );
+        }
+        return 0;
+    }
+
 
 
     int SqrlCrypt::encrypt( uint8_t *cipherText, const uint8_t *plainText, size_t textLength,
@@ -99,6 +145,13 @@ namespace libsqrl
         if( tag ) tag_len = 16;
         if( !add ) add_len = 0;
 
+#if defined(SQRL_X86)
+        if( sqrl_cpu_has_aesni() ) {
+            retVal = gcm_aesni_crypt_and_tag( ENCRYPT, key, 32, miv, iv_len, add, add_len,
+                plainText, cipherText, textLength, tag, tag_len );
+            if( retVal != -1 ) return retVal;
+        }
+#endif
         gcm_setkey( &ctx, (unsigned char*)key, 32 );
         retVal = gcm_crypt_and_tag(
             &ctx, ENCRYPT,
@@ -122,6 +175,14 @@ namespace libsqrl
         if( tag ) tag_len = 16;
         if( !add ) add_len = 0;
 
+#if defined(SQRL_X86)
+        // Only handles 12 byte IVs; anything else falls through to gcm.cpp.
+        if( sqrl_cpu_has_aesni() ) {
+            retVal = gcm_aesni_auth_decrypt( key, 32, iv, iv_len, add, add_len,
+                cipherText, plainText, textLength, tag, tag_len );
+            if( retVal != -1 ) return retVal;
+        }
+#endif
         gcm_setkey( &ctx, (unsigned char*)key, 32 );
         retVal = gcm_auth_decrypt(
             &ctx, iv, iv_len,
@@ -150,11 +211,20 @@ namespace libsqrl
         return true;
     }
 
-    bool SqrlCrypt::genKey_step( SqrlAction *action ) {
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Advances key generation by one time slice, reporting progress at most once.</summary>
+    ///
+    /// <param name="action">The action to report progress to.</param>
+    /// <param name="budget">Microseconds to spend in EnScrypt before returning (0 for one
+    /// 					 iteration).</param>
+    ///
+    /// <returns>true if genKey_step should be called again, false when finished.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlCrypt::genKey_step( SqrlAction *action, int budget ) {
         if( !action || !this->enscrypt ) return false;
         int p;
         if( !this->enscrypt->isFinished() ) {
-            this->enscrypt->update();
+            this->enscrypt->update( budget );
             p = this->enscrypt->getCurrentProgress();
             if( p > this->lastProgress ) {
                 this->lastProgress = p;
@@ -274,10 +344,32 @@ namespace libsqrl
     }
 
 
-    bool SqrlCrypt::verifySignature( const SqrlString *msg, const uint8_t *sig, const uint8_t *pub ) {
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Verifies a signature.</summary>
+    ///
+    /// <remarks>
+    /// libsodium decides, on every platform.  With a cache, the key is decoded once and the
+    /// signature checked by ed25519_verify_key(), which makes libsodium's checks and so gives the same
+    /// answer.</remarks>
+    ///
+    /// <param name="msg">  The signed message.</param>
+    /// <param name="sig">  The signature (64 bytes).</param>
+    /// <param name="pub">  The public key (32 bytes).</param>
+    /// <param name="cache">(Optional) Decoded public keys, to skip decoding 'pub' again.</param>
+    ///
+    /// <returns>true if the signature is valid.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlCrypt::verifySignature( const SqrlString *msg, const uint8_t *sig, const uint8_t *pub, SqrlKeyCache *cache ) {
 #ifdef ARDUINO
         return Ed25519::verify( sig, pub, msg->cstring(), msg->length() );
 #else
+#if defined(SQRL_ED25519_BATCH)
+        if( cache ) {
+            ed25519_key key;
+            return cache->get( pub, &key ) &&
+                0 == ed25519_verify_key( (const uint8_t*)msg->cdata(), msg->length(), sig, pub, &key );
+        }
+#endif
         if( crypto_sign_verify_detached( sig, (const unsigned char *)msg->cdata(), msg->length(), pub ) == 0 ) {
             return true;
         }
@@ -285,6 +377,91 @@ namespace libsqrl
 #endif
     }
 
+#if defined(SQRL_ED25519_BATCH)
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Checks signatures together; if the batch fails, checks each half the same way, down to
+    /// single signatures, which verifySignature() decides.  A few bad signatures in a large batch then
+    /// cost a few more batches, not a check of every signature on its own.</summary>
+    ///
+    /// <returns>The number of valid signatures.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    static size_t sqrl_verify_bisect( size_t n, const SqrlString *const *msgs, const uint8_t *const *m,
+        const size_t *len, const uint8_t *const *sigs, const uint8_t *const *pubs,
+        const ed25519_key *const *keys, bool *results, SqrlKeyCache *cache ) {
+        if( n == 1 ) {
+            results[0] = SqrlCrypt::verifySignature( msgs[0], sigs[0], pubs[0], cache );
+            return results[0] ? 1 : 0;
+        }
+        if( 0 == ed25519_verify_batch( m, len, sigs, pubs, keys, n ) ) {
+            for( size_t i = 0; i < n; i++ ) results[i] = true;
+            return n;
+        }
+        size_t h = n / 2;
+        return sqrl_verify_bisect( h, msgs, m, len, sigs, pubs, keys, results, cache ) +
+            sqrl_verify_bisect( n - h, msgs + h, m + h, len + h, sigs + h, pubs + h,
+                keys ? keys + h : NULL, results + h, cache );
+    }
+#endif
+
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Verifies several signatures.</summary>
+    ///
+    /// <remarks>
+    /// By default each is checked by verifySignature().  With 'cofactored', they are checked together
+    /// with ed25519_verify_batch(), and a batch that passes is accepted; one that fails is split in
+    /// halves until the bad signatures are found.  That is much faster, but the batch check is
+    /// cofactored, so it also accepts signatures whose R or key has a small order component, which
+    /// only the key's owner can make and verifySignature() refuses.  The same on every platform but
+    /// Arduino, where 'cofactored' is ignored.</remarks>
+    ///
+    /// <param name="n">         Number of signatures.</param>
+    /// <param name="msgs">      The signed messages.</param>
+    /// <param name="sigs">      The signatures (64 bytes each).</param>
+    /// <param name="pubs">      The public keys (32 bytes each).</param>
+    /// <param name="results">   [out] Whether each signature is valid.</param>
+    /// <param name="cache">     (Optional) Decoded public keys, to skip decoding 'pubs' again.</param>
+    /// <param name="cofactored">(Optional) Accept batches that pass ed25519_verify_batch().</param>
+    ///
+    /// <returns>The number of valid signatures.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    size_t SqrlCrypt::verifySignatures( size_t n, const SqrlString *const *msgs, const uint8_t *const *sigs,
+        const uint8_t *const *pubs, bool *results, SqrlKeyCache *cache, bool cofactored ) {
+        size_t valid = 0;
+#if defined(SQRL_ED25519_BATCH)
+        ed25519_key *decoded = cofactored && cache && n > 1 ? new ed25519_key[n < SQRL_ED25519_BATCH_MAX ? n : SQRL_ED25519_BATCH_MAX] : NULL;
+#endif
+        for( size_t off = 0; off < n; off += SQRL_ED25519_BATCH_MAX ) {
+            size_t c = n - off < SQRL_ED25519_BATCH_MAX ? n - off : SQRL_ED25519_BATCH_MAX;
+#if defined(SQRL_ED25519_BATCH)
+            if( cofactored && c > 1 ) {
+                const uint8_t *m[SQRL_ED25519_BATCH_MAX];
+                size_t len[SQRL_ED25519_BATCH_MAX];
+                for( size_t i = 0; i < c; i++ ) {
+                    m[i] = (const uint8_t*)msgs[off + i]->cdata();
+                    len[i] = msgs[off + i]->length();
+                }
+                // A key that fails to decode is left for the batch to reject.
+                const ed25519_key *keys[SQRL_ED25519_BATCH_MAX];
+                for( size_t i = 0; decoded && i < c; i++ ) {
+                    keys[i] = cache->get( pubs[off + i], &decoded[i] ) ? &decoded[i] : NULL;
+                }
+                valid += sqrl_verify_bisect( c, msgs + off, m, len, sigs + off, pubs + off,
+                    decoded ? keys : NULL, results + off, cache );
+                continue;
+            }
+#endif
+            for( size_t i = off; i < off + c; i++ ) {
+                results[i] = SqrlCrypt::verifySignature( msgs[i], sigs[i], pubs[i], cache );
+                if( results[i] ) valid++;
+            }
+        }
+#if defined(SQRL_ED25519_BATCH)
+        if( decoded ) delete[] decoded;
+#endif
+        return valid;
+    }
+
 
     void SqrlCrypt::generateCurvePrivateKey( uint8_t *key ) {
         key[0] &= 248;
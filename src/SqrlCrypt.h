@@ -12,6 +12,7 @@
 #include "sqrl.h"
 #include "SqrlString.h"
 #include "SqrlEnScrypt.h"
+#include "SqrlKeyCache.h"
 
 namespace libsqrl
 {
@@ -26,6 +27,7 @@ namespace libsqrl
         SqrlCrypt();
         ~SqrlCrypt();
         static int enHash( uint64_t *out, const uint64_t *in );
+        static int enHashBatch( uint64_t *const *out, const uint64_t *const *in, size_t n );
         static int encrypt( uint8_t *cipherText, const uint8_t *plainText, size_t textLength,
         const uint8_t *key, const uint8_t *iv, const uint8_t *add, size_t add_len, uint8_t *tag );
         static int decrypt( uint8_t *plainText, const uint8_t *cipherText, size_t textLength,
@@ -39,13 +41,15 @@ namespace libsqrl
         static void generateUnlockRequestSigningKey( uint8_t ursk[SQRL_KEY_SIZE], const uint8_t suk[SQRL_KEY_SIZE], const uint8_t iuk[SQRL_KEY_SIZE] );
         static void generatePublicKey( uint8_t *puk, const uint8_t *prk );
         static void sign( const SqrlString *msg, const uint8_t sk[32], const uint8_t pk[32], uint8_t sig[64] );
-        static bool verifySignature( const SqrlString *msg, const uint8_t *sig, const uint8_t *pub );
+        static bool verifySignature( const SqrlString *msg, const uint8_t *sig, const uint8_t *pub, SqrlKeyCache *cache = NULL );
+        static size_t verifySignatures( size_t n, const SqrlString *const *msgs, const uint8_t *const *sigs,
+            const uint8_t *const *pubs, bool *results, SqrlKeyCache *cache = NULL, bool cofactored = false );
         static void generateCurvePrivateKey( uint8_t *key );
         static void generateCurvePublicKey( uint8_t *puk, const uint8_t *prk );
         static int generateSharedSecret( uint8_t *shared, const uint8_t *puk, const uint8_t *prk );
 
         bool genKey_init( SqrlAction *action, const SqrlString *password );
-        bool genKey_step( SqrlAction *action );
+        bool genKey_step( SqrlAction *action, int budget = ENSCRYPT_SLICE );
         bool genKey_finalize( SqrlAction *action );
         bool genKey( SqrlAction *action, const SqrlString *password );
         bool doCrypt();
@@ -11,154 +11,136 @@
 
 namespace libsqrl
 {
+// The capacity a SqrlDeque starts with, on its first push.  Must be a power of two.
+#define SQRL_DEQUE_INITIAL_CAPACITY 8
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>A double ended queue of pointers.</summary>
+    ///
+    /// <remarks>
+    /// Items are kept in order in a ring buffer, which doubles when full and never shrinks, so count()
+    /// and peek() are O(1), and pushes only allocate while the deque is still growing.  pop() and
+    /// peek() return NULL when there is no such item, so T should be a pointer type.  Not thread
+    /// safe.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
     template <class T>
     class DLL_PUBLIC SqrlDeque
     {
     private:
-        template <class T2>
-        struct item
-        {
-            item( T2 newItem ) {
-                this->myItem = newItem;
-                this->previous = NULL;
-                this->next = NULL;
+        T *items;
+        size_t capacity;
+        size_t first;
+        size_t length;
+
+        T &at( size_t offset ) {
+            return this->items[(this->first + offset) & (this->capacity - 1)];
+        }
+
+        void grow() {
+            size_t newCapacity = this->capacity ? this->capacity * 2 : SQRL_DEQUE_INITIAL_CAPACITY;
+            T *newItems = new T[newCapacity];
+            for( size_t i = 0; i < this->length; i++ ) {
+                newItems[i] = this->at( i );
+            }
+            if( this->items ) delete[] this->items;
+            this->items = newItems;
+            this->capacity = newCapacity;
+            this->first = 0;
+        }
+
+        void copy( const SqrlDeque &other ) {
+            this->items = NULL;
+            this->capacity = 0;
+            this->first = 0;
+            this->length = 0;
+            if( !other.length ) return;
+            this->capacity = other.capacity;
+            this->items = new T[this->capacity];
+            for( size_t i = 0; i < other.length; i++ ) {
+                this->items[i] = other.items[(other.first + i) & (other.capacity - 1)];
             }
-            T2 myItem;
-            item *previous;
-            item *next;
-        };
-        struct item<T> *list;
-        struct item<T> *lend;
+            this->length = other.length;
+        }
 
     public:
         SqrlDeque() {
-            this->list = NULL;
-            this->lend = NULL;
+            this->items = NULL;
+            this->capacity = 0;
+            this->first = 0;
+            this->length = 0;
         }
 
-        ~SqrlDeque() {
-            struct item<T> *cur = this->list;
-            struct item<T> *nxt = NULL;
-            while( cur ) {
-                nxt = cur->next;
-                delete cur;
-                cur = nxt;
+        SqrlDeque( const SqrlDeque &other ) {
+            this->copy( other );
+        }
+
+        SqrlDeque &operator=( const SqrlDeque &other ) {
+            if( this != &other ) {
+                if( this->items ) delete[] this->items;
+                this->copy( other );
             }
+            return *this;
+        }
+
+        ~SqrlDeque() {
+            if( this->items ) delete[] this->items;
         }
 
         void push( T newItem ) {
-            struct item<T> *newStruct = new struct item<T>( newItem );
-            newStruct->next = this->list;
-            if( this->list ) {
-                this->list->previous = newStruct;
-            } else {
-                this->lend = newStruct;
-            }
-            this->list = newStruct;
+            if( this->length == this->capacity ) this->grow();
+            this->first = (this->first - 1) & (this->capacity - 1);
+            this->items[this->first] = newItem;
+            this->length++;
         }
 
         void push_back( T newItem ) {
-            struct item<T> *newStruct = new struct item<T>( newItem );
-            newStruct->previous = this->lend;
-            if( this->lend ) {
-                this->lend->next = newStruct;
-            } else {
-                this->list = newStruct;
-            }
-            this->lend = newStruct;
+            if( this->length == this->capacity ) this->grow();
+            this->at( this->length ) = newItem;
+            this->length++;
         }
 
         T pop() {
-            if( !this->list ) return NULL;
-            struct item<T> *freeMe = this->list;
-            T ret = freeMe->myItem;
-            if( freeMe->next ) {
-                freeMe->next->previous = NULL;
-            } else {
-                this->lend = NULL;
-            }
-            this->list = freeMe->next;
-            delete freeMe;
+            if( !this->length ) return NULL;
+            T ret = this->items[this->first];
+            this->first = (this->first + 1) & (this->capacity - 1);
+            this->length--;
             return ret;
         }
 
         T pop_back() {
-            if( !this->lend ) return NULL;
-            struct item<T> *freeMe = this->lend;
-            T ret = freeMe->myItem;
-            if( freeMe->previous ) {
-                freeMe->previous->next = NULL;
-                this->lend = freeMe->previous;
-            } else {
-                this->list = NULL;
-            }
-            this->lend = freeMe->previous;
-            delete freeMe;
-            return ret;
+            if( !this->length ) return NULL;
+            this->length--;
+            return this->at( this->length );
         }
 
+        /// <summary>Removes every copy of 'comp', keeping the rest in order.</summary>
         void erase( T comp ) {
-            if( !this->list ) return;
-            struct item<T> *prev = NULL;
-            struct item<T> *cur = this->list;
-            struct item<T> *freeMe = NULL;
-            while( cur ) {
-                if( cur->myItem == comp ) {
-                    freeMe = cur;
-                    if( cur->next ) {
-                        cur->next->previous = prev;
-                    } else {
-                        this->lend = prev;
-                    }
-                    if( prev ) {
-                        prev->next = cur->next;
-                        cur = cur->next;
-                    } else {
-                        this->list = cur->next;
-                        cur = cur->next;
-                    }
-                    delete freeMe;
-                    continue;
-                } else {
-                    prev = cur;
-                    cur = cur->next;
-                }
+            size_t kept = 0;
+            for( size_t i = 0; i < this->length; i++ ) {
+                T cur = this->at( i );
+                if( cur == comp ) continue;
+                if( kept != i ) this->at( kept ) = cur;
+                kept++;
             }
+            this->length = kept;
         }
 
-
         T peek( size_t offset = 0 ) {
-            if( !this->list ) return NULL;
-            size_t cnt = 0;
-            struct item<T> *cur = this->list;
-            while( cur ) {
-                if( cnt == offset ) {
-                    return cur->myItem;
-                }
-                cur = cur->next;
-                cnt++;
-            }
-            return NULL;
+            if( offset >= this->length ) return NULL;
+            return this->at( offset );
         }
 
         T peek_back() {
-            if( !this->lend ) return NULL;
-            return this->lend->myItem;
+            if( !this->length ) return NULL;
+            return this->at( this->length - 1 );
         }
 
         bool empty() {
-            if( this->list ) return false;
-            return true;
+            return this->length == 0;
         }
 
         size_t count() {
-            size_t ret = 0;
-            struct item<T> *cur = this->list;
-            while( cur ) {
-                ret++;
-                cur = cur->next;
-            }
-            return ret;
+            return this->length;
         }
 
     };
@@ -9,9 +9,17 @@
 
 #include "sqrl_internal.h"
 #include "SqrlEnScrypt.h"
+#include "escrypt_simd.h"
+#include "SqrlEnScryptArena.h"
 
 namespace libsqrl
 {
+    // Calibration: measured milliseconds per EnScrypt iteration, indexed by N-Factor (0 = unknown).
+    static double enscryptIterationTime[64] = {0};
+#if defined(WITH_THREADS)
+    static std::mutex enscryptCalibrationMutex;
+#endif
+
     ////////////////////////////////////////////////////////////////////////////////////////////////////
 /// <summary>Constructor.</summary>
 ///
@@ -24,14 +32,16 @@ namespace libsqrl
 ////////////////////////////////////////////////////////////////////////////////////////////////////
     SqrlEnScrypt::SqrlEnScrypt( const SqrlAction *action, const SqrlString * password, const SqrlString * salt, uint16_t count, bool countIsIterations, uint8_t nFactor ) :
         result( new SqrlString( SQRL_KEY_SIZE ) ),
+        password( NULL ),
         count( count ),
         countIsIterations( countIsIterations ),
         N( (((uint64_t)1) << nFactor) ),
+        nFactor( nFactor ),
+        planned( count ),
         isComplete( false ),
         didError( false ),
         startTime(0.0),
         endTime(0.0),
-        elapsed(0.0),
         escrypt_kdf(NULL),
         local(NULL),
         iCount(0),
@@ -56,22 +66,29 @@ namespace libsqrl
         this->isComplete = true;
         return true;
 #else
-        this->local = malloc( sizeof( escrypt_local_t ) );
-        if( escrypt_init_local( (escrypt_local_t*)this->local ) ) {
+        this->local = SqrlEnScryptArena::acquire( this->N, ENSCRYPT_R, ENSCRYPT_P );
+        if( !this->local ) {
             this->didError = true;
             this->done();
             return;
         }
-        this->escrypt_kdf = (void*)(sodium_runtime_has_sse2() ? escrypt_kdf_sse : escrypt_kdf_nosse);
+        this->escrypt_kdf = (void*)sqrl_escrypt_kdf_select();
         this->startTime = sqrl_get_real_time();
 
         this->iCount = 1;
         int retVal = ((escrypt_kdf_t)this->escrypt_kdf)((escrypt_local_t*)this->local, thePassword, password_len, theSalt, salt_len, this->N, ENSCRYPT_R, ENSCRYPT_P, t[1], 32);
         if( retVal != 0 ) {
+            this->didError = true;
             this->done();
             return;
         }
 		this->result->append( this->t[1], 32 );
+        if( !this->countIsIterations ) {
+            // Plan the whole run now, so update() needn't read the clock until the plan is used up.
+            // The first iteration is a fair sample if we haven't calibrated this N-Factor yet.
+            SqrlEnScrypt::recordIterationTime( nFactor, 1000 * (sqrl_get_real_time() - this->startTime), false );
+            this->planned = SqrlEnScrypt::estimateIterations( this->count, nFactor );
+        }
 #endif
     }
 
@@ -83,8 +100,7 @@ namespace libsqrl
             delete this->password;
         }
         if( this->local ) {
-            escrypt_free_local( (escrypt_local_t*)this->local );
-            free( this->local );
+            SqrlEnScryptArena::release( this->local );
             this->local = NULL;
         }
     }
@@ -152,11 +168,9 @@ namespace libsqrl
     ////////////////////////////////////////////////////////////////////////////////////////////////////
     int SqrlEnScrypt::getCurrentProgress() {
         if( this->isComplete ) return 100;
-        if( this->countIsIterations ) {
-            return this->iCount * 100 / this->count;
-        } else {
-            return (int)(this->elapsed * 100.0 / this->count);
-        }
+        if( this->planned == 0 ) return 0;
+        int progress = this->iCount * 100 / this->planned;
+        return progress > 99 ? 99 : progress;
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -172,12 +186,16 @@ namespace libsqrl
         size_t password_len = this->password ? this->password->length() : NULL;
         int retVal;
         uint64_t *buf = (uint64_t*)this->result->cdata();
-        bool go = false;
-        if( this->countIsIterations ) {
-            if( this->iCount < this->count ) go = true;
-        } else {
-            this->elapsed = 1000 * (sqrl_get_real_time() - this->startTime);
-            if( this->elapsed < this->count ) go = true;
+        bool go = this->iCount < this->planned;
+        if( !go && !this->countIsIterations ) {
+            // Plan used up; if the estimate came in short, extend it using the rate seen so far.
+            double elapsed = 1000 * (sqrl_get_real_time() - this->startTime);
+            if( elapsed < this->count ) {
+                double remaining = (this->count - elapsed) * this->iCount / elapsed;
+                int more = (int)remaining + 1;
+                this->planned = this->iCount + more > 0xFFFF ? 0xFFFF : (uint16_t)(this->iCount + more);
+                go = this->iCount < this->planned;
+            }
         }
         if( go ) {
             if( this->iCount & 1 ) {
@@ -205,14 +223,45 @@ namespace libsqrl
         return this->isComplete;
     }
 
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Runs as many iterations as fit in a budget before returning.</summary>
+    ///
+    /// <remarks>
+    /// Always performs at least one iteration.  Use this instead of update() when EnScrypt shares a
+    /// thread with other work: one call per slice means one trip through the caller's dispatch loop,
+    /// and one progress report, per slice rather than per iteration.</remarks>
+    ///
+    /// <param name="budget">			 Microseconds, or iterations if budgetIsIterations.  Zero or
+    /// 								 less behaves like update().</param>
+    /// <param name="budgetIsIterations">true if 'budget' is an iteration count.</param>
+    ///
+    /// <returns>true if the operation is complete, false if more iterations are required.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlEnScrypt::update( int budget, bool budgetIsIterations ) {
+        if( budget <= 0 ) return this->update();
+        if( budgetIsIterations ) {
+            for( int i = 0; i < budget; i++ ) {
+                if( this->update() ) break;
+            }
+            return this->isComplete;
+        }
+        double stop = sqrl_get_real_time() + budget / 1000000.0;
+        while( !this->update() ) {
+            if( sqrl_get_real_time() >= stop ) break;
+        }
+        return this->isComplete;
+    }
+
     /// <summary>Call this when the operations is complete.</summary>
     void SqrlEnScrypt::done() {
         this->endTime = sqrl_get_real_time();
-        if( escrypt_free_local( (escrypt_local_t*)this->local ) ) {
-            this->didError = true;
+        if( !this->didError && this->iCount > 1 ) {
+            SqrlEnScrypt::recordIterationTime( this->nFactor, 1000 * (this->endTime - this->startTime) / this->iCount, false );
+        }
+        if( this->local ) {
+            SqrlEnScryptArena::release( this->local );
+            this->local = NULL;
         }
-        if( this->local ) free( this->local );
-        this->local = NULL;
         if( this->didError ) {
             if( this->result ) {
                 delete this->result;
@@ -221,4 +270,407 @@ namespace libsqrl
         }
         this->isComplete = true;
     }
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Stores a measured iteration time for an N-Factor.</summary>
+    ///
+    /// <param name="nFactor">The N-Factor.</param>
+    /// <param name="ms">	  Milliseconds per iteration.</param>
+    /// <param name="replace">true to overwrite any earlier value, false to blend with it.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlEnScrypt::recordIterationTime( uint8_t nFactor, double ms, bool replace ) {
+        if( nFactor >= 64 || ms <= 0.0 ) return;
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_LOCK( &enscryptCalibrationMutex )
+#endif
+        double old = enscryptIterationTime[nFactor];
+        enscryptIterationTime[nFactor] = (replace || old == 0.0) ? ms : (old * 3 + ms) / 4;
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_UNLOCK( &enscryptCalibrationMutex )
+#endif
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Benchmarks EnScrypt at an N-Factor, replacing any cached result.</summary>
+    ///
+    /// <remarks>Blocks for about two iterations.  Not required; the first use of an N-Factor
+    /// calibrates lazily, and every completed EnScrypt refines the estimate.</remarks>
+    ///
+    /// <param name="nFactor">The N-Factor.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlEnScrypt::calibrate( uint8_t nFactor ) {
+        if( nFactor == 0 || nFactor >= 64 ) return;
+#if defined(WITH_SCRYPT)
+        uint64_t N = ((uint64_t)1) << nFactor;
+        escrypt_local_t *local = (escrypt_local_t*)SqrlEnScryptArena::acquire( N, ENSCRYPT_R, ENSCRYPT_P );
+        if( !local ) return;
+        escrypt_kdf_t kdf = sqrl_escrypt_kdf_select();
+        uint8_t buf[32] = {0};
+        // The first call warms caches and the scratch region; time the second.
+        if( 0 == kdf( local, NULL, 0, buf, 32, N, ENSCRYPT_R, ENSCRYPT_P, buf, 32 ) ) {
+            double start = sqrl_get_real_time();
+            if( 0 == kdf( local, NULL, 0, buf, 32, N, ENSCRYPT_R, ENSCRYPT_P, buf, 32 ) ) {
+                SqrlEnScrypt::recordIterationTime( nFactor, 1000 * (sqrl_get_real_time() - start), true );
+            }
+        }
+        SqrlEnScryptArena::release( local );
+#endif
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Gets the expected duration of one EnScrypt iteration, calibrating if necessary.</summary>
+    ///
+    /// <param name="nFactor">The N-Factor.</param>
+    ///
+    /// <returns>Milliseconds per iteration, or 0 if it could not be measured.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    double SqrlEnScrypt::getIterationTime( uint8_t nFactor ) {
+        if( nFactor >= 64 ) return 0.0;
+        double ms;
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_LOCK( &enscryptCalibrationMutex )
+#endif
+        ms = enscryptIterationTime[nFactor];
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_UNLOCK( &enscryptCalibrationMutex )
+#endif
+        if( ms == 0.0 ) {
+            SqrlEnScrypt::calibrate( nFactor );
+#if defined(WITH_THREADS)
+            SQRL_MUTEX_LOCK( &enscryptCalibrationMutex )
+#endif
+            ms = enscryptIterationTime[nFactor];
+#if defined(WITH_THREADS)
+            SQRL_MUTEX_UNLOCK( &enscryptCalibrationMutex )
+#endif
+        }
+        return ms;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Estimates how many iterations fit in a time budget.</summary>
+    ///
+    /// <param name="milliseconds">The time budget.</param>
+    /// <param name="nFactor">	   The N-Factor.</param>
+    ///
+    /// <returns>The estimated iteration count (at least 1).</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    uint16_t SqrlEnScrypt::estimateIterations( int milliseconds, uint8_t nFactor ) {
+        double ms = SqrlEnScrypt::getIterationTime( nFactor );
+        if( ms <= 0.0 || milliseconds <= 0 ) return 1;
+        double it = milliseconds / ms;
+        if( it < 1.0 ) return 1;
+        if( it > 65535.0 ) return 0xFFFF;
+        return (uint16_t)(it + 0.5);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Estimates how long an EnScrypt operation will take, e.g. to tell the user "this will
+    /// take about N seconds" before a save or rekey.</summary>
+    ///
+    /// <param name="iterations">The iteration count.</param>
+    /// <param name="nFactor">   The N-Factor.</param>
+    ///
+    /// <returns>The estimated time in milliseconds.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    int SqrlEnScrypt::estimateTime( uint16_t iterations, uint8_t nFactor ) {
+        return (int)(iterations * SqrlEnScrypt::getIterationTime( nFactor ) + 0.5);
+    }
+
+    struct SqrlEnScryptBatch::job
+    {
+        SqrlString *password;
+        SqrlString *salt;
+        SqrlString *result;
+        uint64_t N;
+        uint16_t iterations;
+        bool didError;
+    };
+
+    /// <summary>Constructor.  Creates an empty batch; see add().</summary>
+    SqrlEnScryptBatch::SqrlEnScryptBatch() :
+        jobs( NULL ),
+        order( NULL ),
+        jobCount( 0 ),
+        jobCapacity( 0 ),
+        cursor( 0 )
+    {}
+
+    SqrlEnScryptBatch::~SqrlEnScryptBatch() {
+        for( size_t i = 0; i < this->jobCount; i++ ) {
+            struct job *j = &this->jobs[i];
+            if( j->password ) {
+                j->password->secureClear();
+                delete j->password;
+            }
+            if( j->salt ) delete j->salt;
+            if( j->result ) {
+                j->result->secureClear();
+                delete j->result;
+            }
+        }
+        if( this->jobs ) free( this->jobs );
+        if( this->order ) free( this->order );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Adds an EnScrypt job to the batch.</summary>
+    ///
+    /// <param name="password">  The password (copied).</param>
+    /// <param name="salt">		 The salt (copied).</param>
+    /// <param name="iterations">Number of iterations.</param>
+    /// <param name="nFactor">	 The N-Factor.</param>
+    ///
+    /// <returns>The index of the job, used with getResult() and isSuccessful().</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    size_t SqrlEnScryptBatch::add( const SqrlString *password, const SqrlString *salt, uint16_t iterations, uint8_t nFactor ) {
+        if( this->jobCount == this->jobCapacity ) {
+            size_t cap = this->jobCapacity ? this->jobCapacity * 2 : 16;
+            struct job *nj = (struct job*)realloc( this->jobs, cap * sizeof( struct job ) );
+            if( !nj ) return (size_t)-1;
+            this->jobs = nj;
+            this->jobCapacity = cap;
+        }
+        struct job *j = &this->jobs[this->jobCount];
+        j->password = password ? new SqrlString( password ) : NULL;
+        j->salt = salt ? new SqrlString( salt ) : NULL;
+        j->result = NULL;
+        j->N = ((uint64_t)1) << nFactor;
+        // SqrlEnScrypt always performs at least one iteration.
+        j->iterations = iterations ? iterations : 1;
+        j->didError = false;
+        return this->jobCount++;
+    }
+
+    /// <summary>Gets the number of jobs in this batch.</summary>
+    size_t SqrlEnScryptBatch::count() {
+        return this->jobCount;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Query if a job completed successfully.</summary>
+    ///
+    /// <param name="index">Index of the job, as returned by add().</param>
+    ///
+    /// <returns>true if successful, false if not (or if run() has not been called).</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlEnScryptBatch::isSuccessful( size_t index ) {
+        if( index >= this->jobCount ) return false;
+        return this->jobs[index].result && !this->jobs[index].didError;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Gets the result of a job.</summary>
+    ///
+    /// <remarks>Invalid when this SqrlEnScryptBatch is deleted.</remarks>
+    ///
+    /// <param name="index">Index of the job, as returned by add().</param>
+    ///
+    /// <returns>null if it failed, else the 32 byte result.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    SqrlString *SqrlEnScryptBatch::getResult( size_t index ) {
+        if( !this->isSuccessful( index ) ) return NULL;
+        return this->jobs[index].result;
+    }
+
+    /// <summary>qsort() comparator: orders jobs by N.</summary>
+    int SqrlEnScryptBatch::compare( const void *a, const void *b ) {
+        uint64_t na = (*(const struct job *const *)a)->N;
+        uint64_t nb = (*(const struct job *const *)b)->N;
+        return na < nb ? -1 : (na > nb ? 1 : 0);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Runs every job in the batch, blocking until all are complete.</summary>
+    ///
+    /// <param name="threads">Number of worker threads, or 0 to use one per hardware thread.</param>
+    ///
+    /// <returns>true if every job succeeded.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlEnScryptBatch::run( int threads ) {
+        if( this->jobCount == 0 ) return true;
+        for( size_t i = 0; i < this->jobCount; i++ ) {
+            struct job *j = &this->jobs[i];
+            if( j->result ) {
+                delete j->result;
+                j->result = NULL;
+            }
+            j->didError = false;
+        }
+        if( this->order ) free( this->order );
+        this->order = (struct job**)malloc( this->jobCount * sizeof( struct job* ) );
+        if( !this->order ) return false;
+        for( size_t i = 0; i < this->jobCount; i++ ) {
+            this->order[i] = &this->jobs[i];
+        }
+        // Group jobs by N, so a worker's lanes stay full until a group runs dry.
+        qsort( this->order, this->jobCount, sizeof( struct job* ), SqrlEnScryptBatch::compare );
+        this->cursor = 0;
+
+#if defined(WITH_THREADS)
+        if( threads <= 0 ) {
+            threads = (int)std::thread::hardware_concurrency();
+            if( threads <= 0 ) threads = 1;
+        }
+        // Every worker allocates a full scrypt region per lane; don't start any that would sit idle.
+        size_t lanes = 1;
+#if defined(WITH_SCRYPT)
+        sqrl_escrypt_kdf_mb_select( &lanes );
+#endif
+        size_t maxThreads = (this->jobCount + lanes - 1) / lanes;
+        if( (size_t)threads > maxThreads ) threads = (int)maxThreads;
+        std::thread **workers = new std::thread*[threads];
+        for( int i = 1; i < threads; i++ ) {
+            workers[i] = new std::thread( SqrlEnScryptBatch::worker, this );
+        }
+        SqrlEnScryptBatch::worker( this );
+        for( int i = 1; i < threads; i++ ) {
+            workers[i]->join();
+            delete workers[i];
+        }
+        delete[] workers;
+#else
+        SqrlEnScryptBatch::worker( this );
+#endif
+        bool ok = true;
+        for( size_t i = 0; i < this->jobCount; i++ ) {
+            if( !this->isSuccessful( i ) ) ok = false;
+        }
+        return ok;
+    }
+
+    /// <summary>Takes the next job in N-Factor order, or NULL when none remain.</summary>
+    struct SqrlEnScryptBatch::job *SqrlEnScryptBatch::next() {
+        struct job *j = NULL;
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_LOCK( &this->mutex )
+#endif
+        if( this->cursor < this->jobCount ) {
+            j = this->order[this->cursor++];
+        }
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_UNLOCK( &this->mutex )
+#endif
+        return j;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Worker loop.  Keeps up to 'lanes' jobs of equal N in flight, and refills a lane as
+    /// soon as its job finishes its last iteration.</summary>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlEnScryptBatch::worker( SqrlEnScryptBatch *batch ) {
+#if defined(WITH_SCRYPT)
+        size_t lanes = 1;
+        sqrl_escrypt_kdf_mb_t kdf_mb = sqrl_escrypt_kdf_mb_select( &lanes );
+        escrypt_kdf_t kdf = sqrl_escrypt_kdf_select();
+
+        struct job *active[4] = {NULL};
+        uint16_t iter[4] = {0};
+        uint8_t in[4][32], out[4][32];
+        escrypt_local_t *local[4] = {NULL};
+        escrypt_local_t *pLocal[4];
+        const uint8_t *pPassword[4], *pSalt[4];
+        size_t passwordLen[4], saltLen[4];
+        uint8_t *pOut[4];
+        size_t map[4];
+        uint64_t N = 0;
+        bool ok = true;
+
+        struct job *pending = batch->next();
+        for( ;; ) {
+            size_t busy = 0;
+            for( size_t l = 0; l < lanes; l++ ) {
+                if( active[l] ) busy++;
+            }
+            for( size_t l = 0; l < lanes && pending; l++ ) {
+                if( active[l] ) continue;
+                if( busy && pending->N != N ) break;
+                if( !busy && (pending->N != N || !local[0]) ) {
+                    // Lanes are idle; swap in scratch sized for the next group.
+                    N = pending->N;
+                    for( size_t k = 0; k < lanes; k++ ) {
+                        SqrlEnScryptArena::release( local[k] );
+                        local[k] = (escrypt_local_t*)SqrlEnScryptArena::acquire( N, ENSCRYPT_R, ENSCRYPT_P );
+                        if( !local[k] ) ok = false;
+                    }
+                    if( !ok ) {
+                        pending->didError = true;
+                        break;
+                    }
+                }
+                active[l] = pending;
+                iter[l] = 0;
+                busy++;
+                pending = batch->next();
+            }
+            if( !busy || !ok ) break;
+
+            size_t n = 0;
+            for( size_t l = 0; l < lanes; l++ ) {
+                struct job *j = active[l];
+                if( !j ) continue;
+                map[n] = l;
+                pLocal[n] = local[l];
+                pPassword[n] = j->password ? j->password->cdata() : NULL;
+                passwordLen[n] = j->password ? j->password->length() : 0;
+                if( iter[l] == 0 ) {
+                    pSalt[n] = j->salt ? j->salt->cdata() : NULL;
+                    saltLen[n] = j->salt ? j->salt->length() : 0;
+                } else {
+                    pSalt[n] = in[l];
+                    saltLen[n] = 32;
+                }
+                pOut[n] = out[l];
+                n++;
+            }
+
+            int retVal = 0;
+            if( kdf_mb ) {
+                retVal = kdf_mb( pLocal, pPassword, passwordLen, pSalt, saltLen, n, N, ENSCRYPT_R, ENSCRYPT_P, pOut, 32 );
+            } else {
+                for( size_t k = 0; k < n; k++ ) {
+                    retVal |= kdf( pLocal[k], pPassword[k], passwordLen[k], pSalt[k], saltLen[k], N, ENSCRYPT_R, ENSCRYPT_P, pOut[k], 32 );
+                }
+            }
+
+            for( size_t k = 0; k < n; k++ ) {
+                size_t l = map[k];
+                struct job *j = active[l];
+                if( retVal != 0 ) {
+                    j->didError = true;
+                    active[l] = NULL;
+                    continue;
+                }
+                if( iter[l] == 0 ) {
+                    j->result = new SqrlString( out[l], 32 );
+                } else {
+                    uint8_t *buf = j->result->data();
+                    for( int b = 0; b < 32; b++ ) buf[b] ^= out[l][b];
+                }
+                memcpy( in[l], out[l], 32 );
+                if( ++iter[l] >= j->iterations ) {
+                    active[l] = NULL;
+                }
+            }
+        }
+
+        for( size_t l = 0; l < lanes; l++ ) {
+            SqrlEnScryptArena::release( local[l] );
+        }
+        sqrl_memzero( in, sizeof( in ) );
+        sqrl_memzero( out, sizeof( out ) );
+#else
+        struct job *j;
+        while( (j = batch->next()) ) {
+            uint8_t nFactor = 0;
+            while( (((uint64_t)1) << nFactor) < j->N ) nFactor++;
+            SqrlEnScrypt es( NULL, j->password, j->salt, j->iterations, true, nFactor );
+            while( !es.update() );
+            if( es.isSuccessful() ) {
+                j->result = new SqrlString( es.getResult() );
+            } else {
+                j->didError = true;
+            }
+        }
+#endif
+    }
 }
@@ -18,6 +18,8 @@ namespace libsqrl
 {
 #define ENSCRYPT_R 256
 #define ENSCRYPT_P 1
+// Default time slice, in microseconds, for callers stepping EnScrypt from a shared thread.
+#define ENSCRYPT_SLICE 50000
 #define SODIUM_SCRYPT crypto_pwhash_scryptsalsa208sha256_ll
 
 
@@ -35,25 +37,70 @@ namespace libsqrl
         int getCurrentProgress();
 
         bool update();
+        bool update( int budget, bool budgetIsIterations = false );
+
+        static void calibrate( uint8_t nFactor = 9 );
+        static double getIterationTime( uint8_t nFactor = 9 );
+        static uint16_t estimateIterations( int milliseconds, uint8_t nFactor = 9 );
+        static int estimateTime( uint16_t iterations, uint8_t nFactor = 9 );
 
     private:
         void done();
+        static void recordIterationTime( uint8_t nFactor, double ms, bool replace );
 
         SqrlString *result;
         SqrlString *password;
         uint16_t count;
         bool countIsIterations;
         uint64_t N;
+        uint8_t nFactor;
+        uint16_t planned;
         bool isComplete;
         bool didError;
 
         uint8_t t[2][32] = {{0}, {0}};
-        double startTime, endTime, elapsed;
+        double startTime, endTime;
         void *escrypt_kdf;
         void *local;
         int iCount;
 
         const SqrlAction *action;
     };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Runs many independent EnScrypt operations at once.</summary>
+    ///
+    /// <remarks>
+    /// Meant for offline bulk work (re-verifying or re-encrypting stored identities).  Jobs with the
+    /// same N-Factor share the lanes of the multi-buffer scrypt kernel, and the batch is split across
+    /// worker threads.  Each result is identical to SqrlEnScrypt::getResult() for the same inputs.
+    /// </remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    class DLL_PUBLIC SqrlEnScryptBatch
+    {
+    public:
+        SqrlEnScryptBatch();
+        ~SqrlEnScryptBatch();
+        size_t add( const SqrlString *password, const SqrlString *salt, uint16_t iterations, uint8_t nFactor = 9 );
+        size_t count();
+        bool run( int threads = 0 );
+        bool isSuccessful( size_t index );
+        SqrlString *getResult( size_t index );
+
+    private:
+        struct job;
+        struct job *next();
+        static void worker( SqrlEnScryptBatch *batch );
+        static int compare( const void *a, const void *b );
+
+        struct job *jobs;
+        struct job **order;
+        size_t jobCount;
+        size_t jobCapacity;
+        size_t cursor;
+#if defined(WITH_THREADS)
+        std::mutex mutex;
+#endif
+    };
 }
 #endif // SQRLENSCRYPT_H
@@ -0,0 +1,281 @@
+/** \file SqrlEnScryptArena.cpp
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#include "sqrl_internal.h"
+#include "SqrlEnScryptArena.h"
+
+#if defined(WITH_SCRYPT)
+#include <atomic>
+#if defined(WITH_THREADS)
+#include <mutex>
+#endif
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#define ARENA_SLOTS 8
+#define ARENA_PAGE_SIZE 4096
+#define ARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+namespace libsqrl
+{
+    static std::atomic<bool> arenaHugePages( false );
+    static std::atomic<uint64_t> arenaAllocations( 0 );
+    static std::atomic<uint64_t> arenaReuses( 0 );
+    static std::atomic<uint64_t> arenaFaultsSaved( 0 );
+
+    static void arena_unmap( escrypt_local_t *local ) {
+        if( local->base ) {
+#if defined(_WIN32)
+            VirtualFree( local->base, 0, MEM_RELEASE );
+#else
+            munmap( local->base, local->size );
+#endif
+        }
+        free( local );
+    }
+
+    static escrypt_local_t *arena_map( size_t size ) {
+        escrypt_local_t *local = (escrypt_local_t*)malloc( sizeof( escrypt_local_t ) );
+        if( !local ) return NULL;
+        void *p = NULL;
+#if defined(_WIN32)
+        p = VirtualAlloc( NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
+#else
+#if defined(MAP_HUGETLB)
+        if( arenaHugePages ) {
+            // Explicit huge pages only exist if the administrator reserved some; fall through if not.
+            size_t hugeSize = (size + ARENA_HUGE_PAGE_SIZE - 1) & ~((size_t)ARENA_HUGE_PAGE_SIZE - 1);
+            p = mmap( NULL, hugeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+            if( p == MAP_FAILED ) {
+                p = NULL;
+            } else {
+                size = hugeSize;
+            }
+        }
+#endif
+        if( !p ) {
+            p = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+            if( p == MAP_FAILED ) {
+                p = NULL;
+            }
+#if defined(MADV_HUGEPAGE)
+            else if( arenaHugePages ) {
+                madvise( p, size, MADV_HUGEPAGE );
+            }
+#endif
+        }
+#endif
+        if( !p ) {
+            free( local );
+            return NULL;
+        }
+        // Pre-fault, so the first scrypt pass doesn't take its page faults one at a time.
+        for( size_t i = 0; i < size; i += ARENA_PAGE_SIZE ) {
+            ((volatile uint8_t*)p)[i] = 0;
+        }
+        local->base = p;
+        local->aligned = p;
+        local->size = size;
+        arenaAllocations++;
+        return local;
+    }
+
+    /// <summary>The idle regions, shared by every thread.</summary>
+    struct arena_cache
+    {
+        escrypt_local_t *slot[ARENA_SLOTS];
+        size_t bytes;
+        size_t limit;
+#if defined(WITH_THREADS)
+        std::mutex mutex;
+#endif
+
+        arena_cache() {
+            for( int i = 0; i < ARENA_SLOTS; i++ ) this->slot[i] = NULL;
+            this->bytes = 0;
+            this->limit = SQRL_ENSCRYPT_ARENA_DEFAULT_LIMIT;
+        }
+
+        ~arena_cache() {
+            for( int i = 0; i < ARENA_SLOTS; i++ ) {
+                if( this->slot[i] ) arena_unmap( this->slot[i] );
+            }
+        }
+
+        /// <summary>Takes out the region released longest ago.  Call with the mutex held.</summary>
+        escrypt_local_t *pop() {
+            escrypt_local_t *l = this->slot[0];
+            for( int i = 1; i < ARENA_SLOTS; i++ ) this->slot[i - 1] = this->slot[i];
+            this->slot[ARENA_SLOTS - 1] = NULL;
+            if( l ) this->bytes -= l->size;
+            return l;
+        }
+
+        /// <summary>Takes regions out, oldest first, until at most 'keep' bytes remain.  Call with the
+        /// mutex held, and unmap what lands in 'out' after releasing it.</summary>
+        int shrink( size_t keep, escrypt_local_t **out ) {
+            int n = 0;
+            while( this->bytes > keep ) out[n++] = this->pop();
+            return n;
+        }
+    };
+
+    static struct arena_cache arenaCache;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Gets a scratch region large enough for scrypt with the given parameters.</summary>
+    ///
+    /// <param name="N">The scrypt N parameter.</param>
+    /// <param name="r">The scrypt r parameter.</param>
+    /// <param name="p">The scrypt p parameter.</param>
+    ///
+    /// <returns>An escrypt_local_t*, or NULL on failure.  Give it back with release(), from any
+    /// thread.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void *SqrlEnScryptArena::acquire( uint64_t N, uint32_t r, uint32_t p ) {
+        if( r == 0 || p == 0 || N == 0 || N > SIZE_MAX / 128 / r ) return NULL;
+        // B, V and XY as laid out by every escrypt kernel, plus the SSE kernel's alignment slack.
+        size_t need = (size_t)128 * r * p + (size_t)128 * r * (size_t)N + (size_t)256 * r + 64;
+
+        escrypt_local_t *l = NULL;
+        SQRL_MUTEX_LOCK( &arenaCache.mutex );
+        int best = -1;
+        for( int i = 0; i < ARENA_SLOTS; i++ ) {
+            escrypt_local_t *c = arenaCache.slot[i];
+            if( c && c->size >= need && (best < 0 || c->size < arenaCache.slot[best]->size) ) {
+                best = i;
+            }
+        }
+        if( best >= 0 ) {
+            l = arenaCache.slot[best];
+            for( int i = best + 1; i < ARENA_SLOTS; i++ ) arenaCache.slot[i - 1] = arenaCache.slot[i];
+            arenaCache.slot[ARENA_SLOTS - 1] = NULL;
+            arenaCache.bytes -= l->size;
+        }
+        SQRL_MUTEX_UNLOCK( &arenaCache.mutex );
+        if( l ) {
+            arenaReuses++;
+            arenaFaultsSaved += (l->size + ARENA_PAGE_SIZE - 1) / ARENA_PAGE_SIZE;
+            return l;
+        }
+        need = (need + ARENA_PAGE_SIZE - 1) & ~((size_t)ARENA_PAGE_SIZE - 1);
+        return arena_map( need );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Returns a region obtained from acquire() to the cache.</summary>
+    ///
+    /// <remarks>To stay within the cache limit, the regions released longest ago (possibly this
+    /// one) are freed.</remarks>
+    ///
+    /// <param name="local">The region.  May be NULL.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlEnScryptArena::release( void *local ) {
+        escrypt_local_t *l = (escrypt_local_t*)local;
+        if( !l ) return;
+        escrypt_local_t *freed[ARENA_SLOTS + 1];
+        int n = 0;
+        SQRL_MUTEX_LOCK( &arenaCache.mutex );
+        if( l->size > arenaCache.limit ) {
+            freed[n++] = l;
+        } else {
+            n = arenaCache.shrink( arenaCache.limit - l->size, freed );
+            if( arenaCache.slot[ARENA_SLOTS - 1] ) freed[n++] = arenaCache.pop();
+            int i = 0;
+            while( arenaCache.slot[i] ) i++;
+            arenaCache.slot[i] = l;
+            arenaCache.bytes += l->size;
+        }
+        SQRL_MUTEX_UNLOCK( &arenaCache.mutex );
+        for( int i = 0; i < n; i++ ) arena_unmap( freed[i] );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Frees every cached region.</summary>
+    ///
+    /// <remarks>SqrlClient::loop() calls this once the client has no actions left, so idle clients
+    /// hold no scratch memory.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlEnScryptArena::trim() {
+        escrypt_local_t *freed[ARENA_SLOTS];
+        SQRL_MUTEX_LOCK( &arenaCache.mutex );
+        int n = arenaCache.shrink( 0, freed );
+        SQRL_MUTEX_UNLOCK( &arenaCache.mutex );
+        for( int i = 0; i < n; i++ ) arena_unmap( freed[i] );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Sets the most memory idle regions may hold, across all threads.</summary>
+    ///
+    /// <param name="bytes">The limit; 0 caches nothing.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlEnScryptArena::setCacheLimit( size_t bytes ) {
+        escrypt_local_t *freed[ARENA_SLOTS];
+        SQRL_MUTEX_LOCK( &arenaCache.mutex );
+        arenaCache.limit = bytes;
+        int n = arenaCache.shrink( bytes, freed );
+        SQRL_MUTEX_UNLOCK( &arenaCache.mutex );
+        for( int i = 0; i < n; i++ ) arena_unmap( freed[i] );
+    }
+
+    size_t SqrlEnScryptArena::getCacheLimit() {
+        SQRL_MUTEX_LOCK( &arenaCache.mutex );
+        size_t limit = arenaCache.limit;
+        SQRL_MUTEX_UNLOCK( &arenaCache.mutex );
+        return limit;
+    }
+
+    /// <summary>Gets the memory held by idle regions.</summary>
+    size_t SqrlEnScryptArena::getCachedBytes() {
+        SQRL_MUTEX_LOCK( &arenaCache.mutex );
+        size_t bytes = arenaCache.bytes;
+        SQRL_MUTEX_UNLOCK( &arenaCache.mutex );
+        return bytes;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Requests huge pages for regions mapped from now on.</summary>
+    ///
+    /// <remarks>
+    /// On Linux this tries MAP_HUGETLB first, then falls back to madvise(MADV_HUGEPAGE) for
+    /// transparent huge pages.  Has no effect elsewhere.</remarks>
+    ///
+    /// <param name="enable">true to enable.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlEnScryptArena::setHugePages( bool enable ) {
+        arenaHugePages = enable;
+    }
+
+    bool SqrlEnScryptArena::getHugePages() {
+        return arenaHugePages;
+    }
+
+    /// <summary>Gets the number of regions mapped, across all threads.</summary>
+    uint64_t SqrlEnScryptArena::getAllocationCount() {
+        return arenaAllocations;
+    }
+
+    /// <summary>Gets the number of times acquire() was satisfied from a cache, across all threads.</summary>
+    uint64_t SqrlEnScryptArena::getReuseCount() {
+        return arenaReuses;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Gets the number of page faults avoided by reusing regions.</summary>
+    ///
+    /// <remarks>Counted in 4KB pages: every page of a reused region would otherwise have been faulted
+    /// in again.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    uint64_t SqrlEnScryptArena::getPageFaultsSaved() {
+        return arenaFaultsSaved;
+    }
+}
+#endif // WITH_SCRYPT
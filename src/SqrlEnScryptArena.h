@@ -0,0 +1,47 @@
+/** \file SqrlEnScryptArena.h
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#ifndef SQRLENSCRYPTARENA_H
+#define SQRLENSCRYPTARENA_H
+
+#include "sqrl.h"
+
+namespace libsqrl
+{
+#define SQRL_ENSCRYPT_ARENA_DEFAULT_LIMIT (64 * 1024 * 1024)
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Reusable scratch regions (escrypt_local_t) for scrypt.</summary>
+    ///
+    /// <remarks>
+    /// At N-Factor 9 every scrypt call needs 16MB of scratch.  Rather than allocating and faulting
+    /// that in again for every SqrlEnScrypt, regions are mapped once, pre-faulted, and cached.  A
+    /// region is sized for the N it was acquired for, so the kernels never reallocate it.  One cache
+    /// serves every thread, so a region may be released on a different thread than acquired it.  It
+    /// holds at most setCacheLimit() bytes, freeing the regions released longest ago to stay within
+    /// it, and is emptied by trim(), which SqrlClient::loop() calls once the client is idle.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    class DLL_PUBLIC SqrlEnScryptArena
+    {
+    public:
+        static void *acquire( uint64_t N, uint32_t r, uint32_t p );
+        static void release( void *local );
+        static void trim();
+        static void setCacheLimit( size_t bytes );
+        static size_t getCacheLimit();
+        static size_t getCachedBytes();
+
+        static void setHugePages( bool enable );
+        static bool getHugePages();
+
+        static uint64_t getAllocationCount();
+        static uint64_t getReuseCount();
+        static uint64_t getPageFaultsSaved();
+    };
+}
+#endif // SQRLENSCRYPTARENA_H
@@ -117,6 +117,10 @@ namespace libsqrl
 
     protected:
 
+        virtual bool isMovable() const {
+            return false;
+        }
+
         virtual void allocate( size_t len ) {
             if( this->myData ) return;
             SqrlString::allocate( len );
@@ -129,7 +133,7 @@ namespace libsqrl
         /// <summary>Deallocates this SqrlString.</summary>
         virtual void deallocate() {
             if( this->selfAllocated && this->myData ) {
-                delete this->myData;
+                delete[] this->myData;
             }
             this->myData = NULL;
             this->myDend = NULL;
@@ -12,7 +12,7 @@
 
 namespace libsqrl
 {
-    SqrlIdentityAction::SqrlIdentityAction( SqrlUser *user ) : SqrlAction() {
+    SqrlIdentityAction::SqrlIdentityAction( SqrlUser *user, int priority ) : SqrlAction( priority ) {
         this->setUser( user );
     }
 
@@ -20,7 +20,7 @@ namespace libsqrl
         friend class SqrlActionSave;
 
     public:
-        SqrlIdentityAction( SqrlUser *user );
+        SqrlIdentityAction( SqrlUser *user, int priority = SQRL_ACTION_PRIORITY_NORMAL );
 
 
     protected:
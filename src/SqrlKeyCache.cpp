@@ -0,0 +1,200 @@
+/** \file SqrlKeyCache.cpp
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#include "sqrl_internal.h"
+#include "SqrlKeyCache.h"
+
+#define KEY_CACHE_NONE 0xFFFFFFFFU
+
+namespace libsqrl
+{
+    /// <summary>A cached key: on its hash chain, and on the LRU list.</summary>
+    struct Sqrl_Key_Entry
+    {
+        uint8_t pub[32];
+        bool valid;             // false if libsodium would refuse the key
+        uint32_t next;          // hash chain
+        uint32_t newer;
+        uint32_t older;
+#if defined(SQRL_ED25519_BATCH)
+        ed25519_key key;
+#endif
+    };
+
+    static inline uint64_t key_cache_mix( uint64_t x ) {
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Constructor.</summary>
+    ///
+    /// <param name="capacity">The most keys to remember.  Each takes about 700 bytes.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    SqrlKeyCache::SqrlKeyCache( size_t capacity ) :
+        entries( NULL ), buckets( NULL ), mask( 0 ), capacity( 0 ), size( 0 ),
+        newest( KEY_CACHE_NONE ), oldest( KEY_CACHE_NONE ), hits( 0 ), misses( 0 ), evictions( 0 ) {
+        sqrl_randombytes( &this->seed, sizeof( this->seed ) );
+#if defined(SQRL_ED25519_BATCH)
+        if( capacity == 0 ) return;
+        if( capacity > 0x10000000 ) capacity = 0x10000000;
+        this->capacity = (uint32_t)capacity;
+        this->entries = new struct Sqrl_Key_Entry[this->capacity];
+
+        // Chains average at most one entry.
+        uint32_t nb = 16;
+        while( nb < this->capacity ) nb <<= 1;
+        this->mask = nb - 1;
+        this->buckets = new uint32_t[nb];
+        for( uint32_t i = 0; i < nb; i++ ) this->buckets[i] = KEY_CACHE_NONE;
+#endif
+    }
+
+    SqrlKeyCache::~SqrlKeyCache() {
+        if( this->entries ) delete[] this->entries;
+        if( this->buckets ) delete[] this->buckets;
+    }
+
+    /// <summary>Keys come from clients, so the bucket depends on a secret seed.</summary>
+    uint32_t SqrlKeyCache::hash( const uint8_t pub[32] ) {
+        uint64_t h = this->seed;
+        for( int i = 0; i < 32; i += 8 ) {
+            uint64_t w;
+            memcpy( &w, pub + i, 8 );
+            h = key_cache_mix( h ^ w );
+        }
+        return (uint32_t)h & this->mask;
+    }
+
+    uint32_t SqrlKeyCache::find( uint32_t bucket, const uint8_t pub[32] ) {
+        uint32_t i = this->buckets[bucket];
+        while( i != KEY_CACHE_NONE && memcmp( this->entries[i].pub, pub, 32 ) != 0 ) {
+            i = this->entries[i].next;
+        }
+        return i;
+    }
+
+    /// <summary>Removes an entry from the LRU list.</summary>
+    void SqrlKeyCache::unlink( uint32_t i ) {
+        struct Sqrl_Key_Entry *e = &this->entries[i];
+        if( e->newer != KEY_CACHE_NONE ) this->entries[e->newer].older = e->older;
+        else this->newest = e->older;
+        if( e->older != KEY_CACHE_NONE ) this->entries[e->older].newer = e->newer;
+        else this->oldest = e->newer;
+    }
+
+    /// <summary>Puts an entry at the head of the LRU list.</summary>
+    void SqrlKeyCache::pushNewest( uint32_t i ) {
+        struct Sqrl_Key_Entry *e = &this->entries[i];
+        e->newer = KEY_CACHE_NONE;
+        e->older = this->newest;
+        if( this->newest != KEY_CACHE_NONE ) this->entries[this->newest].newer = i;
+        this->newest = i;
+        if( this->oldest == KEY_CACHE_NONE ) this->oldest = i;
+    }
+
+#if defined(SQRL_ED25519_BATCH)
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Gets a decoded public key, decoding and remembering it if need be.</summary>
+    ///
+    /// <param name="pub">The encoded public key.</param>
+    /// <param name="key">[out] The decoded key.</param>
+    ///
+    /// <returns>true on success; false if the key is one libsodium would refuse.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlKeyCache::get( const uint8_t pub[32], ed25519_key *key ) {
+        if( !this->capacity ) {
+            return ed25519_key_decode( key, pub ) == 0;
+        }
+        uint32_t bucket = this->hash( pub );
+        bool valid = false;
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_LOCK( &this->mutex )
+#endif
+        uint32_t i = this->find( bucket, pub );
+        if( i != KEY_CACHE_NONE ) {
+            this->unlink( i );
+            this->pushNewest( i );
+            valid = this->entries[i].valid;
+            if( valid ) memcpy( key, &this->entries[i].key, sizeof( ed25519_key ) );
+        }
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_UNLOCK( &this->mutex )
+#endif
+        if( i != KEY_CACHE_NONE ) {
+            this->hits++;
+            return valid;
+        }
+
+        this->misses++;
+        valid = ed25519_key_decode( key, pub ) == 0;
+
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_LOCK( &this->mutex )
+#endif
+        // Another thread may have added it while we were decoding.
+        if( this->find( bucket, pub ) == KEY_CACHE_NONE ) {
+            if( this->size < this->capacity ) {
+                i = this->size++;
+            } else {
+                i = this->oldest;
+                this->unlink( i );
+                uint32_t *p = &this->buckets[this->hash( this->entries[i].pub )];
+                while( *p != i ) p = &this->entries[*p].next;
+                *p = this->entries[i].next;
+                this->evictions++;
+            }
+            struct Sqrl_Key_Entry *e = &this->entries[i];
+            memcpy( e->pub, pub, 32 );
+            e->valid = valid;
+            if( valid ) memcpy( &e->key, key, sizeof( ed25519_key ) );
+            e->next = this->buckets[bucket];
+            this->buckets[bucket] = i;
+            this->pushNewest( i );
+        }
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_UNLOCK( &this->mutex )
+#endif
+        return valid;
+    }
+#endif
+
+    /// <summary>Gets the number of lookups that found their key.</summary>
+    uint64_t SqrlKeyCache::getHits() {
+        return this->hits;
+    }
+
+    /// <summary>Gets the number of lookups that had to decode their key.</summary>
+    uint64_t SqrlKeyCache::getMisses() {
+        return this->misses;
+    }
+
+    /// <summary>Gets the number of keys dropped to make room for others.</summary>
+    uint64_t SqrlKeyCache::getEvictions() {
+        return this->evictions;
+    }
+
+    /// <summary>Gets the number of keys held.</summary>
+    size_t SqrlKeyCache::getSize() {
+        size_t s;
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_LOCK( &this->mutex )
+#endif
+        s = this->size;
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_UNLOCK( &this->mutex )
+#endif
+        return s;
+    }
+
+    /// <summary>Gets the most keys the cache will hold.</summary>
+    size_t SqrlKeyCache::getCapacity() {
+        return this->capacity;
+    }
+}
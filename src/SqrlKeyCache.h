@@ -0,0 +1,74 @@
+/** \file SqrlKeyCache.h
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#ifndef SQRLKEYCACHE_H
+#define SQRLKEYCACHE_H
+
+#include <atomic>
+#include "sqrl.h"
+#include "ed25519_batch.h"
+
+namespace libsqrl
+{
+#define SQRL_KEY_CACHE_DEFAULT_CAPACITY 1024
+
+    struct Sqrl_Key_Entry;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Remembers recently used Ed25519 public keys in decoded form.</summary>
+    ///
+    /// <remarks>
+    /// Every verification starts by decompressing the 32 byte public key into a point, which costs
+    /// about a third of the check.  A returning user signs with the same idk each time, so the server
+    /// keeps the decoded points of the most recently used 'capacity' keys, and hands them to
+    /// SqrlCrypt::verifySignature() and SqrlCrypt::verifySignatures().  Keys libsodium would refuse are
+    /// remembered too, as refused.  The least recently used key is evicted when the cache is full.
+    /// Thread safe; decoding happens outside the lock.
+    ///
+    /// Where ed25519_batch.h isn't available (no 128 bit multiplies), the cache does nothing, and its
+    /// counters stay at zero.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    class DLL_PUBLIC SqrlKeyCache
+    {
+    public:
+        SqrlKeyCache( size_t capacity = SQRL_KEY_CACHE_DEFAULT_CAPACITY );
+        ~SqrlKeyCache();
+
+#if defined(SQRL_ED25519_BATCH)
+        bool get( const uint8_t pub[32], ed25519_key *key );
+#endif
+
+        uint64_t getHits();
+        uint64_t getMisses();
+        uint64_t getEvictions();
+        size_t getSize();
+        size_t getCapacity();
+
+    private:
+        uint32_t hash( const uint8_t pub[32] );
+        uint32_t find( uint32_t bucket, const uint8_t pub[32] );
+        void unlink( uint32_t i );
+        void pushNewest( uint32_t i );
+
+        struct Sqrl_Key_Entry *entries;
+        uint32_t *buckets;
+        uint32_t mask;
+        uint32_t capacity;
+        uint32_t size;
+        uint32_t newest;
+        uint32_t oldest;
+        uint64_t seed;
+        std::atomic<uint64_t> hits;
+        std::atomic<uint64_t> misses;
+        std::atomic<uint64_t> evictions;
+#if defined(WITH_THREADS)
+        std::mutex mutex;
+#endif
+    };
+}
+#endif // SQRLKEYCACHE_H
@@ -0,0 +1,318 @@
+/** \file SqrlNutCache.cpp
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#include "sqrl_internal.h"
+#include "SqrlNutCache.h"
+
+#include <new>
+#if !defined(_WIN32) && !defined(ARDUINO)
+#define NUT_CACHE_SHM
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define NUT_CACHE_TAG_MASK 0xFFFFULL
+#define NUT_CACHE_MAGIC (0x53514E5554430000ULL | (SQRL_NUT_CACHE_BUCKETS << 8) | 1)
+#define NUT_CACHE_OPEN_TRIES 1000
+
+namespace libsqrl
+{
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>The cache's state.  The same layout is used on the heap and in shared memory; the
+    /// slots follow it directly.</summary>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    struct Sqrl_Nut_Table
+    {
+        std::atomic<uint64_t> magic;            // set last, once the rest is initialized
+        uint64_t bucketSpan;                    // microseconds per bucket
+        uint64_t slotsPerBucket;                // a power of two
+        std::atomic<uint64_t> newestEpoch;
+        std::atomic<uint64_t> hits;
+        std::atomic<uint64_t> misses;
+        std::atomic<uint64_t> evictions;
+        std::atomic<uint64_t> overflows;
+        std::atomic<uint64_t> epochs[SQRL_NUT_CACHE_BUCKETS];
+    };
+
+    static inline uint64_t nut_cache_mix( uint64_t x ) {
+        x += 0x9E3779B97F4A7C15ULL;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+
+    /// <summary>Works out the table geometry for a nut lifetime and capacity.</summary>
+    static void nut_cache_geometry( uint64_t nutLife, size_t capacity, uint64_t *bucketSpan, uint64_t *slotsPerBucket ) {
+        // A nut lives for BUCKETS - 1 spans, so its bucket isn't reused until it has expired.
+        *bucketSpan = (nutLife + SQRL_NUT_CACHE_BUCKETS - 2) / (SQRL_NUT_CACHE_BUCKETS - 1);
+        if( *bucketSpan == 0 ) *bucketSpan = 1;
+
+        // Keep each table at most half full.
+        uint64_t want = 2 * (uint64_t)capacity / (SQRL_NUT_CACHE_BUCKETS - 1);
+        *slotsPerBucket = SQRL_NUT_CACHE_MAX_PROBE;
+        while( *slotsPerBucket < want ) *slotsPerBucket <<= 1;
+    }
+
+    static size_t nut_cache_size( uint64_t slotsPerBucket ) {
+        return sizeof( struct Sqrl_Nut_Table ) + (size_t)slotsPerBucket * SQRL_NUT_CACHE_BUCKETS * sizeof( uint64_t );
+    }
+
+    /// <summary>Constructs the atomics in place (over zeroed memory) and publishes the table.</summary>
+    static void nut_cache_init( void *mem, uint64_t bucketSpan, uint64_t slotsPerBucket ) {
+        struct Sqrl_Nut_Table *t = new (mem) struct Sqrl_Nut_Table;
+        t->bucketSpan = bucketSpan;
+        t->slotsPerBucket = slotsPerBucket;
+        t->newestEpoch.store( 0, std::memory_order_relaxed );
+        t->hits.store( 0, std::memory_order_relaxed );
+        t->misses.store( 0, std::memory_order_relaxed );
+        t->evictions.store( 0, std::memory_order_relaxed );
+        t->overflows.store( 0, std::memory_order_relaxed );
+        for( int i = 0; i < SQRL_NUT_CACHE_BUCKETS; i++ ) {
+            t->epochs[i].store( 0, std::memory_order_relaxed );
+        }
+        std::atomic<uint64_t> *slots = (std::atomic<uint64_t>*)(t + 1);
+        size_t total = (size_t)slotsPerBucket * SQRL_NUT_CACHE_BUCKETS;
+        for( size_t i = 0; i < total; i++ ) {
+            new (&slots[i]) std::atomic<uint64_t>( 0 );
+        }
+        t->magic.store( NUT_CACHE_MAGIC, std::memory_order_release );
+    }
+
+    SqrlNutCache::SqrlNutCache() :
+        table( NULL ), slots( NULL ), mapSize( 0 ), shared( false ) {
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Constructs a cache private to this process.</summary>
+    ///
+    /// <param name="nutLife"> How long a nut is accepted, in microseconds (SqrlServer::nut_expires).</param>
+    /// <param name="capacity">The most nuts expected to be used within one nut lifetime.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    SqrlNutCache::SqrlNutCache( uint64_t nutLife, size_t capacity ) :
+        SqrlNutCache() {
+        uint64_t bucketSpan, slotsPerBucket;
+        nut_cache_geometry( nutLife, capacity, &bucketSpan, &slotsPerBucket );
+        this->mapSize = nut_cache_size( slotsPerBucket );
+        void *mem = malloc( this->mapSize );
+        if( !mem ) {
+            this->mapSize = 0;
+            return;
+        }
+        nut_cache_init( mem, bucketSpan, slotsPerBucket );
+        this->table = (struct Sqrl_Nut_Table*)mem;
+        this->slots = (std::atomic<uint64_t>*)(this->table + 1);
+    }
+
+    SqrlNutCache::~SqrlNutCache() {
+        if( !this->table ) return;
+        if( this->shared ) {
+#if defined(NUT_CACHE_SHM)
+            munmap( this->table, this->mapSize );
+#endif
+        } else {
+            free( this->table );
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Opens (creating if need be) a cache in a named POSIX shared memory segment.</summary>
+    ///
+    /// <remarks>
+    /// The first process to create the segment sets its size from nutLife and capacity; later ones
+    /// adopt that geometry, so all servers sharing a name should use the same settings.  The segment
+    /// outlives the processes using it until removeShared() is called.  Not available on Windows.
+    /// </remarks>
+    ///
+    /// <param name="name">	   The segment name, such as "/sqrl-nuts".</param>
+    /// <param name="nutLife"> How long a nut is accepted, in microseconds.</param>
+    /// <param name="capacity">The most nuts expected to be used within one nut lifetime, across all
+    /// 					   processes.</param>
+    ///
+    /// <returns>A new SqrlNutCache, or NULL on failure.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    SqrlNutCache *SqrlNutCache::openShared( const char *name, uint64_t nutLife, size_t capacity ) {
+#if defined(NUT_CACHE_SHM)
+        if( !name ) return NULL;
+        if( !std::atomic<uint64_t>().is_lock_free() ) return NULL;
+        uint64_t bucketSpan, slotsPerBucket;
+        nut_cache_geometry( nutLife, capacity, &bucketSpan, &slotsPerBucket );
+        size_t size = nut_cache_size( slotsPerBucket );
+        void *mem = MAP_FAILED;
+
+        int fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL, 0600 );
+        if( fd >= 0 ) {
+            // We created it: size it (zero filled), initialize, then publish via the magic number.
+            if( 0 == ftruncate( fd, (off_t)size ) ) {
+                mem = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+            }
+            close( fd );
+            if( mem == MAP_FAILED ) {
+                shm_unlink( name );
+                return NULL;
+            }
+            nut_cache_init( mem, bucketSpan, slotsPerBucket );
+        } else {
+            fd = shm_open( name, O_RDWR, 0600 );
+            if( fd < 0 ) return NULL;
+            // Wait for the creator to size and initialize it.
+            struct Sqrl_Nut_Table *t = NULL;
+            struct stat st;
+            for( int i = 0; i < NUT_CACHE_OPEN_TRIES; i++ ) {
+                if( 0 == fstat( fd, &st ) && (size_t)st.st_size >= sizeof( struct Sqrl_Nut_Table ) ) {
+                    if( !t ) {
+                        void *p = mmap( NULL, sizeof( struct Sqrl_Nut_Table ), PROT_READ, MAP_SHARED, fd, 0 );
+                        if( p != MAP_FAILED ) t = (struct Sqrl_Nut_Table*)p;
+                    }
+                    if( t && t->magic.load( std::memory_order_acquire ) == NUT_CACHE_MAGIC ) break;
+                }
+                sqrl_sleep( 1 );
+            }
+            if( t ) {
+                if( t->magic.load( std::memory_order_acquire ) == NUT_CACHE_MAGIC ) {
+                    size = nut_cache_size( t->slotsPerBucket );
+                    if( (size_t)st.st_size >= size ) {
+                        mem = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+                    }
+                }
+                munmap( t, sizeof( struct Sqrl_Nut_Table ) );
+            }
+            close( fd );
+            if( mem == MAP_FAILED ) return NULL;
+        }
+
+        SqrlNutCache *cache = new SqrlNutCache();
+        cache->table = (struct Sqrl_Nut_Table*)mem;
+        cache->slots = (std::atomic<uint64_t>*)(cache->table + 1);
+        cache->mapSize = size;
+        cache->shared = true;
+        return cache;
+#else
+        return NULL;
+#endif
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Removes a shared memory segment created by openShared().</summary>
+    ///
+    /// <remarks>Processes that already have it open keep using it.</remarks>
+    ///
+    /// <returns>true on success.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlNutCache::removeShared( const char *name ) {
+#if defined(NUT_CACHE_SHM)
+        return name && 0 == shm_unlink( name );
+#else
+        return false;
+#endif
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Records a (decrypted, otherwise valid) nut as used.</summary>
+    ///
+    /// <remarks>
+    /// Fails closed: a nut that can't be recorded, because its bucket has already been recycled or its
+    /// probe sequence is full, is refused rather than risk accepting it twice.</remarks>
+    ///
+    /// <param name="nut">The nut.</param>
+    ///
+    /// <returns>true if this is the first time the nut has been seen; false for a replay, or if it
+    /// could not be recorded.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlNutCache::add( const Sqrl_Nut *nut ) {
+        struct Sqrl_Nut_Table *t = this->table;
+        if( !nut || !t ) return false;
+        uint64_t epoch = nut->timestamp / t->bucketSpan;
+
+        uint64_t newest = t->newestEpoch.load( std::memory_order_relaxed );
+        while( epoch > newest &&
+            !t->newestEpoch.compare_exchange_weak( newest, epoch, std::memory_order_relaxed ) ) {
+        }
+        if( epoch + (SQRL_NUT_CACHE_BUCKETS - 1) < newest ) {
+            t->overflows++;
+            return false;
+        }
+
+        // Moving a bucket on to a new epoch drops everything in it, in one step.
+        size_t bucket = (size_t)(epoch % SQRL_NUT_CACHE_BUCKETS);
+        uint64_t bucketEpoch = t->epochs[bucket].load( std::memory_order_acquire );
+        while( bucketEpoch < epoch ) {
+            if( t->epochs[bucket].compare_exchange_weak( bucketEpoch, epoch, std::memory_order_acq_rel ) ) {
+                if( bucketEpoch ) t->evictions++;
+                bucketEpoch = epoch;
+                break;
+            }
+        }
+        if( bucketEpoch > epoch ) {
+            t->overflows++;
+            return false;
+        }
+
+        uint64_t h = nut_cache_mix( ((uint64_t)nut->ip << 32 | nut->random) ^ nut_cache_mix( nut->timestamp ) );
+        uint64_t tag = epoch & NUT_CACHE_TAG_MASK;
+        uint64_t value = (h & ~NUT_CACHE_TAG_MASK) | tag;
+        if( value == 0 ) value = (1ULL << 16);
+        std::atomic<uint64_t> *slot = this->slots + bucket * t->slotsPerBucket;
+        size_t mask = (size_t)t->slotsPerBucket - 1;
+        size_t i = (size_t)(h >> 20) & mask;
+
+        for( int probe = 0; probe < SQRL_NUT_CACHE_MAX_PROBE; probe++, i = (i + 1) & mask ) {
+            uint64_t v = slot[i].load( std::memory_order_acquire );
+            while( true ) {
+                if( v == value ) {
+                    t->hits++;
+                    return false;
+                }
+                // Live only if tagged with this epoch; older tags are free for reuse.  A later tag
+                // means the bucket has moved on since, and this nut has expired.
+                if( v != 0 && (v & NUT_CACHE_TAG_MASK) == tag ) break;
+                if( v != 0 && t->epochs[bucket].load( std::memory_order_acquire ) > epoch ) {
+                    t->overflows++;
+                    return false;
+                }
+                if( slot[i].compare_exchange_weak( v, value, std::memory_order_acq_rel ) ) {
+                    t->misses++;
+                    return true;
+                }
+            }
+        }
+        t->overflows++;
+        return false;
+    }
+
+    /// <summary>true if this cache lives in shared memory.</summary>
+    bool SqrlNutCache::isShared() {
+        return this->shared;
+    }
+
+    /// <summary>Gets the number of replayed nuts refused.  Shared caches count across processes.</summary>
+    uint64_t SqrlNutCache::getHits() {
+        return this->table ? this->table->hits.load() : 0;
+    }
+
+    /// <summary>Gets the number of new nuts recorded.</summary>
+    uint64_t SqrlNutCache::getMisses() {
+        return this->table ? this->table->misses.load() : 0;
+    }
+
+    /// <summary>Gets the number of time buckets expired.</summary>
+    uint64_t SqrlNutCache::getEvictions() {
+        return this->table ? this->table->evictions.load() : 0;
+    }
+
+    /// <summary>Gets the number of nuts refused because they could not be recorded.</summary>
+    uint64_t SqrlNutCache::getOverflows() {
+        return this->table ? this->table->overflows.load() : 0;
+    }
+
+    /// <summary>Gets the size of the tables, in bytes.</summary>
+    size_t SqrlNutCache::getMemoryUsage() {
+        return this->mapSize;
+    }
+}
@@ -0,0 +1,64 @@
+/** \file SqrlNutCache.h
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#ifndef SQRLNUTCACHE_H
+#define SQRLNUTCACHE_H
+
+#include <atomic>
+#include "sqrl.h"
+#include "SqrlServer.h"
+
+namespace libsqrl
+{
+#define SQRL_NUT_CACHE_BUCKETS 8
+#define SQRL_NUT_CACHE_MAX_PROBE 64
+
+    struct Sqrl_Nut_Table;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Remembers nuts that have been used, so each one is accepted only once.</summary>
+    ///
+    /// <remarks>
+    /// Nuts are hashed into one of SQRL_NUT_CACHE_BUCKETS open addressing tables by their timestamp, each
+    /// table covering 1/(BUCKETS - 1) of the nut lifetime.  Every slot is tagged with its bucket's
+    /// epoch, so when time moves on to reuse a bucket its old entries simply stop matching: a whole
+    /// bucket expires in O(1), with no sweep.  Memory is fixed at construction.  Lock free; safe to call
+    /// from concurrent SqrlServer::handleQuery() calls.
+    ///
+    /// With openShared(), the tables live in a named shared memory segment instead, so every process
+    /// on the machine that opens the same name shares one replay filter.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    class DLL_PUBLIC SqrlNutCache
+    {
+    public:
+        SqrlNutCache( uint64_t nutLife, size_t capacity = SQRL_NUT_CACHE_DEFAULT_CAPACITY );
+        ~SqrlNutCache();
+
+        static SqrlNutCache *openShared( const char *name, uint64_t nutLife,
+            size_t capacity = SQRL_NUT_CACHE_DEFAULT_CAPACITY );
+        static bool removeShared( const char *name );
+
+        bool add( const Sqrl_Nut *nut );
+        bool isShared();
+
+        uint64_t getHits();
+        uint64_t getMisses();
+        uint64_t getEvictions();
+        uint64_t getOverflows();
+        size_t getMemoryUsage();
+
+    private:
+        SqrlNutCache();
+
+        struct Sqrl_Nut_Table *table;
+        std::atomic<uint64_t> *slots;
+        size_t mapSize;
+        bool shared;
+    };
+}
+#endif // SQRLNUTCACHE_H
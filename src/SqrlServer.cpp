@@ -8,19 +8,82 @@
 
 #include "sqrl_internal.h"
 #include "SqrlServer.h"
+#include "SqrlServerRequest.h"
+#include "SqrlServerParser.h"
+#include "SqrlNutCache.h"
+#include "SqrlSignatureBatch.h"
+#include "SqrlKeyCache.h"
+#include "SqrlCrypt.h"
 #include "aes.h"
+#include "gcm_aesni.h"
 #include "SqrlUri.h"
 #include "SqrlBase64.h"
 
+#define SQRL_SERVER_LINK_BATCH 64
+// Base64url characters in a nut or a MAC: server_b64_encoded_length( 16 ).
+#define SQRL_SERVER_B64_16 22
+
+// Where a query has got to (SqrlServerRequest::step).  Each store call goes from a step to the one
+// after it, which takes the answer.
+#define QUERY_STEP_DONE          0
+#define QUERY_STEP_FIND_IDK      1
+#define QUERY_STEP_FOUND_IDK     2
+#define QUERY_STEP_FOUND_PIDK    3
+#define QUERY_STEP_CHECKED       4
+#define QUERY_STEP_DELETE        5
+#define QUERY_STEP_DELETED       6
+#define QUERY_STEP_ENABLE        7
+#define QUERY_STEP_ENABLED       8
+#define QUERY_STEP_DISABLE       9
+#define QUERY_STEP_DISABLED      10
+#define QUERY_STEP_REKEY         11
+#define QUERY_STEP_REKEYED       12
+#define QUERY_STEP_IDENT_REKEY   13
+#define QUERY_STEP_IDENT_REKEYED 14
+#define QUERY_STEP_CREATE        15
+#define QUERY_STEP_CREATED       16
+#define QUERY_STEP_IDENTIFY      17
+#define QUERY_STEP_IDENTIFIED    18
+#define QUERY_STEP_FAILED        19
+#define QUERY_STEP_REPLY         20
+
+// Who carries on after onUserAsync() (SqrlServerRequest::resumeState).
+#define QUERY_RESUME_DONE      0
+#define QUERY_RESUME_WAITING   1
+#define QUERY_RESUME_SUSPENDED 2
+
 namespace libsqrl
 {
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Expanded nut cipher schedules, and the keyed MAC state, kept in locked memory for the
+    /// life of the server.</summary>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    struct Sqrl_Server_Keys
+    {
+        aes_context enc;
+        aes_context dec;
+        crypto_auth_hmacsha512256_state mac;    // has absorbed the ipad and opad key blocks
+#if defined(SQRL_X86)
+        bool aesni;
+        aesni_context aesniEnc;
+        aesni_context aesniDec;
+#endif
+    };
+
     SqrlServer::SqrlServer(
         const char *uri,
         const char *sfn,
         const char *passcode,
         size_t passcode_len ) {
         SqrlInit();
-        memset( this, 0, sizeof( class SqrlServer ) );
+        this->uri = NULL;
+        this->sfn = NULL;
+        this->qry = NULL;
+        this->replyQry = NULL;
+        this->keys = NULL;
+        this->nutCache = NULL;
+        this->sigBatch = NULL;
+        this->keyCache = NULL;
         SqrlString ssuri = SqrlString( uri );
         if( sfn ) {
             this->sfn = new SqrlString( sfn );
@@ -48,34 +111,75 @@ namespace libsqrl
             }
         }
 
-        if( passcode ) {
-            crypto_hash_sha256( this->key, (unsigned char*)passcode, passcode_len );
-        } else {
-            sqrl_randombytes( this->key, 32 );
+        // The path clients post their next query to.  The prefix ("https://host") is one character
+        // longer than the challenge's scheme and host ("sqrl://host"), so the path starts one back.
+        this->qry = new SqrlString();
+        if( this->uri && this->uri->getPrefixLength() ) {
+            SqrlString challenge = SqrlString();
+            this->uri->getChallenge( &challenge );
+            size_t len = this->uri->getPrefixLength() - 1;
+            if( len < challenge.length() ) {
+                const char *p = challenge.cstring() + len;
+                const char *pp = strchr( p, '?' );
+                this->qry->append( p, pp ? (size_t)(pp - p) : strlen( p ) );
+            }
         }
+        // Every reply carries the same qry line, so it is built once, here.
+        this->replyQry = new SqrlString( "qry=" );
+        this->replyQry->append( this->qry );
+        this->replyQry->append( "\r\n" );
 
+        this->rekey( passcode, passcode_len );
         this->nut_expires = SQRL_DEFAULT_NUT_LIFE * 1000000;
+        this->nutCache = new SqrlNutCache( this->nut_expires );
+        this->keyCache = new SqrlKeyCache();
     }
 
     SqrlServer::~SqrlServer() {
         if( this->uri ) { delete this->uri; }
         if( this->sfn ) { delete(this->sfn); }
-        int i;
-        for( i = 0; i < CONTEXT_KV_COUNT; i++ ) {
-            if( this->context_strings[i] )
-                delete this->context_strings[i];
+        if( this->qry ) { delete this->qry; }
+        if( this->replyQry ) { delete this->replyQry; }
+        if( this->nutCache ) { delete this->nutCache; }
+        if( this->sigBatch ) { delete this->sigBatch; }
+        if( this->keyCache ) { delete this->keyCache; }
+        if( this->keys ) sqrl_free( this->keys, sizeof( struct Sqrl_Server_Keys ) );
+
+        sqrl_memzero( this->key, sizeof( this->key ) );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Replaces the server key, and re-expands the nut cipher schedules.</summary>
+    ///
+    /// <remarks>
+    /// Nuts and links issued under the old key will no longer decrypt or verify.  Not safe to call
+    /// while other threads are using this server.</remarks>
+    ///
+    /// <param name="passcode">	   The passcode to derive the key from, or NULL for a random key.</param>
+    /// <param name="passcode_len">Length of the passcode.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlServer::rekey( const char *passcode, size_t passcode_len ) {
+        if( passcode ) {
+            crypto_hash_sha256( this->key, (unsigned char*)passcode, passcode_len );
+        } else {
+            sqrl_randombytes( this->key, 32 );
         }
-        for( i = 0; i < CLIENT_KV_COUNT; i++ ) {
-            if( this->client_strings[i] )
-                delete this->client_strings[i];
+
+        if( !this->keys ) {
+            // sqrl_malloc() gives us guarded, locked pages; the schedules are as sensitive as the key.
+            this->keys = (struct Sqrl_Server_Keys*)sqrl_malloc( sizeof( struct Sqrl_Server_Keys ) );
+            if( !this->keys ) return;
         }
-        for( i = 0; i < SERVER_KV_COUNT; i++ ) {
-            if( this->server_strings[i] )
-                delete this->server_strings[i];
+        sqrl_memzero( this->keys, sizeof( struct Sqrl_Server_Keys ) );
+        aes_setkey( &this->keys->enc, ENCRYPT, this->key, 16 );
+        aes_setkey( &this->keys->dec, DECRYPT, this->key, 16 );
+        crypto_auth_hmacsha512256_init( &this->keys->mac, this->key, crypto_auth_KEYBYTES );
+#if defined(SQRL_X86)
+        if( sqrl_cpu_has_aesni() && 0 == aesni_setkey( &this->keys->aesniEnc, this->key, 16 ) ) {
+            aesni_setkey_dec( &this->keys->aesniDec, &this->keys->aesniEnc );
+            this->keys->aesni = true;
         }
-        if( this->reply ) delete this->reply;
-
-        sqrl_memzero( this, sizeof( this ) );
+#endif
     }
 
     bool SqrlServer::createNut( Sqrl_Nut *nut, uint32_t ip ) {
@@ -85,16 +189,14 @@ namespace libsqrl
         pt.timestamp = sqrl_get_timestamp();
         pt.random = sqrl_random();
 
-        aes_context ctx;
-        if( 0 != aes_setkey( &ctx, ENCRYPT, this->key, 16 ) ) {
-            return false;
-        }
-        if( 0 != aes_cipher( &ctx, (unsigned char*)&pt, (unsigned char*)nut ) ) {
-            sqrl_memzero( &ctx, sizeof( aes_context ) );
-            return false;
+        if( !this->keys ) return false;
+#if defined(SQRL_X86)
+        if( this->keys->aesni ) {
+            aesni_encrypt_block( &this->keys->aesniEnc, (unsigned char*)&pt, (unsigned char*)nut );
+            return true;
         }
-        sqrl_memzero( &ctx, sizeof( aes_context ) );
-        return true;
+#endif
+        return 0 == aes_cipher( &this->keys->enc, (unsigned char*)&pt, (unsigned char*)nut );
     }
 
     bool SqrlServer::decryptNut( Sqrl_Nut *nut ) {
@@ -102,83 +204,882 @@ namespace libsqrl
         Sqrl_Nut pt;
         memset( &pt, 0, sizeof( Sqrl_Nut ) );
 
-        aes_context ctx;
-        if( 0 != aes_setkey( &ctx, DECRYPT, this->key, 16 ) ) {
-            return false;
-        }
-        if( 0 != aes_cipher( &ctx, (unsigned char*)nut, (unsigned char*)&pt ) ) {
-            sqrl_memzero( &ctx, sizeof( aes_context ) );
+        if( !this->keys ) return false;
+#if defined(SQRL_X86)
+        if( this->keys->aesni ) {
+            aesni_decrypt_block( &this->keys->aesniDec, (unsigned char*)nut, (unsigned char*)&pt );
+        } else
+#endif
+        if( 0 != aes_cipher( &this->keys->dec, (unsigned char*)nut, (unsigned char*)&pt ) ) {
             return false;
         }
-        sqrl_memzero( &ctx, sizeof( aes_context ) );
 
         memcpy( nut, &pt, sizeof( Sqrl_Nut ) );
         return true;
     }
 
+    /// <summary>Starts a MAC from the precomputed keyed state, rather than rehashing the key.</summary>
+    static inline void server_mac_init( const struct Sqrl_Server_Keys *keys, crypto_auth_hmacsha512256_state *state ) {
+        memcpy( state, &keys->mac, sizeof( crypto_auth_hmacsha512256_state ) );
+    }
+
+    /// <summary>The same as crypto_auth( mac, data, len, key ).</summary>
+    static void server_mac( const struct Sqrl_Server_Keys *keys, uint8_t mac[crypto_auth_BYTES], const void *data, size_t len ) {
+        crypto_auth_hmacsha512256_state state;
+        server_mac_init( keys, &state );
+        crypto_auth_hmacsha512256_update( &state, (const unsigned char*)data, len );
+        crypto_auth_hmacsha512256_final( &state, mac );
+        sqrl_memzero( &state, sizeof( state ) );
+    }
+
     void SqrlServer::addMAC( SqrlString *str, char sep ) {
-        if( !str ) return;
+        if( !str || !this->keys ) return;
         uint8_t mac[crypto_auth_BYTES];
+        char macStr[SQRL_SERVER_B64_16];
 
-        crypto_auth( mac, (unsigned char *)str->data(), str->length(), this->key );
+        server_mac( this->keys, mac, str->data(), str->length() );
         if( sep > 0 ) {
             str->push_back( sep );
-            str->append( "mac=" );
-        } else {
-            str->append( "mac=" );
         }
-        SqrlString m = SqrlString( mac, SQRL_SERVER_MAC_LENGTH );
-        SqrlBase64().encode( str, &m, true );
+        str->append( "mac=", 4 );
+        server_b64_encode( macStr, mac, SQRL_SERVER_MAC_LENGTH );
+        str->append( macStr, SQRL_SERVER_B64_16 );
     }
 
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Checks the MAC on a link or reply this server issued.</summary>
+    ///
+    /// <remarks>The MAC is always the last thing in the string: "mac=" and 22 characters, after an
+    /// '&amp;' in a link.  So it is looked for there, rather than searched for.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
     bool SqrlServer::verifyMAC( SqrlString *str ) {
-        if( !str ) return false;
-        size_t len = 0;
+        if( !str || !this->keys ) return false;
         const char *cstr = str->cstring();
+        size_t len = str->length();
+        if( len < 4 + SQRL_SERVER_B64_16 ) return false;
+        const char *m = cstr + len - SQRL_SERVER_B64_16;
+        if( 0 != memcmp( m - 4, "mac=", 4 ) ) return false;
+        len -= 4 + SQRL_SERVER_B64_16;
+        if( len && cstr[len - 1] == '&' ) len--;
+
+        uint8_t given[SQRL_SERVER_MAC_LENGTH];
+        if( !server_b64_decode_exact( given, SQRL_SERVER_MAC_LENGTH, m, SQRL_SERVER_B64_16 ) ) {
+            return false;
+        }
+        uint8_t mac[crypto_auth_BYTES];
+        server_mac( this->keys, mac, cstr, len );
+        return 0 == sodium_memcmp( mac, given, SQRL_SERVER_MAC_LENGTH );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Creates a link (challenge URL with a fresh nut and MAC) for one client.</summary>
+    ///
+    /// <param name="ip">The client's IP address.</param>
+    ///
+    /// <returns>A new SqrlString holding the link, or NULL on failure.  The caller deletes it.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    SqrlString *SqrlServer::createLink( uint32_t ip ) {
+        SqrlString *retVal = new SqrlString();
+        size_t offsets[2];
+        if( 1 != this->createLinks( &ip, 1, retVal, offsets ) ) {
+            delete retVal;
+            return NULL;
+        }
+        return retVal;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Creates links for many clients at once.</summary>
+    ///
+    /// <remarks>
+    /// The challenge template is split once, nuts are encrypted back to back (four blocks at a time
+    /// with AES-NI), and every MAC resumes from an HMAC state that has already absorbed the common
+    /// prefix.  All links are written to one buffer, reserved up front.  Each link is identical to
+    /// what createLink() would produce for the same nut.</remarks>
+    ///
+    /// <param name="ips">	  The client IP addresses.</param>
+    /// <param name="n">	  The number of links to create.</param>
+    /// <param name="links">  [out] Receives the links, back to back.  Cleared first.</param>
+    /// <param name="offsets">[out] n + 1 entries: link i is links->cdata() + offsets[i], ending at
+    /// 					  offsets[i + 1].</param>
+    ///
+    /// <returns>The number of links created: n, or 0 on failure.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    size_t SqrlServer::createLinks( const uint32_t *ips, size_t n, SqrlString *links, size_t *offsets ) {
+        if( !ips || !links || !offsets || !this->uri || !this->keys ) return 0;
+        links->clear();
+        offsets[0] = 0;
+        if( n == 0 ) return 0;
+
+        SqrlString challenge = SqrlString();
+        this->uri->getChallenge( &challenge );
+        const char *tpl = challenge.cstring();
+        const char *p = strstr( tpl, SQRL_SERVER_TOKEN_NUT );
+        if( !p ) return 0;
+        size_t prefixLen = p - tpl;
+        const char *suffix = p + strlen( SQRL_SERVER_TOKEN_NUT );
+        size_t suffixLen = challenge.length() - (suffix - tpl);
+        links->reserve( n * (prefixLen + suffixLen + 2 * SQRL_SERVER_B64_16 + 5) + 1 );
+
+        crypto_auth_hmacsha512256_state prefixState, state;
+        server_mac_init( this->keys, &prefixState );
+        crypto_auth_hmacsha512256_update( &prefixState, (const unsigned char*)tpl, prefixLen );
+
+        Sqrl_Nut nuts[SQRL_SERVER_LINK_BATCH];
+        uint32_t random[SQRL_SERVER_LINK_BATCH];
+        uint8_t mac[crypto_auth_BYTES];
+        char nutStr[SQRL_SERVER_B64_16], macStr[SQRL_SERVER_B64_16];
+        uint64_t timestamp = sqrl_get_timestamp();
+        size_t done, i, cnt;
+
+        for( done = 0; done < n; done += cnt ) {
+            cnt = n - done < SQRL_SERVER_LINK_BATCH ? n - done : SQRL_SERVER_LINK_BATCH;
+            sqrl_randombytes( random, cnt * sizeof( uint32_t ) );
+            for( i = 0; i < cnt; i++ ) {
+                nuts[i].ip = ips[done + i];
+                nuts[i].random = random[i];
+                nuts[i].timestamp = timestamp;
+            }
+#if defined(SQRL_X86)
+            if( this->keys->aesni ) {
+                aesni_encrypt_blocks( &this->keys->aesniEnc, (unsigned char*)nuts, (unsigned char*)nuts, cnt );
+            } else
+#endif
+            {
+                for( i = 0; i < cnt; i++ ) {
+                    aes_cipher( &this->keys->enc, (unsigned char*)&nuts[i], (unsigned char*)&nuts[i] );
+                }
+            }
+
+            for( i = 0; i < cnt; i++ ) {
+                server_b64_encode( nutStr, (uint8_t*)&nuts[i], sizeof( Sqrl_Nut ) );
+                memcpy( &state, &prefixState, sizeof( state ) );
+                crypto_auth_hmacsha512256_update( &state, (const unsigned char*)nutStr, SQRL_SERVER_B64_16 );
+                crypto_auth_hmacsha512256_update( &state, (const unsigned char*)suffix, suffixLen );
+                crypto_auth_hmacsha512256_final( &state, mac );
+                server_b64_encode( macStr, mac, SQRL_SERVER_MAC_LENGTH );
+
+                links->append( tpl, prefixLen );
+                links->append( nutStr, SQRL_SERVER_B64_16 );
+                links->append( suffix, suffixLen );
+                links->append( "&mac=", 5 );
+                links->append( macStr, SQRL_SERVER_B64_16 );
+                offsets[done + i + 1] = links->length();
+            }
+        }
+        sqrl_memzero( &prefixState, sizeof( prefixState ) );
+        sqrl_memzero( &state, sizeof( state ) );
+        sqrl_memzero( mac, sizeof( mac ) );
+        return n;
+    }
+
+    /// <summary>Gets a view's bytes within the buffer it was parsed from.</summary>
+    static inline const char *server_view( const char *base, const struct Sqrl_Kv_View *view ) {
+        return base + view->offset;
+    }
+
+    /// <summary>Gets the idk or pidk the client sent, as text for the callbacks; NULL if it sent none.
+    /// A pidk only counts if the client proved it holds the key, with pids.</summary>
+    const SqrlString *SqrlServer::getClientKey( SqrlServerRequest *request, int kv ) {
+        if( !FLAG_CHECK( request->clientFound, (1 << kv) ) ) return NULL;
+        if( kv == CLIENT_KV_PIDK && !FLAG_CHECK( request->flags, SQRL_SERVER_CONTEXT_FLAG_VALID_PIDS ) ) return NULL;
+        return kv == CLIENT_KV_IDK ? &request->idkText : &request->pidkText;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Handles a query from a SQRL client, replying through onSend().</summary>
+    ///
+    /// <remarks>Thread safe: uses a request context on the stack.</remarks>
+    ///
+    /// <param name="client_ip">The client's IP address.</param>
+    /// <param name="query">	The body of the client's POST.</param>
+    /// <param name="query_len">Length of the query.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlServer::handleQuery( uint32_t client_ip, const char *query, size_t query_len ) {
+        SqrlServerRequest request( client_ip );
+        this->handleQuery( &request, query, query_len );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Handles a query from a SQRL client, using the caller's request context.</summary>
+    ///
+    /// <remarks>
+    /// The request must not be in use by another thread.  It holds the outcome afterwards (tif, user,
+    /// reply), and can be reset() and reused.</remarks>
+    ///
+    /// <param name="request">  The request context.</param>
+    /// <param name="query">	The body of the client's POST.</param>
+    /// <param name="query_len">Length of the query.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlServer::handleQuery( SqrlServerRequest *request, const char *query, size_t query_len ) {
+        this->startQuery( request, query, query_len, false );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Handles a query from a SQRL client, without waiting on the user store.</summary>
+    ///
+    /// <remarks>
+    /// The query is parsed and its signatures checked on the calling thread.  Each user store call is
+    /// then made through onUserAsync(), and the query is suspended until the store answers with
+    /// resumeQuery(); the rest of the query, up to and including onSend(), runs on whichever thread
+    /// resumes it.  This may return before onSend() has been called.
+    ///
+    /// Until onSend(), the request and the query buffer belong to the server: neither may be
+    /// touched, moved or freed.</remarks>
+    ///
+    /// <param name="request">  The request context.</param>
+    /// <param name="query">	The body of the client's POST.</param>
+    /// <param name="query_len">Length of the query.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlServer::handleQueryAsync( SqrlServerRequest *request, const char *query, size_t query_len ) {
+        this->startQuery( request, query, query_len, true );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Continues a query suspended in onUserAsync(), with the store's answer.</summary>
+    ///
+    /// <remarks>
+    /// Call exactly once for each onUserAsync() call, from any thread; possibly before
+    /// onUserAsync() has returned.  The query continues on the calling thread, which may make the
+    /// next onUserAsync() call and the onSend() call before this returns.</remarks>
+    ///
+    /// <param name="request">The suspended request.</param>
+    /// <param name="result"> What the matching synchronous callback would have returned.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlServer::resumeQuery( SqrlServerRequest *request, bool result ) {
+        request->userResult = result;
+        // Whoever comes second carries on: the thread still inside onUserAsync(), or this one.
+        if( request->resumeState.exchange( QUERY_RESUME_DONE ) == QUERY_RESUME_SUSPENDED ) {
+            this->advanceQuery( request, result );
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Makes one user store call without blocking.  The default makes the matching
+    /// synchronous callback, and resumes at once.</summary>
+    ///
+    /// <remarks>
+    /// Override to hand the call to a store that answers later, then call resumeQuery() with its
+    /// result.  The store reports a found user with request->setUser(), as from onUserFind().  The
+    /// strings stay valid until the query is resumed.</remarks>
+    ///
+    /// <param name="request">The request.</param>
+    /// <param name="op">	  Which call: SQRL_SERVER_USER_*.</param>
+    /// <param name="host">   As for the synchronous callbacks.</param>
+    /// <param name="idk">	  As for the synchronous callbacks.</param>
+    /// <param name="pidk">   As for the synchronous callbacks.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlServer::onUserAsync( SqrlServerRequest *request, int op, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) {
+        this->resumeQuery( request, this->callUser( request, op, host, idk, pidk ) );
+    }
+
+    /// <summary>Makes the synchronous callback for a user store call.</summary>
+    bool SqrlServer::callUser( SqrlServerRequest *request, int op, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) {
+        switch( op ) {
+        case SQRL_SERVER_USER_FIND:
+            return this->onUserFind( request, host, idk, pidk );
+        case SQRL_SERVER_USER_CREATE:
+            return this->onUserCreate( request, host, idk, pidk );
+        case SQRL_SERVER_USER_UPDATE:
+            return this->onUserUpdate( request, host, idk, pidk );
+        case SQRL_SERVER_USER_DELETE:
+            return this->onUserDelete( request, host, idk, pidk );
+        case SQRL_SERVER_USER_REKEYED:
+            return this->onUserRekeyed( request, host, idk, pidk );
+        case SQRL_SERVER_USER_IDENTIFIED:
+            return this->onUserIdentified( request, host, idk, pidk );
+        }
+        return false;
+    }
+
+    void SqrlServer::startQuery( SqrlServerRequest *request, const char *query, size_t query_len, bool async ) {
+        if( !request || !query ) return;
+        request->async = async;
+        request->host.clear();
+        if( this->uri ) this->uri->getSiteKey( &request->host );
+
+        // Signatures are all checked by now, so the request leaves its batch before any store call.
+        if( this->sigBatch ) this->sigBatch->enter();
+        bool parsed = this->parseQuery( request, query, query_len );
+        if( this->sigBatch ) this->sigBatch->leave();
+
+        request->step = parsed ? QUERY_STEP_FIND_IDK : QUERY_STEP_CHECKED;
+        this->advanceQuery( request, false );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Runs a query from its current step until it is answered, or suspended on the store.
+    /// </summary>
+    ///
+    /// <remarks>
+    /// Each step that needs the store names the step to continue at, and makes the call: directly
+    /// for handleQuery(), or through onUserAsync() for handleQueryAsync().  'result' is the answer to
+    /// the last call.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlServer::advanceQuery( SqrlServerRequest *request, bool result ) {
+        const SqrlString *host = &request->host;
+        const SqrlString *idk = this->getClientKey( request, CLIENT_KV_IDK );
+        const SqrlString *pidk = this->getClientKey( request, CLIENT_KV_PIDK );
+
+        for( ;; ) {
+            int op;
+            int next;
+            const SqrlString *key = idk;
+            const SqrlString *previous = NULL;
+
+            switch( request->step ) {
+            case QUERY_STEP_FIND_IDK:
+                if( !idk ) {
+                    request->step = QUERY_STEP_CHECKED;
+                    continue;
+                }
+                op = SQRL_SERVER_USER_FIND;
+                next = QUERY_STEP_FOUND_IDK;
+                break;
+            case QUERY_STEP_FOUND_IDK:
+                if( this->foundUser( request, result ) ) {
+                    FLAG_SET( request->tif, SQRL_TIF_ID_MATCH );
+                    if( request->command == SQRL_SERVER_CMD_ENABLE ||
+                        request->command == SQRL_SERVER_CMD_REMOVE ) {
+                        if( !this->verifyUrs( request ) ) {
+                            FLAG_CLEAR( request->flags, SQRL_SERVER_CONTEXT_FLAG_VALID_QUERY );
+                            FLAG_SET( request->tif, SQRL_TIF_CLIENT_FAILURE );
+                        }
+                    }
+                    request->step = QUERY_STEP_CHECKED;
+                    continue;
+                }
+                if( !pidk ) {
+                    request->step = QUERY_STEP_CHECKED;
+                    continue;
+                }
+                op = SQRL_SERVER_USER_FIND;
+                key = pidk;
+                next = QUERY_STEP_FOUND_PIDK;
+                break;
+            case QUERY_STEP_FOUND_PIDK:
+                if( this->foundUser( request, result ) ) {
+                    FLAG_SET( request->tif, SQRL_TIF_PREVIOUS_ID_MATCH );
+                    this->addUserSuk( request );
+                    if( FLAG_CHECK( request->contextFound, (1 << CONTEXT_KV_URS) ) && !this->verifyUrs( request ) ) {
+                        FLAG_CLEAR( request->flags, SQRL_SERVER_CONTEXT_FLAG_VALID_QUERY );
+                        FLAG_SET( request->tif, SQRL_TIF_CLIENT_FAILURE );
+                    }
+                }
+                request->step = QUERY_STEP_CHECKED;
+                continue;
+            case QUERY_STEP_CHECKED:
+                if( FLAG_CHECK( request->flags, SQRL_SERVER_CONTEXT_FLAG_VALID_QUERY ) ) {
+                    if( request->userFound && FLAG_CHECK( request->userFlags, SQRL_SERVER_USER_FLAG_DISABLED ) ) {
+                        FLAG_SET( request->tif, SQRL_TIF_SQRL_DISABLED );
+                        this->addUserSuk( request );
+                    }
+                    request->step = this->startCommand( request );
+                } else {
+                    FLAG_SET( request->tif, SQRL_TIF_COMMAND_FAILURE );
+                    request->step = QUERY_STEP_REPLY;
+                }
+                continue;
+            case QUERY_STEP_DELETE:
+                op = SQRL_SERVER_USER_DELETE;
+                next = QUERY_STEP_DELETED;
+                break;
+            case QUERY_STEP_DELETED:
+                if( !result ) {
+                    request->step = QUERY_STEP_FAILED;
+                    continue;
+                }
+                FLAG_CLEAR( request->tif, SQRL_TIF_ID_MATCH | SQRL_TIF_PREVIOUS_ID_MATCH );
+                request->step = QUERY_STEP_REPLY;
+                continue;
+            case QUERY_STEP_ENABLE:
+            case QUERY_STEP_DISABLE:
+                op = SQRL_SERVER_USER_UPDATE;
+                next = request->step + 1;
+                break;
+            case QUERY_STEP_ENABLED:
+            case QUERY_STEP_DISABLED:
+                if( !result ) {
+                    request->step = QUERY_STEP_FAILED;
+                    continue;
+                }
+                if( request->step == QUERY_STEP_ENABLED ) {
+                    FLAG_CLEAR( request->tif, SQRL_TIF_SQRL_DISABLED );
+                } else {
+                    FLAG_SET( request->tif, SQRL_TIF_SQRL_DISABLED );
+                }
+                request->step = QUERY_STEP_REPLY;
+                continue;
+            case QUERY_STEP_REKEY:
+            case QUERY_STEP_IDENT_REKEY:
+                op = SQRL_SERVER_USER_REKEYED;
+                previous = pidk;
+                next = request->step + 1;
+                break;
+            case QUERY_STEP_REKEYED:
+            case QUERY_STEP_IDENT_REKEYED:
+                if( !result ) {
+                    request->step = QUERY_STEP_FAILED;
+                    continue;
+                }
+                FLAG_CLEAR( request->tif, SQRL_TIF_SQRL_DISABLED | SQRL_TIF_PREVIOUS_ID_MATCH );
+                FLAG_SET( request->tif, SQRL_TIF_ID_MATCH );
+                request->step = request->step == QUERY_STEP_REKEYED ? QUERY_STEP_REPLY : QUERY_STEP_IDENTIFY;
+                continue;
+            case QUERY_STEP_CREATE:
+                op = SQRL_SERVER_USER_CREATE;
+                next = QUERY_STEP_CREATED;
+                break;
+            case QUERY_STEP_CREATED:
+                if( !result ) {
+                    request->step = QUERY_STEP_FAILED;
+                    continue;
+                }
+                request->step = QUERY_STEP_IDENTIFY;
+                continue;
+            case QUERY_STEP_IDENTIFY:
+                op = SQRL_SERVER_USER_IDENTIFIED;
+                next = QUERY_STEP_IDENTIFIED;
+                break;
+            case QUERY_STEP_IDENTIFIED:
+                FLAG_SET( request->tif, SQRL_TIF_ID_MATCH );
+                request->step = QUERY_STEP_REPLY;
+                continue;
+            case QUERY_STEP_FAILED:
+                FLAG_SET( request->tif, SQRL_TIF_COMMAND_FAILURE );
+                request->step = QUERY_STEP_REPLY;
+                continue;
+            default:
+                request->step = QUERY_STEP_DONE;
+                this->buildReply( request );
+                this->onSend( request, &request->reply );
+                return;
+            }
+
+            request->step = next;
+            if( !request->async ) {
+                result = this->callUser( request, op, host, key, previous );
+                continue;
+            }
+            request->resumeState.store( QUERY_RESUME_WAITING );
+            this->onUserAsync( request, op, host, key, previous );
+            // A store that answered within onUserAsync() leaves this thread to carry on.
+            if( request->resumeState.exchange( QUERY_RESUME_SUSPENDED ) != QUERY_RESUME_DONE ) return;
+            result = request->userResult;
+        }
+    }
 
-        const char *m = strstr( cstr, "&mac=" );
-        if( m ) {
-            len = m - cstr;
-            m += 5;
+    bool SqrlServer::parseQuery( SqrlServerRequest *request, const char *query, size_t query_len ) {
+        int required = (1 << CONTEXT_KV_SERVER) | (1 << CONTEXT_KV_CLIENT) | (1 << CONTEXT_KV_IDS);
+        FLAG_CLEAR( request->flags, SQRL_SERVER_CONTEXT_FLAG_VALID_QUERY );
+        request->query = query;
+        int found = request->contextFound = server_split_query( query, query_len, request->context );
+        if( required == (found & required) &&
+            this->verifyServerString( request ) &&
+            this->verifySignatures( request ) ) {
+            // Only a fully verified query uses up its nut, so nobody can burn a nut they've merely seen.
+            if( this->nutCache && !this->nutCache->add( &request->nut ) ) {
+                FLAG_SET( request->tif, SQRL_TIF_TRANSIENT_ERR | SQRL_TIF_COMMAND_FAILURE );
+                return false;
+            }
+            FLAG_SET( request->flags, SQRL_SERVER_CONTEXT_FLAG_VALID_QUERY );
+            return true;
+        }
+        return false;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Gets the replay filter, for its counters.</summary>
+    ///
+    /// <remarks>Sized for SQRL_NUT_CACHE_DEFAULT_CAPACITY nuts per nut lifetime.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    SqrlNutCache *SqrlServer::getNutCache() {
+        return this->nutCache;
+    }
+
+    /// <summary>Gets the signature batcher, for its counters; NULL unless setSignatureBatching() was
+    /// called.</summary>
+    SqrlSignatureBatch *SqrlServer::getSignatureBatch() {
+        return this->sigBatch;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Sets how signatures from concurrent requests are batched.  Call before handling any
+    /// queries.</summary>
+    ///
+    /// <remarks>
+    /// Off by default, when each signature is verified on its own, with libsodium's answer.  Batching
+    /// is much faster under load, but cofactored: it also accepts signatures whose R or key has a
+    /// small order component, which only the key's owner can make (see ed25519_verify_batch()).
+    /// Either way, the answers are the same on every platform.</remarks>
+    ///
+    /// <param name="maxBatch">The most signatures to verify together; 0 verifies each one alone.</param>
+    /// <param name="maxWait"> The longest a request waits for others to join its batch, in
+    /// 					   microseconds.  0 batches only a request's own signatures.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlServer::setSignatureBatching( size_t maxBatch, uint32_t maxWait ) {
+        if( this->sigBatch ) delete this->sigBatch;
+        this->sigBatch = maxBatch ? new SqrlSignatureBatch( maxBatch, maxWait ) : NULL;
+        if( this->sigBatch ) this->sigBatch->setKeyCache( this->keyCache );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Gets the decoded public key cache, for its counters.</summary>
+    ///
+    /// <remarks>A low hit rate with many evictions means the cache is too small for the number of
+    /// users signing in; see setKeyCacheCapacity().</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    SqrlKeyCache *SqrlServer::getKeyCache() {
+        return this->keyCache;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Replaces the decoded public key cache with an empty one.  Call before handling any
+    /// queries.</summary>
+    ///
+    /// <param name="capacity">The most keys to remember; 0 decodes every key afresh.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlServer::setKeyCacheCapacity( size_t capacity ) {
+        if( this->keyCache ) delete this->keyCache;
+        this->keyCache = capacity ? new SqrlKeyCache( capacity ) : NULL;
+        if( this->sigBatch ) this->sigBatch->setKeyCache( this->keyCache );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Replaces the replay filter with one shared by every process that opens the same name.
+    /// </summary>
+    ///
+    /// <remarks>
+    /// For several server processes on one machine sharing a passcode, so that a nut used against one
+    /// can't be replayed against another.  Call before handling any queries.  See
+    /// SqrlNutCache::openShared().</remarks>
+    ///
+    /// <param name="name">	   The shared memory segment name, such as "/sqrl-nuts".</param>
+    /// <param name="capacity">The most nuts expected to be used within one nut lifetime, across all
+    /// 					   processes.</param>
+    ///
+    /// <returns>true on success; on failure the server keeps its private cache.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlServer::useSharedNutCache( const char *name, size_t capacity ) {
+        SqrlNutCache *cache = SqrlNutCache::openShared( name, this->nut_expires, capacity );
+        if( !cache ) return false;
+        if( this->nutCache ) delete this->nutCache;
+        this->nutCache = cache;
+        return true;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Checks the MAC on the server string the client echoed back, and recovers its nut.</summary>
+    ///
+    /// <remarks>The server string is either our original link, or our previous reply.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlServer::verifyServerString( SqrlServerRequest *request ) {
+        bool ok = false;
+        SqrlString *srv = &request->serverText;
+        const struct Sqrl_Kv_View *v = &request->context[CONTEXT_KV_SERVER];
+        struct Sqrl_Kv_View nut;
+        if( server_b64_decode( srv, server_view( request->query, v ), v->length ) &&
+            this->verifyMAC( srv ) &&
+            server_find_value( srv->cstring(), srv->length(), "nut", &nut ) ) {
+            ok = server_b64_decode_exact( (uint8_t*)&request->nut, sizeof( Sqrl_Nut ),
+                server_view( srv->cstring(), &nut ), nut.length ) &&
+                this->decryptNut( &request->nut ) &&
+                this->verifyNut( request );
+        }
+        if( ok ) {
+            FLAG_SET( request->flags, SQRL_SERVER_CONTEXT_FLAG_VALID_SERVER_STRING );
         } else {
-            m = strstr( cstr, "mac=" );
-            if( m ) {
-                len = m - cstr;
-                m += 4;
-            }
-        }
-        if( m ) {
-            uint8_t mac[crypto_auth_BYTES];
-            crypto_auth( mac, (unsigned char *)cstr, len, this->key );
-            SqrlString *v = SqrlBase64().decode( NULL, &(SqrlString( m )) );
-            if( v ) {
-                if( 0 == memcmp( mac, v->data(), SQRL_SERVER_MAC_LENGTH ) ) {
-                    delete v;
-                    return true;
+            FLAG_SET( request->tif, SQRL_TIF_COMMAND_FAILURE | SQRL_TIF_CLIENT_FAILURE );
+        }
+        return ok;
+    }
+
+    bool SqrlServer::verifyNut( SqrlServerRequest *request ) {
+        if( request->clientIp == request->nut.ip ) {
+            FLAG_SET( request->tif, SQRL_TIF_IP_MATCH );
+        }
+        int64_t diff = (int64_t)(sqrl_get_timestamp() - request->nut.timestamp);
+        if( diff < 0 || diff > (int64_t)this->nut_expires ) {
+            FLAG_SET( request->tif, SQRL_TIF_TRANSIENT_ERR );
+            return false;
+        }
+        return true;
+    }
+
+    bool SqrlServer::parseClient( SqrlServerRequest *request ) {
+        int required = (1 << CLIENT_KV_VER) | (1 << CLIENT_KV_CMD) | (1 << CLIENT_KV_IDK);
+        int found = 0;
+        SqrlString *cli = &request->clientText;
+        const struct Sqrl_Kv_View *v = &request->context[CONTEXT_KV_CLIENT];
+        if( server_b64_decode( cli, server_view( request->query, v ), v->length ) ) {
+            found = server_split_client( cli->cstring(), cli->length(), request->client );
+        }
+        request->clientFound = found;
+        if( required == (found & required) ) {
+            const struct Sqrl_Kv_View *cmd = &request->client[CLIENT_KV_CMD];
+            request->command = server_find_command( server_view( cli->cstring(), cmd ), cmd->length );
+            for( int kv = CLIENT_KV_IDK; kv <= CLIENT_KV_PIDK; kv++ ) {
+                if( FLAG_CHECK( found, (1 << kv) ) ) {
+                    SqrlString *text = kv == CLIENT_KV_IDK ? &request->idkText : &request->pidkText;
+                    text->clear();
+                    text->append( server_view( cli->cstring(), &request->client[kv] ), request->client[kv].length );
                 }
-                delete v;
             }
+            FLAG_SET( request->flags, SQRL_SERVER_CONTEXT_FLAG_VALID_CLIENT_STRING );
+            return true;
         }
+        FLAG_SET( request->tif, SQRL_TIF_COMMAND_FAILURE | SQRL_TIF_CLIENT_FAILURE );
         return false;
     }
 
-    SqrlString *SqrlServer::createLink( uint32_t ip ) {
-        SqrlString *retVal = NULL;
+    /// <summary>Decodes a signature from the query, and a public key from the client string.</summary>
+    bool SqrlServer::decodeSignature( SqrlServerRequest *request, int sigKv, int keyKv, uint8_t *sig, uint8_t *key ) {
+        if( !FLAG_CHECK( request->contextFound, (1 << sigKv) ) ||
+            !FLAG_CHECK( request->clientFound, (1 << keyKv) ) ) return false;
+        const struct Sqrl_Kv_View *s = &request->context[sigKv];
+        const struct Sqrl_Kv_View *k = &request->client[keyKv];
+        return server_b64_decode_exact( sig, SQRL_SIG_SIZE, server_view( request->query, s ), s->length ) &&
+            server_b64_decode_exact( key, SQRL_KEY_SIZE, server_view( request->clientText.cstring(), k ), k->length );
+    }
+
+    bool SqrlServer::verifySignatures( SqrlServerRequest *request ) {
+        if( !this->parseClient( request ) ) return false;
+        // The signed message is the client and server strings, as sent.
+        SqrlString *msg = &request->signedText;
+        const struct Sqrl_Kv_View *cv = &request->context[CONTEXT_KV_CLIENT];
+        const struct Sqrl_Kv_View *sv = &request->context[CONTEXT_KV_SERVER];
+        msg->clear();
+        msg->append( server_view( request->query, cv ), cv->length );
+        msg->append( server_view( request->query, sv ), sv->length );
+
+        // ids and pids are checked together, and alongside other requests' when the server is busy.
+        uint8_t sigs[2][SQRL_SIG_SIZE];
+        uint8_t keys[2][SQRL_KEY_SIZE];
+        struct Sqrl_Signature_Job jobs[2];
+        size_t n = 1;
+        bool ok = this->decodeSignature( request, CONTEXT_KV_IDS, CLIENT_KV_IDK, sigs[0], keys[0] );
+        if( ok && FLAG_CHECK( request->contextFound, (1 << CONTEXT_KV_PIDS) ) ) {
+            ok = this->decodeSignature( request, CONTEXT_KV_PIDS, CLIENT_KV_PIDK, sigs[1], keys[1] );
+            n = 2;
+        }
+        for( size_t i = 0; i < n; i++ ) {
+            jobs[i].msg = msg;
+            jobs[i].sig = sigs[i];
+            jobs[i].pub = keys[i];
+            jobs[i].valid = false;
+        }
+        if( ok ) {
+            if( this->sigBatch ) {
+                this->sigBatch->verify( jobs, n );
+            } else {
+                for( size_t i = 0; i < n; i++ ) {
+                    jobs[i].valid = SqrlCrypt::verifySignature( jobs[i].msg, jobs[i].sig, jobs[i].pub, this->keyCache );
+                }
+            }
+        }
+        if( !ok || !jobs[0].valid || (n == 2 && !jobs[1].valid) ) {
+            FLAG_SET( request->tif, SQRL_TIF_COMMAND_FAILURE | SQRL_TIF_CLIENT_FAILURE );
+            return false;
+        }
+        FLAG_SET( request->flags, SQRL_SERVER_CONTEXT_FLAG_VALID_IDS );
+        if( n == 2 ) FLAG_SET( request->flags, SQRL_SERVER_CONTEXT_FLAG_VALID_PIDS );
+        return true;
+    }
+
+    /// <summary>Verifies the unlock request signature against the stored user's VUK.</summary>
+    bool SqrlServer::verifyUrs( SqrlServerRequest *request ) {
+        if( !FLAG_CHECK( request->contextFound, (1 << CONTEXT_KV_URS) ) || !request->userFound ) return false;
+        uint8_t sig[SQRL_SIG_SIZE];
+        const struct Sqrl_Kv_View *v = &request->context[CONTEXT_KV_URS];
+        if( !server_b64_decode_exact( sig, SQRL_SIG_SIZE, server_view( request->query, v ), v->length ) ) return false;
+        if( SqrlCrypt::verifySignature( &request->signedText, sig, request->vuk, this->keyCache ) ) {
+            FLAG_SET( request->flags, SQRL_SERVER_CONTEXT_FLAG_VALID_URS );
+            return true;
+        }
+        return false;
+    }
+
+    /// <summary>Records the answer to onUserFind(); the user, if found, was given with setUser().</summary>
+    bool SqrlServer::foundUser( SqrlServerRequest *request, bool found ) {
+        request->userFound = found;
+        if( found && FLAG_CHECK( request->userFlags, SQRL_SERVER_USER_FLAG_DISABLED ) ) {
+            FLAG_SET( request->tif, SQRL_TIF_SQRL_DISABLED );
+        }
+        return found;
+    }
+
+    bool SqrlServer::decodeClientKey( SqrlServerRequest *request, int kv, uint8_t *key ) {
+        if( !FLAG_CHECK( request->clientFound, (1 << kv) ) ) return false;
+        const struct Sqrl_Kv_View *v = &request->client[kv];
+        return server_b64_decode_exact( key, SQRL_KEY_SIZE, server_view( request->clientText.cstring(), v ), v->length );
+    }
+
+    /// <summary>Asks for the user's suk to be sent with the reply.  It is encoded as the reply is
+    /// written.</summary>
+    void SqrlServer::addUserSuk( SqrlServerRequest *request ) {
+        if( !request->userFound ) return;
+        FLAG_SET( request->flags, SQRL_SERVER_CONTEXT_FLAG_SEND_SUK );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Starts the client's command, once the query and user have been validated.</summary>
+    ///
+    /// <returns>The step to continue at: the first store call the command needs, or the reply.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    int SqrlServer::startCommand( SqrlServerRequest *request ) {
+        switch( request->command ) {
+        case SQRL_SERVER_CMD_QUERY:
+            return QUERY_STEP_REPLY;
+        case SQRL_SERVER_CMD_REMOVE:
+            if( FLAG_CHECK( request->tif, SQRL_TIF_ID_MATCH ) ) return QUERY_STEP_DELETE;
+            break;
+        case SQRL_SERVER_CMD_ENABLE:
+            if( request->userFound && FLAG_CHECK( request->tif, SQRL_TIF_ID_MATCH ) ) {
+                FLAG_CLEAR( request->userFlags, SQRL_SERVER_USER_FLAG_DISABLED );
+                return QUERY_STEP_ENABLE;
+            } else if( request->userFound && FLAG_CHECK( request->tif, SQRL_TIF_PREVIOUS_ID_MATCH ) ) {
+                FLAG_CLEAR( request->userFlags, SQRL_SERVER_USER_FLAG_DISABLED );
+                return QUERY_STEP_REKEY;
+            }
+            break;
+        case SQRL_SERVER_CMD_DISABLE:
+            if( request->userFound && FLAG_CHECK( request->tif, SQRL_TIF_ID_MATCH ) ) {
+                FLAG_SET( request->userFlags, SQRL_SERVER_USER_FLAG_DISABLED );
+                return QUERY_STEP_DISABLE;
+            }
+            break;
+        case SQRL_SERVER_CMD_IDENT:
+            if( FLAG_CHECK( request->tif, SQRL_TIF_ID_MATCH ) ) {
+                if( FLAG_CHECK( request->tif, SQRL_TIF_SQRL_DISABLED ) ) break;
+                return QUERY_STEP_IDENTIFY;
+            }
+            if( FLAG_CHECK( request->tif, SQRL_TIF_PREVIOUS_ID_MATCH ) ) {
+                if( FLAG_CHECK( request->tif, SQRL_TIF_SQRL_DISABLED ) ) break;
+                if( !this->decodeClientKey( request, CLIENT_KV_IDK, request->idk ) ||
+                    !this->decodeClientKey( request, CLIENT_KV_SUK, request->suk ) ||
+                    !this->decodeClientKey( request, CLIENT_KV_VUK, request->vuk ) ) break;
+                return QUERY_STEP_IDENT_REKEY;
+            }
+            // New user.
+            if( this->decodeClientKey( request, CLIENT_KV_IDK, request->idk ) &&
+                this->decodeClientKey( request, CLIENT_KV_SUK, request->suk ) &&
+                this->decodeClientKey( request, CLIENT_KV_VUK, request->vuk ) ) {
+                request->userFlags = 0;
+                request->userFound = true;
+                return QUERY_STEP_CREATE;
+            }
+            break;
+        default:
+            FLAG_SET( request->tif, SQRL_TIF_FUNCTION_NOT_SUPPORTED );
+            return QUERY_STEP_REPLY;
+        }
+        return QUERY_STEP_FAILED;
+    }
+
+#define SQRL_SERVER_REPLY_VER "ver=" SQRL_VERSION_STRING "\r\n"
+#define SQRL_SERVER_REPLY_NUT_LENGTH (4 + SQRL_SERVER_B64_16 + 2)
+#define SQRL_SERVER_REPLY_TIF_LENGTH (4 + 2 * sizeof( Sqrl_Tif ) + 2)
+#define SQRL_SERVER_REPLY_MAC_LENGTH (4 + SQRL_SERVER_B64_16)
+
+    static inline char *server_put( char *p, const char *str, size_t len ) {
+        memcpy( p, str, len );
+        return p + len;
+    }
+
+    /// <summary>Writes 'v' as upper case hex without leading zeros, as printf's "%X" would.</summary>
+    static char *server_put_hex( char *p, Sqrl_Tif v ) {
+        static const char hex[] = "0123456789ABCDEF";
+        int shift = (int)(sizeof( Sqrl_Tif ) * 8) - 4;
+        while( shift > 0 && !(v >> shift) ) shift -= 4;
+        for( ; shift >= 0; shift -= 4 ) {
+            *p++ = hex[(v >> shift) & 0xF];
+        }
+        return p;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Gets the most bytes writeReply() may need for a request's reply.</summary>
+    ///
+    /// <param name="request">The request, once handled.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    size_t SqrlServer::getReplyLength( const SqrlServerRequest *request ) {
+        if( !request ) return 0;
+        size_t len = sizeof( SQRL_SERVER_REPLY_VER ) - 1 + SQRL_SERVER_REPLY_NUT_LENGTH +
+            SQRL_SERVER_REPLY_TIF_LENGTH + this->replyQry->length() + SQRL_SERVER_REPLY_MAC_LENGTH;
+        for( int i = SERVER_KV_SUK; i < SERVER_KV_COUNT; i++ ) {
+            if( i == SERVER_KV_SUK && FLAG_CHECK( request->flags, SQRL_SERVER_CONTEXT_FLAG_SEND_SUK ) ) {
+                len += 4 + server_b64_encoded_length( SQRL_KEY_SIZE ) + 2;
+            } else if( request->server_strings[i] ) {
+                len += 4 + request->server_strings[i]->length() + 2;
+            }
+        }
+        return len;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Writes the reply to a request, with a fresh nut, into the caller's buffer.</summary>
+    ///
+    /// <remarks>
+    /// The reply is a template: the version line and the qry line are fixed when the server is
+    /// constructed, and only the nut, tif, and the optional suk, ask and url values are filled in
+    /// per request.  Doesn't allocate, and doesn't add a terminator.  The result is the same, byte
+    /// for byte, as formatting each line and then appending the MAC.</remarks>
+    ///
+    /// <param name="request">The request, once handled.</param>
+    /// <param name="buf">	  [out] Receives the reply.</param>
+    /// <param name="len">	  The size of 'buf'; at least getReplyLength( request ).</param>
+    ///
+    /// <returns>The length of the reply, or 0 if 'buf' is too small.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    size_t SqrlServer::writeReply( SqrlServerRequest *request, char *buf, size_t len ) {
+        static const char *serverKeys[SERVER_KV_COUNT] = {
+            "ver=", "nut=", "tif=", "qry=", "suk=", "ask=", "url="
+        };
+        if( !buf || !this->keys || len < this->getReplyLength( request ) ) return 0;
+        char *p = server_put( buf, SQRL_SERVER_REPLY_VER, sizeof( SQRL_SERVER_REPLY_VER ) - 1 );
+
+        // Keep the IP the original link was issued to.
+        uint32_t ip = FLAG_CHECK( request->flags, SQRL_SERVER_CONTEXT_FLAG_VALID_SERVER_STRING ) ?
+            request->nut.ip : request->clientIp;
         Sqrl_Nut nut;
         if( this->createNut( &nut, ip ) ) {
-            SqrlString challenge = SqrlString();
-            this->uri->getChallenge( &challenge );
-            char *p, *pp;
-            p = strstr( challenge.string(), SQRL_SERVER_TOKEN_NUT );
-            if( p ) {
-                retVal = new SqrlString( challenge.string(), p - challenge.string() );
-                SqrlString nutString( (uint8_t*)&nut, sizeof( Sqrl_Nut ) );
-                SqrlBase64().encode( retVal, &nutString, true );
-                pp = p + strlen( SQRL_SERVER_TOKEN_NUT );
-                retVal->append( pp );
-                this->addMAC( retVal, '&' );
+            p = server_put( p, serverKeys[SERVER_KV_NUT], 4 );
+            server_b64_encode( p, (const uint8_t*)&nut, sizeof( Sqrl_Nut ) );
+            p = server_put( p + SQRL_SERVER_B64_16, "\r\n", 2 );
+        }
+        p = server_put( p, serverKeys[SERVER_KV_TIF], 4 );
+        p = server_put_hex( p, request->tif );
+        p = server_put( p, "\r\n", 2 );
+        p = server_put( p, this->replyQry->cstring(), this->replyQry->length() );
+        for( int i = SERVER_KV_SUK; i < SERVER_KV_COUNT; i++ ) {
+            if( i == SERVER_KV_SUK && FLAG_CHECK( request->flags, SQRL_SERVER_CONTEXT_FLAG_SEND_SUK ) ) {
+                p = server_put( p, serverKeys[i], 4 );
+                p += server_b64_encode( p, request->suk, SQRL_KEY_SIZE );
+                p = server_put( p, "\r\n", 2 );
+            } else if( request->server_strings[i] ) {
+                p = server_put( p, serverKeys[i], 4 );
+                p = server_put( p, request->server_strings[i]->cstring(), request->server_strings[i]->length() );
+                p = server_put( p, "\r\n", 2 );
             }
         }
-        return retVal;
+
+        uint8_t mac[crypto_auth_BYTES];
+        server_mac( this->keys, mac, buf, p - buf );
+        p = server_put( p, "mac=", 4 );
+        server_b64_encode( p, mac, SQRL_SERVER_MAC_LENGTH );
+        p += SQRL_SERVER_B64_16;
+        return p - buf;
+    }
+
+    /// <summary>Builds the reply to the client, with a fresh nut, in request->reply.</summary>
+    void SqrlServer::buildReply( SqrlServerRequest *request ) {
+        SqrlString *reply = &request->reply;
+        size_t max = this->getReplyLength( request );
+
+        // Write straight into the request's buffer, which is kept from one request to the next.
+        reply->clear();
+        reply->append( '\0', max );
+        size_t len = this->writeReply( request, (char*)reply->data(), reply->length() );
+        reply->erase( len, reply->length() );
     }
 }
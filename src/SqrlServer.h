@@ -15,6 +15,7 @@
 namespace libsqrl
 {
 #define SQRL_DEFAULT_NUT_LIFE 60
+#define SQRL_NUT_CACHE_DEFAULT_CAPACITY 65536
 
 #define SQRL_SERVER_MAC_LENGTH 16
 #define SQRL_SERVER_TOKEN_SFN "_LIBSQRL_SFN_"
@@ -28,6 +29,7 @@ namespace libsqrl
 #define SQRL_SERVER_CONTEXT_FLAG_VALID_QUERY         0x0008
 #define SQRL_SERVER_CONTEXT_FLAG_VALID_SERVER_STRING 0x0010
 #define SQRL_SERVER_CONTEXT_FLAG_VALID_CLIENT_STRING 0x0020
+#define SQRL_SERVER_CONTEXT_FLAG_SEND_SUK            0x0040
 
 #define CONTEXT_KV_COUNT  5
 #define CONTEXT_KV_LENGTH 6
@@ -58,6 +60,21 @@ namespace libsqrl
 #define SERVER_KV_ASK 5
 #define SERVER_KV_URL 6
 
+#define SQRL_SERVER_CMD_UNKNOWN -1
+#define SQRL_SERVER_CMD_QUERY    0
+#define SQRL_SERVER_CMD_IDENT    1
+#define SQRL_SERVER_CMD_DISABLE  2
+#define SQRL_SERVER_CMD_ENABLE   3
+#define SQRL_SERVER_CMD_REMOVE   4
+#define SQRL_SERVER_CMD_COUNT    5
+
+#define SQRL_SERVER_USER_FIND       0
+#define SQRL_SERVER_USER_CREATE     1
+#define SQRL_SERVER_USER_UPDATE     2
+#define SQRL_SERVER_USER_DELETE     3
+#define SQRL_SERVER_USER_REKEYED    4
+#define SQRL_SERVER_USER_IDENTIFIED 5
+
 #pragma pack(push,4)
     typedef struct Sqrl_Nut
     {
@@ -67,51 +84,98 @@ namespace libsqrl
     } Sqrl_Nut;
 #pragma pack(pop)
 
+    struct Sqrl_Server_Keys;
+    class SqrlServerRequest;
+    class SqrlNutCache;
+    class SqrlSignatureBatch;
+    class SqrlKeyCache;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>A SQRL server: issues links and answers client queries.</summary>
+    ///
+    /// <remarks>
+    /// After construction a SqrlServer holds only configuration (URI, SFN, keys, nut lifetime), so
+    /// createLink(), createLinks() and handleQuery() may be called from many threads at once.  All per
+    /// request state lives in a SqrlServerRequest.  The callbacks are made on the calling thread, and
+    /// must be thread safe themselves.  rekey() must not race with anything else.
+    ///
+    /// For a user store that answers slowly, handleQueryAsync() hands each store call to
+    /// onUserAsync() instead, and frees the thread until the store calls resumeQuery().</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
     class DLL_PUBLIC SqrlServer
     {
     public:
         SqrlServer( const char *uri, const char *sfn, const char *passcode, size_t passcode_len );
-        ~SqrlServer();
+        virtual ~SqrlServer();
 
+        void rekey( const char *passcode, size_t passcode_len );
         SqrlString *createLink( uint32_t ip );
+        size_t createLinks( const uint32_t *ips, size_t n, SqrlString *links, size_t *offsets );
         void handleQuery(
             uint32_t client_ip,
             const char *query,
             size_t query_len );
+        void handleQuery(
+            SqrlServerRequest *request,
+            const char *query,
+            size_t query_len );
+        void handleQueryAsync(
+            SqrlServerRequest *request,
+            const char *query,
+            size_t query_len );
+        void resumeQuery( SqrlServerRequest *request, bool result );
+        SqrlNutCache *getNutCache();
+        bool useSharedNutCache( const char *name, size_t capacity = SQRL_NUT_CACHE_DEFAULT_CAPACITY );
+        SqrlSignatureBatch *getSignatureBatch();
+        void setSignatureBatching( size_t maxBatch, uint32_t maxWait );
+        SqrlKeyCache *getKeyCache();
+        void setKeyCacheCapacity( size_t capacity );
+        size_t getReplyLength( const SqrlServerRequest *request );
+        size_t writeReply( SqrlServerRequest *request, char *buf, size_t len );
 
     protected:
-        virtual bool onUserFind( const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) = 0;
-        virtual bool onUserCreate( const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) = 0;
-        virtual bool onUserUpdate( const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) = 0;
-        virtual bool onUserDelete( const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) = 0;
-        virtual bool onUserRekeyed( const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) = 0;
-        virtual bool onUserIdentified( const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) = 0;
-        virtual void onSend( const SqrlString *reply ) = 0;
+        virtual bool onUserFind( SqrlServerRequest *request, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) = 0;
+        virtual bool onUserCreate( SqrlServerRequest *request, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) = 0;
+        virtual bool onUserUpdate( SqrlServerRequest *request, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) = 0;
+        virtual bool onUserDelete( SqrlServerRequest *request, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) = 0;
+        virtual bool onUserRekeyed( SqrlServerRequest *request, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) = 0;
+        virtual bool onUserIdentified( SqrlServerRequest *request, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) = 0;
+        virtual void onSend( SqrlServerRequest *request, const SqrlString *reply ) = 0;
+        virtual void onUserAsync( SqrlServerRequest *request, int op, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk );
 
         SqrlUri *uri;
         SqrlString *sfn;
+        SqrlString *qry;
+        SqrlString *replyQry;
         uint8_t key[32];
+        struct Sqrl_Server_Keys *keys;
         uint64_t nut_expires;
-
-        Sqrl_Nut nut;
-        int command;
-        Sqrl_Tif tif;
-        uint16_t flags;
-        char *context_strings[CONTEXT_KV_COUNT];
-        char *client_strings[CLIENT_KV_COUNT];
-        char *server_strings[SERVER_KV_COUNT];
-        char *reply;
-
-        uint8_t idk[SQRL_KEY_SIZE];
-        uint8_t suk[SQRL_KEY_SIZE];
-        uint8_t vuk[SQRL_KEY_SIZE];
-        uint16_t userFlags;
+        SqrlNutCache *nutCache;
+        SqrlSignatureBatch *sigBatch;
+        SqrlKeyCache *keyCache;
 
         void addMAC( SqrlString *str, char sep );
         bool verifyMAC( SqrlString *str );
         bool createNut( Sqrl_Nut *nut, uint32_t ip );
         bool decryptNut( Sqrl_Nut *nut );
 
+    private:
+        bool parseQuery( SqrlServerRequest *request, const char *query, size_t query_len );
+        bool verifyServerString( SqrlServerRequest *request );
+        bool verifyNut( SqrlServerRequest *request );
+        bool parseClient( SqrlServerRequest *request );
+        bool verifySignatures( SqrlServerRequest *request );
+        bool verifyUrs( SqrlServerRequest *request );
+        void startQuery( SqrlServerRequest *request, const char *query, size_t query_len, bool async );
+        void advanceQuery( SqrlServerRequest *request, bool result );
+        bool callUser( SqrlServerRequest *request, int op, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk );
+        bool foundUser( SqrlServerRequest *request, bool found );
+        bool decodeClientKey( SqrlServerRequest *request, int kv, uint8_t *key );
+        bool decodeSignature( SqrlServerRequest *request, int sigKv, int keyKv, uint8_t *sig, uint8_t *key );
+        const SqrlString *getClientKey( SqrlServerRequest *request, int kv );
+        void addUserSuk( SqrlServerRequest *request );
+        int startCommand( SqrlServerRequest *request );
+        void buildReply( SqrlServerRequest *request );
     };
 }
 #endif // SQRLSERVER_H
@@ -0,0 +1,303 @@
+/** \file SqrlServerParser.cpp
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#include "sqrl_internal.h"
+#include "SqrlServerParser.h"
+
+#define SERVER_KEY3(a, b, c) ((uint32_t)(uint8_t)(a) | ((uint32_t)(uint8_t)(b) << 8) | ((uint32_t)(uint8_t)(c) << 16))
+#define SERVER_B64_INVALID ((size_t)-1)
+
+namespace libsqrl
+{
+    static inline uint32_t server_key3( const char *k ) {
+        return SERVER_KEY3( k[0], k[1], k[2] );
+    }
+
+    /// <summary>Maps a query key to its CONTEXT_KV_* index, or -1.</summary>
+    static int server_context_key( const char *k, size_t len ) {
+        switch( len ) {
+        case 3:
+            switch( server_key3( k ) ) {
+            case SERVER_KEY3( 'i', 'd', 's' ): return CONTEXT_KV_IDS;
+            case SERVER_KEY3( 'u', 'r', 's' ): return CONTEXT_KV_URS;
+            }
+            break;
+        case 4:
+            if( 0 == memcmp( k, "pids", 4 ) ) return CONTEXT_KV_PIDS;
+            break;
+        case 6:
+            if( 0 == memcmp( k, "server", 6 ) ) return CONTEXT_KV_SERVER;
+            if( 0 == memcmp( k, "client", 6 ) ) return CONTEXT_KV_CLIENT;
+            break;
+        }
+        return -1;
+    }
+
+    /// <summary>Maps a client string key to its CLIENT_KV_* index, or -1.</summary>
+    static int server_client_key( const char *k, size_t len ) {
+        switch( len ) {
+        case 3:
+            switch( server_key3( k ) ) {
+            case SERVER_KEY3( 'v', 'e', 'r' ): return CLIENT_KV_VER;
+            case SERVER_KEY3( 'c', 'm', 'd' ): return CLIENT_KV_CMD;
+            case SERVER_KEY3( 'o', 'p', 't' ): return CLIENT_KV_OPT;
+            case SERVER_KEY3( 'b', 't', 'n' ): return CLIENT_KV_BTN;
+            case SERVER_KEY3( 'i', 'd', 'k' ): return CLIENT_KV_IDK;
+            case SERVER_KEY3( 's', 'u', 'k' ): return CLIENT_KV_SUK;
+            case SERVER_KEY3( 'v', 'u', 'k' ): return CLIENT_KV_VUK;
+            }
+            break;
+        case 4:
+            if( 0 == memcmp( k, "pidk", 4 ) ) return CLIENT_KV_PIDK;
+            break;
+        }
+        return -1;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Splits "key=value[sep]key=value..." into views of the recognized keys' values.</summary>
+    ///
+    /// <remarks>A later duplicate key replaces an earlier one.  Trailing CR and LF are dropped from
+    /// each value.</remarks>
+    ///
+    /// <returns>A bit mask of the keys found.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    static int server_split( const char *str, size_t len, char sep,
+        int( *lookup )(const char*, size_t), struct Sqrl_Kv_View *views ) {
+        if( !str || len > 0xFFFFFFFFU ) return 0;
+        int found = 0;
+        const char *p = str;
+        const char *end = str + len;
+        while( p < end ) {
+            const char *next = (const char*)memchr( p, sep, end - p );
+            if( !next ) next = end;
+            const char *eq = (const char*)memchr( p, '=', next - p );
+            if( eq ) {
+                int kv = lookup( p, eq - p );
+                if( kv >= 0 ) {
+                    const char *val = eq + 1;
+                    const char *vend = next;
+                    while( vend > val && (vend[-1] == '\r' || vend[-1] == '\n') ) vend--;
+                    views[kv].offset = (uint32_t)(val - str);
+                    views[kv].length = (uint32_t)(vend - val);
+                    found |= (1 << kv);
+                }
+            }
+            p = next + 1;
+        }
+        return found;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Splits a client's query (the POST body, "client=...&server=...&ids=...").</summary>
+    ///
+    /// <param name="query">The query.  Not modified; the views point into it.</param>
+    /// <param name="len">  Length of the query.</param>
+    /// <param name="views">[out] The value of each CONTEXT_KV_* key found.</param>
+    ///
+    /// <returns>A bit mask of the CONTEXT_KV_* keys found.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    int server_split_query( const char *query, size_t len, struct Sqrl_Kv_View views[CONTEXT_KV_COUNT] ) {
+        return server_split( query, len, '&', server_context_key, views );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Splits a decoded client string ("ver=1\r\ncmd=query\r\nidk=...\r\n").</summary>
+    ///
+    /// <param name="client">The decoded client string.  The views point into it.</param>
+    /// <param name="len">   Its length.</param>
+    /// <param name="views"> [out] The value of each CLIENT_KV_* key found.</param>
+    ///
+    /// <returns>A bit mask of the CLIENT_KV_* keys found.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    int server_split_client( const char *client, size_t len, struct Sqrl_Kv_View views[CLIENT_KV_COUNT] ) {
+        return server_split( client, len, '\n', server_client_key, views );
+    }
+
+    /// <summary>Maps a command name to its SQRL_SERVER_CMD_* value.</summary>
+    int server_find_command( const char *cmd, size_t len ) {
+        switch( len ) {
+        case 5:
+            if( 0 == memcmp( cmd, "query", 5 ) ) return SQRL_SERVER_CMD_QUERY;
+            if( 0 == memcmp( cmd, "ident", 5 ) ) return SQRL_SERVER_CMD_IDENT;
+            break;
+        case 6:
+            if( 0 == memcmp( cmd, "enable", 6 ) ) return SQRL_SERVER_CMD_ENABLE;
+            if( 0 == memcmp( cmd, "remove", 6 ) ) return SQRL_SERVER_CMD_REMOVE;
+            break;
+        case 7:
+            if( 0 == memcmp( cmd, "disable", 7 ) ) return SQRL_SERVER_CMD_DISABLE;
+            break;
+        }
+        return SQRL_SERVER_CMD_UNKNOWN;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Finds a value in a link ("...?nut=...&sfn=...") or a reply ("ver=1\r\nnut=...\r\n").
+    /// </summary>
+    ///
+    /// <param name="str"> The string to search.</param>
+    /// <param name="len"> Its length.</param>
+    /// <param name="key"> The key, without '='.</param>
+    /// <param name="view">[out] The first value for 'key'.</param>
+    ///
+    /// <returns>true if the key was found.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool server_find_value( const char *str, size_t len, const char *key, struct Sqrl_Kv_View *view ) {
+        size_t keyLen = strlen( key );
+        if( !str || keyLen == 0 || len > 0xFFFFFFFFU ) return false;
+        const char *end = str + len;
+        const char *p = str;
+        while( (size_t)(end - p) > keyLen &&
+            NULL != (p = (const char*)memchr( p, key[0], end - p - keyLen )) ) {
+            if( (p == str || p[-1] == '?' || p[-1] == '&' || p[-1] == '\n') &&
+                p[keyLen] == '=' && 0 == memcmp( p, key, keyLen ) ) {
+                const char *val = p + keyLen + 1;
+                const char *vend = val;
+                while( vend < end && *vend != '&' && *vend != '\r' && *vend != '\n' ) vend++;
+                view->offset = (uint32_t)(val - str);
+                view->length = (uint32_t)(vend - val);
+                return true;
+            }
+            p++;
+        }
+        return false;
+    }
+
+    static const int8_t server_b64_table[256] = {
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1,
+        52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+        -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+        15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, 63,
+        -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+        41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+    };
+
+    /// <summary>Drops '=' padding, which SQRL doesn't use but some encoders add.</summary>
+    static inline size_t server_b64_trim( const char *src, size_t len ) {
+        if( len && src[len - 1] == '=' ) len--;
+        if( len && src[len - 1] == '=' ) len--;
+        return len;
+    }
+
+    /// <summary>Gets the number of bytes 'len' base64url characters decode to.</summary>
+    size_t server_b64_decoded_length( size_t len ) {
+        if( len % 4 == 1 ) return SERVER_B64_INVALID;
+        return len / 4 * 3 + (len % 4 ? len % 4 - 1 : 0);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Base64url decodes into 'dest', which must hold server_b64_decoded_length( len )
+    /// bytes.</summary>
+    ///
+    /// <returns>false if 'src' holds anything but base64url characters (and trailing padding), or if
+    /// its last character sets bits past the end of the data, so every value has one spelling.
+    /// </returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool server_b64_decode( uint8_t *dest, const char *src, size_t len ) {
+        len = server_b64_trim( src, len );
+        if( len % 4 == 1 ) return false;
+        const uint8_t *s = (const uint8_t*)src;
+        size_t i;
+        for( i = 0; i + 4 <= len; i += 4 ) {
+            int a = server_b64_table[s[i]], b = server_b64_table[s[i + 1]];
+            int c = server_b64_table[s[i + 2]], d = server_b64_table[s[i + 3]];
+            if( (a | b | c | d) < 0 ) return false;
+            uint32_t v = ((uint32_t)a << 18) | ((uint32_t)b << 12) | ((uint32_t)c << 6) | (uint32_t)d;
+            *dest++ = (uint8_t)(v >> 16);
+            *dest++ = (uint8_t)(v >> 8);
+            *dest++ = (uint8_t)v;
+        }
+        if( i < len ) {
+            int a = server_b64_table[s[i]], b = server_b64_table[s[i + 1]];
+            int c = len - i == 3 ? server_b64_table[s[i + 2]] : 0;
+            if( (a | b | c) < 0 ) return false;
+            uint32_t v = ((uint32_t)a << 18) | ((uint32_t)b << 12) | ((uint32_t)c << 6);
+            if( v & (len - i == 3 ? 0xFF : 0xFFFF) ) return false;
+            *dest++ = (uint8_t)(v >> 16);
+            if( len - i == 3 ) *dest = (uint8_t)(v >> 8);
+        }
+        return true;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Base64url decodes a value that must be exactly 'destLen' bytes, such as a key or a
+    /// signature.</summary>
+    ///
+    /// <returns>true on success; false (leaving 'dest' unspecified) if the value is malformed or the
+    /// wrong length.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool server_b64_decode_exact( uint8_t *dest, size_t destLen, const char *src, size_t len ) {
+        if( !src ) return false;
+        return server_b64_decoded_length( server_b64_trim( src, len ) ) == destLen &&
+            server_b64_decode( dest, src, len );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Base64url decodes into a SqrlString, replacing its contents.</summary>
+    ///
+    /// <remarks>Reuses the string's memory, so a string kept from one request to the next stops
+    /// allocating once it is big enough.</remarks>
+    ///
+    /// <returns>true on success; false if 'src' is empty or malformed.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool server_b64_decode( SqrlString *dest, const char *src, size_t len ) {
+        dest->clear();
+        if( !src ) return false;
+        size_t n = server_b64_decoded_length( server_b64_trim( src, len ) );
+        if( n == SERVER_B64_INVALID || n == 0 ) return false;
+        dest->append( '\0', n );
+        if( dest->length() != n || !server_b64_decode( dest->data(), src, len ) ) {
+            dest->clear();
+            return false;
+        }
+        return true;
+    }
+
+    /// <summary>Gets the number of base64url characters (unpadded) 'len' bytes encode to.</summary>
+    size_t server_b64_encoded_length( size_t len ) {
+        return len / 3 * 4 + (len % 3 ? len % 3 + 1 : 0);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Base64url encodes without padding, as SqrlBase64 does, into 'dest', which must hold
+    /// server_b64_encoded_length( len ) characters.  Doesn't add a terminator.</summary>
+    ///
+    /// <returns>The number of characters written.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    size_t server_b64_encode( char *dest, const uint8_t *src, size_t len ) {
+        static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+        char *d = dest;
+        size_t i;
+        for( i = 0; i + 3 <= len; i += 3 ) {
+            uint32_t v = ((uint32_t)src[i] << 16) | ((uint32_t)src[i + 1] << 8) | src[i + 2];
+            *d++ = alphabet[(v >> 18) & 0x3F];
+            *d++ = alphabet[(v >> 12) & 0x3F];
+            *d++ = alphabet[(v >> 6) & 0x3F];
+            *d++ = alphabet[v & 0x3F];
+        }
+        if( i < len ) {
+            uint32_t v = (uint32_t)src[i] << 16;
+            if( len - i == 2 ) v |= (uint32_t)src[i + 1] << 8;
+            *d++ = alphabet[(v >> 18) & 0x3F];
+            *d++ = alphabet[(v >> 12) & 0x3F];
+            if( len - i == 2 ) *d++ = alphabet[(v >> 6) & 0x3F];
+        }
+        return d - dest;
+    }
+}
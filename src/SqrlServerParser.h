@@ -0,0 +1,44 @@
+/** \file SqrlServerParser.h
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#ifndef SQRLSERVERPARSER_H
+#define SQRLSERVERPARSER_H
+
+#include "sqrl.h"
+#include "SqrlString.h"
+#include "SqrlServer.h"
+
+namespace libsqrl
+{
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>A value found by the parser: 'length' bytes at 'offset' into the parsed buffer.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    struct Sqrl_Kv_View
+    {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    // Zero-copy parsing of client queries.  Nothing here allocates: values are views into the
+    // caller's buffer, and base64url is decoded straight into the caller's fixed-size fields (or
+    // encoded straight into the caller's reply buffer).
+
+    int server_split_query( const char *query, size_t len, struct Sqrl_Kv_View views[CONTEXT_KV_COUNT] );
+    int server_split_client( const char *client, size_t len, struct Sqrl_Kv_View views[CLIENT_KV_COUNT] );
+    int server_find_command( const char *cmd, size_t len );
+    bool server_find_value( const char *str, size_t len, const char *key, struct Sqrl_Kv_View *view );
+
+    size_t server_b64_decoded_length( size_t len );
+    bool server_b64_decode( uint8_t *dest, const char *src, size_t len );
+    bool server_b64_decode_exact( uint8_t *dest, size_t destLen, const char *src, size_t len );
+    bool server_b64_decode( SqrlString *dest, const char *src, size_t len );
+    size_t server_b64_encoded_length( size_t len );
+    size_t server_b64_encode( char *dest, const uint8_t *src, size_t len );
+}
+#endif // SQRLSERVERPARSER_H
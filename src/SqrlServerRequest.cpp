@@ -0,0 +1,137 @@
+/** \file SqrlServerRequest.cpp
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#include "sqrl_internal.h"
+#include "SqrlServerRequest.h"
+
+namespace libsqrl
+{
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Constructor.</summary>
+    ///
+    /// <param name="client_ip">The IP address of the client making the request.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    SqrlServerRequest::SqrlServerRequest( uint32_t client_ip ) :
+        userData( NULL ) {
+        memset( this->server_strings, 0, sizeof( this->server_strings ) );
+        this->reset( client_ip );
+    }
+
+    SqrlServerRequest::~SqrlServerRequest() {
+        this->clearStrings();
+        this->reply.secureClear();
+        sqrl_memzero( this->idk, SQRL_KEY_SIZE );
+        sqrl_memzero( this->suk, SQRL_KEY_SIZE );
+        sqrl_memzero( this->vuk, SQRL_KEY_SIZE );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Readies this request to be reused for another query.</summary>
+    ///
+    /// <param name="client_ip">The IP address of the client making the next request.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlServerRequest::reset( uint32_t client_ip ) {
+        this->clearStrings();
+        this->reply.clear();
+        this->query = NULL;
+        memset( this->context, 0, sizeof( this->context ) );
+        this->contextFound = 0;
+        this->clientText.clear();
+        memset( this->client, 0, sizeof( this->client ) );
+        this->clientFound = 0;
+        this->serverText.clear();
+        this->signedText.clear();
+        this->idkText.clear();
+        this->pidkText.clear();
+        this->clientIp = client_ip;
+        memset( &this->nut, 0, sizeof( Sqrl_Nut ) );
+        this->command = SQRL_SERVER_CMD_UNKNOWN;
+        this->tif = 0;
+        this->flags = 0;
+        this->userFound = false;
+        sqrl_memzero( this->idk, SQRL_KEY_SIZE );
+        sqrl_memzero( this->suk, SQRL_KEY_SIZE );
+        sqrl_memzero( this->vuk, SQRL_KEY_SIZE );
+        this->userFlags = 0;
+        this->step = 0;
+        this->async = false;
+        this->userResult = false;
+        this->resumeState.store( 0 );
+        this->host.clear();
+    }
+
+    void SqrlServerRequest::clearStrings() {
+        for( int i = 0; i < SERVER_KV_COUNT; i++ ) {
+            if( this->server_strings[i] ) {
+                delete this->server_strings[i];
+                this->server_strings[i] = NULL;
+            }
+        }
+    }
+
+    uint32_t SqrlServerRequest::getClientIp() const {
+        return this->clientIp;
+    }
+
+    /// <summary>Gets the command the client sent (SQRL_SERVER_CMD_*).</summary>
+    int SqrlServerRequest::getCommand() const {
+        return this->command;
+    }
+
+    /// <summary>Gets the transaction information flags that will be (or were) sent to the client.</summary>
+    Sqrl_Tif SqrlServerRequest::getTif() const {
+        return this->tif;
+    }
+
+    /// <summary>Gets the decrypted nut the client returned.  Only valid once the server string has been
+    /// verified.</summary>
+    const Sqrl_Nut *SqrlServerRequest::getNut() const {
+        return &this->nut;
+    }
+
+    /// <summary>Gets the reply built for the client.</summary>
+    const SqrlString *SqrlServerRequest::getReply() const {
+        return &this->reply;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Supplies the stored user record.  Called from SqrlServer::onUserFind().</summary>
+    ///
+    /// <param name="idk">	   The user's identity key (32 bytes).</param>
+    /// <param name="suk">	   The user's server unlock key (32 bytes).</param>
+    /// <param name="vuk">	   The user's verify unlock key (32 bytes).</param>
+    /// <param name="userFlags">SQRL_SERVER_USER_FLAG_* flags.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlServerRequest::setUser( const uint8_t *idk, const uint8_t *suk, const uint8_t *vuk, uint16_t userFlags ) {
+        if( idk ) memcpy( this->idk, idk, SQRL_KEY_SIZE );
+        if( suk ) memcpy( this->suk, suk, SQRL_KEY_SIZE );
+        if( vuk ) memcpy( this->vuk, vuk, SQRL_KEY_SIZE );
+        this->userFlags = userFlags;
+        this->userFound = true;
+    }
+
+    bool SqrlServerRequest::hasUser() const {
+        return this->userFound;
+    }
+
+    const uint8_t *SqrlServerRequest::getIdk() const {
+        return this->idk;
+    }
+
+    const uint8_t *SqrlServerRequest::getSuk() const {
+        return this->suk;
+    }
+
+    const uint8_t *SqrlServerRequest::getVuk() const {
+        return this->vuk;
+    }
+
+    uint16_t SqrlServerRequest::getUserFlags() const {
+        return this->userFlags;
+    }
+}
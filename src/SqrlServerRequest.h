@@ -0,0 +1,95 @@
+/** \file SqrlServerRequest.h
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#ifndef SQRLSERVERREQUEST_H
+#define SQRLSERVERREQUEST_H
+
+#include <atomic>
+#include "sqrl.h"
+#include "SqrlString.h"
+#include "SqrlServer.h"
+#include "SqrlServerParser.h"
+
+namespace libsqrl
+{
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>The state of one client request to a SqrlServer.</summary>
+    ///
+    /// <remarks>
+    /// Everything that changes while a query is handled lives here rather than in the SqrlServer, so a
+    /// single server can handle many requests at once.  A request is passed to every SqrlServer
+    /// callback made on its behalf; onUserFind() reports the stored user with setUser().
+    ///
+    /// The query is parsed in place: the request keeps views into the caller's buffer, which must
+    /// stay put while the query is handled.  The decoded client and server strings go into buffers
+    /// the request keeps across reset(), as does the reply, so a reused request is handled without
+    /// allocating.
+    ///
+    /// A request handed to SqrlServer::handleQueryAsync() also keeps where the query has got to, so
+    /// it can be suspended while the user store works and resumed on another thread.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    class DLL_PUBLIC SqrlServerRequest
+    {
+        friend class SqrlServer;
+
+    public:
+        SqrlServerRequest( uint32_t client_ip );
+        ~SqrlServerRequest();
+
+        void reset( uint32_t client_ip );
+
+        uint32_t getClientIp() const;
+        int getCommand() const;
+        Sqrl_Tif getTif() const;
+        const Sqrl_Nut *getNut() const;
+        const SqrlString *getReply() const;
+
+        void setUser( const uint8_t *idk, const uint8_t *suk, const uint8_t *vuk, uint16_t userFlags );
+        bool hasUser() const;
+        const uint8_t *getIdk() const;
+        const uint8_t *getSuk() const;
+        const uint8_t *getVuk() const;
+        uint16_t getUserFlags() const;
+
+        void *userData;
+
+    private:
+        uint32_t clientIp;
+        Sqrl_Nut nut;
+        int command;
+        Sqrl_Tif tif;
+        uint16_t flags;
+        const char *query;
+        struct Sqrl_Kv_View context[CONTEXT_KV_COUNT];
+        int contextFound;
+        SqrlString clientText;
+        struct Sqrl_Kv_View client[CLIENT_KV_COUNT];
+        int clientFound;
+        SqrlString serverText;
+        SqrlString signedText;
+        SqrlString idkText;
+        SqrlString pidkText;
+        SqrlString *server_strings[SERVER_KV_COUNT];
+        SqrlString reply;
+
+        bool userFound;
+        uint8_t idk[SQRL_KEY_SIZE];
+        uint8_t suk[SQRL_KEY_SIZE];
+        uint8_t vuk[SQRL_KEY_SIZE];
+        uint16_t userFlags;
+
+        int step;
+        bool async;
+        bool userResult;
+        std::atomic<int> resumeState;
+        SqrlString host;
+
+        void clearStrings();
+    };
+}
+#endif // SQRLSERVERREQUEST_H
@@ -0,0 +1,171 @@
+/** \file SqrlSignatureBatch.cpp
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#include "sqrl_internal.h"
+#include "SqrlSignatureBatch.h"
+#include "SqrlCrypt.h"
+
+namespace libsqrl
+{
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Constructor.</summary>
+    ///
+    /// <param name="maxBatch">The most signatures to verify at once.</param>
+    /// <param name="maxWait"> The longest a request waits for others to join its batch, in
+    /// 					   microseconds.  0 verifies each request's signatures immediately.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    SqrlSignatureBatch::SqrlSignatureBatch( size_t maxBatch, uint32_t maxWait ) :
+        keyCache( NULL ), maxBatch( maxBatch ? maxBatch : 1 ), maxWait( maxWait ), batches( 0 ), signatures( 0 ), active( 0 ) {
+#if defined(WITH_THREADS)
+        this->pending = 0;
+        this->queued = 0;
+#endif
+    }
+
+    SqrlSignatureBatch::~SqrlSignatureBatch() {
+    }
+
+    /// <summary>Sets the decoded public keys to verify with (not owned), or NULL for none.  Call before
+    /// verifying anything.</summary>
+    void SqrlSignatureBatch::setKeyCache( SqrlKeyCache *keyCache ) {
+        this->keyCache = keyCache;
+    }
+
+    /// <summary>Notes that a request has started; verify() may be called before the matching leave().
+    /// </summary>
+    void SqrlSignatureBatch::enter() {
+        this->active++;
+    }
+
+    /// <summary>Notes that a request has finished, so a batch need no longer wait for it.</summary>
+    void SqrlSignatureBatch::leave() {
+        this->active--;
+#if defined(WITH_THREADS)
+        // Waiters register in 'queued' before checking 'active', so one of us sees the other.
+        if( this->queued > 0 ) {
+            std::lock_guard<std::mutex> lock( this->mutex );
+            this->cond.notify_all();
+        }
+#endif
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Verifies a request's signatures, possibly along with other requests'.</summary>
+    ///
+    /// <param name="jobs">The signatures; each job's 'valid' is set.</param>
+    /// <param name="n">   Number of jobs.</param>
+    ///
+    /// <returns>The number of valid signatures among 'jobs'.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    size_t SqrlSignatureBatch::verify( struct Sqrl_Signature_Job *jobs, size_t n ) {
+        if( !jobs || n == 0 ) return 0;
+#if defined(WITH_THREADS)
+        if( this->active > 1 && this->maxWait > 0 && n < this->maxBatch ) {
+            struct Sqrl_Signature_Waiter me = { jobs, n, false, false };
+            std::unique_lock<std::mutex> lock( this->mutex );
+            if( this->waiters.empty() ) {
+                this->deadline = std::chrono::steady_clock::now() + std::chrono::microseconds( this->maxWait );
+            }
+            this->waiters.push_back( &me );
+            this->pending += n;
+            this->queued++;
+
+            while( !me.done ) {
+                if( me.taken ) {
+                    this->cond.wait( lock );
+                } else if( this->pending >= this->maxBatch ||
+                    (int)this->waiters.size() >= this->active ||
+                    std::chrono::steady_clock::now() >= this->deadline ) {
+                    this->flush( lock );
+                } else {
+                    this->cond.wait_until( lock, this->deadline );
+                }
+            }
+            size_t valid = 0;
+            for( size_t i = 0; i < n; i++ ) {
+                if( jobs[i].valid ) valid++;
+            }
+            return valid;
+        }
+#endif
+        struct Sqrl_Signature_Job *ptrs[SQRL_ED25519_BATCH_MAX];
+        size_t valid = 0;
+        for( size_t off = 0; off < n; off += SQRL_ED25519_BATCH_MAX ) {
+            size_t c = n - off < SQRL_ED25519_BATCH_MAX ? n - off : SQRL_ED25519_BATCH_MAX;
+            for( size_t i = 0; i < c; i++ ) ptrs[i] = &jobs[off + i];
+            valid += this->run( ptrs, c );
+            this->batches++;
+            this->signatures += c;
+        }
+        return valid;
+    }
+
+    /// <summary>Gets the number of batches verified.</summary>
+    uint64_t SqrlSignatureBatch::getBatches() {
+        return this->batches;
+    }
+
+    /// <summary>Gets the number of signatures verified.</summary>
+    uint64_t SqrlSignatureBatch::getSignatures() {
+        return this->signatures;
+    }
+
+    size_t SqrlSignatureBatch::run( struct Sqrl_Signature_Job *const *jobs, size_t n ) {
+        const SqrlString *msgs[SQRL_ED25519_BATCH_MAX];
+        const uint8_t *sigs[SQRL_ED25519_BATCH_MAX];
+        const uint8_t *pubs[SQRL_ED25519_BATCH_MAX];
+        bool results[SQRL_ED25519_BATCH_MAX];
+        for( size_t i = 0; i < n; i++ ) {
+            msgs[i] = jobs[i]->msg;
+            sigs[i] = jobs[i]->sig;
+            pubs[i] = jobs[i]->pub;
+        }
+        size_t valid = SqrlCrypt::verifySignatures( n, msgs, sigs, pubs, results, this->keyCache, true );
+        for( size_t i = 0; i < n; i++ ) {
+            jobs[i]->valid = results[i];
+        }
+        return valid;
+    }
+
+#if defined(WITH_THREADS)
+    /// <summary>Takes the pending batch and verifies it, outside the lock.</summary>
+    void SqrlSignatureBatch::flush( std::unique_lock<std::mutex> &lock ) {
+        std::vector<struct Sqrl_Signature_Waiter*> group;
+        group.swap( this->waiters );
+        this->pending = 0;
+        this->queued -= (int)group.size();
+        for( auto w : group ) w->taken = true;
+        lock.unlock();
+
+        struct Sqrl_Signature_Job *ptrs[SQRL_ED25519_BATCH_MAX];
+        size_t c = 0;
+        uint64_t count = 0;
+        for( auto w : group ) {
+            for( size_t i = 0; i < w->n; i++ ) {
+                ptrs[c++] = &w->jobs[i];
+                if( c == SQRL_ED25519_BATCH_MAX ) {
+                    this->run( ptrs, c );
+                    this->batches++;
+                    count += c;
+                    c = 0;
+                }
+            }
+        }
+        if( c ) {
+            this->run( ptrs, c );
+            this->batches++;
+            count += c;
+        }
+        this->signatures += count;
+
+        lock.lock();
+        for( auto w : group ) w->done = true;
+        this->cond.notify_all();
+    }
+#endif
+}
@@ -0,0 +1,92 @@
+/** \file SqrlSignatureBatch.h
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#ifndef SQRLSIGNATUREBATCH_H
+#define SQRLSIGNATUREBATCH_H
+
+#include <atomic>
+#include "sqrl.h"
+#include "SqrlString.h"
+#include "ed25519_batch.h"
+#include "SqrlKeyCache.h"
+#if defined(WITH_THREADS)
+#include <chrono>
+#include <condition_variable>
+#include <vector>
+#endif
+
+namespace libsqrl
+{
+#define SQRL_SIGNATURE_BATCH_DEFAULT_WAIT 200
+
+    /// <summary>One signature to check, and the outcome.</summary>
+    struct Sqrl_Signature_Job
+    {
+        const SqrlString *msg;
+        const uint8_t *sig;
+        const uint8_t *pub;
+        bool valid;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Gathers signatures from concurrent requests, and verifies them together.</summary>
+    ///
+    /// <remarks>
+    /// Each request is bracketed by enter() and leave().  The first caller of verify() starts a batch;
+    /// it is verified, by whichever caller is waiting at the time, as soon as it holds maxBatch
+    /// signatures, every request in flight has joined it, or the first caller has waited maxWait
+    /// microseconds.  A request on its own is never held back.  Verification uses
+    /// SqrlCrypt::verifySignatures(), cofactored, with the given SqrlKeyCache if any: a batch that
+    /// passes is accepted, and one containing a bad signature is split until it is found.  Using this
+    /// class is the choice to accept cofactored signatures (see ed25519_verify_batch()).</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    class DLL_PUBLIC SqrlSignatureBatch
+    {
+    public:
+        SqrlSignatureBatch( size_t maxBatch = SQRL_ED25519_BATCH_MAX, uint32_t maxWait = SQRL_SIGNATURE_BATCH_DEFAULT_WAIT );
+        ~SqrlSignatureBatch();
+
+        void setKeyCache( SqrlKeyCache *keyCache );
+        void enter();
+        void leave();
+        size_t verify( struct Sqrl_Signature_Job *jobs, size_t n );
+
+        uint64_t getBatches();
+        uint64_t getSignatures();
+
+    private:
+        size_t run( struct Sqrl_Signature_Job *const *jobs, size_t n );
+
+        SqrlKeyCache *keyCache;
+        size_t maxBatch;
+        uint32_t maxWait;
+        std::atomic<uint64_t> batches;
+        std::atomic<uint64_t> signatures;
+        std::atomic<int> active;
+
+#if defined(WITH_THREADS)
+        struct Sqrl_Signature_Waiter
+        {
+            struct Sqrl_Signature_Job *jobs;
+            size_t n;
+            bool taken;
+            bool done;
+        };
+
+        void flush( std::unique_lock<std::mutex> &lock );
+
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::vector<struct Sqrl_Signature_Waiter*> waiters;
+        size_t pending;
+        std::atomic<int> queued;
+        std::chrono::steady_clock::time_point deadline;
+#endif
+    };
+}
+#endif // SQRLSIGNATUREBATCH_H
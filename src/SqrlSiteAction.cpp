@@ -11,6 +11,9 @@
 
 using libsqrl::SqrlSiteAction;
 
+/// <summary>Site actions are what the user is waiting on to log in, so they run as INTERACTIVE.</summary>
+SqrlSiteAction::SqrlSiteAction() : SqrlAction( SQRL_ACTION_PRIORITY_INTERACTIVE ), altIdentity( NULL ) {}
+
 char *SqrlSiteAction::getAltIdentity() {
     return this->altIdentity;
 }
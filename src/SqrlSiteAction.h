@@ -17,6 +17,7 @@ namespace libsqrl
     class DLL_PUBLIC SqrlSiteAction : public SqrlAction
     {
     public:
+        SqrlSiteAction();
         void setAlternateIdentity( const char *altIdentity );
         char *getAltIdentity();
         void setAltIdentity( const char *alt );
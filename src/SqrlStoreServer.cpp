@@ -0,0 +1,96 @@
+/** \file SqrlStoreServer.cpp
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#include "sqrl_internal.h"
+#include "SqrlStoreServer.h"
+#include "SqrlServerRequest.h"
+#include "SqrlServerParser.h"
+#include "SqrlUri.h"
+
+namespace libsqrl
+{
+    /// <summary>Decodes a key handed to a callback, which is still in base64url.</summary>
+    static bool store_server_key( uint8_t *key, const SqrlString *str ) {
+        return str && server_b64_decode_exact( key, SQRL_KEY_SIZE, str->cstring(), str->length() );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Constructor.</summary>
+    ///
+    /// <param name="uri">		   As for SqrlServer.</param>
+    /// <param name="sfn">		   As for SqrlServer.</param>
+    /// <param name="passcode">	   As for SqrlServer.</param>
+    /// <param name="passcode_len">As for SqrlServer.</param>
+    /// <param name="store">	   The user store, which may be shared with other servers and must
+    /// 						   outlive this one; or NULL for a store of this server's own.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    SqrlStoreServer::SqrlStoreServer( const char *uri, const char *sfn, const char *passcode, size_t passcode_len,
+        SqrlUserStore *store ) :
+        SqrlServer( uri, sfn, passcode, passcode_len ) {
+        this->ownStore = store == NULL;
+        this->store = store ? store : new SqrlUserStore();
+        SqrlString host = SqrlString();
+        if( this->uri ) this->uri->getSiteKey( &host );
+        this->site = SqrlUserStore::siteId( &host );
+    }
+
+    SqrlStoreServer::~SqrlStoreServer() {
+        if( this->ownStore && this->store ) delete this->store;
+    }
+
+    /// <summary>Gets the store this server's users are kept in.</summary>
+    SqrlUserStore *SqrlStoreServer::getUserStore() {
+        return this->store;
+    }
+
+    /// <summary>Gets the id this server's users are stored under (SqrlUserStore::siteId()).</summary>
+    uint64_t SqrlStoreServer::getSiteId() {
+        return this->site;
+    }
+
+    bool SqrlStoreServer::onUserFind( SqrlServerRequest *request, const SqrlString * /*host*/, const SqrlString *idk, const SqrlString * /*pidk*/ ) {
+        uint8_t key[SQRL_KEY_SIZE], suk[SQRL_KEY_SIZE], vuk[SQRL_KEY_SIZE];
+        uint16_t flags;
+        if( !store_server_key( key, idk ) ||
+            !this->store->find( this->site, key, suk, vuk, &flags ) ) return false;
+        request->setUser( key, suk, vuk, flags );
+        return true;
+    }
+
+    bool SqrlStoreServer::onUserCreate( SqrlServerRequest *request, const SqrlString * /*host*/, const SqrlString * /*idk*/, const SqrlString * /*pidk*/ ) {
+        return this->store->create( this->site, request->getIdk(), request->getSuk(), request->getVuk(),
+            request->getUserFlags() );
+    }
+
+    bool SqrlStoreServer::onUserUpdate( SqrlServerRequest *request, const SqrlString * /*host*/, const SqrlString *idk, const SqrlString * /*pidk*/ ) {
+        uint8_t key[SQRL_KEY_SIZE];
+        return store_server_key( key, idk ) &&
+            this->store->update( this->site, key, request->getUserFlags() );
+    }
+
+    bool SqrlStoreServer::onUserDelete( SqrlServerRequest * /*request*/, const SqrlString * /*host*/, const SqrlString *idk, const SqrlString * /*pidk*/ ) {
+        uint8_t key[SQRL_KEY_SIZE];
+        return store_server_key( key, idk ) && this->store->remove( this->site, key );
+    }
+
+    /// <summary>Moves the user from pidk to idk.  The request holds the suk and vuk to keep: the new
+    /// ones on ident, or the stored ones on enable.</summary>
+    bool SqrlStoreServer::onUserRekeyed( SqrlServerRequest *request, const SqrlString * /*host*/, const SqrlString *idk, const SqrlString *pidk ) {
+        uint8_t key[SQRL_KEY_SIZE], previous[SQRL_KEY_SIZE];
+        return store_server_key( key, idk ) && store_server_key( previous, pidk ) &&
+            this->store->rekey( this->site, previous, key, request->getSuk(), request->getVuk(),
+                request->getUserFlags() );
+    }
+
+    bool SqrlStoreServer::onUserIdentified( SqrlServerRequest * /*request*/, const SqrlString * /*host*/, const SqrlString * /*idk*/, const SqrlString * /*pidk*/ ) {
+        return true;
+    }
+
+    void SqrlStoreServer::onSend( SqrlServerRequest * /*request*/, const SqrlString * /*reply*/ ) {
+    }
+}
@@ -0,0 +1,51 @@
+/** \file SqrlStoreServer.h
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#ifndef SQRLSTORESERVER_H
+#define SQRLSTORESERVER_H
+
+#include "sqrl.h"
+#include "SqrlServer.h"
+#include "SqrlUserStore.h"
+
+namespace libsqrl
+{
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>A SqrlServer that keeps its users in a SqrlUserStore.</summary>
+    ///
+    /// <remarks>
+    /// Implements the user callbacks against the store: users are created on their first ident,
+    /// updated on disable and enable, moved on rekey and dropped on remove.  onUserIdentified() does
+    /// nothing, and onSend() leaves the reply in the request (SqrlServerRequest::getReply()); override
+    /// them to log the user in and to send the reply.  Thread safe, as SqrlServer is.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    class DLL_PUBLIC SqrlStoreServer : public SqrlServer
+    {
+    public:
+        SqrlStoreServer( const char *uri, const char *sfn, const char *passcode, size_t passcode_len,
+            SqrlUserStore *store = NULL );
+        virtual ~SqrlStoreServer();
+
+        SqrlUserStore *getUserStore();
+        uint64_t getSiteId();
+
+    protected:
+        virtual bool onUserFind( SqrlServerRequest *request, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk );
+        virtual bool onUserCreate( SqrlServerRequest *request, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk );
+        virtual bool onUserUpdate( SqrlServerRequest *request, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk );
+        virtual bool onUserDelete( SqrlServerRequest *request, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk );
+        virtual bool onUserRekeyed( SqrlServerRequest *request, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk );
+        virtual bool onUserIdentified( SqrlServerRequest *request, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk );
+        virtual void onSend( SqrlServerRequest *request, const SqrlString *reply );
+
+        SqrlUserStore *store;
+        bool ownStore;
+        uint64_t site;
+    };
+}
+#endif // SQRLSTORESERVER_H
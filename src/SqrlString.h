@@ -80,6 +80,41 @@ namespace libsqrl
             this->append( in );
         }
 
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        /// <summary>Copy constructor.  Copies the contents, never the buffer.</summary>
+        ///
+        /// <param name="in">The SqrlString to copy.</param>
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        SqrlString( const SqrlString &in ) : SqrlString() {
+            this->append( &in );
+        }
+
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        /// <summary>Move constructor.  Takes the buffer of 'in', leaving it empty, or copies it if the
+        /// buffer can't be given away (see isMovable()).</summary>
+        ///
+        /// <param name="in">The SqrlString to move from.</param>
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        SqrlString( SqrlString &&in ) : SqrlString() {
+            this->take( &in );
+        }
+
+        SqrlString &operator=( const SqrlString &in ) {
+            if( this != &in ) {
+                this->clear();
+                this->append( &in );
+            }
+            return *this;
+        }
+
+        SqrlString &operator=( SqrlString &&in ) {
+            if( this != &in ) {
+                this->clear();
+                this->take( &in );
+            }
+            return *this;
+        }
+
         virtual ~SqrlString() {
             this->deallocate();
         }
@@ -557,6 +592,33 @@ namespace libsqrl
 
     protected:
 
+        /// <summary>Whether another SqrlString may take this one's buffer.  Not for strings whose memory is
+        /// fixed, borrowed or locked.</summary>
+        virtual bool isMovable() const {
+            return true;
+        }
+
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        /// <summary>Takes the contents of 'in', leaving it empty.  The buffer moves with them when both
+        /// strings allow it; otherwise they are copied.</summary>
+        ///
+        /// <param name="in">[in,out] The SqrlString to take from.</param>
+        ////////////////////////////////////////////////////////////////////////////////////////////////////
+        void take( SqrlString *in ) {
+            if( !this->isMovable() || !in->isMovable() ) {
+                this->append( in );
+                in->clear();
+                return;
+            }
+            this->deallocate();
+            this->myData = in->myData;
+            this->myDend = in->myDend;
+            this->myCapacity = in->myCapacity;
+            in->myData = NULL;
+            in->myDend = NULL;
+            in->myCapacity = 0;
+        }
+
         ////////////////////////////////////////////////////////////////////////////////////////////////////
         /// <summary>Destructively allocates len bytes for the SqrlString.</summary>
         /// 
@@ -590,13 +652,13 @@ namespace libsqrl
                 this->myDend = this->myData + oldLen;
                 memset( this->myData, 0, len + 1 );
                 memcpy( this->myData, oldData, oldLen );
-                delete oldData;
+                delete[] oldData;
             }
         }
         /// <summary>Deallocates this SqrlString.</summary>
         virtual void deallocate() {
             if( this->myData ) {
-                delete this->myData;
+                delete[] this->myData;
                 this->myData = NULL;
             }
             this->myDend = NULL;
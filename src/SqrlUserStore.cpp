@@ -0,0 +1,626 @@
+/** \file SqrlUserStore.cpp
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#include "sqrl_internal.h"
+#include "SqrlUserStore.h"
+
+#include <new>
+#include <stddef.h>
+
+#define USER_SLOT_EMPTY   0
+#define USER_SLOT_USED    1
+#define USER_SLOT_DELETED 2
+#define USER_SLOT_STATE_MASK 0xFFFF
+#define USER_SLOT_NONE ((size_t)-1)
+#define USER_SLOT_ALIGN 64
+#define USER_TAG_EMPTY   0
+#define USER_TAG_DELETED 1
+#define USER_STORE_MIN_EMPTY 8      // rehash once fewer than 1/8 of the slots are empty
+
+#define USER_LOG_MAGIC 0x55515153   // "SQQU"
+#define USER_LOG_CREATE 1
+#define USER_LOG_UPDATE 2
+#define USER_LOG_REMOVE 3
+#define USER_LOG_REKEY  4
+
+namespace libsqrl
+{
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>One user: two cache lines.</summary>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    struct Sqrl_User_Slot
+    {
+        std::atomic<uint32_t> seq;              // odd while a writer is changing the slot
+        std::atomic<uint32_t> state;            // USER_SLOT_*, with the user's flags in the top half
+        std::atomic<uint64_t> site;
+        std::atomic<uint64_t> keys[12];         // idk, suk, vuk
+        uint64_t pad[2];
+    };
+
+    /// <summary>A consistent copy of a slot, taken without locking.</summary>
+    struct Sqrl_User_Copy
+    {
+        uint32_t state;
+        uint64_t site;
+        uint64_t keys[12];
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>One change to the store, as written to the log.</summary>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    struct Sqrl_User_Log_Entry
+    {
+        uint32_t magic;
+        uint8_t op;                             // USER_LOG_*
+        uint8_t reserved;
+        uint16_t flags;
+        uint64_t site;
+        uint8_t idk[SQRL_KEY_SIZE];
+        uint8_t suk[SQRL_KEY_SIZE];
+        uint8_t vuk[SQRL_KEY_SIZE];
+        uint8_t pidk[SQRL_KEY_SIZE];
+        uint8_t check[16];                      // BLAKE2b of the above; catches a torn final write
+    };
+
+    static_assert(sizeof( struct Sqrl_User_Slot ) == 128, "Sqrl_User_Slot should be two cache lines");
+    static_assert(sizeof( struct Sqrl_User_Log_Entry ) == 160, "Sqrl_User_Log_Entry has padding");
+
+    static inline uint64_t user_store_mix( uint64_t x ) {
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+
+    /// <summary>The slot a hash starts probing at.</summary>
+    static inline size_t user_store_index( uint64_t h, size_t count ) {
+        return (size_t)(((h & 0xFFFFFFFFULL) * count) >> 32);
+    }
+
+    /// <summary>The tag a hash is filed under; never USER_TAG_EMPTY or USER_TAG_DELETED.</summary>
+    static inline uint32_t user_store_tag( uint64_t h ) {
+        uint32_t tag = (uint32_t)(h >> 32);
+        return tag > USER_TAG_DELETED ? tag : tag + 2;
+    }
+
+    static void user_slot_read( const struct Sqrl_User_Slot *s, struct Sqrl_User_Copy *c ) {
+        uint32_t before, after;
+        do {
+            before = s->seq.load( std::memory_order_acquire );
+            c->state = s->state.load( std::memory_order_relaxed );
+            c->site = s->site.load( std::memory_order_relaxed );
+            for( int i = 0; i < 12; i++ ) {
+                c->keys[i] = s->keys[i].load( std::memory_order_relaxed );
+            }
+            std::atomic_thread_fence( std::memory_order_acquire );
+            after = s->seq.load( std::memory_order_relaxed );
+        } while( (before & 1) || before != after );
+    }
+
+    static void user_log_seal( struct Sqrl_User_Log_Entry *e ) {
+        e->magic = USER_LOG_MAGIC;
+        crypto_generichash( e->check, sizeof( e->check ), (const unsigned char*)e,
+            offsetof( struct Sqrl_User_Log_Entry, check ), NULL, 0 );
+    }
+
+    static bool user_log_valid( const struct Sqrl_User_Log_Entry *e ) {
+        uint8_t check[16];
+        if( e->magic != USER_LOG_MAGIC ) return false;
+        crypto_generichash( check, sizeof( check ), (const unsigned char*)e,
+            offsetof( struct Sqrl_User_Log_Entry, check ), NULL, 0 );
+        return 0 == memcmp( check, e->check, sizeof( check ) );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Constructor.</summary>
+    ///
+    /// <param name="capacity">The most users to hold.  Each takes 165 bytes; the table is kept at most
+    /// 80% full.</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    SqrlUserStore::SqrlUserStore( size_t capacity ) :
+        mem( NULL ), slots( NULL ), tags( NULL ), generation( 0 ), slotCount( 0 ), capacity( 0 ), size( 0 ),
+        deleted( 0 ), fp( NULL ) {
+        sqrl_randombytes( &this->seed, sizeof( this->seed ) );
+        if( capacity > 0x40000000 ) capacity = 0x40000000;
+        size_t count = capacity + capacity / 4 + 1;
+        if( count < 16 ) count = 16;
+        this->mem = malloc( count * (sizeof( struct Sqrl_User_Slot ) + sizeof( uint32_t )) + USER_SLOT_ALIGN );
+        if( !this->mem ) return;
+        uintptr_t p = ((uintptr_t)this->mem + USER_SLOT_ALIGN - 1) & ~(uintptr_t)(USER_SLOT_ALIGN - 1);
+        this->slots = (struct Sqrl_User_Slot*)p;
+        this->tags = (std::atomic<uint32_t>*)(this->slots + count);
+        for( size_t i = 0; i < count; i++ ) {
+            new (&this->tags[i]) std::atomic<uint32_t>( USER_TAG_EMPTY );
+            struct Sqrl_User_Slot *s = new (&this->slots[i]) struct Sqrl_User_Slot;
+            s->seq.store( 0, std::memory_order_relaxed );
+            s->state.store( USER_SLOT_EMPTY, std::memory_order_relaxed );
+            s->site.store( 0, std::memory_order_relaxed );
+            for( int j = 0; j < 12; j++ ) s->keys[j].store( 0, std::memory_order_relaxed );
+        }
+        this->slotCount = count;
+        this->capacity = capacity;
+    }
+
+    SqrlUserStore::~SqrlUserStore() {
+        this->close();
+        if( this->mem ) free( this->mem );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Gets the id a site's users are stored under.</summary>
+    ///
+    /// <param name="siteKey">The site key (SqrlUri::getSiteKey()).</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    uint64_t SqrlUserStore::siteId( const SqrlString *siteKey ) {
+        uint8_t h[16];
+        uint64_t id;
+        crypto_generichash( h, sizeof( h ), siteKey ? siteKey->cdata() : NULL,
+            siteKey ? siteKey->length() : 0, NULL, 0 );
+        memcpy( &id, h, sizeof( id ) );
+        return id;
+    }
+
+    /// <summary>Identity keys come from clients, so the slot depends on a secret seed.</summary>
+    uint64_t SqrlUserStore::hash( uint64_t site, const uint8_t *idk ) {
+        uint64_t h = user_store_mix( this->seed ^ site );
+        for( int i = 0; i < SQRL_KEY_SIZE; i += 8 ) {
+            uint64_t w;
+            memcpy( &w, idk + i, 8 );
+            h = user_store_mix( h ^ w );
+        }
+        return h;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Finds a user's slot.  Writers only.</summary>
+    ///
+    /// <param name="vacant">[out] If not NULL, receives the slot a new user with this key would go in,
+    /// 				   or USER_SLOT_NONE if the table is full.</param>
+    ///
+    /// <returns>The user's slot, or USER_SLOT_NONE.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    size_t SqrlUserStore::locate( uint64_t h, uint64_t site, const uint8_t *idk, size_t *vacant ) {
+        size_t i = user_store_index( h, this->slotCount );
+        uint32_t tag = user_store_tag( h );
+        if( vacant ) *vacant = USER_SLOT_NONE;
+        for( size_t n = 0; n < this->slotCount; n++ ) {
+            uint32_t t = this->tags[i].load( std::memory_order_relaxed );
+            if( t == USER_TAG_EMPTY ) {
+                if( vacant && *vacant == USER_SLOT_NONE ) *vacant = i;
+                return USER_SLOT_NONE;
+            }
+            if( t == USER_TAG_DELETED ) {
+                if( vacant && *vacant == USER_SLOT_NONE ) *vacant = i;
+            } else if( t == tag ) {
+                struct Sqrl_User_Slot *s = &this->slots[i];
+                uint64_t k[4];
+                for( int j = 0; j < 4; j++ ) k[j] = s->keys[j].load( std::memory_order_relaxed );
+                if( s->site.load( std::memory_order_relaxed ) == site && 0 == memcmp( k, idk, SQRL_KEY_SIZE ) ) {
+                    return i;
+                }
+            }
+            if( ++i == this->slotCount ) i = 0;
+        }
+        return USER_SLOT_NONE;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Rewrites a slot, bumping its sequence around the change.  Writers only.</summary>
+    ///
+    /// <remarks>Keys left NULL keep their current value.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    void SqrlUserStore::write( size_t i, uint32_t state, uint64_t site, const uint8_t *idk,
+        const uint8_t *suk, const uint8_t *vuk, uint16_t flags ) {
+        struct Sqrl_User_Slot *s = &this->slots[i];
+        const uint8_t *keys[3] = { idk, suk, vuk };
+        uint32_t seq = s->seq.load( std::memory_order_relaxed );
+        s->seq.store( seq + 1, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_release );
+        s->state.store( state | ((uint32_t)flags << 16), std::memory_order_relaxed );
+        s->site.store( site, std::memory_order_relaxed );
+        for( int k = 0; k < 3; k++ ) {
+            if( !keys[k] ) continue;
+            for( int j = 0; j < 4; j++ ) {
+                uint64_t w;
+                memcpy( &w, keys[k] + j * 8, 8 );
+                s->keys[k * 4 + j].store( w, std::memory_order_relaxed );
+            }
+        }
+        s->seq.store( seq + 2, std::memory_order_release );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Rehashes the table in place, so tombstones become empty slots again.  Writers only.
+    /// </summary>
+    ///
+    /// <remarks>Lookups that miss while this runs look again; see find().</remarks>
+    ///
+    /// <returns>false if there wasn't memory to hold the users while they are moved.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlUserStore::rebuild() {
+        struct Sqrl_User_Copy *live = (struct Sqrl_User_Copy*)malloc( (this->size + 1) * sizeof( struct Sqrl_User_Copy ) );
+        if( !live ) return false;
+        size_t n = 0;
+        for( size_t i = 0; i < this->slotCount && n < this->size; i++ ) {
+            if( this->tags[i].load( std::memory_order_relaxed ) > USER_TAG_DELETED ) {
+                user_slot_read( &this->slots[i], &live[n++] );
+            }
+        }
+
+        uint32_t gen = this->generation.load( std::memory_order_relaxed );
+        this->generation.store( gen + 1, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_release );
+        for( size_t i = 0; i < this->slotCount; i++ ) {
+            if( this->tags[i].load( std::memory_order_relaxed ) == USER_TAG_EMPTY ) continue;
+            this->tags[i].store( USER_TAG_EMPTY, std::memory_order_relaxed );
+            this->write( i, USER_SLOT_EMPTY, 0, NULL, NULL, NULL, 0 );
+        }
+        for( size_t k = 0; k < n; k++ ) {
+            const uint8_t *keys = (const uint8_t*)live[k].keys;
+            uint64_t h = this->hash( live[k].site, keys );
+            size_t i = user_store_index( h, this->slotCount );
+            while( this->tags[i].load( std::memory_order_relaxed ) != USER_TAG_EMPTY ) {
+                if( ++i == this->slotCount ) i = 0;
+            }
+            this->write( i, USER_SLOT_USED, live[k].site, keys, keys + SQRL_KEY_SIZE, keys + 2 * SQRL_KEY_SIZE,
+                (uint16_t)(live[k].state >> 16) );
+            this->tags[i].store( user_store_tag( h ), std::memory_order_release );
+        }
+        this->generation.store( gen + 2, std::memory_order_release );
+        this->deleted = 0;
+        free( live );
+        return true;
+    }
+
+    /// <summary>Leaves a tombstone in a user's slot, rehashing if too few empty slots remain.  Writers
+    /// only.</summary>
+    void SqrlUserStore::vacate( size_t i ) {
+        this->write( i, USER_SLOT_DELETED, this->slots[i].site.load( std::memory_order_relaxed ), NULL, NULL, NULL, 0 );
+        this->tags[i].store( USER_TAG_DELETED, std::memory_order_release );
+        this->deleted++;
+        if( this->slotCount - this->size - this->deleted < this->slotCount / USER_STORE_MIN_EMPTY ) {
+            this->rebuild();
+        }
+    }
+
+    /// <summary>Makes one change to the table.  Writers only.</summary>
+    bool SqrlUserStore::apply( const struct Sqrl_User_Log_Entry *e ) {
+        uint64_t h = this->hash( e->site, e->idk );
+        size_t i, j, vacant;
+        switch( e->op ) {
+        case USER_LOG_CREATE:
+            if( this->size >= this->capacity ) return false;
+            if( USER_SLOT_NONE != this->locate( h, e->site, e->idk, &vacant ) || vacant == USER_SLOT_NONE ) return false;
+            if( this->tags[vacant].load( std::memory_order_relaxed ) == USER_TAG_DELETED ) this->deleted--;
+            this->write( vacant, USER_SLOT_USED, e->site, e->idk, e->suk, e->vuk, e->flags );
+            this->tags[vacant].store( user_store_tag( h ), std::memory_order_release );
+            this->size++;
+            return true;
+        case USER_LOG_UPDATE:
+            i = this->locate( h, e->site, e->idk, NULL );
+            if( i == USER_SLOT_NONE ) return false;
+            this->write( i, USER_SLOT_USED, e->site, NULL, NULL, NULL, e->flags );
+            return true;
+        case USER_LOG_REMOVE:
+            i = this->locate( h, e->site, e->idk, NULL );
+            if( i == USER_SLOT_NONE ) return false;
+            this->size--;
+            this->vacate( i );
+            return true;
+        case USER_LOG_REKEY:
+            // The new record goes in before the old one goes, so a reader always finds one of them.
+            i = this->locate( this->hash( e->site, e->pidk ), e->site, e->pidk, NULL );
+            if( i == USER_SLOT_NONE ) return false;
+            j = this->locate( h, e->site, e->idk, &vacant );
+            if( j != USER_SLOT_NONE || vacant == USER_SLOT_NONE ) return false;
+            if( this->tags[vacant].load( std::memory_order_relaxed ) == USER_TAG_DELETED ) this->deleted--;
+            this->write( vacant, USER_SLOT_USED, e->site, e->idk, e->suk, e->vuk, e->flags );
+            this->tags[vacant].store( user_store_tag( h ), std::memory_order_release );
+            this->vacate( i );
+            return true;
+        }
+        return false;
+    }
+
+    /// <summary>Appends a change to the log, if there is one.  Writers only.</summary>
+    bool SqrlUserStore::log( struct Sqrl_User_Log_Entry *e ) {
+        if( !this->fp ) return true;
+        user_log_seal( e );
+        return 1 == fwrite( e, sizeof( struct Sqrl_User_Log_Entry ), 1, this->fp ) &&
+            0 == fflush( this->fp );
+    }
+
+    /// <summary>Replaces the log with one holding just the current users.  Writers only.</summary>
+    bool SqrlUserStore::rewrite() {
+        if( this->path.length() == 0 ) return false;
+        SqrlString tmp( &this->path );
+        tmp.append( ".tmp" );
+        FILE *out = fopen( tmp.cstring(), "wb" );
+        if( !out ) return false;
+
+        bool ok = true;
+        struct Sqrl_User_Log_Entry e;
+        for( size_t i = 0; ok && i < this->slotCount; i++ ) {
+            struct Sqrl_User_Copy c;
+            user_slot_read( &this->slots[i], &c );
+            if( (c.state & USER_SLOT_STATE_MASK) != USER_SLOT_USED ) continue;
+            memset( &e, 0, sizeof( e ) );
+            e.op = USER_LOG_CREATE;
+            e.flags = (uint16_t)(c.state >> 16);
+            e.site = c.site;
+            memcpy( e.idk, &c.keys[0], SQRL_KEY_SIZE );
+            memcpy( e.suk, &c.keys[4], SQRL_KEY_SIZE );
+            memcpy( e.vuk, &c.keys[8], SQRL_KEY_SIZE );
+            user_log_seal( &e );
+            ok = 1 == fwrite( &e, sizeof( e ), 1, out );
+        }
+        ok = (0 == fflush( out )) && ok;
+        fclose( out );
+        if( !ok ) {
+            ::remove( tmp.cstring() );
+            return false;
+        }
+
+        if( this->fp ) {
+            fclose( this->fp );
+            this->fp = NULL;
+        }
+#if defined(_WIN32)
+        ::remove( this->path.cstring() );
+#endif
+        if( 0 != rename( tmp.cstring(), this->path.cstring() ) ) return false;
+        this->fp = fopen( this->path.cstring(), "ab" );
+        return this->fp != NULL;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Loads the users saved in a log file, and logs every later change to it.</summary>
+    ///
+    /// <remarks>
+    /// Call this before the store is used.  The file is created if it doesn't exist.  If its final
+    /// entry was only partly written, that entry is dropped and the file is compacted.</remarks>
+    ///
+    /// <param name="path">The log file.</param>
+    ///
+    /// <returns>true on success; false if the file couldn't be opened for writing.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlUserStore::open( const char *path ) {
+        if( !path || !this->slots ) return false;
+        bool torn = false, ok;
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_LOCK( &this->mutex )
+#endif
+        if( this->fp ) {
+            fclose( this->fp );
+            this->fp = NULL;
+        }
+        this->path.clear();
+        this->path.append( path );
+
+        FILE *in = fopen( path, "rb" );
+        if( in ) {
+            struct Sqrl_User_Log_Entry e;
+            size_t got;
+            while( (got = fread( &e, 1, sizeof( e ), in )) == sizeof( e ) ) {
+                if( !user_log_valid( &e ) ) break;
+                this->apply( &e );
+            }
+            torn = got != 0;
+            fclose( in );
+        }
+        if( torn ) {
+            ok = this->rewrite();
+        } else {
+            this->fp = fopen( path, "ab" );
+            ok = this->fp != NULL;
+        }
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_UNLOCK( &this->mutex )
+#endif
+        return ok;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Rehashes the table, clearing the tombstones removed users left, and rewrites the log
+    /// with only the users currently held, dropping their history.</summary>
+    ///
+    /// <returns>true if the log was rewritten; false if it couldn't be, or there is none.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlUserStore::compact() {
+        bool ok;
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_LOCK( &this->mutex )
+#endif
+        if( this->deleted ) this->rebuild();
+        ok = this->rewrite();
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_UNLOCK( &this->mutex )
+#endif
+        return ok;
+    }
+
+    /// <summary>Stops logging changes.  The users stay in memory.</summary>
+    void SqrlUserStore::close() {
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_LOCK( &this->mutex )
+#endif
+        if( this->fp ) {
+            fclose( this->fp );
+            this->fp = NULL;
+        }
+        this->path.clear();
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_UNLOCK( &this->mutex )
+#endif
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Looks up a user.  Takes no lock.</summary>
+    ///
+    /// <param name="site"> The site id (siteId()).</param>
+    /// <param name="idk">  The user's identity key (32 bytes).</param>
+    /// <param name="suk">  [out] If not NULL, receives the user's server unlock key (32 bytes).</param>
+    /// <param name="vuk">  [out] If not NULL, receives the user's verify unlock key (32 bytes).</param>
+    /// <param name="flags">[out] If not NULL, receives the user's SQRL_SERVER_USER_FLAG_* flags.</param>
+    ///
+    /// <returns>true if the user was found.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlUserStore::find( uint64_t site, const uint8_t *idk, uint8_t *suk, uint8_t *vuk, uint16_t *flags ) {
+        if( !idk || !this->slots ) return false;
+        uint64_t h = this->hash( site, idk );
+        uint32_t tag = user_store_tag( h ), gen;
+        struct Sqrl_User_Copy c;
+        do {
+            gen = this->generation.load( std::memory_order_acquire );
+            if( gen & 1 ) continue;
+            size_t i = user_store_index( h, this->slotCount );
+            for( size_t n = 0; n < this->slotCount; n++ ) {
+                uint32_t t = this->tags[i].load( std::memory_order_acquire );
+                if( t == USER_TAG_EMPTY ) break;
+                if( t == tag ) {
+                    // The tag only narrows the search; the record itself decides.  A user found
+                    // mid-rehash has already been moved whole, so only a miss needs another look.
+                    user_slot_read( &this->slots[i], &c );
+                    if( (c.state & USER_SLOT_STATE_MASK) == USER_SLOT_USED && c.site == site &&
+                        0 == memcmp( c.keys, idk, SQRL_KEY_SIZE ) ) {
+                        if( suk ) memcpy( suk, &c.keys[4], SQRL_KEY_SIZE );
+                        if( vuk ) memcpy( vuk, &c.keys[8], SQRL_KEY_SIZE );
+                        if( flags ) *flags = (uint16_t)(c.state >> 16);
+                        return true;
+                    }
+                }
+                if( ++i == this->slotCount ) i = 0;
+            }
+            std::atomic_thread_fence( std::memory_order_acquire );
+        } while( (gen & 1) || gen != this->generation.load( std::memory_order_relaxed ) );
+        return false;
+    }
+
+#if defined(WITH_THREADS)
+#define USER_STORE_CHANGE(e, ok) \
+        SQRL_MUTEX_LOCK( &this->mutex ) \
+        ok = this->apply( &e ) && this->log( &e ); \
+        SQRL_MUTEX_UNLOCK( &this->mutex )
+#else
+#define USER_STORE_CHANGE(e, ok) \
+        ok = this->apply( &e ) && this->log( &e );
+#endif
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Adds a user.</summary>
+    ///
+    /// <returns>true on success; false if the user already exists, the store is full, or the change
+    /// couldn't be logged (it is still made).</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlUserStore::create( uint64_t site, const uint8_t *idk, const uint8_t *suk, const uint8_t *vuk, uint16_t flags ) {
+        if( !idk || !suk || !vuk || !this->slots ) return false;
+        struct Sqrl_User_Log_Entry e;
+        bool ok;
+        memset( &e, 0, sizeof( e ) );
+        e.op = USER_LOG_CREATE;
+        e.flags = flags;
+        e.site = site;
+        memcpy( e.idk, idk, SQRL_KEY_SIZE );
+        memcpy( e.suk, suk, SQRL_KEY_SIZE );
+        memcpy( e.vuk, vuk, SQRL_KEY_SIZE );
+        USER_STORE_CHANGE( e, ok )
+        return ok;
+    }
+
+    /// <summary>Changes a user's flags.  false if there is no such user.</summary>
+    bool SqrlUserStore::update( uint64_t site, const uint8_t *idk, uint16_t flags ) {
+        if( !idk || !this->slots ) return false;
+        struct Sqrl_User_Log_Entry e;
+        bool ok;
+        memset( &e, 0, sizeof( e ) );
+        e.op = USER_LOG_UPDATE;
+        e.flags = flags;
+        e.site = site;
+        memcpy( e.idk, idk, SQRL_KEY_SIZE );
+        USER_STORE_CHANGE( e, ok )
+        return ok;
+    }
+
+    /// <summary>Removes a user.  false if there is no such user.</summary>
+    bool SqrlUserStore::remove( uint64_t site, const uint8_t *idk ) {
+        if( !idk || !this->slots ) return false;
+        struct Sqrl_User_Log_Entry e;
+        bool ok;
+        memset( &e, 0, sizeof( e ) );
+        e.op = USER_LOG_REMOVE;
+        e.site = site;
+        memcpy( e.idk, idk, SQRL_KEY_SIZE );
+        USER_STORE_CHANGE( e, ok )
+        return ok;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Moves a user from their previous identity to a new one.</summary>
+    ///
+    /// <param name="site"> The site id.</param>
+    /// <param name="pidk"> The user's previous identity key, which they are stored under now.</param>
+    /// <param name="idk">  The user's new identity key.</param>
+    /// <param name="suk">  The server unlock key to store for the new identity.</param>
+    /// <param name="vuk">  The verify unlock key to store for the new identity.</param>
+    /// <param name="flags">The user's flags.</param>
+    ///
+    /// <returns>true on success; false if there is no user under pidk, or there already is one under
+    /// idk.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    bool SqrlUserStore::rekey( uint64_t site, const uint8_t *pidk, const uint8_t *idk,
+        const uint8_t *suk, const uint8_t *vuk, uint16_t flags ) {
+        if( !pidk || !idk || !suk || !vuk || !this->slots ) return false;
+        struct Sqrl_User_Log_Entry e;
+        bool ok;
+        memset( &e, 0, sizeof( e ) );
+        e.op = USER_LOG_REKEY;
+        e.flags = flags;
+        e.site = site;
+        memcpy( e.idk, idk, SQRL_KEY_SIZE );
+        memcpy( e.suk, suk, SQRL_KEY_SIZE );
+        memcpy( e.vuk, vuk, SQRL_KEY_SIZE );
+        memcpy( e.pidk, pidk, SQRL_KEY_SIZE );
+        USER_STORE_CHANGE( e, ok )
+        return ok;
+    }
+
+    /// <summary>Gets the number of users held.</summary>
+    size_t SqrlUserStore::getSize() {
+        size_t s;
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_LOCK( &this->mutex )
+#endif
+        s = this->size;
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_UNLOCK( &this->mutex )
+#endif
+        return s;
+    }
+
+    /// <summary>Gets the most users the store will hold.</summary>
+    size_t SqrlUserStore::getCapacity() {
+        return this->capacity;
+    }
+
+    /// <summary>Gets the number of empty slots, at which a lookup for a missing user stops.</summary>
+    size_t SqrlUserStore::getEmptySlots() {
+        size_t s;
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_LOCK( &this->mutex )
+#endif
+        s = this->slotCount - this->size - this->deleted;
+#if defined(WITH_THREADS)
+        SQRL_MUTEX_UNLOCK( &this->mutex )
+#endif
+        return s;
+    }
+
+    /// <summary>Gets the size of the table, in bytes.</summary>
+    size_t SqrlUserStore::getMemoryUsage() {
+        return this->slotCount * (sizeof( struct Sqrl_User_Slot ) + sizeof( uint32_t ));
+    }
+}
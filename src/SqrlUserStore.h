@@ -0,0 +1,98 @@
+/** \file SqrlUserStore.h
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#ifndef SQRLUSERSTORE_H
+#define SQRLUSERSTORE_H
+
+#include <atomic>
+#include <stdio.h>
+#include "sqrl.h"
+#include "SqrlString.h"
+
+namespace libsqrl
+{
+#define SQRL_USER_STORE_DEFAULT_CAPACITY 65536
+
+    struct Sqrl_User_Slot;
+    struct Sqrl_User_Log_Entry;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>An in-process store of SQRL users, keyed by site and identity key.</summary>
+    ///
+    /// <remarks>
+    /// Users are fixed-size records (idk, suk, vuk, flags) in one open addressing table, sized at
+    /// construction for 'capacity' users.  Probes run over a separate array of 32 bit hash tags, 16
+    /// to a cache line, and only visit a record when its tag matches.  Each record carries a sequence
+    /// number that is odd while a writer is changing it, so lookups take no lock: a reader copies the
+    /// record and retries if the sequence moved.  Writers are serialized.
+    ///
+    /// Removed users leave tombstones, which probes have to step over.  Once fewer than an eighth of
+    /// the slots are empty, the table is rehashed in place; it has a sequence number of its own, and
+    /// a lookup that misses while the table is rehashed looks again.
+    ///
+    /// Sites are told apart by siteId(), a hash of the site key, so one store can serve several
+    /// servers.  rekey() moves a user from their previous identity key to the new one.
+    ///
+    /// With open(), every change is also appended to a log file, which is replayed the next time the
+    /// store is opened.  The log is flushed after every change, but not synced to disk.  compact()
+    /// rehashes the table and rewrites the log with only the users currently held.  The log is in the
+    /// machine's byte order.
+    /// </remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    class DLL_PUBLIC SqrlUserStore
+    {
+    public:
+        SqrlUserStore( size_t capacity = SQRL_USER_STORE_DEFAULT_CAPACITY );
+        ~SqrlUserStore();
+
+        bool open( const char *path );
+        bool compact();
+        void close();
+
+        static uint64_t siteId( const SqrlString *siteKey );
+
+        bool find( uint64_t site, const uint8_t *idk, uint8_t *suk, uint8_t *vuk, uint16_t *flags );
+        bool create( uint64_t site, const uint8_t *idk, const uint8_t *suk, const uint8_t *vuk, uint16_t flags );
+        bool update( uint64_t site, const uint8_t *idk, uint16_t flags );
+        bool remove( uint64_t site, const uint8_t *idk );
+        bool rekey( uint64_t site, const uint8_t *pidk, const uint8_t *idk,
+            const uint8_t *suk, const uint8_t *vuk, uint16_t flags );
+
+        size_t getSize();
+        size_t getCapacity();
+        size_t getMemoryUsage();
+        size_t getEmptySlots();
+
+    private:
+        uint64_t hash( uint64_t site, const uint8_t *idk );
+        size_t locate( uint64_t h, uint64_t site, const uint8_t *idk, size_t *vacant );
+        void write( size_t i, uint32_t state, uint64_t site, const uint8_t *idk,
+            const uint8_t *suk, const uint8_t *vuk, uint16_t flags );
+        void vacate( size_t i );
+        bool rebuild();
+        bool apply( const struct Sqrl_User_Log_Entry *e );
+        bool log( struct Sqrl_User_Log_Entry *e );
+        bool rewrite();
+
+        void *mem;
+        struct Sqrl_User_Slot *slots;
+        std::atomic<uint32_t> *tags;
+        std::atomic<uint32_t> generation;       // odd while the table is rehashed
+        size_t slotCount;
+        size_t capacity;
+        size_t size;
+        size_t deleted;
+        uint64_t seed;
+        FILE *fp;
+        SqrlString path;
+#if defined(WITH_THREADS)
+        std::mutex mutex;
+#endif
+    };
+}
+#endif // SQRLUSERSTORE_H
@@ -0,0 +1,101 @@
+/** \file cpu_features.cpp
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#include "cpu_features.h"
+
+#if defined(SQRL_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace libsqrl
+{
+#define CPU_FEATURE_AVX2     0x0001
+#define CPU_FEATURE_AVX512   0x0002
+#define CPU_FEATURE_SHA      0x0004
+#define CPU_FEATURE_AESNI    0x0008
+
+    static int cpu_features = -1;
+
+#if defined(SQRL_X86)
+    static void sqrl_cpuid( uint32_t leaf, uint32_t subleaf, uint32_t out[4] ) {
+#if defined(_MSC_VER)
+        __cpuidex( (int*)out, (int)leaf, (int)subleaf );
+#else
+        __cpuid_count( leaf, subleaf, out[0], out[1], out[2], out[3] );
+#endif
+    }
+
+    static uint64_t sqrl_xgetbv() {
+#if defined(_MSC_VER)
+        return _xgetbv( 0 );
+#else
+        uint32_t eax, edx;
+        __asm__ __volatile__( "xgetbv" : "=a" (eax), "=d" (edx) : "c" (0) );
+        return ((uint64_t)edx << 32) | eax;
+#endif
+    }
+#endif
+
+    static int sqrl_cpu_features() {
+        if( cpu_features >= 0 ) return cpu_features;
+        int features = 0;
+#if defined(SQRL_X86)
+        uint32_t r[4] = {0};
+        sqrl_cpuid( 0, 0, r );
+        uint32_t maxLeaf = r[0];
+        sqrl_cpuid( 1, 0, r );
+        uint32_t leaf1ecx = r[2];
+        // AES-NI and PCLMULQDQ, with the SSSE3 / SSE4.1 shuffles our GCM code uses.
+        if( (leaf1ecx & 0x02080202) == 0x02080202 ) {
+            features |= CPU_FEATURE_AESNI;
+        }
+        if( maxLeaf >= 7 ) {
+            sqrl_cpuid( 7, 0, r );
+            // SHA extensions; our code also uses SSSE3 and SSE4.1 alongside them.
+            if( (r[1] & 0x20000000) && (leaf1ecx & 0x00080200) == 0x00080200 ) {
+                features |= CPU_FEATURE_SHA;
+            }
+        }
+        // OSXSAVE and AVX
+        if( (leaf1ecx & 0x18000000) == 0x18000000 && maxLeaf >= 7 ) {
+            uint64_t xcr0 = sqrl_xgetbv();
+            sqrl_cpuid( 7, 0, r );
+            // OS saves XMM and YMM state.
+            if( (xcr0 & 0x06) == 0x06 ) {
+                if( r[1] & 0x00000020 ) features |= CPU_FEATURE_AVX2;
+                // OS also saves opmask and ZMM state; need AVX512F and AVX512VL.
+                if( (xcr0 & 0xE0) == 0xE0 && (r[1] & 0x80010000) == 0x80010000 ) {
+                    features |= CPU_FEATURE_AVX512;
+                }
+            }
+        }
+#endif
+        cpu_features = features;
+        return features;
+    }
+
+    bool sqrl_cpu_has_avx2() {
+        return (sqrl_cpu_features() & CPU_FEATURE_AVX2) == CPU_FEATURE_AVX2;
+    }
+
+    bool sqrl_cpu_has_avx512() {
+        return (sqrl_cpu_features() & CPU_FEATURE_AVX512) == CPU_FEATURE_AVX512;
+    }
+
+    bool sqrl_cpu_has_sha() {
+        return (sqrl_cpu_features() & CPU_FEATURE_SHA) == CPU_FEATURE_SHA;
+    }
+
+    bool sqrl_cpu_has_aesni() {
+        return (sqrl_cpu_features() & CPU_FEATURE_AESNI) == CPU_FEATURE_AESNI;
+    }
+}
@@ -0,0 +1,32 @@
+/** \file cpu_features.h
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SQRL_X86
+#if defined(_MSC_VER)
+#define SQRL_TARGET(t)
+#else
+#define SQRL_TARGET(t) __attribute__((target(t)))
+#endif
+#endif
+
+namespace libsqrl
+{
+    // Runtime CPU feature detection.  Each test checks both the CPU and the OS (XSAVE state),
+    // is evaluated once, and always returns false on non-x86 platforms.
+    bool sqrl_cpu_has_avx2();
+    bool sqrl_cpu_has_avx512();
+    bool sqrl_cpu_has_sha();
+    bool sqrl_cpu_has_aesni();
+}
+#endif // CPU_FEATURES_H
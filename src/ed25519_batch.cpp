@@ -0,0 +1,696 @@
+/** \file ed25519_batch.cpp
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#include "sqrl_internal.h"
+#include "ed25519_batch.h"
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+#if defined(SQRL_ED25519_BATCH)
+
+namespace libsqrl
+{
+#if defined(__SIZEOF_INT128__)
+    typedef unsigned __int128 ed_u128;
+#else
+    /// <summary>Just enough of a 128 bit integer for the field arithmetic below, where the compiler
+    /// has none: products of two 64 bit values, sums, shifts right by less than 64.</summary>
+    struct ed_u128
+    {
+        uint64_t lo, hi;
+        ed_u128() {}
+        ed_u128( uint64_t v ) : lo( v ), hi( 0 ) {}
+        explicit operator uint64_t() const { return this->lo; }
+    };
+
+    static inline ed_u128 operator*( const ed_u128 &a, const ed_u128 &b ) {
+        ed_u128 r;
+#if defined(_MSC_VER) && defined(_M_X64)
+        r.lo = _umul128( a.lo, b.lo, &r.hi );
+#else
+        uint64_t a0 = a.lo & 0xFFFFFFFF, a1 = a.lo >> 32;
+        uint64_t b0 = b.lo & 0xFFFFFFFF, b1 = b.lo >> 32;
+        uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+        uint64_t mid = (p00 >> 32) + (p01 & 0xFFFFFFFF) + (p10 & 0xFFFFFFFF);
+        r.lo = (p00 & 0xFFFFFFFF) | (mid << 32);
+        r.hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+#endif
+        return r;
+    }
+
+    static inline ed_u128 operator+( const ed_u128 &a, const ed_u128 &b ) {
+        ed_u128 r;
+        r.lo = a.lo + b.lo;
+        r.hi = a.hi + b.hi + (r.lo < a.lo);
+        return r;
+    }
+
+    static inline ed_u128 &operator+=( ed_u128 &a, const ed_u128 &b ) {
+        a = a + b;
+        return a;
+    }
+
+    static inline ed_u128 operator>>( const ed_u128 &a, int n ) {
+        ed_u128 r;
+        r.lo = (a.lo >> n) | (a.hi << (64 - n));
+        r.hi = a.hi >> n;
+        return r;
+    }
+#endif
+    typedef uint64_t ed_fe[5];
+
+#define ED_MASK51 0x7FFFFFFFFFFFFULL
+#define ED_BASE_WINDOW 8
+#define ED_POINT_WINDOW 5
+#define ED_BASE_TABLE (1 << (ED_BASE_WINDOW - 2))
+#define ED_POINT_TABLE (1 << (ED_POINT_WINDOW - 2))
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    // Field arithmetic mod p = 2^255 - 19, in five 51 bit limbs.  Limbs are kept below 2^52 between
+    // operations, so products never overflow 128 bits.
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+
+    static inline uint64_t ed_load64( const uint8_t *s ) {
+        uint64_t r = 0;
+        for( int i = 7; i >= 0; i-- ) r = (r << 8) | s[i];
+        return r;
+    }
+
+    static inline void fe_copy( ed_fe h, const ed_fe f ) {
+        for( int i = 0; i < 5; i++ ) h[i] = f[i];
+    }
+
+    static inline void fe_set( ed_fe h, uint64_t v ) {
+        h[0] = v; h[1] = h[2] = h[3] = h[4] = 0;
+    }
+
+    static inline void fe_carry( ed_fe h ) {
+        uint64_t c;
+        c = h[0] >> 51; h[0] &= ED_MASK51; h[1] += c;
+        c = h[1] >> 51; h[1] &= ED_MASK51; h[2] += c;
+        c = h[2] >> 51; h[2] &= ED_MASK51; h[3] += c;
+        c = h[3] >> 51; h[3] &= ED_MASK51; h[4] += c;
+        c = h[4] >> 51; h[4] &= ED_MASK51; h[0] += c * 19;
+    }
+
+    static void fe_frombytes( ed_fe h, const uint8_t s[32] ) {
+        h[0] = ed_load64( s ) & ED_MASK51;
+        h[1] = (ed_load64( s + 6 ) >> 3) & ED_MASK51;
+        h[2] = (ed_load64( s + 12 ) >> 6) & ED_MASK51;
+        h[3] = (ed_load64( s + 19 ) >> 1) & ED_MASK51;
+        h[4] = (ed_load64( s + 24 ) >> 12) & ED_MASK51;
+    }
+
+    static void fe_tobytes( uint8_t s[32], const ed_fe f ) {
+        ed_fe h;
+        fe_copy( h, f );
+        fe_carry( h );
+        fe_carry( h );
+        // Now h < 2^255 + 19 * 2^-51ish; subtract p once if h >= p.
+        uint64_t q = (h[0] + 19) >> 51;
+        q = (h[1] + q) >> 51;
+        q = (h[2] + q) >> 51;
+        q = (h[3] + q) >> 51;
+        q = (h[4] + q) >> 51;
+        h[0] += 19 * q;
+        uint64_t c;
+        c = h[0] >> 51; h[0] &= ED_MASK51; h[1] += c;
+        c = h[1] >> 51; h[1] &= ED_MASK51; h[2] += c;
+        c = h[2] >> 51; h[2] &= ED_MASK51; h[3] += c;
+        c = h[3] >> 51; h[3] &= ED_MASK51; h[4] += c;
+        h[4] &= ED_MASK51;
+
+        uint64_t w[4];
+        w[0] = h[0] | (h[1] << 51);
+        w[1] = (h[1] >> 13) | (h[2] << 38);
+        w[2] = (h[2] >> 26) | (h[3] << 25);
+        w[3] = (h[3] >> 39) | (h[4] << 12);
+        for( int i = 0; i < 4; i++ ) {
+            for( int j = 0; j < 8; j++ ) s[i * 8 + j] = (uint8_t)(w[i] >> (8 * j));
+        }
+    }
+
+    static inline void fe_add( ed_fe h, const ed_fe f, const ed_fe g ) {
+        for( int i = 0; i < 5; i++ ) h[i] = f[i] + g[i];
+        fe_carry( h );
+    }
+
+    static inline void fe_sub( ed_fe h, const ed_fe f, const ed_fe g ) {
+        // Add 4p first so no limb goes negative.
+        h[0] = f[0] + 0x1FFFFFFFFFFFB4ULL - g[0];
+        h[1] = f[1] + 0x1FFFFFFFFFFFFCULL - g[1];
+        h[2] = f[2] + 0x1FFFFFFFFFFFFCULL - g[2];
+        h[3] = f[3] + 0x1FFFFFFFFFFFFCULL - g[3];
+        h[4] = f[4] + 0x1FFFFFFFFFFFFCULL - g[4];
+        fe_carry( h );
+    }
+
+    static inline void fe_neg( ed_fe h, const ed_fe f ) {
+        ed_fe zero;
+        fe_set( zero, 0 );
+        fe_sub( h, zero, f );
+    }
+
+    static inline void fe_reduce_wide( ed_fe h, ed_u128 r0, ed_u128 r1, ed_u128 r2, ed_u128 r3, ed_u128 r4 ) {
+        uint64_t c;
+        r1 += (uint64_t)(r0 >> 51); h[0] = (uint64_t)r0 & ED_MASK51;
+        r2 += (uint64_t)(r1 >> 51); h[1] = (uint64_t)r1 & ED_MASK51;
+        r3 += (uint64_t)(r2 >> 51); h[2] = (uint64_t)r2 & ED_MASK51;
+        r4 += (uint64_t)(r3 >> 51); h[3] = (uint64_t)r3 & ED_MASK51;
+        c = (uint64_t)(r4 >> 51); h[4] = (uint64_t)r4 & ED_MASK51;
+        h[0] += c * 19;
+        c = h[0] >> 51; h[0] &= ED_MASK51; h[1] += c;
+    }
+
+    static void fe_mul( ed_fe h, const ed_fe f, const ed_fe g ) {
+        uint64_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+        uint64_t g0 = g[0], g1 = g[1], g2 = g[2], g3 = g[3], g4 = g[4];
+        uint64_t g1_19 = 19 * g1, g2_19 = 19 * g2, g3_19 = 19 * g3, g4_19 = 19 * g4;
+        ed_u128 r0 = (ed_u128)f0 * g0 + (ed_u128)f1 * g4_19 + (ed_u128)f2 * g3_19 + (ed_u128)f3 * g2_19 + (ed_u128)f4 * g1_19;
+        ed_u128 r1 = (ed_u128)f0 * g1 + (ed_u128)f1 * g0 + (ed_u128)f2 * g4_19 + (ed_u128)f3 * g3_19 + (ed_u128)f4 * g2_19;
+        ed_u128 r2 = (ed_u128)f0 * g2 + (ed_u128)f1 * g1 + (ed_u128)f2 * g0 + (ed_u128)f3 * g4_19 + (ed_u128)f4 * g3_19;
+        ed_u128 r3 = (ed_u128)f0 * g3 + (ed_u128)f1 * g2 + (ed_u128)f2 * g1 + (ed_u128)f3 * g0 + (ed_u128)f4 * g4_19;
+        ed_u128 r4 = (ed_u128)f0 * g4 + (ed_u128)f1 * g3 + (ed_u128)f2 * g2 + (ed_u128)f3 * g1 + (ed_u128)f4 * g0;
+        fe_reduce_wide( h, r0, r1, r2, r3, r4 );
+    }
+
+    static void fe_sq( ed_fe h, const ed_fe f ) {
+        uint64_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+        uint64_t f0_2 = 2 * f0, f1_2 = 2 * f1;
+        uint64_t f1_38 = 38 * f1, f2_38 = 38 * f2, f3_38 = 38 * f3;
+        uint64_t f3_19 = 19 * f3, f4_19 = 19 * f4;
+        ed_u128 r0 = (ed_u128)f0 * f0 + (ed_u128)f1_38 * f4 + (ed_u128)f2_38 * f3;
+        ed_u128 r1 = (ed_u128)f0_2 * f1 + (ed_u128)f2_38 * f4 + (ed_u128)f3_19 * f3;
+        ed_u128 r2 = (ed_u128)f0_2 * f2 + (ed_u128)f1 * f1 + (ed_u128)f3_38 * f4;
+        ed_u128 r3 = (ed_u128)f0_2 * f3 + (ed_u128)f1_2 * f2 + (ed_u128)f4_19 * f4;
+        ed_u128 r4 = (ed_u128)f0_2 * f4 + (ed_u128)f1_2 * f3 + (ed_u128)f2 * f2;
+        fe_reduce_wide( h, r0, r1, r2, r3, r4 );
+    }
+
+    static void fe_sqn( ed_fe h, const ed_fe f, int n ) {
+        fe_sq( h, f );
+        while( --n > 0 ) fe_sq( h, h );
+    }
+
+    /// <summary>Computes z^(2^250 - 1), and z^11, the common part of inversion and square roots.</summary>
+    static void fe_pow2_250( ed_fe out, ed_fe z11, const ed_fe z ) {
+        ed_fe t0, t1, t2;
+        fe_sq( t0, z );             // 2
+        fe_sqn( t1, t0, 2 );        // 8
+        fe_mul( t1, t1, z );        // 9
+        fe_mul( z11, t0, t1 );      // 11
+        fe_sq( t0, z11 );           // 22
+        fe_mul( t0, t0, t1 );       // 2^5 - 1
+        fe_sqn( t1, t0, 5 );
+        fe_mul( t0, t1, t0 );       // 2^10 - 1
+        fe_sqn( t1, t0, 10 );
+        fe_mul( t1, t1, t0 );       // 2^20 - 1
+        fe_sqn( t2, t1, 20 );
+        fe_mul( t1, t2, t1 );       // 2^40 - 1
+        fe_sqn( t1, t1, 10 );
+        fe_mul( t0, t1, t0 );       // 2^50 - 1
+        fe_sqn( t1, t0, 50 );
+        fe_mul( t1, t1, t0 );       // 2^100 - 1
+        fe_sqn( t2, t1, 100 );
+        fe_mul( t1, t2, t1 );       // 2^200 - 1
+        fe_sqn( t1, t1, 50 );
+        fe_mul( out, t1, t0 );      // 2^250 - 1
+    }
+
+    static void fe_invert( ed_fe out, const ed_fe z ) {
+        ed_fe t, z11;
+        fe_pow2_250( t, z11, z );
+        fe_sqn( t, t, 5 );
+        fe_mul( out, t, z11 );      // 2^255 - 21
+    }
+
+    static void fe_pow22523( ed_fe out, const ed_fe z ) {
+        ed_fe t, z11;
+        fe_pow2_250( t, z11, z );
+        fe_sqn( t, t, 2 );
+        fe_mul( out, t, z );        // 2^252 - 3
+    }
+
+    static bool fe_iszero( const ed_fe f ) {
+        uint8_t s[32];
+        fe_tobytes( s, f );
+        uint8_t r = 0;
+        for( int i = 0; i < 32; i++ ) r |= s[i];
+        return r == 0;
+    }
+
+    static bool fe_equal( const ed_fe f, const ed_fe g ) {
+        ed_fe d;
+        fe_sub( d, f, g );
+        return fe_iszero( d );
+    }
+
+    static int fe_isnegative( const ed_fe f ) {
+        uint8_t s[32];
+        fe_tobytes( s, f );
+        return s[0] & 1;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    // Points on -x^2 + y^2 = 1 + d x^2 y^2, in the ref10 representations:
+    //   p2: (X:Y:Z)             x = X/Z, y = Y/Z
+    //   p3: (X:Y:Z:T)           as p2, with XY = ZT
+    //   p1p1: ((X:Z),(Y:T))     x = X/Z, y = Y/T; the result of an addition or doubling
+    //   cached: (Y+X, Y-X, Z, 2dT), the second operand of an addition
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+
+    struct ed_p2 { ed_fe X, Y, Z; };
+    struct ed_p3 { ed_fe X, Y, Z, T; };
+    struct ed_p1p1 { ed_fe X, Y, Z, T; };
+    struct ed_cached { ed_fe YplusX, YminusX, Z, T2d; };
+
+    struct ed_consts
+    {
+        ed_fe d;
+        ed_fe d2;
+        ed_fe sqrtm1;
+        ed_cached base[ED_BASE_TABLE];  // B, 3B, 5B, ...
+    };
+
+    static void ed_p2_tobytes( uint8_t s[32], const ed_p2 *p ) {
+        ed_fe recip, x, y;
+        fe_invert( recip, p->Z );
+        fe_mul( x, p->X, recip );
+        fe_mul( y, p->Y, recip );
+        fe_tobytes( s, y );
+        s[31] ^= (uint8_t)(fe_isnegative( x ) << 7);
+    }
+
+    static inline void ed_p1p1_to_p2( ed_p2 *r, const ed_p1p1 *p ) {
+        fe_mul( r->X, p->X, p->T );
+        fe_mul( r->Y, p->Y, p->Z );
+        fe_mul( r->Z, p->Z, p->T );
+    }
+
+    static inline void ed_p1p1_to_p3( ed_p3 *r, const ed_p1p1 *p ) {
+        fe_mul( r->X, p->X, p->T );
+        fe_mul( r->Y, p->Y, p->Z );
+        fe_mul( r->Z, p->Z, p->T );
+        fe_mul( r->T, p->X, p->Y );
+    }
+
+    static inline void ed_p3_to_cached( ed_cached *r, const ed_p3 *p, const ed_consts *k ) {
+        fe_add( r->YplusX, p->Y, p->X );
+        fe_sub( r->YminusX, p->Y, p->X );
+        fe_copy( r->Z, p->Z );
+        fe_mul( r->T2d, p->T, k->d2 );
+    }
+
+    static void ed_p2_dbl( ed_p1p1 *r, const ed_fe X, const ed_fe Y, const ed_fe Z ) {
+        ed_fe t0;
+        fe_sq( r->X, X );
+        fe_sq( r->Z, Y );
+        fe_sq( r->T, Z );
+        fe_add( r->T, r->T, r->T );
+        fe_add( r->Y, X, Y );
+        fe_sq( t0, r->Y );
+        fe_add( r->Y, r->Z, r->X );
+        fe_sub( r->Z, r->Z, r->X );
+        fe_sub( r->X, t0, r->Y );
+        fe_sub( r->T, r->T, r->Z );
+    }
+
+    static void ed_add( ed_p1p1 *r, const ed_p3 *p, const ed_cached *q ) {
+        ed_fe t0;
+        fe_add( r->X, p->Y, p->X );
+        fe_sub( r->Y, p->Y, p->X );
+        fe_mul( r->Z, r->X, q->YplusX );
+        fe_mul( r->Y, r->Y, q->YminusX );
+        fe_mul( r->T, q->T2d, p->T );
+        fe_mul( r->X, p->Z, q->Z );
+        fe_add( t0, r->X, r->X );
+        fe_sub( r->X, r->Z, r->Y );
+        fe_add( r->Y, r->Z, r->Y );
+        fe_add( r->Z, t0, r->T );
+        fe_sub( r->T, t0, r->T );
+    }
+
+    static void ed_sub( ed_p1p1 *r, const ed_p3 *p, const ed_cached *q ) {
+        ed_fe t0;
+        fe_add( r->X, p->Y, p->X );
+        fe_sub( r->Y, p->Y, p->X );
+        fe_mul( r->Z, r->X, q->YminusX );
+        fe_mul( r->Y, r->Y, q->YplusX );
+        fe_mul( r->T, q->T2d, p->T );
+        fe_mul( r->X, p->Z, q->Z );
+        fe_add( t0, r->X, r->X );
+        fe_sub( r->X, r->Z, r->Y );
+        fe_add( r->Y, r->Z, r->Y );
+        fe_sub( r->Z, t0, r->T );
+        fe_add( r->T, t0, r->T );
+    }
+
+    /// <summary>true if the encoded y coordinate is less than p.</summary>
+    static bool ed_is_canonical( const uint8_t s[32] ) {
+        if( (s[31] & 0x7F) != 0x7F ) return true;
+        for( int i = 30; i > 0; i-- ) {
+            if( s[i] != 0xFF ) return true;
+        }
+        return s[0] < 0xED;
+    }
+
+    /// <summary>The group order, L = 2^252 + 27742317777372353535851937790883648493.</summary>
+    static const uint8_t ed_order[32] = {
+        0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58, 0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10 };
+
+    /// <summary>true if the scalar is less than the group order L.</summary>
+    static bool ed_scalar_is_canonical( const uint8_t s[32] ) {
+        for( int i = 31; i >= 0; i-- ) {
+            if( s[i] < ed_order[i] ) return true;
+            if( s[i] > ed_order[i] ) return false;
+        }
+        return false;
+    }
+
+    /// <summary>Decodes a point, negated.  Returns -1 if it isn't on the curve.</summary>
+    static int ed_frombytes_negate( ed_p3 *h, const uint8_t s[32], const ed_consts *k ) {
+        ed_fe u, v, v3, vxx, check, one;
+        fe_set( one, 1 );
+        fe_frombytes( h->Y, s );
+        fe_set( h->Z, 1 );
+        fe_sq( u, h->Y );
+        fe_mul( v, u, k->d );
+        fe_sub( u, u, one );            // y^2 - 1
+        fe_add( v, v, one );            // d y^2 + 1
+
+        fe_sq( v3, v );
+        fe_mul( v3, v3, v );            // v^3
+        fe_sq( h->X, v3 );
+        fe_mul( h->X, h->X, v );
+        fe_mul( h->X, h->X, u );        // u v^7
+        fe_pow22523( h->X, h->X );
+        fe_mul( h->X, h->X, v3 );
+        fe_mul( h->X, h->X, u );        // u v^3 (u v^7)^((p-5)/8)
+
+        fe_sq( vxx, h->X );
+        fe_mul( vxx, vxx, v );
+        fe_sub( check, vxx, u );
+        if( !fe_iszero( check ) ) {
+            fe_add( check, vxx, u );
+            if( !fe_iszero( check ) ) return -1;
+            fe_mul( h->X, h->X, k->sqrtm1 );
+        }
+        if( fe_isnegative( h->X ) == (s[31] >> 7) ) {
+            fe_neg( h->X, h->X );
+        }
+        fe_mul( h->T, h->X, h->Y );
+        return 0;
+    }
+
+    /// <summary>true if 8P is the identity, for P = (X:Y:Z).</summary>
+    static bool ed_has_small_order( const ed_fe X, const ed_fe Y, const ed_fe Z ) {
+        ed_p1p1 t;
+        ed_p2 q;
+        ed_p2_dbl( &t, X, Y, Z );
+        ed_p1p1_to_p2( &q, &t );
+        ed_p2_dbl( &t, q.X, q.Y, q.Z );
+        ed_p1p1_to_p2( &q, &t );
+        ed_p2_dbl( &t, q.X, q.Y, q.Z );
+        ed_p1p1_to_p2( &q, &t );
+        return fe_iszero( q.X ) && fe_equal( q.Y, q.Z );
+    }
+
+    /// <summary>Fills 'table' with P, 3P, 5P, ... (count entries).</summary>
+    static void ed_odd_multiples( ed_cached *table, int count, const ed_p3 *p, const ed_consts *k ) {
+        ed_p1p1 t;
+        ed_p3 p2, cur;
+        ed_cached c2;
+        ed_p2_dbl( &t, p->X, p->Y, p->Z );
+        ed_p1p1_to_p3( &p2, &t );
+        ed_p3_to_cached( &c2, &p2, k );
+        ed_p3_to_cached( &table[0], p, k );
+        cur = *p;
+        for( int i = 1; i < count; i++ ) {
+            ed_add( &t, &cur, &c2 );
+            ed_p1p1_to_p3( &cur, &t );
+            ed_p3_to_cached( &table[i], &cur, k );
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    // Multi-scalar multiplication (Straus), with width-w NAF scalars.
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+
+    /// <summary>Recodes a scalar below 2^255 into odd digits, |d| < 2^(w-1), with at least w-1 zeros
+    /// between nonzero digits.</summary>
+    static void ed_wnaf( int8_t naf[256], const uint8_t s[32], int w ) {
+        uint64_t x[5];
+        for( int i = 0; i < 4; i++ ) x[i] = ed_load64( s + 8 * i );
+        x[4] = 0;
+        memset( naf, 0, 256 );
+        uint64_t width = 1ULL << w;
+        uint64_t mask = width - 1;
+        uint64_t carry = 0;
+        int pos = 0;
+        while( pos < 256 ) {
+            int idx = pos / 64;
+            int bit = pos % 64;
+            uint64_t buf = x[idx] >> bit;
+            if( bit > 64 - w ) buf |= x[idx + 1] << (64 - bit);
+            uint64_t window = carry + (buf & mask);
+            if( (window & 1) == 0 ) {
+                pos++;
+                continue;
+            }
+            if( window < width / 2 ) {
+                carry = 0;
+                naf[pos] = (int8_t)window;
+            } else {
+                carry = 1;
+                naf[pos] = (int8_t)((int64_t)window - (int64_t)width);
+            }
+            pos += w;
+        }
+    }
+
+    static inline void ed_add_digit( ed_p1p1 *t, ed_p3 *u, int d, const ed_cached *table ) {
+        ed_p1p1_to_p3( u, t );
+        if( d > 0 ) ed_add( t, u, &table[d / 2] );
+        else ed_sub( t, u, &table[(-d) / 2] );
+    }
+
+    /// <summary>r = b B + sum naf_i P_i, where the P_i are given as tables of odd multiples.</summary>
+    static void ed_multiscalar( ed_p2 *r, const int8_t *bnaf, const int8_t *nafs, const ed_cached *tables,
+        size_t count, const ed_consts *k ) {
+        int top = 255;
+        while( top >= 0 ) {
+            bool any = bnaf[top] != 0;
+            for( size_t j = 0; !any && j < count; j++ ) any = nafs[j * 256 + top] != 0;
+            if( any ) break;
+            top--;
+        }
+        fe_set( r->X, 0 );
+        fe_set( r->Y, 1 );
+        fe_set( r->Z, 1 );
+
+        ed_p1p1 t;
+        ed_p3 u;
+        for( int i = top; i >= 0; i-- ) {
+            ed_p2_dbl( &t, r->X, r->Y, r->Z );
+            if( bnaf[i] ) ed_add_digit( &t, &u, bnaf[i], k->base );
+            for( size_t j = 0; j < count; j++ ) {
+                int d = nafs[j * 256 + i];
+                if( d ) ed_add_digit( &t, &u, d, tables + j * ED_POINT_TABLE );
+            }
+            ed_p1p1_to_p2( r, &t );
+        }
+    }
+
+    static ed_consts *ed_make_consts() {
+        ed_consts *k = new ed_consts;
+        ed_fe t, u;
+
+        // d = -121665 / 121666
+        fe_set( t, 121666 );
+        fe_invert( t, t );
+        fe_set( u, 121665 );
+        fe_mul( t, t, u );
+        fe_neg( k->d, t );
+        fe_add( k->d2, k->d, k->d );
+
+        // sqrt(-1) = 2^((p-1)/4) = (2^((p-5)/8))^2 * 2
+        fe_set( u, 2 );
+        fe_pow22523( t, u );
+        fe_sq( t, t );
+        fe_mul( k->sqrtm1, t, u );
+
+        // The base point, y = 4/5, x even.
+        uint8_t b[32];
+        b[0] = 0x58;
+        memset( b + 1, 0x66, 31 );
+        ed_p3 B;
+        ed_frombytes_negate( &B, b, k );
+        fe_neg( B.X, B.X );
+        fe_neg( B.T, B.T );
+        ed_odd_multiples( k->base, ED_BASE_TABLE, &B, k );
+        return k;
+    }
+
+    static const ed_consts *ed_get_consts() {
+        static const ed_consts *k = ed_make_consts();
+        return k;
+    }
+
+    /// <summary>Decodes a public key, negated, as libsodium would accept it.</summary>
+    static int ed_decode_key( ed_p3 *A, const uint8_t pk[32], const ed_consts *k ) {
+        if( !ed_is_canonical( pk ) ||
+            ed_frombytes_negate( A, pk, k ) != 0 ||
+            ed_has_small_order( A->X, A->Y, A->Z ) ) return -1;
+        return 0;
+    }
+
+    /// <summary>Decodes a signature's R, negated, refusing what libsodium refuses: a non-canonical
+    /// encoding, or a point of small order.</summary>
+    static int ed_decode_r( ed_p3 *R, const uint8_t sig[32], const ed_consts *k ) {
+        if( !ed_is_canonical( sig ) ||
+            ed_frombytes_negate( R, sig, k ) != 0 ||
+            ed_has_small_order( R->X, R->Y, R->Z ) ) return -1;
+        return 0;
+    }
+
+    static_assert(sizeof( ed_cached ) * ED_POINT_TABLE == sizeof( ed25519_key ), "ed25519_key doesn't fit the point table");
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Decodes a public key for ed25519_verify_key() and ed25519_verify_batch().</summary>
+    ///
+    /// <returns>0 on success; -1 if libsodium would reject signatures made with the key.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    int ed25519_key_decode( ed25519_key *key, const uint8_t pk[32] ) {
+        const ed_consts *k = ed_get_consts();
+        ed_p3 A;
+        if( ed_decode_key( &A, pk, k ) != 0 ) return -1;
+        ed_odd_multiples( (ed_cached*)key->table, ED_POINT_TABLE, &A, k );
+        return 0;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Verifies a signature with an already decoded key.</summary>
+    ///
+    /// <remarks>
+    /// Makes crypto_sign_verify_detached()'s checks, so gives the same answers: s must be canonical,
+    /// R must not be of small order, and the encoding of sB - hA must equal R byte for byte.  Only
+    /// decoding A (which ed25519_key_decode() has done) is skipped.</remarks>
+    ///
+    /// <returns>0 if the signature is valid; -1 if not.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    int ed25519_verify_key( const uint8_t *msg, size_t msg_len, const uint8_t sig[64],
+        const uint8_t pk[32], const ed25519_key *key ) {
+        const ed_consts *k = ed_get_consts();
+        if( !ed_scalar_is_canonical( sig + 32 ) ) return -1;
+
+        uint8_t hash[64], h[32];
+        crypto_hash_sha512_state st;
+        crypto_hash_sha512_init( &st );
+        crypto_hash_sha512_update( &st, sig, 32 );
+        crypto_hash_sha512_update( &st, pk, 32 );
+        crypto_hash_sha512_update( &st, msg, msg_len );
+        crypto_hash_sha512_final( &st, hash );
+        crypto_core_ed25519_scalar_reduce( h, hash );
+
+        int8_t bnaf[256], hnaf[256];
+        ed_wnaf( bnaf, sig + 32, ED_BASE_WINDOW );
+        ed_wnaf( hnaf, h, ED_POINT_WINDOW );
+        ed_p2 r;
+        ed_multiscalar( &r, bnaf, hnaf, (const ed_cached*)key->table, 1, k );
+
+        // A small order R is refused even when it matches.
+        uint8_t rcheck[32];
+        ed_p2_tobytes( rcheck, &r );
+        if( memcmp( rcheck, sig, 32 ) != 0 ) return -1;
+        return ed_has_small_order( r.X, r.Y, r.Z ) ? -1 : 0;
+    }
+
+    static int ed25519_verify_chunk( const uint8_t *const *msgs, const size_t *msg_lens,
+        const uint8_t *const *sigs, const uint8_t *const *pks, const ed25519_key *const *keys, size_t n,
+        const ed_consts *k ) {
+        // Points 2i and 2i+1 are -R_i and -A_i.
+        size_t points = 2 * n;
+        ed_cached *tables = new ed_cached[points * ED_POINT_TABLE];
+        int8_t *nafs = new int8_t[points * 256];
+        uint8_t z[SQRL_ED25519_BATCH_MAX][32];
+        uint8_t bscalar[32], hash[64], h[32], t[32];
+        int ret = -1;
+
+        memset( z, 0, sizeof( z ) );
+        memset( bscalar, 0, sizeof( bscalar ) );
+        for( size_t i = 0; i < n; i++ ) {
+            sqrl_randombytes( z[i], 16 );
+            z[i][0] |= 1;
+        }
+
+        size_t i;
+        for( i = 0; i < n; i++ ) {
+            const uint8_t *sig = sigs[i];
+            const uint8_t *pk = pks[i];
+            const ed25519_key *key = keys ? keys[i] : NULL;
+            ed_p3 R, A;
+            if( !ed_scalar_is_canonical( sig + 32 ) || ed_decode_r( &R, sig, k ) != 0 ) break;
+            if( !key && ed_decode_key( &A, pk, k ) != 0 ) break;
+
+            crypto_hash_sha512_state st;
+            crypto_hash_sha512_init( &st );
+            crypto_hash_sha512_update( &st, sig, 32 );
+            crypto_hash_sha512_update( &st, pk, 32 );
+            crypto_hash_sha512_update( &st, msgs[i], msg_lens[i] );
+            crypto_hash_sha512_final( &st, hash );
+            crypto_core_ed25519_scalar_reduce( h, hash );
+
+            // B gets sum z_i s_i; -R_i gets z_i; -A_i gets z_i h_i.
+            crypto_core_ed25519_scalar_mul( t, z[i], sig + 32 );
+            crypto_core_ed25519_scalar_add( bscalar, bscalar, t );
+            crypto_core_ed25519_scalar_mul( t, z[i], h );
+
+            ed_wnaf( nafs + (2 * i) * 256, z[i], ED_POINT_WINDOW );
+            ed_wnaf( nafs + (2 * i + 1) * 256, t, ED_POINT_WINDOW );
+            ed_odd_multiples( tables + (2 * i) * ED_POINT_TABLE, ED_POINT_TABLE, &R, k );
+            if( key ) {
+                memcpy( tables + (2 * i + 1) * ED_POINT_TABLE, key->table, sizeof( ed25519_key ) );
+            } else {
+                ed_odd_multiples( tables + (2 * i + 1) * ED_POINT_TABLE, ED_POINT_TABLE, &A, k );
+            }
+        }
+
+        if( i == n ) {
+            int8_t bnaf[256];
+            ed_wnaf( bnaf, bscalar, ED_BASE_WINDOW );
+            ed_p2 r;
+            ed_multiscalar( &r, bnaf, nafs, tables, points, k );
+
+            // Multiply by the cofactor, then test for the identity.
+            if( ed_has_small_order( r.X, r.Y, r.Z ) ) ret = 0;
+        }
+
+        delete[] tables;
+        delete[] nafs;
+        return ret;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Verifies a batch of Ed25519 signatures.</summary>
+    ///
+    /// <returns>0 if every signature is valid; -1 if any one is not.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    int ed25519_verify_batch( const uint8_t *const *msgs, const size_t *msg_lens,
+        const uint8_t *const *sigs, const uint8_t *const *pks, const ed25519_key *const *keys, size_t n ) {
+        const ed_consts *k = ed_get_consts();
+        for( size_t off = 0; off < n; off += SQRL_ED25519_BATCH_MAX ) {
+            size_t c = n - off < SQRL_ED25519_BATCH_MAX ? n - off : SQRL_ED25519_BATCH_MAX;
+            if( ed25519_verify_chunk( msgs + off, msg_lens + off, sigs + off, pks + off,
+                keys ? keys + off : NULL, c, k ) != 0 ) return -1;
+        }
+        return 0;
+    }
+}
+#endif // SQRL_ED25519_BATCH
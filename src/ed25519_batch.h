@@ -0,0 +1,71 @@
+/** \file ed25519_batch.h
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#ifndef ED25519_BATCH_H
+#define ED25519_BATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Everywhere libsodium is; on Arduino signatures are simply verified one at a time.
+#if !defined(ARDUINO)
+#define SQRL_ED25519_BATCH
+#endif
+
+#define SQRL_ED25519_BATCH_MAX 64
+
+namespace libsqrl
+{
+#if defined(SQRL_ED25519_BATCH)
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>A decoded public key A, kept as -A, -3A, ... -15A, ready to verify with.</summary>
+    ///
+    /// <remarks>Decoding is the expensive part of using a key that ed25519_verify_key() and
+    /// ed25519_verify_batch() can skip, so decoded keys are worth caching (see SqrlKeyCache).</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    typedef struct
+    {
+        uint64_t table[8][4][5];
+    } ed25519_key;
+
+    int ed25519_key_decode( ed25519_key *key, const uint8_t pk[32] );
+
+    int ed25519_verify_key(
+        const uint8_t *msg,             // the signed message
+        size_t msg_len,                 // its length
+        const uint8_t sig[64],          // the signature
+        const uint8_t pk[32],           // the encoded public key
+        const ed25519_key *key );       // pk, decoded
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Randomized batch verification of Ed25519 signatures.</summary>
+    ///
+    /// <remarks>
+    /// Checks 8 * ((sum z_i s_i) B - sum z_i R_i - sum (z_i h_i) A_i) == 0 for random 128 bit z_i, with
+    /// one multi-scalar multiplication, which costs about half as much per signature as verifying each
+    /// separately.  s must be canonical, and R and A canonical points that are not of small order, as
+    /// libsodium requires.  The equation is cofactored, though, so where R or A has a small order
+    /// component a batch can accept a signature that ed25519_verify_key() and libsodium refuse.  Only
+    /// the key's owner can make such a signature; honest signers never do.  Checking each point for
+    /// such a component would cost as much as verifying it alone, so a passing batch is only a fast
+    /// accept for callers that have opted in to cofactored verification.  Variable time, which is
+    /// fine as everything involved is public.
+    ///
+    /// A failed batch says only that at least one signature is bad; check them individually to find
+    /// out which.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    int ed25519_verify_batch(
+        const uint8_t *const *msgs,     // the signed messages
+        const size_t *msg_lens,         // their lengths
+        const uint8_t *const *sigs,     // 64 byte signatures
+        const uint8_t *const *pks,      // 32 byte public keys
+        const ed25519_key *const *keys, // decoded public keys, or NULL (or NULL entries) to decode pks
+        size_t n );                     // number of signatures
+#endif
+}
+#endif // ED25519_BATCH_H
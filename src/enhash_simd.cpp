@@ -0,0 +1,221 @@
+/** \file enhash_simd.cpp
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#include "sqrl_internal.h"
+#include "enhash_simd.h"
+
+#if defined(SQRL_X86)
+#include <immintrin.h>
+#endif
+
+namespace libsqrl
+{
+#if defined(SQRL_X86)
+    static const uint32_t enhash_k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+
+    static const uint32_t enhash_iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    static inline uint32_t enhash_load_be32( const uint8_t *p ) {
+        return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+    }
+
+    static inline void enhash_store_be32( uint8_t *p, uint32_t v ) {
+        p[0] = (uint8_t)(v >> 24);
+        p[1] = (uint8_t)(v >> 16);
+        p[2] = (uint8_t)(v >> 8);
+        p[3] = (uint8_t)v;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    // SHA extensions.  The state lives in the ABEF / CDGH register order sha256rnds2 wants; it is put
+    // back in ABCD / EFGH order after each compression, because that is also the next message.
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    SQRL_TARGET( "sha,sse4.1,ssse3" ) void sqrl_enhash_shani( uint8_t out[32], const uint8_t in[32] ) {
+        const __m128i MASK = _mm_set_epi64x( 0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL );
+        const __m128i ABEF0 = _mm_set_epi32( 0x6a09e667, 0xbb67ae85, 0x510e527f, (int)0x9b05688c );
+        const __m128i CDGH0 = _mm_set_epi32( 0x3c6ef372, (int)0xa54ff53a, 0x1f83d9ab, 0x5be0cd19 );
+        const __m128i PAD0 = _mm_set_epi32( 0, 0, 0, (int)0x80000000 );
+        const __m128i PAD1 = _mm_set_epi32( 256, 0, 0, 0 );
+        __m128i H0 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*)in ), MASK );
+        __m128i H1 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*)(in + 16) ), MASK );
+        __m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+        __m128i S0, S1, MSG, TMP, M[4];
+
+        for( int i = 0; i < 16; i++ ) {
+            S0 = ABEF0;
+            S1 = CDGH0;
+            M[0] = H0;
+            M[1] = H1;
+            M[2] = PAD0;
+            M[3] = PAD1;
+            for( int q = 0; q < 16; q++ ) {
+                MSG = _mm_add_epi32( M[q & 3], _mm_loadu_si128( (const __m128i*)&enhash_k[q * 4] ) );
+                S1 = _mm_sha256rnds2_epu32( S1, S0, MSG );
+                if( q >= 3 && q < 15 ) {
+                    TMP = _mm_alignr_epi8( M[q & 3], M[(q - 1) & 3], 4 );
+                    M[(q + 1) & 3] = _mm_sha256msg2_epu32( _mm_add_epi32( M[(q + 1) & 3], TMP ), M[q & 3] );
+                }
+                MSG = _mm_shuffle_epi32( MSG, 0x0E );
+                S0 = _mm_sha256rnds2_epu32( S0, S1, MSG );
+                if( q >= 1 && q < 13 ) {
+                    M[(q - 1) & 3] = _mm_sha256msg1_epu32( M[(q - 1) & 3], M[q & 3] );
+                }
+            }
+            S0 = _mm_add_epi32( S0, ABEF0 );
+            S1 = _mm_add_epi32( S1, CDGH0 );
+            TMP = _mm_shuffle_epi32( S0, 0x1B );
+            S1 = _mm_shuffle_epi32( S1, 0xB1 );
+            H0 = _mm_blend_epi16( TMP, S1, 0xF0 );
+            H1 = _mm_alignr_epi8( S1, TMP, 8 );
+            acc0 = _mm_xor_si128( acc0, H0 );
+            acc1 = _mm_xor_si128( acc1, H1 );
+        }
+        _mm_storeu_si128( (__m128i*)out, _mm_shuffle_epi8( acc0, MASK ) );
+        _mm_storeu_si128( (__m128i*)(out + 16), _mm_shuffle_epi8( acc1, MASK ) );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    // Multi-buffer kernels.  Lane j of vector i holds word i of job j's state, so the plain SHA-256
+    // round function runs unchanged on every lane.
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+#define ENHASH_SIGMA( XOR3, ROR, SRL, x, a, b, c ) XOR3( ROR( x, a ), ROR( x, b ), SRL( x, c ) )
+#define ENHASH_SUM( XOR3, ROR, x, a, b, c ) XOR3( ROR( x, a ), ROR( x, b ), ROR( x, c ) )
+
+#define ENHASH_MB_KERNEL( name, target, LANES, VT, ADD, XOR, SET1, ROR, SRL, CH, MAJ, XOR3, LOADU, STOREU ) \
+    static SQRL_TARGET( target ) void enhash_mb_##name( uint32_t *h ) { \
+        VT H[8], acc[8], W[16]; \
+        for( int i = 0; i < 8; i++ ) { \
+            H[i] = LOADU( h + i * LANES ); \
+            acc[i] = SET1( 0 ); \
+        } \
+        for( int it = 0; it < 16; it++ ) { \
+            for( int i = 0; i < 8; i++ ) W[i] = H[i]; \
+            W[8] = SET1( 0x80000000 ); \
+            for( int i = 9; i < 15; i++ ) W[i] = SET1( 0 ); \
+            W[15] = SET1( 256 ); \
+            VT a = SET1( enhash_iv[0] ), b = SET1( enhash_iv[1] ), c = SET1( enhash_iv[2] ), d = SET1( enhash_iv[3] ); \
+            VT e = SET1( enhash_iv[4] ), f = SET1( enhash_iv[5] ), g = SET1( enhash_iv[6] ), hh = SET1( enhash_iv[7] ); \
+            for( int t = 0; t < 64; t++ ) { \
+                if( t >= 16 ) { \
+                    VT s0 = ENHASH_SIGMA( XOR3, ROR, SRL, W[(t - 15) & 15], 7, 18, 3 ); \
+                    VT s1 = ENHASH_SIGMA( XOR3, ROR, SRL, W[(t - 2) & 15], 17, 19, 10 ); \
+                    W[t & 15] = ADD( ADD( W[t & 15], s0 ), ADD( W[(t - 7) & 15], s1 ) ); \
+                } \
+                VT t1 = ADD( ADD( hh, ENHASH_SUM( XOR3, ROR, e, 6, 11, 25 ) ), \
+                    ADD( CH( e, f, g ), ADD( SET1( enhash_k[t] ), W[t & 15] ) ) ); \
+                VT t2 = ADD( ENHASH_SUM( XOR3, ROR, a, 2, 13, 22 ), MAJ( a, b, c ) ); \
+                hh = g; g = f; f = e; e = ADD( d, t1 ); \
+                d = c; c = b; b = a; a = ADD( t1, t2 ); \
+            } \
+            H[0] = ADD( a, SET1( enhash_iv[0] ) ); H[1] = ADD( b, SET1( enhash_iv[1] ) ); \
+            H[2] = ADD( c, SET1( enhash_iv[2] ) ); H[3] = ADD( d, SET1( enhash_iv[3] ) ); \
+            H[4] = ADD( e, SET1( enhash_iv[4] ) ); H[5] = ADD( f, SET1( enhash_iv[5] ) ); \
+            H[6] = ADD( g, SET1( enhash_iv[6] ) ); H[7] = ADD( hh, SET1( enhash_iv[7] ) ); \
+            for( int i = 0; i < 8; i++ ) acc[i] = XOR( acc[i], H[i] ); \
+        } \
+        for( int i = 0; i < 8; i++ ) STOREU( h + i * LANES, acc[i] ); \
+    }
+
+#define SSE2_SET1( x ) _mm_set1_epi32( (int)(x) )
+#define SSE2_ROR( x, n ) _mm_or_si128( _mm_srli_epi32( x, n ), _mm_slli_epi32( x, 32 - (n) ) )
+#define SSE2_CH( e, f, g ) _mm_xor_si128( _mm_and_si128( e, f ), _mm_andnot_si128( e, g ) )
+#define SSE2_MAJ( a, b, c ) _mm_or_si128( _mm_and_si128( a, b ), _mm_and_si128( c, _mm_or_si128( a, b ) ) )
+#define SSE2_XOR3( a, b, c ) _mm_xor_si128( _mm_xor_si128( a, b ), c )
+#define SSE2_LOADU( p ) _mm_loadu_si128( (const __m128i*)(p) )
+#define SSE2_STOREU( p, x ) _mm_storeu_si128( (__m128i*)(p), x )
+
+#define AVX2_SET1( x ) _mm256_set1_epi32( (int)(x) )
+#define AVX2_ROR( x, n ) _mm256_or_si256( _mm256_srli_epi32( x, n ), _mm256_slli_epi32( x, 32 - (n) ) )
+#define AVX2_CH( e, f, g ) _mm256_xor_si256( _mm256_and_si256( e, f ), _mm256_andnot_si256( e, g ) )
+#define AVX2_MAJ( a, b, c ) _mm256_or_si256( _mm256_and_si256( a, b ), _mm256_and_si256( c, _mm256_or_si256( a, b ) ) )
+#define AVX2_XOR3( a, b, c ) _mm256_xor_si256( _mm256_xor_si256( a, b ), c )
+#define AVX2_LOADU( p ) _mm256_loadu_si256( (const __m256i*)(p) )
+#define AVX2_STOREU( p, x ) _mm256_storeu_si256( (__m256i*)(p), x )
+
+#define AVX512_SET1( x ) _mm512_set1_epi32( (int)(x) )
+#define AVX512_CH( e, f, g ) _mm512_ternarylogic_epi32( e, f, g, 0xCA )
+#define AVX512_MAJ( a, b, c ) _mm512_ternarylogic_epi32( a, b, c, 0xE8 )
+#define AVX512_XOR3( a, b, c ) _mm512_ternarylogic_epi32( a, b, c, 0x96 )
+#define AVX512_LOADU( p ) _mm512_loadu_si512( (const void*)(p) )
+#define AVX512_STOREU( p, x ) _mm512_storeu_si512( (void*)(p), x )
+
+    ENHASH_MB_KERNEL( sse2, "sse2", 4, __m128i, _mm_add_epi32, _mm_xor_si128, SSE2_SET1, SSE2_ROR, _mm_srli_epi32,
+        SSE2_CH, SSE2_MAJ, SSE2_XOR3, SSE2_LOADU, SSE2_STOREU )
+    ENHASH_MB_KERNEL( avx2, "avx2", 8, __m256i, _mm256_add_epi32, _mm256_xor_si256, AVX2_SET1, AVX2_ROR, _mm256_srli_epi32,
+        AVX2_CH, AVX2_MAJ, AVX2_XOR3, AVX2_LOADU, AVX2_STOREU )
+    ENHASH_MB_KERNEL( avx512, "avx512f", 16, __m512i, _mm512_add_epi32, _mm512_xor_si512, AVX512_SET1, _mm512_ror_epi32, _mm512_srli_epi32,
+        AVX512_CH, AVX512_MAJ, AVX512_XOR3, AVX512_LOADU, AVX512_STOREU )
+
+    /// <summary>Transposes up to 'maxLanes' inputs into words, runs 'kernel', and transposes back.</summary>
+    static void enhash_mb( void( *kernel )(uint32_t*), size_t maxLanes,
+        uint8_t *const *out, const uint8_t *const *in, size_t lanes ) {
+        uint32_t h[8 * 16];
+        if( lanes > maxLanes ) lanes = maxLanes;
+        if( lanes == 0 ) return;
+        for( size_t j = 0; j < maxLanes; j++ ) {
+            // Idle lanes repeat lane 0; their results are discarded.
+            const uint8_t *p = in[j < lanes ? j : 0];
+            for( int i = 0; i < 8; i++ ) {
+                h[i * maxLanes + j] = enhash_load_be32( p + i * 4 );
+            }
+        }
+        kernel( h );
+        for( size_t j = 0; j < lanes; j++ ) {
+            for( int i = 0; i < 8; i++ ) {
+                enhash_store_be32( out[j] + i * 4, h[i * maxLanes + j] );
+            }
+        }
+        sqrl_memzero( h, sizeof( h ) );
+    }
+
+    void sqrl_enhash_x4_sse2( uint8_t *const *out, const uint8_t *const *in, size_t lanes ) {
+        enhash_mb( enhash_mb_sse2, 4, out, in, lanes );
+    }
+
+    void sqrl_enhash_x8_avx2( uint8_t *const *out, const uint8_t *const *in, size_t lanes ) {
+        enhash_mb( enhash_mb_avx2, 8, out, in, lanes );
+    }
+
+    void sqrl_enhash_x16_avx512( uint8_t *const *out, const uint8_t *const *in, size_t lanes ) {
+        enhash_mb( enhash_mb_avx512, 16, out, in, lanes );
+    }
+#endif // SQRL_X86
+
+    sqrl_enhash_mb_t sqrl_enhash_mb_select( size_t *lanes ) {
+#if defined(SQRL_X86)
+        if( sqrl_cpu_has_avx512() ) {
+            *lanes = 16;
+            return sqrl_enhash_x16_avx512;
+        }
+        if( sqrl_cpu_has_avx2() ) {
+            *lanes = 8;
+            return sqrl_enhash_x8_avx2;
+        }
+        // One SHA-NI stream beats four SSE2 lanes.
+#if defined(__x86_64__) || defined(_M_X64)
+        if( !sqrl_cpu_has_sha() ) {
+            *lanes = 4;
+            return sqrl_enhash_x4_sse2;
+        }
+#endif
+#endif
+        *lanes = 1;
+        return NULL;
+    }
+}
@@ -0,0 +1,43 @@
+/** \file enhash_simd.h
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#ifndef ENHASH_SIMD_H
+#define ENHASH_SIMD_H
+
+#include "sqrl.h"
+#include "cpu_features.h"
+
+namespace libsqrl
+{
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Multi-buffer EnHash: runs 'lanes' independent EnHash operations at once.</summary>
+    ///
+    /// <remarks>
+    /// 'out' and 'in' hold 'lanes' pointers to 32 byte buffers.  Every SHA-256 in EnHash hashes exactly
+    /// 32 bytes, so each step is a single compression with a fixed padding block, and the kernels keep
+    /// the state in words from the first step to the last.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    typedef void( *sqrl_enhash_mb_t )(uint8_t *const *out, const uint8_t *const *in, size_t lanes);
+
+#if defined(SQRL_X86)
+    /// <summary>Single EnHash using the SHA extensions.  Requires sqrl_cpu_has_sha().</summary>
+    void sqrl_enhash_shani( uint8_t out[32], const uint8_t in[32] );
+
+    /// <summary>Multi-buffer kernels: 4, 8 or 16 lanes of 32 bit SHA-256 words.</summary>
+    void sqrl_enhash_x4_sse2( uint8_t *const *out, const uint8_t *const *in, size_t lanes );
+    void sqrl_enhash_x8_avx2( uint8_t *const *out, const uint8_t *const *in, size_t lanes );
+    void sqrl_enhash_x16_avx512( uint8_t *const *out, const uint8_t *const *in, size_t lanes );
+#endif
+
+    /// <summary>Picks the widest multi-buffer kernel, storing its lane count in 'lanes'.</summary>
+    ///
+    /// <returns>The kernel, or NULL (and *lanes = 1) when none is available or a single SHA-NI
+    /// stream would be faster.</returns>
+    sqrl_enhash_mb_t sqrl_enhash_mb_select( size_t *lanes );
+}
+#endif // ENHASH_SIMD_H
@@ -0,0 +1,395 @@
+/** \file escrypt_simd.cpp
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#include "sqrl_internal.h"
+#include "escrypt_simd.h"
+#include "cpu_features.h"
+#include <errno.h>
+
+#if defined(WITH_SCRYPT) && defined(SQRL_X86)
+#include <immintrin.h>
+#endif
+
+namespace libsqrl
+{
+#if defined(WITH_SCRYPT)
+#if defined(SQRL_X86)
+
+    // Data is kept in the SIMD-friendly "diagonal" word order (word i of each 64 byte block holds
+    // word (i * 5) % 16 of the scrypt block), so each Salsa20/8 row fits one 128 bit register.
+    // scrypt with p = 1 is a strictly sequential chain of Salsa20/8 calls; no register width can
+    // run one chain's cores side by side.  The gains here come from three-operand VEX encoding
+    // (fewer register moves than SSE2) and, on AVX-512, the native vprold rotate.
+
+#define SALSA_ROTXOR_AVX2( X, T, n ) \
+    X = _mm_xor_si128( X, _mm_xor_si128( _mm_slli_epi32( T, n ), _mm_srli_epi32( T, 32 - (n) ) ) )
+#define SALSA_ROTXOR_AVX512( X, T, n ) \
+    X = _mm_xor_si128( X, _mm_rol_epi32( T, n ) )
+
+    // The same core, generic over the vector type.  _mm256_shuffle_epi32 and _mm512_shuffle_epi32
+    // permute within each 128 bit lane, so a wider register simply runs one independent Salsa20/8
+    // state per lane; the multi-buffer kernels below rely on that.
+#define SALSA20_8_V( VT, ADD, SHUF, X0, X1, X2, X3, ROTXOR ) { \
+    VT Y0 = X0, Y1 = X1, Y2 = X2, Y3 = X3, T; \
+    for( int round = 0; round < 8; round += 2 ) { \
+        T = ADD( Y0, Y3 ); ROTXOR( Y1, T, 7 ); \
+        T = ADD( Y1, Y0 ); ROTXOR( Y2, T, 9 ); \
+        T = ADD( Y2, Y1 ); ROTXOR( Y3, T, 13 ); \
+        T = ADD( Y3, Y2 ); ROTXOR( Y0, T, 18 ); \
+        Y1 = SHUF( Y1, 0x93 ); \
+        Y2 = SHUF( Y2, 0x4E ); \
+        Y3 = SHUF( Y3, 0x39 ); \
+        T = ADD( Y0, Y1 ); ROTXOR( Y3, T, 7 ); \
+        T = ADD( Y3, Y0 ); ROTXOR( Y2, T, 9 ); \
+        T = ADD( Y2, Y3 ); ROTXOR( Y1, T, 13 ); \
+        T = ADD( Y1, Y2 ); ROTXOR( Y0, T, 18 ); \
+        Y1 = SHUF( Y1, 0x39 ); \
+        Y2 = SHUF( Y2, 0x4E ); \
+        Y3 = SHUF( Y3, 0x93 ); \
+    } \
+    X0 = ADD( X0, Y0 ); \
+    X1 = ADD( X1, Y1 ); \
+    X2 = ADD( X2, Y2 ); \
+    X3 = ADD( X3, Y3 ); \
+}
+
+#define SALSA20_8( X0, X1, X2, X3, ROTXOR ) \
+    SALSA20_8_V( __m128i, _mm_add_epi32, _mm_shuffle_epi32, X0, X1, X2, X3, ROTXOR )
+
+#define XOR4( X0, X1, X2, X3, in ) \
+    X0 = _mm_xor_si128( X0, (in)[0] ); \
+    X1 = _mm_xor_si128( X1, (in)[1] ); \
+    X2 = _mm_xor_si128( X2, (in)[2] ); \
+    X3 = _mm_xor_si128( X3, (in)[3] );
+
+#define STORE4( out, X0, X1, X2, X3 ) \
+    (out)[0] = X0; (out)[1] = X1; (out)[2] = X2; (out)[3] = X3;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    // Defines a complete smix() for one instruction set:
+    //   blockmix_<name>:     Bout = BlockMix(Bin), or BlockMix(Bin ^ Bxor) when Bxor is non-null.
+    //   smix_<name>:         scrypt ROMix over one 128 * r byte block, in place.
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+#define ESCRYPT_SIMD_KERNEL( name, target, ROTXOR ) \
+    static SQRL_TARGET( target ) void blockmix_##name( const __m128i *Bin, const __m128i *Bxor, __m128i *Bout, size_t r ) { \
+        __m128i X0 = Bin[8 * r - 4], X1 = Bin[8 * r - 3], X2 = Bin[8 * r - 2], X3 = Bin[8 * r - 1]; \
+        if( Bxor ) { XOR4( X0, X1, X2, X3, Bxor + 8 * r - 4 ) } \
+        for( size_t i = 0; i < r; i++ ) { \
+            XOR4( X0, X1, X2, X3, Bin + i * 8 ) \
+            if( Bxor ) { XOR4( X0, X1, X2, X3, Bxor + i * 8 ) } \
+            SALSA20_8( X0, X1, X2, X3, ROTXOR ) \
+            STORE4( Bout + i * 4, X0, X1, X2, X3 ) \
+            XOR4( X0, X1, X2, X3, Bin + i * 8 + 4 ) \
+            if( Bxor ) { XOR4( X0, X1, X2, X3, Bxor + i * 8 + 4 ) } \
+            SALSA20_8( X0, X1, X2, X3, ROTXOR ) \
+            STORE4( Bout + (r + i) * 4, X0, X1, X2, X3 ) \
+        } \
+    } \
+    static SQRL_TARGET( target ) void smix_##name( uint8_t *B, size_t r, uint64_t N, __m128i *V, __m128i *XY ) { \
+        size_t s = 8 * r; \
+        __m128i *X = XY, *Y = XY + s; \
+        sqrl_escrypt_shuffle( (uint32_t*)V, B, r ); \
+        for( uint64_t i = 0; i < N - 1; i++ ) { \
+            blockmix_##name( V + i * s, NULL, V + (i + 1) * s, r ); \
+        } \
+        blockmix_##name( V + (N - 1) * s, NULL, X, r ); \
+        for( uint64_t i = 0; i < N; i += 2 ) { \
+            blockmix_##name( X, V + (sqrl_escrypt_integerify( X, r ) & (N - 1)) * s, Y, r ); \
+            blockmix_##name( Y, V + (sqrl_escrypt_integerify( Y, r ) & (N - 1)) * s, X, r ); \
+        } \
+        sqrl_escrypt_unshuffle( B, (uint32_t*)X, r ); \
+    }
+
+    typedef void( *sqrl_smix_t )(uint8_t *B, size_t r, uint64_t N, __m128i *V, __m128i *XY);
+
+    static void sqrl_escrypt_shuffle( uint32_t *out, const uint8_t *in, size_t r ) {
+        for( size_t k = 0; k < 2 * r; k++ ) {
+            for( size_t i = 0; i < 16; i++ ) {
+                const uint8_t *p = in + (k * 16 + (i * 5 % 16)) * 4;
+                out[k * 16 + i] = (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+                    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+            }
+        }
+    }
+
+    static void sqrl_escrypt_unshuffle( uint8_t *out, const uint32_t *in, size_t r ) {
+        for( size_t k = 0; k < 2 * r; k++ ) {
+            for( size_t i = 0; i < 16; i++ ) {
+                uint8_t *p = out + (k * 16 + (i * 5 % 16)) * 4;
+                uint32_t v = in[k * 16 + i];
+                p[0] = (uint8_t)v;
+                p[1] = (uint8_t)(v >> 8);
+                p[2] = (uint8_t)(v >> 16);
+                p[3] = (uint8_t)(v >> 24);
+            }
+        }
+    }
+
+    // Word 0 and word 13 of the last 64 byte block are words 0 and 1 in scrypt order.
+    static inline uint64_t sqrl_escrypt_integerify( const __m128i *B, size_t r ) {
+        const uint32_t *X = (const uint32_t*)(B + (2 * r - 1) * 4);
+        return ((uint64_t)X[13] << 32) | X[0];
+    }
+
+    ESCRYPT_SIMD_KERNEL( avx2, "avx2", SALSA_ROTXOR_AVX2 )
+    ESCRYPT_SIMD_KERNEL( avx512, "avx512f,avx512vl", SALSA_ROTXOR_AVX512 )
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    // Multi-buffer kernels: up to LANES independent scrypt computations with the same N and r step
+    // together, one per 128 bit lane of a YMM / ZMM register.  Each job keeps its own B, V and XY in
+    // the layout above; rows are gathered into lanes on load and scattered back on store.  Lanes past
+    // 'lanes' repeat lane 0 and are never stored.
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+#define ROTXOR_AVX2_MB( X, T, n ) \
+    X = _mm256_xor_si256( X, _mm256_xor_si256( _mm256_slli_epi32( T, n ), _mm256_srli_epi32( T, 32 - (n) ) ) )
+#define ROTXOR_AVX512_MB( X, T, n ) \
+    X = _mm512_xor_si512( X, _mm512_rol_epi32( T, n ) )
+#define SHUF_AVX512( X, imm ) _mm512_shuffle_epi32( X, (_MM_PERM_ENUM)(imm) )
+
+#define GATHER_AVX2( p, off ) \
+    _mm256_inserti128_si256( _mm256_castsi128_si256( _mm_load_si128( (p)[0] + (off) ) ), \
+        _mm_load_si128( (p)[1] + (off) ), 1 )
+#define SCATTER_AVX2( p, off, X, lanes ) \
+    _mm_store_si128( (p)[0] + (off), _mm256_castsi256_si128( X ) ); \
+    if( lanes > 1 ) _mm_store_si128( (p)[1] + (off), _mm256_extracti128_si256( X, 1 ) );
+
+#define GATHER_AVX512( p, off ) \
+    _mm512_inserti32x4( _mm512_inserti32x4( _mm512_inserti32x4( \
+        _mm512_castsi128_si512( _mm_load_si128( (p)[0] + (off) ) ), \
+        _mm_load_si128( (p)[1] + (off) ), 1 ), \
+        _mm_load_si128( (p)[2] + (off) ), 2 ), \
+        _mm_load_si128( (p)[3] + (off) ), 3 )
+#define SCATTER_AVX512( p, off, X, lanes ) \
+    _mm_store_si128( (p)[0] + (off), _mm512_castsi512_si128( X ) ); \
+    if( lanes > 1 ) _mm_store_si128( (p)[1] + (off), _mm512_extracti32x4_epi32( X, 1 ) ); \
+    if( lanes > 2 ) _mm_store_si128( (p)[2] + (off), _mm512_extracti32x4_epi32( X, 2 ) ); \
+    if( lanes > 3 ) _mm_store_si128( (p)[3] + (off), _mm512_extracti32x4_epi32( X, 3 ) );
+
+#define XOR4_MB( XOR, GATHER, X0, X1, X2, X3, p, off ) \
+    X0 = XOR( X0, GATHER( p, (off) + 0 ) ); \
+    X1 = XOR( X1, GATHER( p, (off) + 1 ) ); \
+    X2 = XOR( X2, GATHER( p, (off) + 2 ) ); \
+    X3 = XOR( X3, GATHER( p, (off) + 3 ) );
+
+#define STORE4_MB( SCATTER, p, off, X0, X1, X2, X3, lanes ) \
+    SCATTER( p, (off) + 0, X0, lanes ) \
+    SCATTER( p, (off) + 1, X1, lanes ) \
+    SCATTER( p, (off) + 2, X2, lanes ) \
+    SCATTER( p, (off) + 3, X3, lanes )
+
+#define ESCRYPT_MB_KERNEL( name, target, LANES, VT, XOR, ADD, SHUF, ROTXOR, GATHER, SCATTER ) \
+    static SQRL_TARGET( target ) void blockmix_mb_##name( __m128i *const *Bin, __m128i *const *Bxor, \
+        __m128i *const *Bout, size_t r, size_t lanes ) { \
+        VT X0 = GATHER( Bin, 8 * r - 4 ), X1 = GATHER( Bin, 8 * r - 3 ), \
+            X2 = GATHER( Bin, 8 * r - 2 ), X3 = GATHER( Bin, 8 * r - 1 ); \
+        if( Bxor ) { XOR4_MB( XOR, GATHER, X0, X1, X2, X3, Bxor, 8 * r - 4 ) } \
+        for( size_t i = 0; i < r; i++ ) { \
+            XOR4_MB( XOR, GATHER, X0, X1, X2, X3, Bin, i * 8 ) \
+            if( Bxor ) { XOR4_MB( XOR, GATHER, X0, X1, X2, X3, Bxor, i * 8 ) } \
+            SALSA20_8_V( VT, ADD, SHUF, X0, X1, X2, X3, ROTXOR ) \
+            STORE4_MB( SCATTER, Bout, i * 4, X0, X1, X2, X3, lanes ) \
+            XOR4_MB( XOR, GATHER, X0, X1, X2, X3, Bin, i * 8 + 4 ) \
+            if( Bxor ) { XOR4_MB( XOR, GATHER, X0, X1, X2, X3, Bxor, i * 8 + 4 ) } \
+            SALSA20_8_V( VT, ADD, SHUF, X0, X1, X2, X3, ROTXOR ) \
+            STORE4_MB( SCATTER, Bout, (r + i) * 4, X0, X1, X2, X3, lanes ) \
+        } \
+    } \
+    static SQRL_TARGET( target ) void smix_mb_##name( uint8_t *const *B, size_t r, uint64_t N, \
+        __m128i *const *V, __m128i *const *XY, size_t lanes ) { \
+        size_t s = 8 * r; \
+        __m128i *Vl[LANES], *X[LANES], *Y[LANES], *in[LANES], *out[LANES]; \
+        for( size_t l = 0; l < LANES; l++ ) { \
+            size_t k = l < lanes ? l : 0; \
+            Vl[l] = V[k]; \
+            X[l] = XY[k]; \
+            Y[l] = XY[k] + s; \
+            if( l < lanes ) sqrl_escrypt_shuffle( (uint32_t*)V[l], B[l], r ); \
+        } \
+        for( uint64_t i = 0; i < N - 1; i++ ) { \
+            for( size_t l = 0; l < LANES; l++ ) { \
+                in[l] = Vl[l] + i * s; \
+                out[l] = Vl[l] + (i + 1) * s; \
+            } \
+            blockmix_mb_##name( in, NULL, out, r, lanes ); \
+        } \
+        for( size_t l = 0; l < LANES; l++ ) in[l] = Vl[l] + (N - 1) * s; \
+        blockmix_mb_##name( in, NULL, X, r, lanes ); \
+        for( uint64_t i = 0; i < N; i += 2 ) { \
+            for( size_t l = 0; l < LANES; l++ ) in[l] = Vl[l] + (sqrl_escrypt_integerify( X[l], r ) & (N - 1)) * s; \
+            blockmix_mb_##name( X, in, Y, r, lanes ); \
+            for( size_t l = 0; l < LANES; l++ ) in[l] = Vl[l] + (sqrl_escrypt_integerify( Y[l], r ) & (N - 1)) * s; \
+            blockmix_mb_##name( Y, in, X, r, lanes ); \
+        } \
+        for( size_t l = 0; l < lanes; l++ ) sqrl_escrypt_unshuffle( B[l], (uint32_t*)X[l], r ); \
+    }
+
+    typedef void( *sqrl_smix_mb_t )(uint8_t *const *B, size_t r, uint64_t N, __m128i *const *V, __m128i *const *XY, size_t lanes);
+
+    ESCRYPT_MB_KERNEL( avx2, "avx2", 2, __m256i, _mm256_xor_si256, _mm256_add_epi32, _mm256_shuffle_epi32,
+        ROTXOR_AVX2_MB, GATHER_AVX2, SCATTER_AVX2 )
+    ESCRYPT_MB_KERNEL( avx512, "avx512f,avx512vl", 4, __m512i, _mm512_xor_si512, _mm512_add_epi32, SHUF_AVX512,
+        ROTXOR_AVX512_MB, GATHER_AVX512, SCATTER_AVX512 )
+
+    /// <summary>PBKDF2-HMAC-SHA256 with a single iteration, as used on both ends of scrypt.</summary>
+    static void sqrl_pbkdf2_sha256_1( const uint8_t *passwd, size_t passwdlen,
+        const uint8_t *salt, size_t saltlen, uint8_t *buf, size_t buflen ) {
+        crypto_auth_hmacsha256_state pre, ctx;
+        uint8_t ivec[4];
+        uint8_t U[32];
+
+        crypto_auth_hmacsha256_init( &pre, passwd, passwdlen );
+        crypto_auth_hmacsha256_update( &pre, salt, saltlen );
+        for( uint32_t i = 0; (size_t)i * 32 < buflen; i++ ) {
+            uint32_t n = i + 1;
+            ivec[0] = (uint8_t)(n >> 24);
+            ivec[1] = (uint8_t)(n >> 16);
+            ivec[2] = (uint8_t)(n >> 8);
+            ivec[3] = (uint8_t)n;
+            memcpy( &ctx, &pre, sizeof( crypto_auth_hmacsha256_state ) );
+            crypto_auth_hmacsha256_update( &ctx, ivec, 4 );
+            crypto_auth_hmacsha256_final( &ctx, U );
+            size_t clen = buflen - (size_t)i * 32;
+            if( clen > 32 ) clen = 32;
+            memcpy( buf + (size_t)i * 32, U, clen );
+        }
+        sqrl_memzero( &pre, sizeof( crypto_auth_hmacsha256_state ) );
+        sqrl_memzero( &ctx, sizeof( crypto_auth_hmacsha256_state ) );
+        sqrl_memzero( U, sizeof( U ) );
+    }
+
+    static bool sqrl_escrypt_params_ok( uint64_t N, uint32_t r, uint32_t p ) {
+        if( r == 0 || p == 0 || N < 2 || (N & (N - 1)) != 0 ||
+            (uint64_t)r * (uint64_t)p >= (1 << 30) || N > SIZE_MAX / 128 / r ) {
+            errno = EINVAL;
+            return false;
+        }
+        return true;
+    }
+
+    /// <summary>Grows 'local' to hold B, V and XY for one job, and returns B (V and XY follow it).</summary>
+    static uint8_t *sqrl_escrypt_region( escrypt_local_t *local, uint64_t N, uint32_t r, uint32_t p ) {
+        size_t need = (size_t)128 * r * p + (size_t)128 * r * (size_t)N + (size_t)256 * r;
+        if( local->size < need ) {
+            if( free_region( local ) ) return NULL;
+            if( !alloc_region( local, need ) ) return NULL;
+        }
+        return (uint8_t*)local->aligned;
+    }
+
+    static int sqrl_escrypt_kdf( sqrl_smix_t smix, escrypt_local_t *local,
+        const uint8_t *passwd, size_t passwdlen,
+        const uint8_t *salt, size_t saltlen,
+        uint64_t N, uint32_t r, uint32_t p,
+        uint8_t *buf, size_t buflen ) {
+        if( !local || !sqrl_escrypt_params_ok( N, r, p ) ) {
+            errno = EINVAL;
+            return -1;
+        }
+        uint8_t *B = sqrl_escrypt_region( local, N, r, p );
+        if( !B ) return -1;
+        size_t B_size = (size_t)128 * r * p;
+        __m128i *V = (__m128i*)(B + B_size);
+        __m128i *XY = (__m128i*)((uint8_t*)V + (size_t)128 * r * (size_t)N);
+
+        sqrl_pbkdf2_sha256_1( passwd, passwdlen, salt, saltlen, B, B_size );
+        for( uint32_t i = 0; i < p; i++ ) {
+            smix( B + (size_t)128 * r * i, r, N, V, XY );
+        }
+        sqrl_pbkdf2_sha256_1( passwd, passwdlen, B, B_size, buf, buflen );
+        return 0;
+    }
+
+    static int sqrl_escrypt_kdf_mb( sqrl_smix_mb_t smix, size_t maxLanes, escrypt_local_t *const *local,
+        const uint8_t *const *passwd, const size_t *passwdlen,
+        const uint8_t *const *salt, const size_t *saltlen,
+        size_t lanes, uint64_t N, uint32_t r, uint32_t p,
+        uint8_t *const *buf, size_t buflen ) {
+        if( lanes == 0 || lanes > maxLanes || !sqrl_escrypt_params_ok( N, r, p ) ) {
+            errno = EINVAL;
+            return -1;
+        }
+        size_t B_size = (size_t)128 * r * p;
+        uint8_t *B[4], *Bi[4];
+        __m128i *V[4], *XY[4];
+        for( size_t l = 0; l < lanes; l++ ) {
+            if( !local[l] ) {
+                errno = EINVAL;
+                return -1;
+            }
+            B[l] = sqrl_escrypt_region( local[l], N, r, p );
+            if( !B[l] ) return -1;
+            V[l] = (__m128i*)(B[l] + B_size);
+            XY[l] = (__m128i*)((uint8_t*)V[l] + (size_t)128 * r * (size_t)N);
+            sqrl_pbkdf2_sha256_1( passwd[l], passwdlen[l], salt[l], saltlen[l], B[l], B_size );
+        }
+        for( uint32_t i = 0; i < p; i++ ) {
+            for( size_t l = 0; l < lanes; l++ ) Bi[l] = B[l] + (size_t)128 * r * i;
+            smix( Bi, r, N, V, XY, lanes );
+        }
+        for( size_t l = 0; l < lanes; l++ ) {
+            sqrl_pbkdf2_sha256_1( passwd[l], passwdlen[l], B[l], B_size, buf[l], buflen );
+        }
+        return 0;
+    }
+
+    int sqrl_escrypt_kdf_avx2( escrypt_local_t *local,
+        const uint8_t *passwd, size_t passwdlen,
+        const uint8_t *salt, size_t saltlen,
+        uint64_t N, uint32_t r, uint32_t p,
+        uint8_t *buf, size_t buflen ) {
+        return sqrl_escrypt_kdf( smix_avx2, local, passwd, passwdlen, salt, saltlen, N, r, p, buf, buflen );
+    }
+
+    int sqrl_escrypt_kdf_avx512( escrypt_local_t *local,
+        const uint8_t *passwd, size_t passwdlen,
+        const uint8_t *salt, size_t saltlen,
+        uint64_t N, uint32_t r, uint32_t p,
+        uint8_t *buf, size_t buflen ) {
+        return sqrl_escrypt_kdf( smix_avx512, local, passwd, passwdlen, salt, saltlen, N, r, p, buf, buflen );
+    }
+    int sqrl_escrypt_kdf_mb_avx2( escrypt_local_t *const *local,
+        const uint8_t *const *passwd, const size_t *passwdlen,
+        const uint8_t *const *salt, const size_t *saltlen,
+        size_t lanes, uint64_t N, uint32_t r, uint32_t p,
+        uint8_t *const *buf, size_t buflen ) {
+        return sqrl_escrypt_kdf_mb( smix_mb_avx2, 2, local, passwd, passwdlen, salt, saltlen, lanes, N, r, p, buf, buflen );
+    }
+
+    int sqrl_escrypt_kdf_mb_avx512( escrypt_local_t *const *local,
+        const uint8_t *const *passwd, const size_t *passwdlen,
+        const uint8_t *const *salt, const size_t *saltlen,
+        size_t lanes, uint64_t N, uint32_t r, uint32_t p,
+        uint8_t *const *buf, size_t buflen ) {
+        return sqrl_escrypt_kdf_mb( smix_mb_avx512, 4, local, passwd, passwdlen, salt, saltlen, lanes, N, r, p, buf, buflen );
+    }
+#endif // SQRL_X86
+
+    sqrl_escrypt_kdf_mb_t sqrl_escrypt_kdf_mb_select( size_t *lanes ) {
+#if defined(SQRL_X86)
+        if( sqrl_cpu_has_avx512() ) {
+            *lanes = 4;
+            return sqrl_escrypt_kdf_mb_avx512;
+        }
+        if( sqrl_cpu_has_avx2() ) {
+            *lanes = 2;
+            return sqrl_escrypt_kdf_mb_avx2;
+        }
+#endif
+        *lanes = 1;
+        return NULL;
+    }
+
+    escrypt_kdf_t sqrl_escrypt_kdf_select() {
+#if defined(SQRL_X86)
+        if( sqrl_cpu_has_avx512() ) return sqrl_escrypt_kdf_avx512;
+        if( sqrl_cpu_has_avx2() ) return sqrl_escrypt_kdf_avx2;
+#endif
+        return sodium_runtime_has_sse2() ? escrypt_kdf_sse : escrypt_kdf_nosse;
+    }
+#endif // WITH_SCRYPT
+}
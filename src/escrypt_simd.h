@@ -0,0 +1,76 @@
+/** \file escrypt_simd.h
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#ifndef ESCRYPT_SIMD_H
+#define ESCRYPT_SIMD_H
+
+#include "sqrl_internal.h"
+#include "cpu_features.h"
+
+#if defined(WITH_SCRYPT)
+namespace libsqrl
+{
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Multi-buffer scrypt: runs 'lanes' independent derivations sharing N, r and p.</summary>
+    ///
+    /// <remarks>
+    /// Every argument other than N, r, p and buflen is an array of 'lanes' entries, one per job.  Each
+    /// job needs its own escrypt_local_t, and produces exactly what escrypt_kdf would for the same
+    /// inputs.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    typedef int( *sqrl_escrypt_kdf_mb_t )(escrypt_local_t *const *local,
+        const uint8_t *const *passwd, const size_t *passwdlen,
+        const uint8_t *const *salt, const size_t *saltlen,
+        size_t lanes, uint64_t N, uint32_t r, uint32_t p,
+        uint8_t *const *buf, size_t buflen);
+
+#if defined(SQRL_X86)
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>scrypt kernels using AVX2 and AVX-512 encodings of the Salsa20/8 core.</summary>
+    ///
+    /// <remarks>
+    /// Drop-in replacements for libsodium's escrypt_kdf_sse / escrypt_kdf_nosse: same signature, same
+    /// escrypt_local_t scratch region, and bit-for-bit identical output.  Only call a kernel when the
+    /// matching sqrl_cpu_has_*() test passes; sqrl_escrypt_kdf_select() does that for you.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    int sqrl_escrypt_kdf_avx2( escrypt_local_t *local,
+        const uint8_t *passwd, size_t passwdlen,
+        const uint8_t *salt, size_t saltlen,
+        uint64_t N, uint32_t r, uint32_t p,
+        uint8_t *buf, size_t buflen );
+
+    int sqrl_escrypt_kdf_avx512( escrypt_local_t *local,
+        const uint8_t *passwd, size_t passwdlen,
+        const uint8_t *salt, size_t saltlen,
+        uint64_t N, uint32_t r, uint32_t p,
+        uint8_t *buf, size_t buflen );
+
+    /// <summary>Multi-buffer kernels: two jobs per YMM register, or four per ZMM register.</summary>
+    int sqrl_escrypt_kdf_mb_avx2( escrypt_local_t *const *local,
+        const uint8_t *const *passwd, const size_t *passwdlen,
+        const uint8_t *const *salt, const size_t *saltlen,
+        size_t lanes, uint64_t N, uint32_t r, uint32_t p,
+        uint8_t *const *buf, size_t buflen );
+
+    int sqrl_escrypt_kdf_mb_avx512( escrypt_local_t *const *local,
+        const uint8_t *const *passwd, const size_t *passwdlen,
+        const uint8_t *const *salt, const size_t *saltlen,
+        size_t lanes, uint64_t N, uint32_t r, uint32_t p,
+        uint8_t *const *buf, size_t buflen );
+#endif
+
+    /// <summary>Picks the fastest scrypt kernel this CPU supports: AVX-512, AVX2, SSE2, or portable.</summary>
+    escrypt_kdf_t sqrl_escrypt_kdf_select();
+
+    /// <summary>Picks the widest multi-buffer kernel, storing its lane count in 'lanes'.</summary>
+    ///
+    /// <returns>The kernel, or NULL (and *lanes = 1) when only single-buffer kernels are available.</returns>
+    sqrl_escrypt_kdf_mb_t sqrl_escrypt_kdf_mb_select( size_t *lanes );
+}
+#endif // WITH_SCRYPT
+#endif // ESCRYPT_SIMD_H
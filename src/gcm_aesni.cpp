@@ -0,0 +1,355 @@
+/** \file gcm_aesni.cpp
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#include "sqrl_internal.h"
+#include "gcm.h"
+#include "gcm_aesni.h"
+
+#if defined(SQRL_X86)
+#include <immintrin.h>
+
+#define AESNI_TARGET SQRL_TARGET( "aes,pclmul,sse4.1,ssse3" )
+
+namespace libsqrl
+{
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    // Key expansion
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    static AESNI_TARGET inline __m128i aesni_expand_step( __m128i key, __m128i assist ) {
+        key = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+        key = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+        key = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+        return _mm_xor_si128( key, assist );
+    }
+
+#define AES128_ROUND( i, rcon ) \
+    rk[i] = aesni_expand_step( rk[i - 1], _mm_shuffle_epi32( _mm_aeskeygenassist_si128( rk[i - 1], rcon ), 0xFF ) );
+
+#define AES256_ROUND( i, rcon ) \
+    rk[i] = aesni_expand_step( rk[i - 2], _mm_shuffle_epi32( _mm_aeskeygenassist_si128( rk[i - 1], rcon ), 0xFF ) ); \
+    rk[i + 1] = aesni_expand_step( rk[i - 1], _mm_shuffle_epi32( _mm_aeskeygenassist_si128( rk[i], 0 ), 0xAA ) );
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Expands an AES key.</summary>
+    ///
+    /// <param name="ctx">	  The context to fill.</param>
+    /// <param name="key">	  The key.</param>
+    /// <param name="keysize">16 or 32 (bytes).</param>
+    ///
+    /// <returns>0 on success, -1 for an unsupported key size.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    AESNI_TARGET int aesni_setkey( aesni_context *ctx, const uchar *key, uint keysize ) {
+        __m128i rk[15];
+        if( keysize == 16 ) {
+            rk[0] = _mm_loadu_si128( (const __m128i*)key );
+            AES128_ROUND( 1, 0x01 )
+            AES128_ROUND( 2, 0x02 )
+            AES128_ROUND( 3, 0x04 )
+            AES128_ROUND( 4, 0x08 )
+            AES128_ROUND( 5, 0x10 )
+            AES128_ROUND( 6, 0x20 )
+            AES128_ROUND( 7, 0x40 )
+            AES128_ROUND( 8, 0x80 )
+            AES128_ROUND( 9, 0x1B )
+            AES128_ROUND( 10, 0x36 )
+            ctx->rounds = 10;
+        } else if( keysize == 32 ) {
+            rk[0] = _mm_loadu_si128( (const __m128i*)key );
+            rk[1] = _mm_loadu_si128( (const __m128i*)(key + 16) );
+            AES256_ROUND( 2, 0x01 )
+            AES256_ROUND( 4, 0x02 )
+            AES256_ROUND( 6, 0x04 )
+            AES256_ROUND( 8, 0x08 )
+            AES256_ROUND( 10, 0x10 )
+            AES256_ROUND( 12, 0x20 )
+            rk[14] = aesni_expand_step( rk[12], _mm_shuffle_epi32( _mm_aeskeygenassist_si128( rk[13], 0x40 ), 0xFF ) );
+            ctx->rounds = 14;
+        } else {
+            return -1;
+        }
+        for( int i = 0; i <= ctx->rounds; i++ ) {
+            _mm_storeu_si128( (__m128i*)&ctx->rk[i * 2], rk[i] );
+        }
+        sqrl_memzero( rk, sizeof( rk ) );
+        return 0;
+    }
+
+    static AESNI_TARGET inline __m128i aesni_encrypt( const __m128i *rk, int rounds, __m128i x ) {
+        x = _mm_xor_si128( x, rk[0] );
+        for( int i = 1; i < rounds; i++ ) {
+            x = _mm_aesenc_si128( x, rk[i] );
+        }
+        return _mm_aesenclast_si128( x, rk[rounds] );
+    }
+
+    /// <summary>Encrypts a single 16 byte block.</summary>
+    AESNI_TARGET void aesni_encrypt_block( const aesni_context *ctx, const uchar input[16], uchar output[16] ) {
+        const __m128i *rk = (const __m128i*)ctx->rk;
+        __m128i x = _mm_xor_si128( _mm_loadu_si128( (const __m128i*)input ), _mm_loadu_si128( rk ) );
+        for( int i = 1; i < ctx->rounds; i++ ) {
+            x = _mm_aesenc_si128( x, _mm_loadu_si128( rk + i ) );
+        }
+        x = _mm_aesenclast_si128( x, _mm_loadu_si128( rk + ctx->rounds ) );
+        _mm_storeu_si128( (__m128i*)output, x );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Encrypts independent 16 byte blocks (ECB), four at a time.</summary>
+    ///
+    /// <remarks>AESENC has a latency of several cycles but a throughput of one per cycle, so
+    /// interleaving independent blocks keeps the unit busy.  'input' and 'output' may be the same.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    AESNI_TARGET void aesni_encrypt_blocks( const aesni_context *ctx, const uchar *input, uchar *output, size_t blocks ) {
+        __m128i rk[15];
+        int rounds = ctx->rounds;
+        for( int i = 0; i <= rounds; i++ ) {
+            rk[i] = _mm_loadu_si128( (const __m128i*)&ctx->rk[i * 2] );
+        }
+        for( ; blocks >= 4; blocks -= 4, input += 64, output += 64 ) {
+            __m128i b0 = _mm_xor_si128( _mm_loadu_si128( (const __m128i*)input ), rk[0] );
+            __m128i b1 = _mm_xor_si128( _mm_loadu_si128( (const __m128i*)(input + 16) ), rk[0] );
+            __m128i b2 = _mm_xor_si128( _mm_loadu_si128( (const __m128i*)(input + 32) ), rk[0] );
+            __m128i b3 = _mm_xor_si128( _mm_loadu_si128( (const __m128i*)(input + 48) ), rk[0] );
+            for( int i = 1; i < rounds; i++ ) {
+                b0 = _mm_aesenc_si128( b0, rk[i] );
+                b1 = _mm_aesenc_si128( b1, rk[i] );
+                b2 = _mm_aesenc_si128( b2, rk[i] );
+                b3 = _mm_aesenc_si128( b3, rk[i] );
+            }
+            _mm_storeu_si128( (__m128i*)output, _mm_aesenclast_si128( b0, rk[rounds] ) );
+            _mm_storeu_si128( (__m128i*)(output + 16), _mm_aesenclast_si128( b1, rk[rounds] ) );
+            _mm_storeu_si128( (__m128i*)(output + 32), _mm_aesenclast_si128( b2, rk[rounds] ) );
+            _mm_storeu_si128( (__m128i*)(output + 48), _mm_aesenclast_si128( b3, rk[rounds] ) );
+        }
+        for( ; blocks > 0; blocks--, input += 16, output += 16 ) {
+            __m128i b = aesni_encrypt( rk, rounds, _mm_loadu_si128( (const __m128i*)input ) );
+            _mm_storeu_si128( (__m128i*)output, b );
+        }
+        sqrl_memzero( rk, sizeof( rk ) );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Builds the decryption schedule (equivalent inverse cipher) from an encryption one.</summary>
+    ///
+    /// <param name="dec">The context to fill.  May not be 'enc'.</param>
+    /// <param name="enc">A context filled by aesni_setkey().</param>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    AESNI_TARGET void aesni_setkey_dec( aesni_context *dec, const aesni_context *enc ) {
+        int rounds = enc->rounds;
+        dec->rounds = rounds;
+        _mm_storeu_si128( (__m128i*)&dec->rk[0], _mm_loadu_si128( (const __m128i*)&enc->rk[rounds * 2] ) );
+        for( int i = 1; i < rounds; i++ ) {
+            __m128i k = _mm_loadu_si128( (const __m128i*)&enc->rk[(rounds - i) * 2] );
+            _mm_storeu_si128( (__m128i*)&dec->rk[i * 2], _mm_aesimc_si128( k ) );
+        }
+        _mm_storeu_si128( (__m128i*)&dec->rk[rounds * 2], _mm_loadu_si128( (const __m128i*)&enc->rk[0] ) );
+    }
+
+    /// <summary>Decrypts a single 16 byte block, using a schedule from aesni_setkey_dec().</summary>
+    AESNI_TARGET void aesni_decrypt_block( const aesni_context *dec, const uchar input[16], uchar output[16] ) {
+        const __m128i *rk = (const __m128i*)dec->rk;
+        __m128i x = _mm_xor_si128( _mm_loadu_si128( (const __m128i*)input ), _mm_loadu_si128( rk ) );
+        for( int i = 1; i < dec->rounds; i++ ) {
+            x = _mm_aesdec_si128( x, _mm_loadu_si128( rk + i ) );
+        }
+        x = _mm_aesdeclast_si128( x, _mm_loadu_si128( rk + dec->rounds ) );
+        _mm_storeu_si128( (__m128i*)output, x );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    // GHASH.  Blocks are byte reflected on load, so GF(2^128) multiplication is a carry-less multiply
+    // followed by a one bit shift and reduction modulo x^128 + x^7 + x^2 + x + 1.
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    static AESNI_TARGET inline __m128i ghash_mul( __m128i a, __m128i b ) {
+        __m128i lo = _mm_clmulepi64_si128( a, b, 0x00 );
+        __m128i mid = _mm_xor_si128( _mm_clmulepi64_si128( a, b, 0x10 ), _mm_clmulepi64_si128( a, b, 0x01 ) );
+        __m128i hi = _mm_clmulepi64_si128( a, b, 0x11 );
+        lo = _mm_xor_si128( lo, _mm_slli_si128( mid, 8 ) );
+        hi = _mm_xor_si128( hi, _mm_srli_si128( mid, 8 ) );
+
+        // Shift the 256 bit product left by one.
+        __m128i c1 = _mm_srli_epi32( lo, 31 );
+        __m128i c2 = _mm_srli_epi32( hi, 31 );
+        lo = _mm_slli_epi32( lo, 1 );
+        hi = _mm_slli_epi32( hi, 1 );
+        __m128i c3 = _mm_srli_si128( c1, 12 );
+        c2 = _mm_slli_si128( c2, 4 );
+        c1 = _mm_slli_si128( c1, 4 );
+        lo = _mm_or_si128( lo, c1 );
+        hi = _mm_or_si128( hi, _mm_or_si128( c2, c3 ) );
+
+        // Reduce.
+        __m128i t = _mm_xor_si128( _mm_xor_si128( _mm_slli_epi32( lo, 31 ), _mm_slli_epi32( lo, 30 ) ), _mm_slli_epi32( lo, 25 ) );
+        __m128i t2 = _mm_srli_si128( t, 4 );
+        lo = _mm_xor_si128( lo, _mm_slli_si128( t, 12 ) );
+        __m128i r = _mm_xor_si128( _mm_xor_si128( _mm_srli_epi32( lo, 1 ), _mm_srli_epi32( lo, 2 ) ), _mm_srli_epi32( lo, 7 ) );
+        r = _mm_xor_si128( r, t2 );
+        lo = _mm_xor_si128( lo, r );
+        return _mm_xor_si128( hi, lo );
+    }
+
+    /// <summary>Loads up to 16 bytes, zero padded.</summary>
+    static AESNI_TARGET inline __m128i load_partial( const uchar *p, size_t len ) {
+        uchar buf[16] = {0};
+        memcpy( buf, p, len );
+        return _mm_loadu_si128( (const __m128i*)buf );
+    }
+
+    /// <summary>GHASH over a buffer, zero padding the last block.  H[0..3] hold H^1..H^4.</summary>
+    static AESNI_TARGET __m128i ghash_update( __m128i X, const __m128i *H, const __m128i BSWAP, const uchar *p, size_t len ) {
+        // Four blocks at a time: X = (X ^ B0)H^4 ^ B1 H^3 ^ B2 H^2 ^ B3 H.  Reduction is linear, so the
+        // four products are independent and can overlap in the pipeline.
+        while( len >= 64 ) {
+            __m128i b0 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*)p ), BSWAP );
+            __m128i b1 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*)(p + 16) ), BSWAP );
+            __m128i b2 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*)(p + 32) ), BSWAP );
+            __m128i b3 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*)(p + 48) ), BSWAP );
+            X = _mm_xor_si128(
+                _mm_xor_si128( ghash_mul( _mm_xor_si128( X, b0 ), H[3] ), ghash_mul( b1, H[2] ) ),
+                _mm_xor_si128( ghash_mul( b2, H[1] ), ghash_mul( b3, H[0] ) ) );
+            p += 64;
+            len -= 64;
+        }
+        while( len >= 16 ) {
+            X = ghash_mul( _mm_xor_si128( X, _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*)p ), BSWAP ) ), H[0] );
+            p += 16;
+            len -= 16;
+        }
+        if( len ) {
+            X = ghash_mul( _mm_xor_si128( X, _mm_shuffle_epi8( load_partial( p, len ), BSWAP ) ), H[0] );
+        }
+        return X;
+    }
+
+    /// <summary>Builds counter block 'ctr' (big-endian, in the last four bytes) after the 12 byte IV.</summary>
+    static AESNI_TARGET inline __m128i ctr_block( __m128i iv, uint32_t ctr ) {
+        return _mm_insert_epi32( iv, (int)(((ctr & 0xFF) << 24) | ((ctr & 0xFF00) << 8) |
+            ((ctr >> 8) & 0xFF00) | (ctr >> 24)), 3 );
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Encrypts or decrypts with AES-GCM, and generates the authentication tag.</summary>
+    ///
+    /// <returns>0 on success, -1 if the key size or IV length is not supported here.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    AESNI_TARGET int gcm_aesni_crypt_and_tag( int mode, const uchar *key, uint keysize,
+        const uchar *iv, size_t iv_len, const uchar *add, size_t add_len,
+        const uchar *input, uchar *output, size_t length, uchar *tag, size_t tag_len ) {
+        if( iv_len != 12 || tag_len > 16 ) return -1;
+        aesni_context ctx;
+        if( aesni_setkey( &ctx, key, keysize ) ) return -1;
+
+        const __m128i BSWAP = _mm_set_epi8( 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 );
+        __m128i rk[15];
+        int rounds = ctx.rounds;
+        for( int i = 0; i <= rounds; i++ ) {
+            rk[i] = _mm_loadu_si128( (const __m128i*)&ctx.rk[i * 2] );
+        }
+        sqrl_memzero( &ctx, sizeof( ctx ) );
+
+        __m128i H[4];
+        H[0] = _mm_shuffle_epi8( aesni_encrypt( rk, rounds, _mm_setzero_si128() ), BSWAP );
+        H[1] = ghash_mul( H[0], H[0] );
+        H[2] = ghash_mul( H[1], H[0] );
+        H[3] = ghash_mul( H[2], H[0] );
+
+        __m128i IV = load_partial( iv, 12 );
+        __m128i EJ0 = aesni_encrypt( rk, rounds, ctr_block( IV, 1 ) );
+        __m128i X = ghash_update( _mm_setzero_si128(), H, BSWAP, add, add_len );
+
+        uint32_t ctr = 2;
+        size_t done = 0;
+        // Four counter blocks at a time keeps the AES units busy.
+        while( length - done >= 64 ) {
+            __m128i k0 = _mm_xor_si128( ctr_block( IV, ctr ), rk[0] );
+            __m128i k1 = _mm_xor_si128( ctr_block( IV, ctr + 1 ), rk[0] );
+            __m128i k2 = _mm_xor_si128( ctr_block( IV, ctr + 2 ), rk[0] );
+            __m128i k3 = _mm_xor_si128( ctr_block( IV, ctr + 3 ), rk[0] );
+            for( int i = 1; i < rounds; i++ ) {
+                k0 = _mm_aesenc_si128( k0, rk[i] );
+                k1 = _mm_aesenc_si128( k1, rk[i] );
+                k2 = _mm_aesenc_si128( k2, rk[i] );
+                k3 = _mm_aesenc_si128( k3, rk[i] );
+            }
+            k0 = _mm_aesenclast_si128( k0, rk[rounds] );
+            k1 = _mm_aesenclast_si128( k1, rk[rounds] );
+            k2 = _mm_aesenclast_si128( k2, rk[rounds] );
+            k3 = _mm_aesenclast_si128( k3, rk[rounds] );
+            const uchar *in = input + done;
+            __m128i c0 = _mm_loadu_si128( (const __m128i*)in );
+            __m128i c1 = _mm_loadu_si128( (const __m128i*)(in + 16) );
+            __m128i c2 = _mm_loadu_si128( (const __m128i*)(in + 32) );
+            __m128i c3 = _mm_loadu_si128( (const __m128i*)(in + 48) );
+            if( mode == DECRYPT ) X = ghash_update( X, H, BSWAP, in, 64 );
+            uchar *out = output + done;
+            _mm_storeu_si128( (__m128i*)out, _mm_xor_si128( c0, k0 ) );
+            _mm_storeu_si128( (__m128i*)(out + 16), _mm_xor_si128( c1, k1 ) );
+            _mm_storeu_si128( (__m128i*)(out + 32), _mm_xor_si128( c2, k2 ) );
+            _mm_storeu_si128( (__m128i*)(out + 48), _mm_xor_si128( c3, k3 ) );
+            if( mode == ENCRYPT ) X = ghash_update( X, H, BSWAP, out, 64 );
+            ctr += 4;
+            done += 64;
+        }
+        while( done < length ) {
+            size_t n = length - done < 16 ? length - done : 16;
+            uchar ks[16];
+            _mm_storeu_si128( (__m128i*)ks, aesni_encrypt( rk, rounds, ctr_block( IV, ctr ) ) );
+            if( mode == DECRYPT ) X = ghash_update( X, H, BSWAP, input + done, n );
+            for( size_t i = 0; i < n; i++ ) {
+                output[done + i] = input[done + i] ^ ks[i];
+            }
+            if( mode == ENCRYPT ) X = ghash_update( X, H, BSWAP, output + done, n );
+            sqrl_memzero( ks, sizeof( ks ) );
+            ctr++;
+            done += n;
+        }
+
+        // Lengths block: bit lengths of the additional data and the cipher text, big-endian.
+        uchar lens[16];
+        uint64_t abits = (uint64_t)add_len * 8, cbits = (uint64_t)length * 8;
+        for( int i = 0; i < 8; i++ ) {
+            lens[i] = (uchar)(abits >> (56 - i * 8));
+            lens[8 + i] = (uchar)(cbits >> (56 - i * 8));
+        }
+        X = ghash_update( X, H, BSWAP, lens, 16 );
+
+        uchar full[16];
+        _mm_storeu_si128( (__m128i*)full, _mm_xor_si128( _mm_shuffle_epi8( X, BSWAP ), EJ0 ) );
+        if( tag && tag_len ) memcpy( tag, full, tag_len );
+        sqrl_memzero( full, sizeof( full ) );
+        sqrl_memzero( rk, sizeof( rk ) );
+        sqrl_memzero( H, sizeof( H ) );
+        return 0;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>Decrypts with AES-GCM and verifies the tag, wiping the output if it doesn't match.</summary>
+    ///
+    /// <returns>0 on success, GCM_AUTH_FAILURE on a bad tag, or -1 if not supported here.</returns>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    int gcm_aesni_auth_decrypt( const uchar *key, uint keysize,
+        const uchar *iv, size_t iv_len, const uchar *add, size_t add_len,
+        const uchar *input, uchar *output, size_t length, const uchar *tag, size_t tag_len ) {
+        uchar check_tag[16];
+        int diff = 0;
+        if( gcm_aesni_crypt_and_tag( DECRYPT, key, keysize, iv, iv_len, add, add_len,
+            input, output, length, check_tag, tag_len ) ) {
+            return -1;
+        }
+        for( size_t i = 0; i < tag_len; i++ ) {
+            diff |= tag[i] ^ check_tag[i];
+        }
+        sqrl_memzero( check_tag, sizeof( check_tag ) );
+        if( diff != 0 ) {
+            memset( output, 0, length );
+            return GCM_AUTH_FAILURE;
+        }
+        return 0;
+    }
+}
+#endif // SQRL_X86
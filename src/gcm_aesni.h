@@ -0,0 +1,67 @@
+/** \file gcm_aesni.h
+ *
+ * \author Adam Comley
+ *
+ * This file is part of libsqrl.  It is released under the MIT license.
+ * For more details, see the LICENSE file included with this package.
+**/
+
+#ifndef GCM_AESNI_H
+#define GCM_AESNI_H
+
+#include "aes.h"
+#include "cpu_features.h"
+
+namespace libsqrl
+{
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// <summary>AES-GCM using AES-NI and PCLMULQDQ.</summary>
+    ///
+    /// <remarks>
+    /// A drop-in replacement for gcm_crypt_and_tag / gcm_auth_decrypt, producing identical output, for
+    /// 128 and 256 bit keys and 12 byte IVs.  Runs in constant time: there are no key or data dependent
+    /// table lookups.  Only call these when sqrl_cpu_has_aesni() is true; they return -1 for anything
+    /// they don't handle, so the caller can fall back to gcm.cpp.</remarks>
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+#if defined(SQRL_X86)
+    typedef struct
+    {
+        uint64_t rk[30];        // expanded key: up to 15 round keys (16 bytes each, 16 byte aligned)
+        int rounds;             // 10 or 14
+    } aesni_context;
+
+    int aesni_setkey( aesni_context *ctx, const uchar *key, uint keysize );
+    void aesni_encrypt_block( const aesni_context *ctx, const uchar input[16], uchar output[16] );
+    void aesni_encrypt_blocks( const aesni_context *ctx, const uchar *input, uchar *output, size_t blocks );
+    void aesni_setkey_dec( aesni_context *dec, const aesni_context *enc );
+    void aesni_decrypt_block( const aesni_context *dec, const uchar input[16], uchar output[16] );
+
+    int gcm_aesni_crypt_and_tag(
+        int mode,               // ENCRYPT or DECRYPT
+        const uchar *key,       // pointer to the cipher key
+        uint keysize,           // 16 or 32 bytes
+        const uchar *iv,        // pointer to the 12-byte initialization vector
+        size_t iv_len,          // must be 12
+        const uchar *add,       // pointer to the non-ciphered additional data
+        size_t add_len,         // byte length of the additional AEAD data
+        const uchar *input,     // pointer to the cipher data source
+        uchar *output,          // pointer to the cipher data destination
+        size_t length,          // byte length of the cipher data
+        uchar *tag,             // pointer to the tag to be generated
+        size_t tag_len );       // byte length of the tag to be generated
+
+    int gcm_aesni_auth_decrypt(
+        const uchar *key,       // pointer to the cipher key
+        uint keysize,           // 16 or 32 bytes
+        const uchar *iv,        // pointer to the 12-byte initialization vector
+        size_t iv_len,          // must be 12
+        const uchar *add,       // pointer to the non-ciphered additional data
+        size_t add_len,         // byte length of the additional AEAD data
+        const uchar *input,     // pointer to the cipher data source
+        uchar *output,          // pointer to the cipher data destination
+        size_t length,          // byte length of the cipher data
+        const uchar *tag,       // pointer to the tag to be authenticated
+        size_t tag_len );       // byte length of the tag <= 16
+#endif
+}
+#endif // GCM_AESNI_H
@@ -70,6 +70,7 @@ namespace libsqrl
     class SqrlActionEnable;
     class SqrlActionDisable;
     class SqrlActionChangePassword;
+    class SqrlActionExecutor;
     class SqrlAction;
 
     // Buffer sizes for keys, etc...
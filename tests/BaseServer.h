@@ -1,6 +1,9 @@
 #pragma once
 
+#include <atomic>
 #include "SqrlServer.h"
+#include "SqrlServerRequest.h"
+#include "SqrlString.h"
 
 using namespace libsqrl;
 
@@ -8,42 +11,67 @@ class BaseServer : public SqrlServer
 {
 public:
     BaseServer( const char *uri, const char *sfn, const char *passcode, size_t passcode_len )
-        : SqrlServer( uri, sfn, passcode, passcode_len ) {
+        : SqrlServer( uri, sfn, passcode, passcode_len ), replies( 0 ), failures( 0 ) {
 
     }
 
+    void tryAddMAC( SqrlString *str, char sep ) {
+        this->addMAC( str, sep );
+    }
+
     bool tryVerifyMAC( SqrlString *str ) {
         return this->verifyMAC( str );
     }
 
+    bool tryCreateNut( Sqrl_Nut *nut, uint32_t ip ) {
+        return this->createNut( nut, ip );
+    }
+
+    bool tryDecryptNut( Sqrl_Nut *nut ) {
+        return this->decryptNut( nut );
+    }
+
+    const uint8_t *getKey() {
+        return this->key;
+    }
+
+    const SqrlString *getQry() {
+        return this->qry;
+    }
+
+    std::atomic<int> replies;
+    std::atomic<int> failures;
+
 protected:
-    bool onUserFind( const std::string *host, const std::string *idk, const std::string *pidk ) {
+    bool onUserFind( SqrlServerRequest *request, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) {
         return true;
     }
 
-    bool onUserCreate( const std::string *host, const std::string *idk, const std::string *pidk ) {
+    bool onUserCreate( SqrlServerRequest *request, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) {
         return true;
     }
 
-    bool onUserUpdate( const std::string *host, const std::string *idk, const std::string *pidk ) {
+    bool onUserUpdate( SqrlServerRequest *request, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) {
         return true;
     }
 
-    bool onUserDelete( const std::string *host, const std::string *idk, const std::string *pidk ) {
+    bool onUserDelete( SqrlServerRequest *request, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) {
         return true;
     }
 
-    bool onUserRekeyed( const std::string *host, const std::string *idk, const std::string *pidk ) {
+    bool onUserRekeyed( SqrlServerRequest *request, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) {
         return true;
     }
 
-    bool onUserIdentified( const std::string *host, const std::string *idk, const std::string *pidk ) {
+    bool onUserIdentified( SqrlServerRequest *request, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) {
         return true;
     }
 
-    void onSend( const std::string *reply ) {
-        printf( "srv -> client: %s\n", reply->data() );
+    void onSend( SqrlServerRequest *request, const SqrlString *reply ) {
+        this->replies++;
+        if( request->getTif() & SQRL_TIF_COMMAND_FAILURE ) {
+            this->failures++;
+        }
     }
 
 };
-
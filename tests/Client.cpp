@@ -0,0 +1,680 @@
+#include "catch.hpp"
+#include "sqrl.h"
+#include "SqrlClientAsync.h"
+#include "SqrlAction.h"
+#include "SqrlActionExecutor.h"
+#include "SqrlUser.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace libsqrl;
+
+typedef std::chrono::steady_clock::time_point Sqrl_Test_Time;
+
+// Counts finished actions; any other callback is unexpected.
+class LatencyClient : public SqrlClientAsync
+{
+public:
+    std::atomic<int> completed;
+    std::atomic<int> loops;
+
+    LatencyClient() : SqrlClientAsync(), completed( 0 ), loops( 0 ) {}
+    ~LatencyClient() { this->stop(); }
+
+    // Waits up to 'ms' for 'n' actions to finish.
+    bool waitCompleted( int n, int ms ) {
+        auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds( ms );
+        while( this->completed < n ) {
+            if( std::chrono::steady_clock::now() > end ) return false;
+            std::this_thread::yield();
+        }
+        return true;
+    }
+
+protected:
+    void onLoop() { this->loops++; }
+    void onSend( SqrlAction *t, SqrlString url, SqrlString payload ) {}
+    void onProgress( SqrlAction *action, int progress ) {}
+    void onAsk( SqrlAction *action, SqrlString message, SqrlString firstButton, SqrlString secondButton ) {}
+    void onAuthenticationRequired( SqrlAction *action, Sqrl_Credential_Type credentialType ) {}
+    void onSelectUser( SqrlAction *action ) {}
+    void onSelectAlternateIdentity( SqrlAction *action ) {}
+    void onSaveSuggested( SqrlUser *user ) {}
+    void onActionComplete( SqrlAction *action ) { this->completed++; }
+};
+
+// Notes when it is first run, then finishes.
+class TimedAction : public SqrlAction
+{
+public:
+    TimedAction( Sqrl_Test_Time *ran ) : SqrlAction(), ran( ran ) {}
+
+protected:
+    int run( int cs ) {
+        *this->ran = std::chrono::steady_clock::now();
+        return this->retActionComplete( SQRL_ACTION_SUCCESS );
+    }
+
+    Sqrl_Test_Time *ran;
+};
+
+// Waits for an answer through authenticate(), then finishes.
+class WaitingAction : public SqrlAction
+{
+public:
+    WaitingAction( Sqrl_Test_Time *ran ) : SqrlAction(), ran( ran ), answered( false ) {}
+
+    void answer() {
+        this->answered = true;
+        this->authenticate( SQRL_CREDENTIAL_HINT, "", 0 );
+    }
+
+protected:
+    int run( int cs ) {
+        if( !this->answered ) return cs;
+        *this->ran = std::chrono::steady_clock::now();
+        return this->retActionComplete( SQRL_ACTION_SUCCESS );
+    }
+
+    Sqrl_Test_Time *ran;
+    std::atomic<bool> answered;
+};
+
+TEST_CASE( "Async client wakes for new actions", "[client]" ) {
+    LatencyClient *client = new LatencyClient();
+    Sqrl_Test_Time ran;
+    double worst = 0, total = 0;
+    const int n = 200;
+
+    // Let the client thread go to sleep first.
+    std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+    int idleLoops = client->loops;
+    std::this_thread::sleep_for( std::chrono::milliseconds( 300 ) );
+    REQUIRE( client->loops == idleLoops );
+
+    for( int i = 0; i < n; i++ ) {
+        Sqrl_Test_Time start = std::chrono::steady_clock::now();
+        (new TimedAction( &ran ))->start();
+        REQUIRE( client->waitCompleted( i + 1, 1000 ) );
+        double us = std::chrono::duration<double, std::micro>( ran - start ).count();
+        total += us;
+        if( us > worst ) worst = us;
+    }
+    // The old client slept up to 100 ms between looks at its queue.
+    INFO( "start() to first run(): " << total / n << " us mean, " << worst << " us worst" );
+    REQUIRE( total / n < 10000.0 );
+
+    // An action waiting on the user moves as soon as it is answered.
+    WaitingAction *waiting = new WaitingAction( &ran );
+    waiting->start();
+    std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+    Sqrl_Test_Time start = std::chrono::steady_clock::now();
+    waiting->answer();
+    REQUIRE( client->waitCompleted( n + 1, 1000 ) );
+    double us = std::chrono::duration<double, std::micro>( ran - start ).count();
+    INFO( "authenticate() to next run(): " << us << " us" );
+    REQUIRE( us < 10000.0 );
+
+    delete client;
+}
+
+// Counts how many steps run at once, in total and per user.
+struct Sqrl_Test_Overlap
+{
+    std::atomic<int> running;
+    std::atomic<int> peak;
+    std::atomic<int> clashes;
+    std::atomic<int> users[16];
+
+    Sqrl_Test_Overlap() : running( 0 ), peak( 0 ), clashes( 0 ) {
+        for( int i = 0; i < 16; i++ ) this->users[i] = 0;
+    }
+};
+
+// Takes 'steps' steps of its user's time, each lasting 'us' (sleeping, or spinning if 'spin').
+class UserStepAction : public SqrlAction
+{
+public:
+    UserStepAction( SqrlUser *user, int slot, int steps, int us, bool spin, Sqrl_Test_Overlap *overlap ) :
+        SqrlAction(), slot( slot ), steps( steps ), us( us ), spin( spin ), overlap( overlap ) {
+        this->user = user;
+    }
+
+protected:
+    int run( int cs ) {
+        if( cs >= this->steps ) return this->retActionComplete( SQRL_ACTION_SUCCESS );
+        if( this->overlap->users[this->slot]++ != 0 ) this->overlap->clashes++;
+        int now = ++this->overlap->running;
+        int peak = this->overlap->peak;
+        while( now > peak && !this->overlap->peak.compare_exchange_weak( peak, now ) );
+        if( this->spin ) {
+            auto end = std::chrono::steady_clock::now() + std::chrono::microseconds( this->us );
+            while( std::chrono::steady_clock::now() < end );
+        } else {
+            std::this_thread::sleep_for( std::chrono::microseconds( this->us ) );
+        }
+        this->overlap->running--;
+        this->overlap->users[this->slot]--;
+        return cs + 1;
+    }
+
+    int slot, steps, us;
+    bool spin;
+    Sqrl_Test_Overlap *overlap;
+};
+
+// Is answered while its first step is still running, as by another thread, then finishes.
+class AnsweredMidStepAction : public SqrlAction
+{
+public:
+    AnsweredMidStepAction() : SqrlAction(), answered( false ) {}
+
+protected:
+    int run( int cs ) {
+        if( this->answered ) return this->retActionComplete( SQRL_ACTION_SUCCESS );
+        this->answered = true;
+        this->authenticate( SQRL_CREDENTIAL_HINT, "", 0 );
+        return cs;
+    }
+
+    bool answered;
+};
+
+TEST_CASE( "Action executor", "[client]" ) {
+    LatencyClient *client = new LatencyClient();
+    REQUIRE( client->setActionWorkers( 4 ) );
+    REQUIRE_FALSE( client->setActionWorkers( 2 ) );
+    SqrlActionExecutor *executor = client->getActionExecutor();
+    REQUIRE( executor );
+    REQUIRE( executor->getWorkerCount() == 4 );
+    SqrlUser *users[16];
+    for( int i = 0; i < 16; i++ ) users[i] = new SqrlUser();
+    int done = 0;
+
+    SECTION( "Steps for one user never overlap" ) {
+        Sqrl_Test_Overlap overlap;
+        const int n = 48;
+        for( int i = 0; i < n; i++ ) {
+            (new UserStepAction( users[i % 3], i % 3, 10, 200, false, &overlap ))->start();
+        }
+        REQUIRE( client->waitCompleted( n, 10000 ) );
+        REQUIRE( overlap.clashes == 0 );
+        REQUIRE( executor->getSteps() >= (uint64_t)n * 11 );
+        // Three users, so at most three at once.
+        REQUIRE( overlap.peak <= 3 );
+    }
+
+    SECTION( "Different users run in parallel" ) {
+        Sqrl_Test_Overlap overlap;
+        const int n = 8, steps = 5, us = 2000;
+        Sqrl_Test_Time start = std::chrono::steady_clock::now();
+        for( int i = 0; i < n; i++ ) {
+            (new UserStepAction( users[i], i, steps, us, false, &overlap ))->start();
+        }
+        REQUIRE( client->waitCompleted( n, 10000 ) );
+        double ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+        REQUIRE( overlap.clashes == 0 );
+        REQUIRE( overlap.peak > 1 );
+        REQUIRE( overlap.peak <= 4 );
+        REQUIRE( ms < n * steps * us / 1000.0 * 0.75 );
+    }
+
+    SECTION( "Actions without a user run in parallel" ) {
+        Sqrl_Test_Overlap overlap;
+        const int n = 8;
+        for( int i = 0; i < n; i++ ) {
+            (new UserStepAction( NULL, i, 5, 2000, false, &overlap ))->start();
+        }
+        REQUIRE( client->waitCompleted( n, 10000 ) );
+        REQUIRE( overlap.peak > 1 );
+    }
+
+    SECTION( "Idle workers steal queued actions" ) {
+        Sqrl_Test_Overlap overlap;
+        const int n = 16;
+        // Every action lands on a worker in turn; uneven lengths leave some workers with nothing.
+        for( int i = 0; i < n; i++ ) {
+            (new UserStepAction( users[i], i, i % 4 == 0 ? 20 : 1, 500, false, &overlap ))->start();
+        }
+        REQUIRE( client->waitCompleted( n, 10000 ) );
+        REQUIRE( executor->getSteals() > 0 );
+    }
+
+    SECTION( "A waiting action is parked until it is answered" ) {
+        Sqrl_Test_Time ran;
+        WaitingAction *waiting = new WaitingAction( &ran );
+        waiting->start();
+        std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+        REQUIRE( executor->getParks() > 0 );
+        uint64_t steps = executor->getSteps();
+        std::this_thread::sleep_for( std::chrono::milliseconds( SQRL_CLIENT_POLL_MS * 2 + 10 ) );
+        // Looked at now and then, not spun on.
+        REQUIRE( executor->getSteps() - steps <= 4 );
+        Sqrl_Test_Time start = std::chrono::steady_clock::now();
+        waiting->answer();
+        REQUIRE( client->waitCompleted( 1, 1000 ) );
+        double us = std::chrono::duration<double, std::micro>( ran - start ).count();
+        REQUIRE( us < 10000.0 );
+    }
+
+    SECTION( "An action answered during its step isn't parked" ) {
+        (new AnsweredMidStepAction())->start();
+        REQUIRE( client->waitCompleted( 1, SQRL_CLIENT_POLL_MS / 2 ) );
+        REQUIRE( executor->getParks() == 0 );
+    }
+
+    delete client;
+}
+
+// Steps per second for many users' actions, each step spinning for a few microseconds.
+static double client_step_rate( size_t workers, int actions, int steps, int us ) {
+    LatencyClient *client = new LatencyClient();
+    if( workers ) client->setActionWorkers( workers );
+    SqrlUser *users[16];
+    for( int i = 0; i < 16; i++ ) users[i] = new SqrlUser();
+    Sqrl_Test_Overlap overlap;
+    Sqrl_Test_Time start = std::chrono::steady_clock::now();
+    for( int i = 0; i < actions; i++ ) {
+        (new UserStepAction( users[i % 16], i % 16, steps, us, true, &overlap ))->start();
+    }
+    bool finished = client->waitCompleted( actions, 60000 );
+    double s = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+    delete client;
+    return finished ? actions * (steps + 1) / s : 0;
+}
+
+TEST_CASE( "Action executor throughput", "[.][benchmark]" ) {
+    const int actions = 256, steps = 50, us = 20;
+    printf( "Hardware threads: %u\n", std::thread::hardware_concurrency() );
+    printf( "Client thread: %.0f steps/sec\n", client_step_rate( 0, actions, steps, us ) );
+    for( size_t workers = 1; workers <= 8; workers *= 2 ) {
+        printf( "%u worker(s): %.0f steps/sec\n", (unsigned)workers, client_step_rate( workers, actions, steps, us ) );
+    }
+}
+
+// A client stepped by hand, for checking the order of steps.
+class StepClient : public SqrlClient
+{
+protected:
+    void onSend( SqrlAction *t, SqrlString url, SqrlString payload ) {}
+    void onProgress( SqrlAction *action, int progress ) {}
+    void onAsk( SqrlAction *action, SqrlString message, SqrlString firstButton, SqrlString secondButton ) {}
+    void onAuthenticationRequired( SqrlAction *action, Sqrl_Credential_Type credentialType ) {}
+    void onSelectUser( SqrlAction *action ) {}
+    void onSelectAlternateIdentity( SqrlAction *action ) {}
+    void onSaveSuggested( SqrlUser *user ) {}
+    void onActionComplete( SqrlAction *action ) {}
+};
+
+// Logs its id at each step, and finishes after 'steps' steps; with steps < 0, waits forever.
+class PriorityAction : public SqrlAction
+{
+public:
+    PriorityAction( int priority, int id, int steps, std::vector<int> *log ) :
+        SqrlAction( priority ), id( id ), steps( steps ), log( log ) {}
+
+protected:
+    int run( int cs ) {
+        if( this->steps >= 0 && cs >= this->steps ) return this->retActionComplete( SQRL_ACTION_SUCCESS );
+        this->log->push_back( this->id );
+        return this->steps < 0 ? cs : cs + 1;
+    }
+
+    int id, steps;
+    std::vector<int> *log;
+};
+
+TEST_CASE( "Action priorities", "[client]" ) {
+    StepClient *client = new StepClient();
+    std::vector<int> log;
+    struct Sqrl_Action_Stats stats;
+
+    SECTION( "The most urgent class runs first, and alone while it moves" ) {
+        (new PriorityAction( SQRL_ACTION_PRIORITY_BACKGROUND, 3, 2, &log ))->start();
+        (new PriorityAction( SQRL_ACTION_PRIORITY_NORMAL, 2, 2, &log ))->start();
+        (new PriorityAction( SQRL_ACTION_PRIORITY_INTERACTIVE, 1, 2, &log ))->start();
+        for( int i = 0; i < 12; i++ ) client->loop();
+        std::vector<int> expected = { 1, 1, 2, 2, 3, 3 };
+        REQUIRE( log == expected );
+        for( int i = 0; i < SQRL_ACTION_PRIORITY_COUNT; i++ ) {
+            REQUIRE( client->getActionStats( i, &stats ) );
+            REQUIRE( stats.queued == 0 );
+            REQUIRE( stats.steps == 3 );
+        }
+    }
+
+    SECTION( "Less urgent actions run while a more urgent one waits" ) {
+        (new PriorityAction( SQRL_ACTION_PRIORITY_INTERACTIVE, 1, -1, &log ))->start();
+        (new PriorityAction( SQRL_ACTION_PRIORITY_BACKGROUND, 3, 2, &log ))->start();
+        client->loop();
+        std::vector<int> expected = { 1, 3 };
+        REQUIRE( log == expected );
+        REQUIRE( client->getActionStats( SQRL_ACTION_PRIORITY_INTERACTIVE, &stats ) );
+        REQUIRE( stats.queued == 1 );
+        // The waiting action's later steps are not waits.
+        client->loop();
+        client->loop();
+        REQUIRE( client->getActionStats( SQRL_ACTION_PRIORITY_INTERACTIVE, &stats ) );
+        REQUIRE( stats.steps == 3 );
+        REQUIRE( stats.waits == 1 );
+    }
+
+    SECTION( "Earlier deadlines go first within a class" ) {
+        (new PriorityAction( SQRL_ACTION_PRIORITY_NORMAL, 1, 1, &log ))->start();
+        PriorityAction *late = new PriorityAction( SQRL_ACTION_PRIORITY_NORMAL, 2, 1, &log );
+        late->setDeadline( 20 );
+        late->start();
+        PriorityAction *soon = new PriorityAction( SQRL_ACTION_PRIORITY_NORMAL, 3, 1, &log );
+        soon->setDeadline( 10 );
+        soon->start();
+        client->loop();
+        std::vector<int> expected = { 3, 2, 1 };
+        REQUIRE( log == expected );
+    }
+
+    SECTION( "A missed deadline makes an action interactive" ) {
+        (new PriorityAction( SQRL_ACTION_PRIORITY_NORMAL, 1, 3, &log ))->start();
+        PriorityAction *overdue = new PriorityAction( SQRL_ACTION_PRIORITY_BACKGROUND, 2, 1, &log );
+        overdue->setDeadline( 0.0001 );
+        overdue->start();
+        std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+        client->loop();
+        std::vector<int> expected = { 2 };
+        REQUIRE( log == expected );
+        REQUIRE( client->getActionStats( SQRL_ACTION_PRIORITY_BACKGROUND, &stats ) );
+        REQUIRE( stats.missedDeadlines == 1 );
+    }
+
+    SECTION( "Changing the priority moves the action between classes" ) {
+        PriorityAction *action = new PriorityAction( SQRL_ACTION_PRIORITY_BACKGROUND, 1, 1, &log );
+        action->start();
+        REQUIRE( action->getPriority() == SQRL_ACTION_PRIORITY_BACKGROUND );
+        action->setPriority( SQRL_ACTION_PRIORITY_INTERACTIVE );
+        REQUIRE( action->getPriority() == SQRL_ACTION_PRIORITY_INTERACTIVE );
+        REQUIRE( client->getActionStats( SQRL_ACTION_PRIORITY_BACKGROUND, &stats ) );
+        REQUIRE( stats.queued == 0 );
+        REQUIRE( client->getActionStats( SQRL_ACTION_PRIORITY_INTERACTIVE, &stats ) );
+        REQUIRE( stats.queued == 1 );
+        client->loop();
+        REQUIRE( client->getActionStats( SQRL_ACTION_PRIORITY_INTERACTIVE, &stats ) );
+        REQUIRE( stats.steps == 1 );
+        REQUIRE( stats.waits == 1 );
+        REQUIRE( stats.waitMax > 0 );
+        client->resetActionStats();
+        REQUIRE( client->getActionStats( SQRL_ACTION_PRIORITY_INTERACTIVE, &stats ) );
+        REQUIRE( stats.steps == 0 );
+        REQUIRE( stats.waitTotal == 0 );
+        REQUIRE( stats.queued == 1 );
+        REQUIRE_FALSE( client->getActionStats( SQRL_ACTION_PRIORITY_COUNT, &stats ) );
+    }
+
+    delete client;
+}
+
+// A PriorityAction that counts its deletion.
+class CountedAction : public PriorityAction
+{
+public:
+    CountedAction( int id, std::vector<int> *log, int *deleted ) :
+        PriorityAction( SQRL_ACTION_PRIORITY_NORMAL, id, 1, log ), deleted( deleted ) {}
+    ~CountedAction() { (*this->deleted)++; }
+
+private:
+    int *deleted;
+};
+
+TEST_CASE( "Actions that are never started", "[client]" ) {
+    StepClient *client = new StepClient();
+    std::vector<int> log;
+    struct Sqrl_Action_Stats stats;
+    int deleted = 0;
+
+    CountedAction *late = new CountedAction( 1, &log, &deleted );
+    CountedAction *dropped = new CountedAction( 2, &log, &deleted );
+    new CountedAction( 3, &log, &deleted );
+    REQUIRE_FALSE( client->loop() );
+    REQUIRE( log.empty() );
+    REQUIRE( client->getActionStats( SQRL_ACTION_PRIORITY_NORMAL, &stats ) );
+    REQUIRE( stats.queued == 0 );
+
+    // Starting one late still runs it; deleting one unstarted is allowed.
+    late->start();
+    delete dropped;
+    REQUIRE( deleted == 1 );
+    while( client->loop() );
+    std::vector<int> expected = { 1 };
+    REQUIRE( log == expected );
+    REQUIRE( deleted == 2 );
+
+    // The client takes the one that was forgotten with it.
+    delete client;
+    REQUIRE( deleted == 3 );
+}
+
+// Spins for 'us' per step, and finishes after 'steps' steps.
+class BusyAction : public SqrlAction
+{
+public:
+    BusyAction( int priority, int steps, int us, Sqrl_Test_Time *done = NULL ) :
+        SqrlAction( priority ), steps( steps ), us( us ), done( done ) {}
+
+protected:
+    int run( int cs ) {
+        if( cs >= this->steps ) {
+            if( this->done ) *this->done = std::chrono::steady_clock::now();
+            return this->retActionComplete( SQRL_ACTION_SUCCESS );
+        }
+        auto end = std::chrono::steady_clock::now() + std::chrono::microseconds( this->us );
+        while( std::chrono::steady_clock::now() < end );
+        return cs + 1;
+    }
+
+    int steps, us;
+    Sqrl_Test_Time *done;
+};
+
+// Times short interactive actions while background actions keep the client busy.
+static void client_interactive_latency( int interactivePriority, size_t workers ) {
+    const int background = 4, trials = 50;
+    LatencyClient *client = new LatencyClient();
+    if( workers ) client->setActionWorkers( workers );
+    for( int i = 0; i < background; i++ ) {
+        (new BusyAction( SQRL_ACTION_PRIORITY_BACKGROUND, 1000000, 2000 ))->start();
+    }
+    std::vector<double> ms;
+    for( int i = 0; i < trials; i++ ) {
+        Sqrl_Test_Time done;
+        Sqrl_Test_Time start = std::chrono::steady_clock::now();
+        (new BusyAction( interactivePriority, 10, 50, &done ))->start();
+        if( !client->waitCompleted( i + 1, 10000 ) ) break;
+        ms.push_back( std::chrono::duration<double, std::milli>( done - start ).count() );
+    }
+    struct Sqrl_Action_Stats stats;
+    client->getActionStats( interactivePriority, &stats );
+    delete client;
+    std::sort( ms.begin(), ms.end() );
+    printf( "%s, %u worker(s): median %.1f ms, p95 %.1f ms, max %.1f ms; mean wait per step %.2f ms\n",
+        interactivePriority == SQRL_ACTION_PRIORITY_INTERACTIVE ? "Interactive" : "Background ",
+        (unsigned)workers, ms[ms.size() / 2], ms[ms.size() * 95 / 100], ms.back(),
+        stats.waits ? 1000.0 * stats.waitTotal / stats.waits : 0.0 );
+}
+
+TEST_CASE( "Interactive latency under background load", "[.][benchmark]" ) {
+    client_interactive_latency( SQRL_ACTION_PRIORITY_BACKGROUND, 0 );
+    client_interactive_latency( SQRL_ACTION_PRIORITY_INTERACTIVE, 0 );
+    client_interactive_latency( SQRL_ACTION_PRIORITY_BACKGROUND, 2 );
+    client_interactive_latency( SQRL_ACTION_PRIORITY_INTERACTIVE, 2 );
+}
+
+// Records what progress and send callbacks it is given; when not recording, only counts bytes sent.
+class CallbackClient : public StepClient
+{
+public:
+    std::vector<int> progress;
+    std::vector<std::string> sent;
+    bool record = true;
+    size_t bytes = 0;
+
+protected:
+    void onSend( SqrlAction *t, SqrlString url, SqrlString payload ) {
+        this->bytes += url.length() + payload.length();
+        if( !this->record ) return;
+        this->sent.push_back( std::string( url.cstring(), url.length() ) );
+        this->sent.push_back( std::string( payload.cstring(), payload.length() ) );
+    }
+    void onProgress( SqrlAction *action, int progress ) { this->progress.push_back( progress ); }
+};
+
+// Never finishes; queues callbacks for the test.
+class CallbackAction : public SqrlAction
+{
+public:
+    void report( int progress ) { this->onProgress( progress ); }
+    void sendQuery( SqrlString *url, SqrlString *payload, bool movePayload ) {
+        this->send( url, payload, movePayload );
+    }
+
+protected:
+    int run( int cs ) { return cs; }
+};
+
+TEST_CASE( "Callback queue", "[client]" ) {
+    CallbackClient *client = new CallbackClient();
+    CallbackAction *action = new CallbackAction();
+    action->start();
+
+    SECTION( "Callbacks past the end of the ring are kept in order" ) {
+        for( int round = 0; round < 2; round++ ) {
+            client->progress.clear();
+            for( int i = 0; i < SQRL_CALLBACK_QUEUE_SIZE * 3; i++ ) action->report( i );
+            REQUIRE( client->loop() );
+            REQUIRE( client->progress.size() == SQRL_CALLBACK_QUEUE_SIZE * 3 );
+            for( int i = 0; i < SQRL_CALLBACK_QUEUE_SIZE * 3; i++ ) {
+                REQUIRE( client->progress[i] == i );
+            }
+        }
+    }
+
+    SECTION( "Callbacks from several threads all arrive, each thread's in order" ) {
+        const int threads = 4, each = 5000;
+        std::atomic<int> running( threads );
+        std::vector<std::thread*> producers;
+        for( int t = 0; t < threads; t++ ) {
+            producers.push_back( new std::thread( [action, &running, t] {
+                for( int i = 0; i < each; i++ ) action->report( t * each + i );
+                running--;
+            } ) );
+        }
+        while( running > 0 ) client->loop();
+        client->loop();
+        for( std::thread *t : producers ) {
+            t->join();
+            delete t;
+        }
+        REQUIRE( client->progress.size() == threads * each );
+        int last[threads] = { -1, -1, -1, -1 };
+        bool ordered = true;
+        for( int p : client->progress ) {
+            int t = p / each;
+            ordered = ordered && p > last[t];
+            last[t] = p;
+        }
+        REQUIRE( ordered );
+    }
+
+    SECTION( "A send payload is copied, or moved when asked" ) {
+        SqrlString url( "https://example.com/sqrl?nut=123" );
+        SqrlString payload( "client=abc&server=def" );
+        std::string longPayload( SQRL_CALLBACK_INLINE_STRING * 3, 'x' );
+        SqrlString bigPayload( longPayload.c_str() );
+        action->sendQuery( &url, &payload, false );
+        action->sendQuery( &url, &bigPayload, false );
+        REQUIRE( payload.length() == 21 );
+        REQUIRE( bigPayload.length() == longPayload.size() );
+        action->sendQuery( &url, &bigPayload, true );
+        REQUIRE( bigPayload.length() == 0 );
+        client->loop();
+        REQUIRE( client->sent.size() == 6 );
+        REQUIRE( client->sent[0] == "https://example.com/sqrl?nut=123" );
+        REQUIRE( client->sent[1] == "client=abc&server=def" );
+        REQUIRE( client->sent[3] == longPayload );
+        REQUIRE( client->sent[4] == client->sent[0] );
+        REQUIRE( client->sent[5] == longPayload );
+    }
+
+    delete client;
+}
+
+// Queuing as it was: a new record with copies of its strings, on a locked queue.
+struct LockedCallback
+{
+    SqrlString *str[2];
+};
+
+static double callback_locked_ns( SqrlString *url, SqrlString *payload, int batches, int batch ) {
+    std::mutex mutex;
+    SqrlDeque<LockedCallback*> queue;
+    size_t sum = 0;
+    Sqrl_Test_Time start = std::chrono::steady_clock::now();
+    for( int b = 0; b < batches; b++ ) {
+        for( int i = 0; i < batch; i++ ) {
+            LockedCallback *cb = new LockedCallback();
+            cb->str[0] = new SqrlString( url );
+            cb->str[1] = new SqrlString( payload );
+            mutex.lock();
+            queue.push_back( cb );
+            mutex.unlock();
+        }
+        while( true ) {
+            mutex.lock();
+            LockedCallback *cb = queue.pop();
+            mutex.unlock();
+            if( !cb ) break;
+            SqrlString u( cb->str[0] ), p( cb->str[1] );
+            sum += u.length() + p.length();
+            delete cb->str[0];
+            delete cb->str[1];
+            delete cb;
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now() - start ).count();
+    if( !sum ) printf( "-" );
+    return ns / ((double)batches * batch);
+}
+
+static double callback_ring_ns( CallbackClient *client, CallbackAction *action,
+    SqrlString *url, SqrlString *payload, int batches, int batch, bool move ) {
+    Sqrl_Test_Time start = std::chrono::steady_clock::now();
+    for( int b = 0; b < batches; b++ ) {
+        for( int i = 0; i < batch; i++ ) {
+            SqrlString moved;
+            if( move ) moved.append( payload );
+            action->sendQuery( url, move ? &moved : payload, move );
+        }
+        client->loop();
+    }
+    double ns = std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now() - start ).count();
+    return ns / ((double)batches * batch);
+}
+
+TEST_CASE( "Callback queue throughput", "[.][benchmark]" ) {
+    const int batches = 20000, batch = 16;
+    CallbackClient *client = new CallbackClient();
+    CallbackAction *action = new CallbackAction();
+    action->start();
+    client->record = false;
+    SqrlString url( "https://www.grc.com/sqrl?nut=oOB4QOFJux5Z&sfn=R1JD" );
+    const size_t sizes[] = { 300, 2000 };
+    for( size_t s = 0; s < sizeof( sizes ) / sizeof( sizes[0] ); s++ ) {
+        std::string text( sizes[s], 'p' );
+        SqrlString payload( text.c_str() );
+        printf( "%4u byte payload: locked queue %6.0f ns; ring, copied %6.0f ns; ring, moved %6.0f ns (includes making the copy to move)\n",
+            (unsigned)sizes[s], callback_locked_ns( &url, &payload, batches, batch ),
+            callback_ring_ns( client, action, &url, &payload, batches, batch, false ),
+            callback_ring_ns( client, action, &url, &payload, batches, batch, true ) );
+    }
+    delete client;
+}
@@ -9,6 +9,20 @@
 #include "SqrlBase64.h"
 #include "SqrlBigInt.h"
 #include "SqrlEnScrypt.h"
+#include "escrypt_simd.h"
+#include "enhash_simd.h"
+#include "SqrlEnScryptArena.h"
+#include "aes.h"
+#include "gcm.h"
+#include "gcm_aesni.h"
+#include "ed25519_batch.h"
+#include "SqrlKeyCache.h"
+#include "sodium.h"
+#include <chrono>
+#include <vector>
+#if defined(WITH_THREADS)
+#include <thread>
+#endif
 
 using namespace std;
 using namespace libsqrl;
@@ -59,6 +73,414 @@ TEST_CASE( "EnHash", "[crypto]" ) {
     fclose( fp );
 }
 
+TEST_CASE( "EnHash batch", "[crypto]" ) {
+    FILE *fp = fopen( "data/vectors/enhash-vectors.txt", "r" );
+    if( fp == NULL ) {
+        REQUIRE( false );
+    }
+
+    static uint8_t in[1000][SQRL_KEY_SIZE], expected[1000][SQRL_KEY_SIZE], out[1000][SQRL_KEY_SIZE];
+    uint64_t *pOut[1000];
+    const uint64_t *pIn[1000];
+    char line[256];
+    SqrlString input( (size_t)0 ), output( (size_t)0 );
+    SqrlString tmp( (size_t)0 ), tmp2( (size_t)0 );
+    SqrlBase64 b64 = SqrlBase64();
+
+    size_t n = 0;
+    while( n < 1000 && fgets( line, sizeof( line ), fp ) ) {
+        tmp.append( line, 43 );
+        tmp2.append( line + 43, 43 );
+        b64.decode( &input, &tmp );
+        b64.decode( &output, &tmp2 );
+        REQUIRE( 32 == input.length() );
+        REQUIRE( 32 == output.length() );
+        memcpy( in[n], input.data(), 32 );
+        memcpy( expected[n], output.data(), 32 );
+        pIn[n] = (const uint64_t*)in[n];
+        pOut[n] = (uint64_t*)out[n];
+        n++;
+        input.clear();
+        output.clear();
+        tmp.clear();
+        tmp2.clear();
+    }
+    fclose( fp );
+    REQUIRE( n == 1000 );
+
+    // Odd batch sizes exercise the part-filled tail.
+    size_t sizes[3] = { 1000, 999, 13 };
+    for( int s = 0; s < 3; s++ ) {
+        memset( out, 0, sizeof( out ) );
+        SqrlCrypt::enHashBatch( pOut, pIn, sizes[s] );
+        for( size_t i = 0; i < sizes[s]; i++ ) {
+            REQUIRE( 0 == memcmp( out[i], expected[i], 32 ) );
+        }
+    }
+}
+
+#if defined(SQRL_X86)
+TEST_CASE( "EnHash kernels", "[crypto]" ) {
+    sqrl_enhash_mb_t kernels[3] = { sqrl_enhash_x4_sse2, sqrl_enhash_x8_avx2, sqrl_enhash_x16_avx512 };
+    size_t width[3] = { 4, 8, 16 };
+#if defined(__x86_64__) || defined(_M_X64)
+    bool sse2 = true;
+#else
+    bool sse2 = false;
+#endif
+    bool available[3] = { sse2, sqrl_cpu_has_avx2(), sqrl_cpu_has_avx512() };
+
+    uint8_t in[16][32], expected[16][32], out[16][32], zero[32] = { 0 };
+    uint8_t *pOut[16];
+    const uint8_t *pIn[16];
+    sqrl_randombytes( in, sizeof( in ) );
+    for( int j = 0; j < 16; j++ ) {
+        SqrlCrypt::enHash( (uint64_t*)expected[j], (const uint64_t*)in[j] );
+        pIn[j] = in[j];
+        pOut[j] = out[j];
+    }
+    for( int k = 0; k < 3; k++ ) {
+        if( !available[k] ) continue;
+        // Every lane count, so each lane is checked both full and part-filled.
+        for( size_t lanes = 1; lanes <= width[k]; lanes++ ) {
+            memset( out, 0, sizeof( out ) );
+            kernels[k]( pOut, pIn, lanes );
+            for( size_t j = 0; j < lanes; j++ ) {
+                REQUIRE( 0 == memcmp( out[j], expected[j], 32 ) );
+            }
+            // Lanes past 'lanes' are left alone.
+            for( size_t j = lanes; j < 16; j++ ) {
+                REQUIRE( 0 == memcmp( out[j], zero, 32 ) );
+            }
+        }
+    }
+}
+#endif
+
+TEST_CASE( "AES-GCM backends", "[crypto]" ) {
+#if defined(SQRL_X86)
+    if( !sqrl_cpu_has_aesni() ) return;
+    gcm_initialize();
+    uint8_t key[32], iv[12], add[64], in[300], out1[300], out2[300], tag1[16], tag2[16];
+    sqrl_randombytes( key, sizeof( key ) );
+    sqrl_randombytes( iv, sizeof( iv ) );
+    sqrl_randombytes( add, sizeof( add ) );
+    sqrl_randombytes( in, sizeof( in ) );
+
+    // Lengths straddle the four block stride and partial blocks.
+    size_t lengths[7] = { 0, 1, 15, 16, 63, 65, 300 };
+    for( int k = 16; k <= 32; k += 16 ) {
+        gcm_context ctx;
+        gcm_setkey( &ctx, key, k );
+        for( int i = 0; i < 7; i++ ) {
+            size_t len = lengths[i];
+            REQUIRE( 0 == gcm_crypt_and_tag( &ctx, ENCRYPT, iv, 12, add, i * 9, in, out1, len, tag1, 16 ) );
+            REQUIRE( 0 == gcm_aesni_crypt_and_tag( ENCRYPT, key, k, iv, 12, add, i * 9, in, out2, len, tag2, 16 ) );
+            REQUIRE( 0 == memcmp( out1, out2, len ) );
+            REQUIRE( 0 == memcmp( tag1, tag2, 16 ) );
+
+            REQUIRE( 0 == gcm_aesni_auth_decrypt( key, k, iv, 12, add, i * 9, out2, out2, len, tag2, 16 ) );
+            REQUIRE( 0 == memcmp( out2, in, len ) );
+            tag2[15] ^= 1;
+            REQUIRE( GCM_AUTH_FAILURE == gcm_aesni_auth_decrypt( key, k, iv, 12, add, i * 9, out1, out2, len, tag2, 16 ) );
+        }
+        gcm_zero_ctx( &ctx );
+    }
+#endif
+}
+
+TEST_CASE( "AES-GCM throughput", "[.][benchmark]" ) {
+#if defined(SQRL_X86)
+    gcm_initialize();
+    static uint8_t buf[1024 * 1024];
+    uint8_t key[32] = {0}, iv[12] = {0}, tag[16];
+    int reps = 16;
+
+    gcm_context ctx;
+    gcm_setkey( &ctx, key, 32 );
+    auto t0 = std::chrono::steady_clock::now();
+    for( int i = 0; i < reps; i++ ) {
+        gcm_crypt_and_tag( &ctx, ENCRYPT, iv, 12, NULL, 0, buf, buf, sizeof( buf ), tag, 16 );
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    double portable = std::chrono::duration<double>( t1 - t0 ).count();
+    printf( "AES-GCM portable: %.1f MB/s\n", reps / portable );
+    gcm_zero_ctx( &ctx );
+
+    if( sqrl_cpu_has_aesni() ) {
+        t0 = std::chrono::steady_clock::now();
+        for( int i = 0; i < reps; i++ ) {
+            gcm_aesni_crypt_and_tag( ENCRYPT, key, 32, iv, 12, NULL, 0, buf, buf, sizeof( buf ), tag, 16 );
+        }
+        t1 = std::chrono::steady_clock::now();
+        double aesni = std::chrono::duration<double>( t1 - t0 ).count();
+        printf( "AES-GCM AES-NI:   %.1f MB/s\n", reps / aesni );
+    }
+#endif
+}
+
+// Signs 'n' random messages with fresh keys.
+static void makeSignatures( size_t n, std::vector<SqrlString> &msgs, std::vector<uint8_t> &sigs, std::vector<uint8_t> &pubs ) {
+    uint8_t sk[SQRL_KEY_SIZE];
+    msgs.resize( n );
+    sigs.resize( n * SQRL_SIG_SIZE );
+    pubs.resize( n * SQRL_KEY_SIZE );
+    for( size_t i = 0; i < n; i++ ) {
+        uint8_t buf[300];
+        size_t len = i * 7 % sizeof( buf );
+        sqrl_randombytes( buf, len );
+        msgs[i].clear();
+        msgs[i].append( buf, len );
+        sqrl_randombytes( sk, SQRL_KEY_SIZE );
+        SqrlCrypt::generatePublicKey( &pubs[i * SQRL_KEY_SIZE], sk );
+        SqrlCrypt::sign( &msgs[i], sk, &pubs[i * SQRL_KEY_SIZE], &sigs[i * SQRL_SIG_SIZE] );
+    }
+}
+
+TEST_CASE( "Ed25519 batch verification", "[crypto]" ) {
+    const size_t n = 80;
+    std::vector<SqrlString> msgs;
+    std::vector<uint8_t> sigs, pubs;
+    makeSignatures( n, msgs, sigs, pubs );
+    const SqrlString *m[n];
+    const uint8_t *s[n], *p[n];
+    bool results[n];
+    for( size_t i = 0; i < n; i++ ) {
+        m[i] = &msgs[i];
+        s[i] = &sigs[i * SQRL_SIG_SIZE];
+        p[i] = &pubs[i * SQRL_KEY_SIZE];
+    }
+    REQUIRE( SqrlCrypt::verifySignatures( n, m, s, p, results ) == n );
+    REQUIRE( SqrlCrypt::verifySignatures( n, m, s, p, results, NULL, true ) == n );
+
+#if defined(SQRL_ED25519_BATCH)
+    const uint8_t *raw[n];
+    size_t lens[n];
+    for( size_t i = 0; i < n; i++ ) {
+        raw[i] = (const uint8_t*)msgs[i].cdata();
+        lens[i] = msgs[i].length();
+    }
+    REQUIRE( ed25519_verify_batch( raw, lens, s, p, NULL, 1 ) == 0 );
+    REQUIRE( ed25519_verify_batch( raw, lens, s, p, NULL, 3 ) == 0 );
+    REQUIRE( ed25519_verify_batch( raw, lens, s, p, NULL, n ) == 0 );
+
+    // A bad signature anywhere fails the batch.
+    sigs[5 * SQRL_SIG_SIZE + 40] ^= 1;
+    REQUIRE( ed25519_verify_batch( raw, lens, s, p, NULL, n ) != 0 );
+    sigs[5 * SQRL_SIG_SIZE + 40] ^= 1;
+    lens[70]--;
+    REQUIRE( ed25519_verify_batch( raw, lens, s, p, NULL, n ) != 0 );
+    lens[70]++;
+
+    // Non-canonical s (s + L): libsodium refuses it, so must we.
+    static const uint8_t L[32] = {
+        0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58, 0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10 };
+    uint8_t bad[SQRL_SIG_SIZE];
+    memcpy( bad, s[0], SQRL_SIG_SIZE );
+    int carry = 0;
+    for( int i = 0; i < 32; i++ ) {
+        int v = bad[32 + i] + L[i] + carry;
+        bad[32 + i] = (uint8_t)v;
+        carry = v >> 8;
+    }
+    const uint8_t *badSig[2] = { bad, s[1] };
+    REQUIRE( carry == 0 );
+    REQUIRE( ed25519_verify_batch( raw, lens, badSig, p, NULL, 2 ) != 0 );
+
+    // A small order key.
+    uint8_t identity[SQRL_KEY_SIZE] = { 1 };
+    const uint8_t *badKey[2] = { identity, p[1] };
+    REQUIRE( ed25519_verify_batch( raw, lens, s, badKey, NULL, 2 ) != 0 );
+
+    // A key or R with a torsion component (plus a point of order 8): the single checks must give
+    // libsodium's answer, cache or not.
+    static const uint8_t T8[32] = {
+        0xc7, 0x17, 0x6a, 0x70, 0x3d, 0x4d, 0xd8, 0x4f, 0xba, 0x3c, 0x0b, 0x76, 0x0d, 0x10, 0x67, 0x0f,
+        0x2a, 0x20, 0x53, 0xfa, 0x2c, 0x39, 0xcc, 0xc6, 0x4e, 0xc7, 0xfd, 0x77, 0x92, 0xac, 0x03, 0x7a };
+    for( int torsionR = 0; torsionR < 2; torsionR++ ) {
+        for( int trial = 0; trial < 64; trial++ ) {
+            uint8_t a[32], r[32], h[32], hash[64], pk[SQRL_KEY_SIZE], sig[SQRL_SIG_SIZE];
+            crypto_core_ed25519_scalar_random( a );
+            crypto_core_ed25519_scalar_random( r );
+            REQUIRE( crypto_scalarmult_ed25519_base_noclamp( pk, a ) == 0 );
+            REQUIRE( crypto_scalarmult_ed25519_base_noclamp( sig, r ) == 0 );
+            REQUIRE( crypto_core_ed25519_add( torsionR ? sig : pk, torsionR ? sig : pk, T8 ) == 0 );
+            crypto_hash_sha512_state st;
+            crypto_hash_sha512_init( &st );
+            crypto_hash_sha512_update( &st, sig, 32 );
+            crypto_hash_sha512_update( &st, pk, 32 );
+            crypto_hash_sha512_update( &st, raw[trial], lens[trial] );
+            crypto_hash_sha512_final( &st, hash );
+            crypto_core_ed25519_scalar_reduce( h, hash );
+            crypto_core_ed25519_scalar_mul( h, h, a );
+            crypto_core_ed25519_scalar_add( sig + 32, r, h );
+
+            bool lib = 0 == crypto_sign_verify_detached( sig, raw[trial], lens[trial], pk );
+            ed25519_key key;
+            SqrlKeyCache cache( 4 );
+            REQUIRE( ed25519_key_decode( &key, pk ) == 0 );
+            REQUIRE( (ed25519_verify_key( raw[trial], lens[trial], sig, pk, &key ) == 0) == lib );
+            REQUIRE( SqrlCrypt::verifySignature( m[trial], sig, pk ) == lib );
+            REQUIRE( SqrlCrypt::verifySignature( m[trial], sig, pk, &cache ) == lib );
+            const SqrlString *tm[2] = { m[trial], m[trial + 1] };
+            const uint8_t *ts[2] = { sig, s[trial + 1] };
+            const uint8_t *tp[2] = { pk, p[trial + 1] };
+            REQUIRE( SqrlCrypt::verifySignatures( 2, tm, ts, tp, results, &cache ) == (lib ? 2 : 1) );
+            REQUIRE( results[0] == lib );
+        }
+    }
+#endif
+
+    // Bisecting the failed batch picks out exactly the bad one.
+    sigs[33 * SQRL_SIG_SIZE + 3] ^= 0x80;
+    REQUIRE( SqrlCrypt::verifySignatures( n, m, s, p, results, NULL, true ) == n - 1 );
+    for( size_t i = 0; i < n; i++ ) {
+        REQUIRE( results[i] == (i != 33) );
+    }
+}
+
+#if defined(SQRL_ED25519_BATCH)
+TEST_CASE( "Ed25519 decoded key cache", "[crypto]" ) {
+    const size_t n = 40;
+    std::vector<SqrlString> msgs;
+    std::vector<uint8_t> sigs, pubs;
+    makeSignatures( n, msgs, sigs, pubs );
+    const SqrlString *m[n];
+    const uint8_t *s[n], *p[n];
+    bool results[n];
+    for( size_t i = 0; i < n; i++ ) {
+        m[i] = &msgs[i];
+        s[i] = &sigs[i * SQRL_SIG_SIZE];
+        p[i] = &pubs[i * SQRL_KEY_SIZE];
+    }
+
+    // ed25519_verify_key() agrees with libsodium, good signature or bad.
+    ed25519_key key;
+    for( size_t i = 0; i < n; i++ ) {
+        REQUIRE( ed25519_key_decode( &key, p[i] ) == 0 );
+        const uint8_t *msg = (const uint8_t*)msgs[i].cdata();
+        REQUIRE( ed25519_verify_key( msg, msgs[i].length(), s[i], p[i], &key ) == 0 );
+        int bit = (int)(i * 37 % (SQRL_SIG_SIZE * 8));
+        sigs[i * SQRL_SIG_SIZE + bit / 8] ^= (uint8_t)(1 << (bit % 8));
+        bool lib = 0 == crypto_sign_verify_detached( s[i], msg, msgs[i].length(), p[i] );
+        REQUIRE( SqrlCrypt::verifySignature( m[i], s[i], p[i] ) == lib );
+        REQUIRE( lib == (ed25519_verify_key( msg, msgs[i].length(), s[i], p[i], &key ) == 0) );
+        sigs[i * SQRL_SIG_SIZE + bit / 8] ^= (uint8_t)(1 << (bit % 8));
+    }
+    uint8_t identity[SQRL_KEY_SIZE] = { 1 };
+    REQUIRE( ed25519_key_decode( &key, identity ) != 0 );
+
+    // R = 0 and s = h a satisfy sB = R + hA, but libsodium refuses a small order R, so must we.
+    uint8_t seed[SQRL_KEY_SIZE], pk[SQRL_KEY_SIZE], sig[SQRL_SIG_SIZE], hash[64], a[64], h[32];
+    sqrl_randombytes( seed, sizeof( seed ) );
+    SqrlCrypt::generatePublicKey( pk, seed );
+    crypto_hash_sha512( hash, seed, sizeof( seed ) );
+    memset( a, 0, sizeof( a ) );
+    memcpy( a, hash, 32 );
+    a[0] &= 248;
+    a[31] &= 127;
+    a[31] |= 64;
+    crypto_core_ed25519_scalar_reduce( a, a );
+    memset( sig, 0, sizeof( sig ) );
+    sig[0] = 1;
+    crypto_hash_sha512_state st;
+    crypto_hash_sha512_init( &st );
+    crypto_hash_sha512_update( &st, sig, 32 );
+    crypto_hash_sha512_update( &st, pk, 32 );
+    crypto_hash_sha512_update( &st, (const uint8_t*)msgs[0].cdata(), msgs[0].length() );
+    crypto_hash_sha512_final( &st, hash );
+    crypto_core_ed25519_scalar_reduce( h, hash );
+    crypto_core_ed25519_scalar_mul( sig + 32, h, a );
+    REQUIRE( ed25519_key_decode( &key, pk ) == 0 );
+    REQUIRE( !SqrlCrypt::verifySignature( m[0], sig, pk ) );
+    REQUIRE( ed25519_verify_key( (const uint8_t*)msgs[0].cdata(), msgs[0].length(), sig, pk, &key ) != 0 );
+
+    // The cache: misses, then hits, then evictions once it's full.
+    SqrlKeyCache cache( n / 2 );
+    for( size_t i = 0; i < n / 2; i++ ) REQUIRE( SqrlCrypt::verifySignature( m[i], s[i], p[i], &cache ) );
+    REQUIRE( cache.getMisses() == n / 2 );
+    REQUIRE( cache.getSize() == n / 2 );
+    for( size_t i = 0; i < n / 2; i++ ) REQUIRE( SqrlCrypt::verifySignature( m[i], s[i], p[i], &cache ) );
+    REQUIRE( cache.getHits() == n / 2 );
+    REQUIRE( cache.getEvictions() == 0 );
+    REQUIRE( SqrlCrypt::verifySignatures( n, m, s, p, results, &cache ) == n );
+    REQUIRE( cache.getHits() == n );
+    REQUIRE( cache.getMisses() == n );
+    REQUIRE( cache.getEvictions() == n / 2 );
+    REQUIRE( cache.getSize() == n / 2 );
+
+    // Bad keys are remembered as bad.
+    REQUIRE( !SqrlCrypt::verifySignature( m[0], s[0], identity, &cache ) );
+    REQUIRE( !SqrlCrypt::verifySignature( m[0], s[0], identity, &cache ) );
+    REQUIRE( cache.getMisses() == n + 1 );
+
+    // A batch holding a bad signature still picks it out.
+    sigs[7 * SQRL_SIG_SIZE + 50] ^= 4;
+    REQUIRE( SqrlCrypt::verifySignatures( n, m, s, p, results, &cache, true ) == n - 1 );
+    for( size_t i = 0; i < n; i++ ) {
+        REQUIRE( results[i] == (i != 7) );
+    }
+}
+#endif
+
+TEST_CASE( "Ed25519 batch throughput", "[.][benchmark]" ) {
+    const size_t n = SQRL_ED25519_BATCH_MAX;
+    std::vector<SqrlString> msgs;
+    std::vector<uint8_t> sigs, pubs;
+    makeSignatures( n, msgs, sigs, pubs );
+    const SqrlString *m[n];
+    const uint8_t *s[n], *p[n];
+    bool results[n];
+    for( size_t i = 0; i < n; i++ ) {
+        m[i] = &msgs[i];
+        s[i] = &sigs[i * SQRL_SIG_SIZE];
+        p[i] = &pubs[i * SQRL_KEY_SIZE];
+    }
+    const int reps = 20;
+
+    auto t0 = std::chrono::steady_clock::now();
+    for( int r = 0; r < reps; r++ ) {
+        for( size_t i = 0; i < n; i++ ) REQUIRE( SqrlCrypt::verifySignature( m[i], s[i], p[i] ) );
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    double single = std::chrono::duration<double>( t1 - t0 ).count();
+    printf( "Ed25519 one at a time: %.0f signatures/sec\n", reps * n / single );
+
+    SqrlKeyCache cache;
+    t0 = std::chrono::steady_clock::now();
+    for( int r = 0; r < reps; r++ ) {
+        for( size_t i = 0; i < n; i++ ) REQUIRE( SqrlCrypt::verifySignature( m[i], s[i], p[i], &cache ) );
+    }
+    t1 = std::chrono::steady_clock::now();
+    double cached = std::chrono::duration<double>( t1 - t0 ).count();
+    printf( "Ed25519 cached keys:   %.0f signatures/sec (%d%% hits)\n", reps * n / cached,
+        (int)(100 * cache.getHits() / (cache.getHits() + cache.getMisses())) );
+
+    size_t sizes[] = { 2, 8, n };
+    for( size_t size : sizes ) {
+        t0 = std::chrono::steady_clock::now();
+        for( int r = 0; r < reps; r++ ) {
+            for( size_t off = 0; off + size <= n; off += size ) {
+                REQUIRE( SqrlCrypt::verifySignatures( size, m + off, s + off, p + off, results, NULL, true ) == size );
+            }
+        }
+        t1 = std::chrono::steady_clock::now();
+        double batch = std::chrono::duration<double>( t1 - t0 ).count();
+        printf( "Ed25519 batches of %d:  %.0f signatures/sec\n", (int)size, reps * (n / size) * size / batch );
+
+        t0 = std::chrono::steady_clock::now();
+        for( int r = 0; r < reps; r++ ) {
+            for( size_t off = 0; off + size <= n; off += size ) {
+                REQUIRE( SqrlCrypt::verifySignatures( size, m + off, s + off, p + off, results, &cache, true ) == size );
+            }
+        }
+        t1 = std::chrono::steady_clock::now();
+        batch = std::chrono::duration<double>( t1 - t0 ).count();
+        printf( "  ... with cached keys: %.0f signatures/sec\n", reps * (n / size) * size / batch );
+    }
+}
+
 TEST_CASE( "EnScrypt -- 1 iteration", "[enscrypt]" ) {
     SqrlEnScrypt es = SqrlEnScrypt( NULL, NULL, NULL, 1 );
     while( !es.isFinished() ) {
@@ -71,6 +493,25 @@ TEST_CASE( "EnScrypt -- 1 iteration", "[enscrypt]" ) {
     REQUIRE( str.compare( "a8ea62a6e1bfd20e4275011595307aa302645c1801600ef5cd79bf9d884d911c" ) == 0 );
 }
 
+#if defined(SQRL_X86)
+TEST_CASE( "EnScrypt kernels -- 1 iteration", "[enscrypt]" ) {
+    escrypt_kdf_t kernels[2] = { sqrl_escrypt_kdf_avx2, sqrl_escrypt_kdf_avx512 };
+    bool available[2] = { sqrl_cpu_has_avx2(), sqrl_cpu_has_avx512() };
+    for( int i = 0; i < 2; i++ ) {
+        if( !available[i] ) continue;
+        escrypt_local_t local;
+        uint8_t out[32];
+        REQUIRE( 0 == escrypt_init_local( &local ) );
+        REQUIRE( 0 == kernels[i]( &local, NULL, 0, NULL, 0, 512, ENSCRYPT_R, ENSCRYPT_P, out, 32 ) );
+        escrypt_free_local( &local );
+        SqrlString buf( out, 32 );
+        SqrlString str = SqrlString();
+        SqrlEncoder().encode( &str, &buf );
+        REQUIRE( str.compare( "a8ea62a6e1bfd20e4275011595307aa302645c1801600ef5cd79bf9d884d911c" ) == 0 );
+    }
+}
+#endif
+
 TEST_CASE( "EnScrypt -- 1 + 1 second", "[enscrypt]" ) {
     SqrlEnScrypt es = SqrlEnScrypt( NULL, NULL, NULL, 1000, false );
     while( !es.isFinished() ) {
@@ -88,6 +529,95 @@ TEST_CASE( "EnScrypt -- 1 + 1 second", "[enscrypt]" ) {
     REQUIRE( buf->compare( buf2 ) == 0 );
 }
 
+TEST_CASE( "EnScrypt -- budgeted update", "[enscrypt]" ) {
+    SqrlEnScrypt es = SqrlEnScrypt( NULL, NULL, NULL, 5 );
+    REQUIRE_FALSE( es.update( 2, true ) );
+    REQUIRE( es.update( 10, true ) );
+    REQUIRE( es.isSuccessful() );
+    REQUIRE( es.getIterations() == 5 );
+    SqrlEnScrypt es2 = SqrlEnScrypt( NULL, NULL, NULL, 5 );
+    while( !es2.update( ENSCRYPT_SLICE ) );
+    REQUIRE( es2.isSuccessful() );
+    REQUIRE( es.getResult()->compare( es2.getResult() ) == 0 );
+}
+
+TEST_CASE( "EnScrypt calibration", "[enscrypt]" ) {
+    double ms = SqrlEnScrypt::getIterationTime( 9 );
+    REQUIRE( ms > 0.0 );
+    uint16_t iterations = SqrlEnScrypt::estimateIterations( 1000 );
+    REQUIRE( iterations >= 1 );
+    if( iterations > 1 ) {
+        int estimate = SqrlEnScrypt::estimateTime( iterations );
+        REQUIRE( estimate >= 1000 - ms );
+        REQUIRE( estimate <= 1000 + ms );
+    }
+}
+
+TEST_CASE( "EnScrypt scratch arena", "[enscrypt]" ) {
+    SqrlEnScryptArena::trim();
+    void *a = SqrlEnScryptArena::acquire( 512, ENSCRYPT_R, ENSCRYPT_P );
+    REQUIRE( a != NULL );
+    SqrlEnScryptArena::release( a );
+    uint64_t reuses = SqrlEnScryptArena::getReuseCount();
+    uint64_t saved = SqrlEnScryptArena::getPageFaultsSaved();
+    // A smaller request is served by the cached region.
+    void *b = SqrlEnScryptArena::acquire( 256, ENSCRYPT_R, ENSCRYPT_P );
+    REQUIRE( b == a );
+    REQUIRE( SqrlEnScryptArena::getReuseCount() == reuses + 1 );
+    REQUIRE( SqrlEnScryptArena::getPageFaultsSaved() > saved );
+    SqrlEnScryptArena::release( b );
+    SqrlEnScrypt es = SqrlEnScrypt( NULL, NULL, NULL, 1 );
+    while( !es.isFinished() ) {
+        es.update();
+    }
+    REQUIRE( es.isSuccessful() );
+    REQUIRE( SqrlEnScryptArena::getReuseCount() == reuses + 2 );
+
+#if defined(WITH_THREADS)
+    // One cache for every thread: a region released elsewhere is reused here.
+    void *c = SqrlEnScryptArena::acquire( 512, ENSCRYPT_R, ENSCRYPT_P );
+    std::thread( [c]() { SqrlEnScryptArena::release( c ); } ).join();
+    REQUIRE( SqrlEnScryptArena::acquire( 512, ENSCRYPT_R, ENSCRYPT_P ) == c );
+    SqrlEnScryptArena::release( c );
+#endif
+
+    // The cache never holds more than its limit.
+    size_t limit = SqrlEnScryptArena::getCacheLimit();
+    size_t one = SqrlEnScryptArena::getCachedBytes();
+    REQUIRE( one > 0 );
+    void *d[3];
+    for( int i = 0; i < 3; i++ ) d[i] = SqrlEnScryptArena::acquire( 512, ENSCRYPT_R, ENSCRYPT_P );
+    SqrlEnScryptArena::setCacheLimit( 2 * one );
+    for( int i = 0; i < 3; i++ ) SqrlEnScryptArena::release( d[i] );
+    REQUIRE( SqrlEnScryptArena::getCachedBytes() == 2 * one );
+    SqrlEnScryptArena::setCacheLimit( 0 );
+    REQUIRE( SqrlEnScryptArena::getCachedBytes() == 0 );
+    SqrlEnScryptArena::setCacheLimit( limit );
+    SqrlEnScryptArena::trim();
+}
+
+TEST_CASE( "EnScrypt batch", "[enscrypt]" ) {
+    SqrlString password[5], salt[5];
+    uint16_t iterations[5] = { 1, 3, 2, 1, 4 };
+    uint8_t nFactor[5] = { 9, 9, 8, 9, 9 };
+    SqrlEnScryptBatch batch;
+    for( int i = 0; i < 5; i++ ) {
+        password[i].append( (char)('a' + i), i + 1 );
+        salt[i].append( (char)('A' + i), 16 );
+        REQUIRE( batch.add( &password[i], &salt[i], iterations[i], nFactor[i] ) == (size_t)i );
+    }
+    REQUIRE( batch.run() );
+    for( int i = 0; i < 5; i++ ) {
+        SqrlEnScrypt es = SqrlEnScrypt( NULL, &password[i], &salt[i], iterations[i], true, nFactor[i] );
+        while( !es.isFinished() ) {
+            es.update();
+        }
+        REQUIRE( es.isSuccessful() );
+        REQUIRE( batch.isSuccessful( i ) );
+        REQUIRE( batch.getResult( i )->compare( es.getResult() ) == 0 );
+    }
+}
+
 TEST_CASE( "EnScrypt 100 iterations", "[.][enscrypt]" ) {
     SqrlEnScrypt es = SqrlEnScrypt( NULL, NULL, NULL, 100 );
     while( !es.isFinished() ) {
@@ -0,0 +1,253 @@
+#include "catch.hpp"
+#include "sqrl.h"
+#include "SqrlDeque.h"
+#include <chrono>
+#include <deque>
+#include <stdint.h>
+
+using namespace libsqrl;
+
+// SqrlDeque as it was: a doubly linked list, kept to compare against.
+template <class T>
+class LinkedDeque
+{
+private:
+    struct item
+    {
+        item( T newItem ) : myItem( newItem ), previous( NULL ), next( NULL ) {}
+        T myItem;
+        item *previous;
+        item *next;
+    };
+    item *list;
+    item *lend;
+
+public:
+    LinkedDeque() : list( NULL ), lend( NULL ) {}
+
+    ~LinkedDeque() {
+        while( this->list ) {
+            item *nxt = this->list->next;
+            delete this->list;
+            this->list = nxt;
+        }
+    }
+
+    void push_back( T newItem ) {
+        item *newStruct = new item( newItem );
+        newStruct->previous = this->lend;
+        if( this->lend ) {
+            this->lend->next = newStruct;
+        } else {
+            this->list = newStruct;
+        }
+        this->lend = newStruct;
+    }
+
+    T pop() {
+        if( !this->list ) return NULL;
+        item *freeMe = this->list;
+        T ret = freeMe->myItem;
+        if( freeMe->next ) {
+            freeMe->next->previous = NULL;
+        } else {
+            this->lend = NULL;
+        }
+        this->list = freeMe->next;
+        delete freeMe;
+        return ret;
+    }
+
+    void erase( T comp ) {
+        item *prev = NULL;
+        item *cur = this->list;
+        while( cur ) {
+            item *nxt = cur->next;
+            if( cur->myItem == comp ) {
+                if( nxt ) nxt->previous = prev; else this->lend = prev;
+                if( prev ) prev->next = nxt; else this->list = nxt;
+                delete cur;
+            } else {
+                prev = cur;
+            }
+            cur = nxt;
+        }
+    }
+
+    T peek( size_t offset = 0 ) {
+        size_t cnt = 0;
+        for( item *cur = this->list; cur; cur = cur->next ) {
+            if( cnt++ == offset ) return cur->myItem;
+        }
+        return NULL;
+    }
+
+    size_t count() {
+        size_t ret = 0;
+        for( item *cur = this->list; cur; cur = cur->next ) ret++;
+        return ret;
+    }
+};
+
+static int *deque_item( uintptr_t i ) {
+    return (int*)(i * sizeof( int ) + sizeof( int ));
+}
+
+// Checks that the deque holds exactly what the reference does, in order.
+static void deque_match( SqrlDeque<int*> *dq, std::deque<int*> *ref ) {
+    REQUIRE( dq->count() == ref->size() );
+    REQUIRE( dq->empty() == ref->empty() );
+    for( size_t i = 0; i < ref->size(); i++ ) {
+        REQUIRE( dq->peek( i ) == (*ref)[i] );
+    }
+    REQUIRE( dq->peek( ref->size() ) == NULL );
+    REQUIRE( dq->peek_back() == (ref->empty() ? NULL : ref->back()) );
+}
+
+TEST_CASE( "Deque", "[deque]" ) {
+    SqrlDeque<int*> dq;
+    std::deque<int*> ref;
+
+    SECTION( "Empty" ) {
+        REQUIRE( dq.empty() );
+        REQUIRE( dq.count() == 0 );
+        REQUIRE( dq.pop() == NULL );
+        REQUIRE( dq.pop_back() == NULL );
+        REQUIRE( dq.peek() == NULL );
+        REQUIRE( dq.peek_back() == NULL );
+        dq.erase( deque_item( 1 ) );
+        REQUIRE( dq.empty() );
+    }
+
+    SECTION( "Both ends, across the wrap and through growth" ) {
+        for( uintptr_t i = 0; i < 100; i++ ) {
+            if( i % 3 ) {
+                dq.push_back( deque_item( i ) );
+                ref.push_back( deque_item( i ) );
+            } else {
+                dq.push( deque_item( i ) );
+                ref.push_front( deque_item( i ) );
+            }
+            if( i % 7 == 6 ) {
+                REQUIRE( dq.pop() == ref.front() );
+                ref.pop_front();
+            }
+            if( i % 11 == 10 ) {
+                REQUIRE( dq.pop_back() == ref.back() );
+                ref.pop_back();
+            }
+            deque_match( &dq, &ref );
+        }
+        while( !ref.empty() ) {
+            REQUIRE( dq.pop() == ref.front() );
+            ref.pop_front();
+        }
+        deque_match( &dq, &ref );
+    }
+
+    SECTION( "A steady queue wraps without losing order" ) {
+        for( uintptr_t i = 0; i < 5; i++ ) {
+            dq.push_back( deque_item( i ) );
+            ref.push_back( deque_item( i ) );
+        }
+        for( uintptr_t i = 5; i < 1000; i++ ) {
+            REQUIRE( dq.pop() == ref.front() );
+            ref.pop_front();
+            dq.push_back( deque_item( i ) );
+            ref.push_back( deque_item( i ) );
+        }
+        deque_match( &dq, &ref );
+    }
+
+    SECTION( "Erase removes every copy and keeps the order" ) {
+        for( uintptr_t i = 0; i < 20; i++ ) {
+            dq.push( deque_item( i % 4 ) );
+            ref.push_front( deque_item( i % 4 ) );
+        }
+        dq.erase( deque_item( 2 ) );
+        for( std::deque<int*>::iterator it = ref.begin(); it != ref.end(); ) {
+            if( *it == deque_item( 2 ) ) it = ref.erase( it ); else ++it;
+        }
+        deque_match( &dq, &ref );
+        dq.erase( deque_item( 9 ) );
+        deque_match( &dq, &ref );
+        dq.push_back( deque_item( 7 ) );
+        ref.push_back( deque_item( 7 ) );
+        deque_match( &dq, &ref );
+    }
+
+    SECTION( "Copies are independent" ) {
+        for( uintptr_t i = 0; i < 10; i++ ) {
+            dq.push( deque_item( i ) );
+            ref.push_front( deque_item( i ) );
+        }
+        SqrlDeque<int*> copy( dq );
+        SqrlDeque<int*> assigned;
+        assigned.push_back( deque_item( 99 ) );
+        assigned = dq;
+        dq.pop();
+        deque_match( &copy, &ref );
+        deque_match( &assigned, &ref );
+    }
+}
+
+typedef std::chrono::steady_clock::time_point Sqrl_Deque_Time;
+
+static double deque_ns( Sqrl_Deque_Time start, size_t ops ) {
+    return std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now() - start ).count() / ops;
+}
+
+// FIFO traffic through a queue holding 'depth' items, as callbackQueue and actions see.
+template <class D>
+static double deque_churn( size_t depth, size_t ops ) {
+    D dq;
+    uintptr_t sum = 0;
+    for( size_t i = 0; i < depth; i++ ) dq.push_back( deque_item( i ) );
+    Sqrl_Deque_Time start = std::chrono::steady_clock::now();
+    for( size_t i = 0; i < ops; i++ ) {
+        sum += (uintptr_t)dq.pop();
+        dq.push_back( deque_item( i ) );
+    }
+    double ns = deque_ns( start, ops );
+    if( !sum ) printf( "-" );
+    return ns;
+}
+
+// A count() bounded peek() walk over every item, as SqrlClient::getUser() does.
+template <class D>
+static double deque_scan( size_t n, size_t rounds ) {
+    D dq;
+    uintptr_t sum = 0;
+    for( size_t i = 0; i < n; i++ ) dq.push_back( deque_item( i ) );
+    Sqrl_Deque_Time start = std::chrono::steady_clock::now();
+    for( size_t r = 0; r < rounds; r++ ) {
+        size_t end = dq.count();
+        for( size_t i = 0; i < end; i++ ) sum += (uintptr_t)dq.peek( i );
+    }
+    double ns = deque_ns( start, rounds * n );
+    if( !sum ) printf( "-" );
+    return ns;
+}
+
+// Erasing items from the middle, as ~SqrlAction does from the action list.
+template <class D>
+static double deque_erase( size_t n ) {
+    D dq;
+    for( size_t i = 0; i < n; i++ ) dq.push_back( deque_item( i ) );
+    Sqrl_Deque_Time start = std::chrono::steady_clock::now();
+    for( size_t i = 0; i < n; i++ ) dq.erase( deque_item( (i * 7919) % n ) );
+    return deque_ns( start, n );
+}
+
+TEST_CASE( "Deque performance", "[.][benchmark]" ) {
+    const size_t sizes[] = { 4, 64, 1024 };
+    for( size_t s = 0; s < sizeof( sizes ) / sizeof( sizes[0] ); s++ ) {
+        size_t n = sizes[s];
+        size_t rounds = 4000000 / (n * n) + 1;
+        printf( "%5u items: pop+push_back %6.1f ns (list %6.1f); peek walk %6.2f ns/item (list %8.2f); erase %8.1f ns (list %8.1f)\n",
+            (unsigned)n,
+            deque_churn<SqrlDeque<int*> >( n, 2000000 ), deque_churn<LinkedDeque<int*> >( n, 2000000 ),
+            deque_scan<SqrlDeque<int*> >( n, rounds ), deque_scan<LinkedDeque<int*> >( n, rounds ),
+            deque_erase<SqrlDeque<int*> >( n ), deque_erase<LinkedDeque<int*> >( n ) );
+    }
+}
@@ -56,11 +56,15 @@ class GenClient : public SqrlClientAsync
         REQUIRE( false );
     }
     void onSaveSuggested( SqrlUser *user ) {
-        new SqrlActionSave( user, "file://test2.sqrl", SQRL_EXPORT_ALL, SQRL_ENCODING_BINARY );
+        (new SqrlActionSave( user, "file://test2.sqrl", SQRL_EXPORT_ALL, SQRL_ENCODING_BINARY ))->start();
     }
     void onActionComplete( SqrlAction *action ) {
         this->completed++;
     }
 public:
+    ~GenClient() {
+        this->stop();
+    }
+
     int completed = 0;
 };
@@ -14,7 +14,7 @@ using namespace libsqrl;
 
 TEST_CASE( "GenerateIdentity", "[identity]" ) {
     GenClient *client = new GenClient();
-    new SqrlActionGenerate();
+    (new SqrlActionGenerate())->start();
     while( client->completed < 2 ) {
         Sleep( 100 );
     }
@@ -8,6 +8,12 @@ using namespace libsqrl;
 
 class NullClient : public SqrlClientAsync
 {
+public:
+    ~NullClient() {
+        this->stop();
+    }
+
+private:
     void onSend( SqrlAction *t, SqrlString url, SqrlString payload ) {
         REQUIRE( false );
     }
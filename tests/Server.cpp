@@ -1,16 +1,1465 @@
 #include "catch.hpp"
 #include "BaseServer.h"
 #include "NullClient.h"
+#include "aes.h"
+#include "SqrlBase64.h"
+#include "SqrlCrypt.h"
+#include "SqrlNutCache.h"
+#include "SqrlSignatureBatch.h"
+#include "SqrlServerParser.h"
+#include "SqrlStoreServer.h"
+#include "sodium.h"
+#if defined(WITH_THREADS)
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#endif
+#include <chrono>
+#include <new>
+#if !defined(_WIN32)
+#include <atomic>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
 
 using namespace libsqrl;
 
-/*
-TEST_CASE( "Server Link MAC" ) {
-    BaseServer srv = BaseServer( "sqrl://test.sqrlid.com/sqrl?nut=_LIBSQRL_NUT_&sfn=_LIBSQRL_SFN_", "SQRLid", "test", 4 );
-    std::string *str = srv.createLink( 0 );
-    REQUIRE( srv.tryVerifyMAC( str ) );
-    str->erase( str->length() - 4 );
-    REQUIRE( !srv.tryVerifyMAC( str ) );
-    delete str;
+#define TEST_SERVER_URI "sqrl://test.sqrlid.com/sqrl?nut=_LIBSQRL_NUT_&sfn=_LIBSQRL_SFN_"
+
+// Builds a signed client query for 'link', as a SQRL client would post it.  With 'psk', the query
+// also carries the previous identity (pidk and pids).  'extra' is added to the client string.
+static void buildQuery( SqrlString *query, const SqrlString *link, const char *cmd, const uint8_t *sk,
+    const uint8_t *psk = NULL, const char *extra = NULL ) {
+    uint8_t pk[SQRL_KEY_SIZE], ppk[SQRL_KEY_SIZE];
+    uint8_t sig[SQRL_SIG_SIZE];
+    SqrlBase64 b64 = SqrlBase64();
+    SqrlCrypt::generatePublicKey( pk, sk );
+
+    SqrlString client( "ver=1\r\ncmd=" );
+    client.append( cmd );
+    client.append( "\r\nidk=" );
+    SqrlString pkStr( pk, SQRL_KEY_SIZE );
+    b64.encode( &client, &pkStr, true );
+    client.append( "\r\n" );
+    if( psk ) {
+        SqrlCrypt::generatePublicKey( ppk, psk );
+        SqrlString ppkStr( ppk, SQRL_KEY_SIZE );
+        client.append( "pidk=" );
+        b64.encode( &client, &ppkStr, true );
+        client.append( "\r\n" );
+    }
+    if( extra ) client.append( extra );
+
+    SqrlString msg;
+    b64.encode( &msg, &client );
+    SqrlString server;
+    b64.encode( &server, link );
+    query->clear();
+    query->append( "client=" );
+    query->append( &msg );
+    query->append( "&server=" );
+    query->append( &server );
+    msg.append( &server );
+    SqrlCrypt::sign( &msg, sk, pk, sig );
+    SqrlString sigStr( sig, SQRL_SIG_SIZE );
+    query->append( "&ids=" );
+    b64.encode( query, &sigStr, true );
+    if( psk ) {
+        SqrlCrypt::sign( &msg, psk, ppk, sig );
+        SqrlString psigStr( sig, SQRL_SIG_SIZE );
+        query->append( "&pids=" );
+        b64.encode( query, &psigStr, true );
+    }
+}
+
+// Counts the heap allocations this thread makes while it is alive, so the paths meant not to
+// allocate can be checked.  Counters nest; only the innermost one counts.
+static thread_local size_t *allocationCount = NULL;
+
+class AllocationCounter
+{
+public:
+    AllocationCounter() : count( 0 ), outer( allocationCount ) { allocationCount = &this->count; }
+    ~AllocationCounter() { allocationCount = this->outer; }
+    size_t get() const { return this->count; }
+
+private:
+    size_t count;
+    size_t *outer;
+};
+
+// Replacing operator new can't be confined to this file, so every form is replaced, and outside an
+// AllocationCounter they do no more than the library's own.
+static void *test_allocate( size_t n ) {
+    if( allocationCount ) (*allocationCount)++;
+    return malloc( n ? n : 1 );
+}
+
+void *operator new( size_t n ) {
+    void *p = test_allocate( n );
+    if( !p ) throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[]( size_t n ) {
+    void *p = test_allocate( n );
+    if( !p ) throw std::bad_alloc();
+    return p;
+}
+
+void *operator new( size_t n, const std::nothrow_t & ) noexcept {
+    return test_allocate( n );
+}
+
+void *operator new[]( size_t n, const std::nothrow_t & ) noexcept {
+    return test_allocate( n );
+}
+
+void operator delete( void *p ) noexcept {
+    free( p );
+}
+
+void operator delete[]( void *p ) noexcept {
+    free( p );
+}
+
+void operator delete( void *p, size_t ) noexcept {
+    free( p );
+}
+
+void operator delete[]( void *p, size_t ) noexcept {
+    free( p );
+}
+
+void operator delete( void *p, const std::nothrow_t & ) noexcept {
+    free( p );
+}
+
+void operator delete[]( void *p, const std::nothrow_t & ) noexcept {
+    free( p );
+}
+
+// The MAC as it used to be made and checked: keyed from scratch each time, found with strstr().
+static void legacyAddMAC( const uint8_t *key, SqrlString *str, char sep ) {
+    uint8_t mac[crypto_auth_BYTES];
+    crypto_auth( mac, str->cdata(), str->length(), key );
+    if( sep > 0 ) str->push_back( sep );
+    str->append( "mac=" );
+    SqrlString m( mac, SQRL_SERVER_MAC_LENGTH );
+    SqrlBase64().encode( str, &m, true );
+}
+
+static bool legacyVerifyMAC( const uint8_t *key, SqrlString *str ) {
+    const char *cstr = str->cstring();
+    size_t len = 0;
+    const char *m = strstr( cstr, "&mac=" );
+    if( m ) {
+        len = m - cstr;
+        m += 5;
+    } else if( (m = strstr( cstr, "mac=" )) != NULL ) {
+        len = m - cstr;
+        m += 4;
+    }
+    if( !m ) return false;
+    SqrlString given( m, 22 );
+    SqrlString *raw = SqrlBase64().decode( NULL, &given );
+    uint8_t mac[crypto_auth_BYTES];
+    crypto_auth( mac, (const unsigned char*)cstr, len, key );
+    bool ok = raw && raw->length() == SQRL_SERVER_MAC_LENGTH && 0 == sodium_memcmp( mac, raw->cdata(), SQRL_SERVER_MAC_LENGTH );
+    if( raw ) delete raw;
+    return ok;
+}
+
+TEST_CASE( "Server MAC", "[server]" ) {
+    BaseServer srv( TEST_SERVER_URI, "SQRLid", "test", 4 );
+    SqrlString *link = srv.createLink( 0 );
+    REQUIRE( srv.tryVerifyMAC( link ) );
+    REQUIRE( legacyVerifyMAC( srv.getKey(), link ) );
+    link->erase( link->length() - 4, link->length() );
+    REQUIRE( !srv.tryVerifyMAC( link ) );
+    delete link;
+
+    // The precomputed key state gives the same MAC as keying from scratch.
+    for( int sep = 0; sep < 2; sep++ ) {
+        SqrlString a( "ver=1\r\ntif=5\r\nqry=/sqrl\r\n" ), b( &a );
+        srv.tryAddMAC( &a, sep ? '&' : 0 );
+        legacyAddMAC( srv.getKey(), &b, sep ? '&' : 0 );
+        REQUIRE( 0 == a.compare( &b ) );
+        REQUIRE( srv.tryVerifyMAC( &a ) );
+        a.data()[3] ^= 1;
+        REQUIRE( !srv.tryVerifyMAC( &a ) );
+    }
+
+    // The MAC must come last; a stray "mac=" earlier on doesn't confuse it.
+    SqrlString c( "mac=AAAAAAAAAAAAAAAAAAAAAA&x=1" );
+    REQUIRE( !srv.tryVerifyMAC( &c ) );
+    srv.tryAddMAC( &c, '&' );
+    REQUIRE( srv.tryVerifyMAC( &c ) );
+    c.append( "\r\n" );
+    REQUIRE( !srv.tryVerifyMAC( &c ) );
+
+    // After a rekey, the keyed state is rebuilt.
+    SqrlString d( "abc" );
+    srv.tryAddMAC( &d, '&' );
+    srv.rekey( "other", 5 );
+    REQUIRE( !srv.tryVerifyMAC( &d ) );
+    REQUIRE( !legacyVerifyMAC( srv.getKey(), &d ) );
+}
+
+TEST_CASE( "Server MAC throughput", "[.][benchmark]" ) {
+    BaseServer srv( TEST_SERVER_URI, "SQRLid", "test", 4 );
+    const int reps = 200000;
+    Sqrl_Nut nut;
+    SqrlString str;
+
+    // A nut, as in a link, MACed and then checked.
+    auto t0 = std::chrono::steady_clock::now();
+    for( int i = 0; i < reps; i++ ) {
+        srv.tryCreateNut( &nut, (uint32_t)i );
+        SqrlString nutString( (uint8_t*)&nut, sizeof( Sqrl_Nut ) );
+        str.clear();
+        str.append( "sqrl://test.sqrlid.com/sqrl?nut=" );
+        SqrlBase64().encode( &str, &nutString, true );
+        legacyAddMAC( srv.getKey(), &str, '&' );
+        legacyVerifyMAC( srv.getKey(), &str );
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for( int i = 0; i < reps; i++ ) {
+        srv.tryCreateNut( &nut, (uint32_t)i );
+        SqrlString nutString( (uint8_t*)&nut, sizeof( Sqrl_Nut ) );
+        str.clear();
+        str.append( "sqrl://test.sqrlid.com/sqrl?nut=" );
+        SqrlBase64().encode( &str, &nutString, true );
+        srv.tryAddMAC( &str, '&' );
+        srv.tryVerifyMAC( &str );
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    printf( "Nut + MAC + verify, keyed per call:   %.0f nuts/sec\n", reps / std::chrono::duration<double>( t1 - t0 ).count() );
+    printf( "Nut + MAC + verify, precomputed state: %.0f nuts/sec\n", reps / std::chrono::duration<double>( t2 - t1 ).count() );
+}
+
+TEST_CASE( "Server nut round trip", "[server]" ) {
+    BaseServer srv( TEST_SERVER_URI, "SQRLid", "test", 4 );
+    Sqrl_Nut nut, first;
+    REQUIRE( srv.tryCreateNut( &nut, 0x0a000001 ) );
+    memcpy( &first, &nut, sizeof( Sqrl_Nut ) );
+    REQUIRE( srv.tryDecryptNut( &nut ) );
+    REQUIRE( nut.ip == 0x0a000001 );
+
+    // The cached schedules must agree with a freshly expanded key.
+    aes_context ctx;
+    Sqrl_Nut pt;
+    aes_setkey( &ctx, DECRYPT, srv.getKey(), 16 );
+    aes_cipher( &ctx, (unsigned char*)&first, (unsigned char*)&pt );
+    REQUIRE( 0 == memcmp( &pt, &nut, sizeof( Sqrl_Nut ) ) );
+
+    // After a rekey, old nuts no longer decrypt to the same plain text.
+    srv.rekey( "other", 5 );
+    memcpy( &nut, &first, sizeof( Sqrl_Nut ) );
+    REQUIRE( srv.tryDecryptNut( &nut ) );
+    REQUIRE( 0 != memcmp( &pt, &nut, sizeof( Sqrl_Nut ) ) );
+    REQUIRE( srv.tryCreateNut( &nut, 0x0a000002 ) );
+    REQUIRE( srv.tryDecryptNut( &nut ) );
+    REQUIRE( nut.ip == 0x0a000002 );
+}
+
+TEST_CASE( "Server nut throughput", "[.][benchmark]" ) {
+    BaseServer srv( TEST_SERVER_URI, "SQRLid", "test", 4 );
+    const int reps = 200000;
+    Sqrl_Nut nut;
+
+    // What createNut / decryptNut used to do: expand the key for every nut.
+    auto t0 = std::chrono::steady_clock::now();
+    for( int i = 0; i < reps; i++ ) {
+        aes_context ctx;
+        Sqrl_Nut pt = { (uint32_t)i, 0, 0 };
+        aes_setkey( &ctx, ENCRYPT, srv.getKey(), 16 );
+        aes_cipher( &ctx, (unsigned char*)&pt, (unsigned char*)&nut );
+        aes_setkey( &ctx, DECRYPT, srv.getKey(), 16 );
+        aes_cipher( &ctx, (unsigned char*)&nut, (unsigned char*)&pt );
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for( int i = 0; i < reps; i++ ) {
+        srv.tryCreateNut( &nut, (uint32_t)i );
+        srv.tryDecryptNut( &nut );
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    double before = std::chrono::duration<double>( t1 - t0 ).count();
+    double after = std::chrono::duration<double>( t2 - t1 ).count();
+    printf( "Nut create + decrypt, per-call key expansion: %.0f nuts/sec\n", reps / before );
+    printf( "Nut create + decrypt, cached schedules:       %.0f nuts/sec\n", reps / after );
+}
+
+TEST_CASE( "Server batch links", "[server]" ) {
+    BaseServer srv( TEST_SERVER_URI, "SQRLid", "test", 4 );
+    uint32_t ips[130];
+    size_t offsets[131];
+    for( int i = 0; i < 130; i++ ) ips[i] = 0x0a000000 + i;
+
+    SqrlString links;
+    REQUIRE( 130 == srv.createLinks( ips, 130, &links, offsets ) );
+    SqrlString *single = srv.createLink( 1 );
+    REQUIRE( single );
+    for( int i = 0; i < 130; i++ ) {
+        SqrlString link( (const char*)links.cdata() + offsets[i], offsets[i + 1] - offsets[i] );
+        REQUIRE( link.length() == single->length() );
+        REQUIRE( srv.tryVerifyMAC( &link ) );
+
+        const char *p = strstr( link.cstring(), "nut=" ) + 4;
+        SqrlString nutStr( p, 22 );
+        SqrlString *raw = SqrlBase64().decode( NULL, &nutStr );
+        REQUIRE( raw );
+        Sqrl_Nut nut;
+        memcpy( &nut, raw->cdata(), sizeof( Sqrl_Nut ) );
+        delete raw;
+        REQUIRE( srv.tryDecryptNut( &nut ) );
+        REQUIRE( nut.ip == ips[i] );
+    }
+    delete single;
+}
+
+TEST_CASE( "Server link throughput", "[.][benchmark]" ) {
+    BaseServer srv( TEST_SERVER_URI, "SQRLid", "test", 4 );
+    const size_t n = 10000;
+    static uint32_t ips[n];
+    static size_t offsets[n + 1];
+    SqrlString links;
+
+    auto t0 = std::chrono::steady_clock::now();
+    for( size_t i = 0; i < n; i++ ) {
+        delete srv.createLink( (uint32_t)i );
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    srv.createLinks( ips, n, &links, offsets );
+    auto t2 = std::chrono::steady_clock::now();
+    printf( "createLink:  %.0f links/ms\n", n / std::chrono::duration<double, std::milli>( t1 - t0 ).count() );
+    printf( "createLinks: %.0f links/ms\n", n / std::chrono::duration<double, std::milli>( t2 - t1 ).count() );
+}
+
+TEST_CASE( "Server query", "[server]" ) {
+    BaseServer srv( TEST_SERVER_URI, "SQRLid", "test", 4 );
+    uint8_t sk[SQRL_KEY_SIZE];
+    sqrl_randombytes( sk, SQRL_KEY_SIZE );
+    SqrlString *link = srv.createLink( 0x0a000001 );
+    REQUIRE( link );
+    SqrlString query;
+    buildQuery( &query, link, "query", sk );
+    delete link;
+
+    SqrlServerRequest request( 0x0a000001 );
+    srv.handleQuery( &request, query.cstring(), query.length() );
+    REQUIRE( srv.replies == 1 );
+    REQUIRE( 0 == (request.getTif() & SQRL_TIF_COMMAND_FAILURE) );
+    REQUIRE( (request.getTif() & SQRL_TIF_ID_MATCH) );
+    REQUIRE( (request.getTif() & SQRL_TIF_IP_MATCH) );
+    REQUIRE( request.getCommand() == SQRL_SERVER_CMD_QUERY );
+    SqrlString reply( request.getReply() );
+    REQUIRE( srv.tryVerifyMAC( &reply ) );
+
+    // A corrupted signature fails.
+    query.data()[query.length() - 2] ^= 1;
+    request.reset( 0x0a000001 );
+    srv.handleQuery( &request, query.cstring(), query.length() );
+    REQUIRE( (request.getTif() & SQRL_TIF_COMMAND_FAILURE) );
+    REQUIRE( srv.failures == 1 );
+}
+
+TEST_CASE( "Server query parser", "[server]" ) {
+    struct Sqrl_Kv_View ctx[CONTEXT_KV_COUNT], cli[CLIENT_KV_COUNT];
+    const char *q = "client=abc&server=de&junk=1&ids=f&client=gh&urs=ij\r\n";
+    int found = server_split_query( q, strlen( q ), ctx );
+    REQUIRE( found == ((1 << CONTEXT_KV_CLIENT) | (1 << CONTEXT_KV_SERVER) | (1 << CONTEXT_KV_IDS) | (1 << CONTEXT_KV_URS)) );
+    REQUIRE( 0 == memcmp( q + ctx[CONTEXT_KV_CLIENT].offset, "gh", ctx[CONTEXT_KV_CLIENT].length ) );
+    REQUIRE( 0 == memcmp( q + ctx[CONTEXT_KV_SERVER].offset, "de", ctx[CONTEXT_KV_SERVER].length ) );
+    REQUIRE( ctx[CONTEXT_KV_URS].length == 2 );
+    REQUIRE( server_split_query( "pids", 4, ctx ) == 0 );
+
+    const char *c = "ver=1\r\ncmd=disable\r\nidk=AAAA\r\npidk=BBBB\r\nopt=cps~suk\r\n";
+    found = server_split_client( c, strlen( c ), cli );
+    REQUIRE( found == ((1 << CLIENT_KV_VER) | (1 << CLIENT_KV_CMD) | (1 << CLIENT_KV_IDK) | (1 << CLIENT_KV_PIDK) | (1 << CLIENT_KV_OPT)) );
+    REQUIRE( server_find_command( c + cli[CLIENT_KV_CMD].offset, cli[CLIENT_KV_CMD].length ) == SQRL_SERVER_CMD_DISABLE );
+    REQUIRE( 0 == memcmp( c + cli[CLIENT_KV_PIDK].offset, "BBBB", cli[CLIENT_KV_PIDK].length ) );
+    REQUIRE( server_find_command( "querx", 5 ) == SQRL_SERVER_CMD_UNKNOWN );
+
+    struct Sqrl_Kv_View nut;
+    const char *link = "sqrl://example.com/sqrl?x=1&nut=abc&mac=def";
+    REQUIRE( server_find_value( link, strlen( link ), "nut", &nut ) );
+    REQUIRE( 0 == memcmp( link + nut.offset, "abc", nut.length ) );
+    const char *reply = "ver=1\r\nsnut=x\r\nnut=xyz\r\ntif=5\r\n";
+    REQUIRE( server_find_value( reply, strlen( reply ), "nut", &nut ) );
+    REQUIRE( 0 == memcmp( reply + nut.offset, "xyz", nut.length ) );
+    REQUIRE( !server_find_value( reply, strlen( reply ), "mac", &nut ) );
+
+    // Decoding agrees with SqrlBase64, and insists on the expected length.
+    uint8_t raw[70], out[70];
+    sqrl_randombytes( raw, sizeof( raw ) );
+    for( size_t len = 1; len < sizeof( raw ); len++ ) {
+        SqrlString in( raw, len ), enc;
+        SqrlBase64().encode( &enc, &in );
+        REQUIRE( server_b64_decode_exact( out, len, enc.cstring(), enc.length() ) );
+        REQUIRE( 0 == memcmp( out, raw, len ) );
+        REQUIRE( !server_b64_decode_exact( out, len + 1, enc.cstring(), enc.length() ) );
+        SqrlString dec;
+        REQUIRE( server_b64_decode( &dec, enc.cstring(), enc.length() ) );
+        REQUIRE( 0 == dec.compare( &in ) );
+        // Setting a bit past the end of the data gives another spelling, which is refused.
+        if( len % 3 ) {
+            static const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+            char *last = (char*)enc.data() + enc.length() - 1;
+            *last = alphabet[(strchr( alphabet, *last ) - alphabet) ^ 1];
+            REQUIRE( !server_b64_decode_exact( out, len, enc.cstring(), enc.length() ) );
+            REQUIRE( !server_b64_decode( &dec, enc.cstring(), enc.length() ) );
+        }
+    }
+    REQUIRE( server_b64_decode_exact( out, 2, "AAE=", 4 ) );
+    REQUIRE( !server_b64_decode_exact( out, 2, "AAF=", 4 ) );
+    REQUIRE( !server_b64_decode_exact( out, 1, "AB", 2 ) );
+    REQUIRE( !server_b64_decode_exact( out, 3, "AA+A", 4 ) );
+    REQUIRE( !server_b64_decode_exact( out, 3, "AA A", 4 ) );
+
+    // A query parses without touching the heap, once the buffers are warm.
+    BaseServer srv( TEST_SERVER_URI, "SQRLid", "test", 4 );
+    uint8_t sk[SQRL_KEY_SIZE], sig[SQRL_SIG_SIZE], pk[SQRL_KEY_SIZE];
+    sqrl_randombytes( sk, SQRL_KEY_SIZE );
+    SqrlString *l = srv.createLink( 1 );
+    SqrlString query, clientText, serverText;
+    buildQuery( &query, l, "query", sk );
+    delete l;
+    size_t allocated = 0;
+    bool ok = true;
+    for( int pass = 0; pass < 2; pass++ ) {
+        // Catch's own macros allocate, so the checks wait until the count is taken.
+        AllocationCounter counter;
+        found = server_split_query( query.cstring(), query.length(), ctx );
+        ok &= found == ((1 << CONTEXT_KV_CLIENT) | (1 << CONTEXT_KV_SERVER) | (1 << CONTEXT_KV_IDS));
+        const struct Sqrl_Kv_View *v = &ctx[CONTEXT_KV_CLIENT];
+        ok &= server_b64_decode( &clientText, query.cstring() + v->offset, v->length );
+        v = &ctx[CONTEXT_KV_SERVER];
+        ok &= server_b64_decode( &serverText, query.cstring() + v->offset, v->length );
+        found = server_split_client( clientText.cstring(), clientText.length(), cli );
+        ok &= (found & (1 << CLIENT_KV_IDK)) != 0;
+        v = &ctx[CONTEXT_KV_IDS];
+        ok &= server_b64_decode_exact( sig, SQRL_SIG_SIZE, query.cstring() + v->offset, v->length );
+        v = &cli[CLIENT_KV_IDK];
+        ok &= server_b64_decode_exact( pk, SQRL_KEY_SIZE, clientText.cstring() + v->offset, v->length );
+        allocated = counter.get();
+    }
+    REQUIRE( ok );
+    REQUIRE( allocated == 0 );
+}
+
+// The parser as it was: a new SqrlString for every value, and every decode.
+static int legacyParseKv( const char *str, size_t len, const char *sep,
+    const char **names, int count, SqrlString **values ) {
+    int found = 0;
+    size_t sepLen = strlen( sep );
+    const char *end = str + len;
+    while( str < end ) {
+        const char *eq = (const char*)memchr( str, '=', end - str );
+        if( !eq ) break;
+        const char *val = eq + 1;
+        const char *next = val;
+        while( next < end && ((size_t)(end - next) < sepLen || 0 != memcmp( next, sep, sepLen )) ) {
+            next++;
+        }
+        size_t keyLen = eq - str;
+        for( int i = 0; i < count; i++ ) {
+            if( keyLen == strlen( names[i] ) && 0 == memcmp( str, names[i], keyLen ) ) {
+                if( values[i] ) delete values[i];
+                values[i] = new SqrlString( val, next - val );
+                found |= (1 << i);
+                break;
+            }
+        }
+        if( next >= end ) break;
+        str = next + sepLen;
+    }
+    return found;
+}
+
+TEST_CASE( "Server query parsing throughput", "[.][benchmark]" ) {
+    static const char *contextKeys[CONTEXT_KV_COUNT] = { "server", "client", "ids", "pids", "urs" };
+    static const char *clientKeys[CLIENT_KV_COUNT] = { "ver", "cmd", "opt", "btn", "idk", "pidk", "suk", "vuk" };
+    BaseServer srv( TEST_SERVER_URI, "SQRLid", "test", 4 );
+    uint8_t sk[SQRL_KEY_SIZE], sig[SQRL_SIG_SIZE], pk[SQRL_KEY_SIZE];
+    sqrl_randombytes( sk, SQRL_KEY_SIZE );
+    SqrlString *link = srv.createLink( 1 );
+    SqrlString query;
+    buildQuery( &query, link, "query", sk );
+    delete link;
+    const int reps = 100000;
+
+    size_t copying, inPlace;
+    auto t0 = std::chrono::steady_clock::now();
+    {
+        AllocationCounter counter;
+        for( int r = 0; r < reps; r++ ) {
+            SqrlString *ctx[CONTEXT_KV_COUNT] = { NULL }, *cli[CLIENT_KV_COUNT] = { NULL };
+            legacyParseKv( query.cstring(), query.length(), "&", contextKeys, CONTEXT_KV_COUNT, ctx );
+            SqrlString *srvText = SqrlBase64().decode( NULL, ctx[CONTEXT_KV_SERVER] );
+            SqrlString *cliText = SqrlBase64().decode( NULL, ctx[CONTEXT_KV_CLIENT] );
+            legacyParseKv( cliText->cstring(), cliText->length(), "\r\n", clientKeys, CLIENT_KV_COUNT, cli );
+            SqrlString *s = SqrlBase64().decode( NULL, ctx[CONTEXT_KV_IDS] );
+            SqrlString *k = SqrlBase64().decode( NULL, cli[CLIENT_KV_IDK] );
+            memcpy( sig, s->cdata(), SQRL_SIG_SIZE );
+            memcpy( pk, k->cdata(), SQRL_KEY_SIZE );
+            delete s;
+            delete k;
+            delete srvText;
+            delete cliText;
+            for( int i = 0; i < CONTEXT_KV_COUNT; i++ ) if( ctx[i] ) delete ctx[i];
+            for( int i = 0; i < CLIENT_KV_COUNT; i++ ) if( cli[i] ) delete cli[i];
+        }
+        copying = counter.get();
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    struct Sqrl_Kv_View ctx[CONTEXT_KV_COUNT], cli[CLIENT_KV_COUNT];
+    SqrlString clientText, serverText;
+    {
+        AllocationCounter counter;
+        for( int r = 0; r < reps; r++ ) {
+            server_split_query( query.cstring(), query.length(), ctx );
+            const struct Sqrl_Kv_View *v = &ctx[CONTEXT_KV_SERVER];
+            server_b64_decode( &serverText, query.cstring() + v->offset, v->length );
+            v = &ctx[CONTEXT_KV_CLIENT];
+            server_b64_decode( &clientText, query.cstring() + v->offset, v->length );
+            server_split_client( clientText.cstring(), clientText.length(), cli );
+            v = &ctx[CONTEXT_KV_IDS];
+            server_b64_decode_exact( sig, SQRL_SIG_SIZE, query.cstring() + v->offset, v->length );
+            v = &cli[CLIENT_KV_IDK];
+            server_b64_decode_exact( pk, SQRL_KEY_SIZE, clientText.cstring() + v->offset, v->length );
+        }
+        inPlace = counter.get();
+    }
+    auto t2 = std::chrono::steady_clock::now();
+
+    printf( "Query parsing, copying: %.0f queries/sec, %.1f allocations each\n",
+        reps / std::chrono::duration<double>( t1 - t0 ).count(), (double)copying / reps );
+    printf( "Query parsing, in place: %.0f queries/sec, %.1f allocations each\n",
+        reps / std::chrono::duration<double>( t2 - t1 ).count(), (double)inPlace / reps );
+}
+
+// Finds a user for every query, disabled, so replies carry the suk.
+class SukServer : public BaseServer
+{
+public:
+    SukServer() : BaseServer( TEST_SERVER_URI, "SQRLid", "test", 4 ) {
+        sqrl_randombytes( this->suk, SQRL_KEY_SIZE );
+    }
+
+    uint8_t suk[SQRL_KEY_SIZE];
+
+protected:
+    bool onUserFind( SqrlServerRequest *request, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) {
+        request->setUser( NULL, this->suk, NULL, SQRL_SERVER_USER_FLAG_DISABLED );
+        return true;
+    }
+};
+
+// The reply as it used to be built: a line at a time, then the MAC.
+static void legacyReply( BaseServer *srv, SqrlString *reply, const Sqrl_Nut *nut, Sqrl_Tif tif, const uint8_t *suk ) {
+    char buf[32];
+    reply->clear();
+    reply->append( "ver=1\r\n" );
+    SqrlString nutString( (uint8_t*)nut, sizeof( Sqrl_Nut ) );
+    reply->append( "nut=" );
+    SqrlBase64().encode( reply, &nutString, true );
+    reply->append( "\r\n" );
+    snprintf( buf, sizeof( buf ), "tif=%X\r\n", tif );
+    reply->append( buf );
+    reply->append( "qry=" );
+    reply->append( srv->getQry() );
+    reply->append( "\r\n" );
+    if( suk ) {
+        SqrlString sukString( suk, SQRL_KEY_SIZE );
+        SqrlString *enc = SqrlBase64().encode( NULL, &sukString );
+        reply->append( "suk=" );
+        reply->append( enc );
+        reply->append( "\r\n" );
+        delete enc;
+    }
+    uint8_t mac[crypto_auth_BYTES];
+    crypto_auth( mac, reply->cdata(), reply->length(), srv->getKey() );
+    reply->append( "mac=" );
+    SqrlString m( mac, SQRL_SERVER_MAC_LENGTH );
+    SqrlBase64().encode( reply, &m, true );
+}
+
+// Pulls the nut back out of a reply.
+static bool replyNut( const SqrlString *reply, Sqrl_Nut *nut ) {
+    struct Sqrl_Kv_View v;
+    return server_find_value( reply->cstring(), reply->length(), "nut", &v ) &&
+        server_b64_decode_exact( (uint8_t*)nut, sizeof( Sqrl_Nut ), reply->cstring() + v.offset, v.length );
+}
+
+TEST_CASE( "Server reply template", "[server]" ) {
+    uint8_t sk[SQRL_KEY_SIZE];
+    sqrl_randombytes( sk, SQRL_KEY_SIZE );
+    SqrlString query, expected;
+    Sqrl_Nut nut;
+
+    // Replies are the same, byte for byte, as the line by line builder's.
+    BaseServer plain( TEST_SERVER_URI, "SQRLid", "test", 4 );
+    SukServer withSuk;
+    BaseServer *servers[2] = { &plain, &withSuk };
+    for( int s = 0; s < 2; s++ ) {
+        const char *cmds[3] = { "query", "ident", "bogus" };
+        for( int c = 0; c < 3; c++ ) {
+            SqrlString *link = servers[s]->createLink( 0x0a000001 );
+            buildQuery( &query, link, cmds[c], sk );
+            delete link;
+            SqrlServerRequest request( 0x0a000001 );
+            servers[s]->handleQuery( &request, query.cstring(), query.length() );
+            const SqrlString *reply = request.getReply();
+            REQUIRE( replyNut( reply, &nut ) );
+            legacyReply( servers[s], &expected, &nut, request.getTif(), s ? withSuk.suk : NULL );
+            REQUIRE( 0 == reply->compare( &expected ) );
+            REQUIRE( (strstr( reply->cstring(), "suk=" ) != NULL) == (s == 1) );
+            REQUIRE( reply->length() <= servers[s]->getReplyLength( &request ) );
+        }
+    }
+
+    // Writing into the caller's buffer doesn't allocate, and refuses a buffer that's too small.
+    SqrlString *link = withSuk.createLink( 0x0a000001 );
+    buildQuery( &query, link, "query", sk );
+    delete link;
+    SqrlServerRequest request( 0x0a000001 );
+    withSuk.handleQuery( &request, query.cstring(), query.length() );
+    char buf[512];
+    size_t need = withSuk.getReplyLength( &request );
+    REQUIRE( need <= sizeof( buf ) );
+    REQUIRE( 0 == withSuk.writeReply( &request, buf, need - 1 ) );
+    size_t allocated, len = 0;
+    {
+        AllocationCounter counter;
+        for( int i = 0; i < 100; i++ ) {
+            len = withSuk.writeReply( &request, buf, sizeof( buf ) );
+        }
+        allocated = counter.get();
+    }
+    REQUIRE( allocated == 0 );
+    SqrlString written( buf, len );
+    REQUIRE( replyNut( &written, &nut ) );
+    legacyReply( &withSuk, &expected, &nut, request.getTif(), withSuk.suk );
+    REQUIRE( 0 == written.compare( &expected ) );
+    REQUIRE( withSuk.tryVerifyMAC( &written ) );
+}
+
+TEST_CASE( "Server reply throughput", "[.][benchmark]" ) {
+    SukServer srv;
+    uint8_t sk[SQRL_KEY_SIZE];
+    sqrl_randombytes( sk, SQRL_KEY_SIZE );
+    SqrlString *link = srv.createLink( 0x0a000001 );
+    SqrlString query, reply;
+    buildQuery( &query, link, "query", sk );
+    delete link;
+    SqrlServerRequest request( 0x0a000001 );
+    srv.handleQuery( &request, query.cstring(), query.length() );
+    const int reps = 200000;
+    Sqrl_Nut nut;
+    char buf[512];
+
+    size_t lineByLine, templated;
+    auto t0 = std::chrono::steady_clock::now();
+    {
+        AllocationCounter counter;
+        for( int i = 0; i < reps; i++ ) {
+            srv.tryCreateNut( &nut, 0x0a000001 );
+            legacyReply( &srv, &reply, &nut, request.getTif(), srv.suk );
+        }
+        lineByLine = counter.get();
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    {
+        AllocationCounter counter;
+        for( int i = 0; i < reps; i++ ) {
+            srv.writeReply( &request, buf, sizeof( buf ) );
+        }
+        templated = counter.get();
+    }
+    auto t2 = std::chrono::steady_clock::now();
+
+    printf( "Reply, line by line: %.0f replies/sec, %.1f allocations each\n",
+        reps / std::chrono::duration<double>( t1 - t0 ).count(), (double)lineByLine / reps );
+    printf( "Reply, template:     %.0f replies/sec, %.1f allocations each\n",
+        reps / std::chrono::duration<double>( t2 - t1 ).count(), (double)templated / reps );
+}
+
+#if defined(WITH_THREADS)
+TEST_CASE( "Server concurrent queries", "[server]" ) {
+    BaseServer srv( TEST_SERVER_URI, "SQRLid", "test", 4 );
+    const int threads = 4;
+    const int perThread = 50;
+    std::vector<SqrlString> queries( threads * perThread );
+    uint8_t sk[SQRL_KEY_SIZE];
+    for( int i = 0; i < threads * perThread; i++ ) {
+        sqrl_randombytes( sk, SQRL_KEY_SIZE );
+        SqrlString *link = srv.createLink( (uint32_t)i );
+        buildQuery( &queries[i], link, "query", sk );
+        delete link;
+    }
+
+    // One server, no locking: each thread works through its own share of the queries.
+    std::vector<std::thread> pool;
+    for( int t = 0; t < threads; t++ ) {
+        pool.push_back( std::thread( [&srv, &queries, t, perThread]() {
+            for( int i = t * perThread; i < (t + 1) * perThread; i++ ) {
+                srv.handleQuery( (uint32_t)i, queries[i].cstring(), queries[i].length() );
+            }
+        } ) );
+    }
+    for( auto &th : pool ) th.join();
+
+    REQUIRE( srv.replies == threads * perThread );
+    REQUIRE( srv.failures == 0 );
+}
+#endif
+
+TEST_CASE( "Server signature batching", "[server]" ) {
+    BaseServer srv( TEST_SERVER_URI, "SQRLid", "test", 4 );
+    // A long wait, which a lone request must not be made to sit through.
+    srv.setSignatureBatching( SQRL_ED25519_BATCH_MAX, 2000000 );
+    const int count = 200;
+    std::vector<SqrlString> queries( count );
+    uint8_t sk[SQRL_KEY_SIZE];
+    for( int i = 0; i < count; i++ ) {
+        sqrl_randombytes( sk, SQRL_KEY_SIZE );
+        SqrlString *link = srv.createLink( (uint32_t)i );
+        buildQuery( &queries[i], link, "query", sk );
+        delete link;
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    srv.handleQuery( (uint32_t)0, queries[0].cstring(), queries[0].length() );
+    auto t1 = std::chrono::steady_clock::now();
+    REQUIRE( srv.replies == 1 );
+    REQUIRE( std::chrono::duration<double>( t1 - t0 ).count() < 1.0 );
+
+    // A bad signature is still refused when it shares a batch.
+    char *ids = strstr( (char*)queries[1].data(), "ids=" ) + 4;
+    *ids = *ids == 'A' ? 'B' : 'A';
+
+#if defined(WITH_THREADS)
+    const int threads = 4;
+    std::atomic<int> next( 1 );
+    std::vector<std::thread> pool;
+    for( int t = 0; t < threads; t++ ) {
+        pool.push_back( std::thread( [&srv, &queries, &next, count]() {
+            int i;
+            while( (i = next++) < count ) {
+                srv.handleQuery( (uint32_t)i, queries[i].cstring(), queries[i].length() );
+            }
+        } ) );
+    }
+    for( auto &th : pool ) th.join();
+#else
+    for( int i = 1; i < count; i++ ) {
+        srv.handleQuery( (uint32_t)i, queries[i].cstring(), queries[i].length() );
+    }
+#endif
+    REQUIRE( srv.replies == count );
+    REQUIRE( srv.failures == 1 );
+    SqrlSignatureBatch *batch = srv.getSignatureBatch();
+    INFO( batch->getSignatures() << " signatures in " << batch->getBatches() << " batches" );
+    REQUIRE( batch->getSignatures() == (uint64_t)count );
+}
+
+TEST_CASE( "Nut replay cache", "[server]" ) {
+    const uint64_t life = 60 * 1000000ULL;
+    const uint64_t base = 1500000000ULL * 1000000ULL;
+    SqrlNutCache cache( life, 1024 );
+    Sqrl_Nut nut = { 1, 2, base };
+    REQUIRE( cache.add( &nut ) );
+    REQUIRE( !cache.add( &nut ) );
+    nut.random = 3;
+    REQUIRE( cache.add( &nut ) );
+    REQUIRE( cache.getMisses() == 2 );
+    REQUIRE( cache.getHits() == 1 );
+
+    // Walk forward through two nut lifetimes; old buckets are recycled, and their nuts refused.
+    for( int i = 1; i <= 14; i++ ) {
+        Sqrl_Nut n = { 1, (uint32_t)i, base + i * life / 7 };
+        REQUIRE( cache.add( &n ) );
+    }
+    REQUIRE( cache.getEvictions() > 0 );
+    REQUIRE( !cache.add( &nut ) );
+    REQUIRE( cache.getOverflows() == 1 );
+
+#if defined(WITH_THREADS)
+    // Many threads racing on the same nuts: each is accepted exactly once.
+    SqrlNutCache shared( life, 4096 );
+    std::vector<std::thread> pool;
+    for( int t = 0; t < 4; t++ ) {
+        pool.push_back( std::thread( [&shared, base]() {
+            for( uint32_t i = 0; i < 1000; i++ ) {
+                Sqrl_Nut n = { i, i * 7, base + i };
+                shared.add( &n );
+            }
+        } ) );
+    }
+    for( auto &th : pool ) th.join();
+    REQUIRE( shared.getMisses() == 1000 );
+    REQUIRE( shared.getHits() == 3000 );
+#endif
+}
+
+TEST_CASE( "Nut replay cache over a long run", "[server]" ) {
+    const uint64_t life = 60 * 1000000ULL;
+    const uint64_t base = 1500000000ULL * 1000000ULL;
+    const uint64_t span = life / (SQRL_NUT_CACHE_BUCKETS - 1);
+
+    // Epoch tags are 16 bits.  Fill every bucket's table, then skip ahead, past where the tags
+    // wrap: the old entries must still read as expired, and make room for new ones.
+    const uint64_t skips[] = { 0x8800, 0xC000, 0x10800 };
+    for( uint64_t lives : skips ) {
+        SqrlNutCache cache( life, 64 );
+        uint32_t r = 0;
+        for( int b = 0; b < SQRL_NUT_CACHE_BUCKETS; b++ ) {
+            for( int i = 0; i < SQRL_NUT_CACHE_MAX_PROBE; i++ ) {
+                Sqrl_Nut nut = { 1, r++, base + b * span };
+                REQUIRE( cache.add( &nut ) );
+            }
+        }
+        for( int b = 0; b < SQRL_NUT_CACHE_BUCKETS; b++ ) {
+            for( int i = 0; i < SQRL_NUT_CACHE_MAX_PROBE / 2; i++ ) {
+                Sqrl_Nut nut = { 1, r++, base + lives * life + b * span };
+                REQUIRE( cache.add( &nut ) );
+            }
+        }
+        REQUIRE( cache.getOverflows() == 0 );
+    }
+}
+
+TEST_CASE( "Server refuses replayed queries", "[server]" ) {
+    BaseServer srv( TEST_SERVER_URI, "SQRLid", "test", 4 );
+    uint8_t sk[SQRL_KEY_SIZE];
+    sqrl_randombytes( sk, SQRL_KEY_SIZE );
+    SqrlString *link = srv.createLink( 0x0a000001 );
+    SqrlString query;
+    buildQuery( &query, link, "query", sk );
+    delete link;
+
+    SqrlServerRequest request( 0x0a000001 );
+    srv.handleQuery( &request, query.cstring(), query.length() );
+    REQUIRE( 0 == (request.getTif() & SQRL_TIF_COMMAND_FAILURE) );
+    request.reset( 0x0a000001 );
+    srv.handleQuery( &request, query.cstring(), query.length() );
+    REQUIRE( (request.getTif() & SQRL_TIF_TRANSIENT_ERR) );
+    REQUIRE( (request.getTif() & SQRL_TIF_COMMAND_FAILURE) );
+    REQUIRE( srv.getNutCache()->getHits() == 1 );
+}
+
+#if !defined(_WIN32)
+// Runs 'work( worker )' in 'workers' forked processes, and waits for them all to succeed.
+template<typename F> static bool forkWorkers( int workers, F work ) {
+    std::vector<pid_t> pids;
+    for( int w = 0; w < workers; w++ ) {
+        pid_t pid = fork();
+        if( pid == 0 ) {
+            work( w );
+            _exit( 0 );
+        }
+        if( pid < 0 ) return false;
+        pids.push_back( pid );
+    }
+    bool ok = true;
+    for( pid_t pid : pids ) {
+        int status = 0;
+        if( waitpid( pid, &status, 0 ) != pid || !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 ) ok = false;
+    }
+    return ok;
+}
+
+TEST_CASE( "Shared nut cache across processes", "[server]" ) {
+    const uint64_t life = 60 * 1000000ULL;
+    const uint64_t base = 1500000000ULL * 1000000ULL;
+    const int workers = 8;
+    const uint32_t nuts = 20000;
+    char name[64];
+    snprintf( name, sizeof( name ), "/libsqrl-test-%d", (int)getpid() );
+    SqrlNutCache::removeShared( name );
+
+    // How many times each nut was accepted, by any process.
+    size_t countSize = nuts * sizeof( std::atomic<int> );
+    std::atomic<int> *accepted = (std::atomic<int>*)mmap( NULL, countSize,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    REQUIRE( accepted != MAP_FAILED );
+    for( uint32_t i = 0; i < nuts; i++ ) new (&accepted[i]) std::atomic<int>( 0 );
+
+    // Every worker opens the segment itself, racing to create it, then to claim the same nuts.
+    REQUIRE( forkWorkers( workers, [&]( int w ) {
+        SqrlNutCache *cache = SqrlNutCache::openShared( name, life, nuts );
+        if( !cache ) _exit( 1 );
+        for( uint32_t j = 0; j < nuts; j++ ) {
+            uint32_t i = (j + (uint32_t)w * 997) % nuts;
+            Sqrl_Nut n = { i, i * 31, base + i * (life / nuts) };
+            if( cache->add( &n ) ) accepted[i]++;
+        }
+        delete cache;
+    } ) );
+
+    SqrlNutCache *cache = SqrlNutCache::openShared( name, life, nuts );
+    REQUIRE( cache );
+    REQUIRE( cache->isShared() );
+    REQUIRE( cache->getMisses() == nuts );
+    REQUIRE( cache->getHits() == (uint64_t)(workers - 1) * nuts );
+    REQUIRE( cache->getOverflows() == 0 );
+    uint32_t once = 0;
+    for( uint32_t i = 0; i < nuts; i++ ) {
+        if( accepted[i] == 1 ) once++;
+    }
+    REQUIRE( once == nuts );
+    delete cache;
+
+    // Whole servers, one per process, sharing a passcode: each query is accepted by just one of them.
+    REQUIRE( SqrlNutCache::removeShared( name ) );
+    const int queryCount = 50;
+    std::vector<SqrlString> queries( queryCount );
+    {
+        BaseServer srv( TEST_SERVER_URI, "SQRLid", "test", 4 );
+        uint8_t sk[SQRL_KEY_SIZE];
+        for( int i = 0; i < queryCount; i++ ) {
+            sqrl_randombytes( sk, SQRL_KEY_SIZE );
+            SqrlString *link = srv.createLink( (uint32_t)i );
+            buildQuery( &queries[i], link, "query", sk );
+            delete link;
+        }
+    }
+    for( int i = 0; i < queryCount; i++ ) accepted[i] = 0;
+    REQUIRE( forkWorkers( 4, [&]( int w ) {
+        BaseServer srv( TEST_SERVER_URI, "SQRLid", "test", 4 );
+        if( !srv.useSharedNutCache( name, 1024 ) ) _exit( 1 );
+        SqrlServerRequest request( 0 );
+        for( int j = 0; j < queryCount; j++ ) {
+            int i = (j + w * 13) % queryCount;
+            request.reset( (uint32_t)i );
+            srv.handleQuery( &request, queries[i].cstring(), queries[i].length() );
+            if( 0 == (request.getTif() & SQRL_TIF_COMMAND_FAILURE) ) accepted[i]++;
+        }
+    } ) );
+    for( int i = 0; i < queryCount; i++ ) {
+        REQUIRE( accepted[i] == 1 );
+    }
+
+    REQUIRE( SqrlNutCache::removeShared( name ) );
+    munmap( accepted, countSize );
+}
+#endif
+
+#define TEST_USER_LOG "sqrl_user_store_test.log"
+
+// Fills in a user's keys from a number, so any copy can be checked against it.
+static void testUser( uint32_t n, uint8_t *idk, uint8_t *suk, uint8_t *vuk ) {
+    for( int i = 0; i < SQRL_KEY_SIZE; i++ ) {
+        idk[i] = (uint8_t)(n >> ((i & 3) * 8)) ^ (uint8_t)i;
+        suk[i] = idk[i] ^ 0x5A;
+        vuk[i] = idk[i] ^ 0xA5;
+    }
+}
+
+TEST_CASE( "User store", "[server]" ) {
+    uint8_t idk[SQRL_KEY_SIZE], suk[SQRL_KEY_SIZE], vuk[SQRL_KEY_SIZE];
+    uint8_t idk2[SQRL_KEY_SIZE], suk2[SQRL_KEY_SIZE], vuk2[SQRL_KEY_SIZE];
+    uint8_t gotSuk[SQRL_KEY_SIZE], gotVuk[SQRL_KEY_SIZE];
+    uint16_t flags;
+    SqrlString a( "example.com" ), b( "example.org" );
+    uint64_t siteA = SqrlUserStore::siteId( &a ), siteB = SqrlUserStore::siteId( &b );
+    REQUIRE( siteA != siteB );
+    remove( TEST_USER_LOG );
+
+    {
+        SqrlUserStore store( 100 );
+        REQUIRE( store.open( TEST_USER_LOG ) );
+        testUser( 1, idk, suk, vuk );
+        testUser( 2, idk2, suk2, vuk2 );
+        REQUIRE( !store.find( siteA, idk, gotSuk, gotVuk, &flags ) );
+        REQUIRE( store.create( siteA, idk, suk, vuk, 0 ) );
+        REQUIRE( !store.create( siteA, idk, suk, vuk, 0 ) );
+        REQUIRE( store.find( siteA, idk, gotSuk, gotVuk, &flags ) );
+        REQUIRE( 0 == memcmp( gotSuk, suk, SQRL_KEY_SIZE ) );
+        REQUIRE( 0 == memcmp( gotVuk, vuk, SQRL_KEY_SIZE ) );
+        REQUIRE( flags == 0 );
+        REQUIRE( !store.find( siteB, idk, NULL, NULL, NULL ) );
+
+        REQUIRE( store.update( siteA, idk, SQRL_SERVER_USER_FLAG_DISABLED ) );
+        REQUIRE( store.find( siteA, idk, NULL, NULL, &flags ) );
+        REQUIRE( flags == SQRL_SERVER_USER_FLAG_DISABLED );
+        REQUIRE( !store.update( siteB, idk, 0 ) );
+
+        // Rekeying moves the user; the old key is gone.
+        REQUIRE( store.rekey( siteA, idk, idk2, suk2, vuk2, 0 ) );
+        REQUIRE( !store.find( siteA, idk, NULL, NULL, NULL ) );
+        REQUIRE( store.find( siteA, idk2, gotSuk, NULL, &flags ) );
+        REQUIRE( 0 == memcmp( gotSuk, suk2, SQRL_KEY_SIZE ) );
+        REQUIRE( !store.rekey( siteA, idk, idk2, suk2, vuk2, 0 ) );
+        REQUIRE( store.getSize() == 1 );
+
+        // Fill it, with removals leaving tombstones along the way.
+        for( uint32_t i = 10; i < 200; i++ ) {
+            testUser( i, idk, suk, vuk );
+            bool full = store.getSize() == 100;
+            REQUIRE( store.create( siteB, idk, suk, vuk, (uint16_t)i ) == !full );
+            if( i % 3 == 0 && i < 100 ) REQUIRE( store.remove( siteB, idk ) );
+        }
+        REQUIRE( store.getSize() == 100 );
+        REQUIRE( !store.remove( siteB, idk ) );
+    }
+
+    // The log brings it all back, and a torn final entry is dropped.
+    FILE *fp = fopen( TEST_USER_LOG, "ab" );
+    REQUIRE( fp );
+    fwrite( "torn", 1, 4, fp );
+    fclose( fp );
+    for( int pass = 0; pass < 2; pass++ ) {
+        SqrlUserStore store( 100 );
+        REQUIRE( store.open( TEST_USER_LOG ) );
+        REQUIRE( store.getSize() == 100 );
+        REQUIRE( store.find( siteA, idk2, gotSuk, NULL, &flags ) );
+        REQUIRE( 0 == memcmp( gotSuk, suk2, SQRL_KEY_SIZE ) );
+        REQUIRE( !store.find( siteA, idk, NULL, NULL, NULL ) );
+        // 129 were created and 30 removed before the store filled up.
+        for( uint32_t i = 10; i < 200; i++ ) {
+            testUser( i, idk, suk, vuk );
+            bool found = store.find( siteB, idk, gotSuk, gotVuk, &flags );
+            REQUIRE( found == (i < 139 && (i % 3 != 0 || i >= 100)) );
+            if( found ) {
+                REQUIRE( flags == (pass == 1 && i == 13 ? 77 : i) );
+                REQUIRE( 0 == memcmp( gotVuk, vuk, SQRL_KEY_SIZE ) );
+            }
+        }
+        if( pass == 0 ) {
+            REQUIRE( store.compact() );
+            testUser( 13, idk, suk, vuk );
+            REQUIRE( store.update( siteB, idk, 77 ) );
+        }
+    }
+    remove( TEST_USER_LOG );
+}
+
+TEST_CASE( "User store churn", "[server]" ) {
+    // Users come and go far more often than the table has slots.  Tombstones mustn't take over
+    // the empty slots that end a probe for a missing user.
+    SqrlUserStore store( 100 ), fresh( 100 );
+    const size_t slots = fresh.getEmptySlots();
+    const uint32_t live = 80, rounds = 5000;
+    uint8_t idk[SQRL_KEY_SIZE], suk[SQRL_KEY_SIZE], vuk[SQRL_KEY_SIZE], gotSuk[SQRL_KEY_SIZE];
+    size_t fewest = slots;
+    for( uint32_t i = 0; i < rounds; i++ ) {
+        testUser( i, idk, suk, vuk );
+        REQUIRE( store.create( 1, idk, suk, vuk, (uint16_t)i ) );
+        if( i >= live ) {
+            testUser( i - live, idk, suk, vuk );
+            REQUIRE( store.remove( 1, idk ) );
+        }
+        if( store.getEmptySlots() < fewest ) fewest = store.getEmptySlots();
+    }
+    REQUIRE( fewest >= slots / 8 );
+    REQUIRE( store.getSize() == live );
+    for( uint32_t i = 0; i < rounds; i++ ) {
+        testUser( i, idk, suk, vuk );
+        bool found = store.find( 1, idk, gotSuk, NULL, NULL );
+        REQUIRE( found == (i >= rounds - live) );
+        if( found ) REQUIRE( 0 == memcmp( gotSuk, suk, SQRL_KEY_SIZE ) );
+    }
+
+    // Compacting clears every tombstone, log or no log.
+    store.compact();
+    REQUIRE( store.getEmptySlots() + store.getSize() == slots );
+    for( uint32_t i = rounds - live; i < rounds; i++ ) {
+        testUser( i, idk, suk, vuk );
+        REQUIRE( store.find( 1, idk, NULL, NULL, NULL ) );
+    }
+}
+
+TEST_CASE( "Store server", "[server]" ) {
+    SqrlStoreServer srv( TEST_SERVER_URI, "SQRLid", "test", 4 );
+    SqrlUserStore *store = srv.getUserStore();
+    uint8_t sk1[SQRL_KEY_SIZE], sk2[SQRL_KEY_SIZE];
+    uint8_t pk1[SQRL_KEY_SIZE], pk2[SQRL_KEY_SIZE], suk[SQRL_KEY_SIZE], vuk[SQRL_KEY_SIZE];
+    uint8_t got[SQRL_KEY_SIZE];
+    uint16_t flags;
+    sqrl_randombytes( sk1, SQRL_KEY_SIZE );
+    sqrl_randombytes( sk2, SQRL_KEY_SIZE );
+    sqrl_randombytes( suk, SQRL_KEY_SIZE );
+    sqrl_randombytes( vuk, SQRL_KEY_SIZE );
+    SqrlCrypt::generatePublicKey( pk1, sk1 );
+    SqrlCrypt::generatePublicKey( pk2, sk2 );
+
+    SqrlString keys( "suk=" ), str;
+    SqrlString sukStr( suk, SQRL_KEY_SIZE ), vukStr( vuk, SQRL_KEY_SIZE ), pk1Str( pk1, SQRL_KEY_SIZE );
+    SqrlBase64().encode( &keys, &sukStr, true );
+    keys.append( "\r\nvuk=" );
+    SqrlBase64().encode( &keys, &vukStr, true );
+    keys.append( "\r\n" );
+    SqrlString forged( "pidk=" );
+    SqrlBase64().encode( &forged, &pk1Str, true );
+    forged.append( "\r\n" );
+
+    SqrlServerRequest request( 0x0a000001 );
+    SqrlString query;
+    auto run = [&]( const char *cmd, const uint8_t *sk, const uint8_t *psk, const char *extra ) {
+        SqrlString *link = srv.createLink( 0x0a000001 );
+        buildQuery( &query, link, cmd, sk, psk, extra );
+        delete link;
+        request.reset( 0x0a000001 );
+        srv.handleQuery( &request, query.cstring(), query.length() );
+        return request.getTif();
+    };
+
+    // An unknown user is created by their first ident.
+    REQUIRE( 0 == (run( "query", sk1, NULL, NULL ) & SQRL_TIF_ID_MATCH) );
+    REQUIRE( (run( "ident", sk1, NULL, keys.cstring() ) & SQRL_TIF_ID_MATCH) );
+    REQUIRE( store->getSize() == 1 );
+    REQUIRE( store->find( srv.getSiteId(), pk1, got, NULL, &flags ) );
+    REQUIRE( 0 == memcmp( got, suk, SQRL_KEY_SIZE ) );
+    REQUIRE( (run( "query", sk1, NULL, NULL ) & SQRL_TIF_ID_MATCH) );
+
+    // Claiming a pidk without signing for it gets nowhere.
+    Sqrl_Tif tif = run( "ident", sk2, NULL, forged.cstring() );
+    REQUIRE( 0 == (tif & (SQRL_TIF_ID_MATCH | SQRL_TIF_PREVIOUS_ID_MATCH)) );
+    REQUIRE( store->find( srv.getSiteId(), pk1, NULL, NULL, NULL ) );
+
+    // A signed pidk moves the user to the new identity.
+    REQUIRE( (run( "query", sk2, sk1, NULL ) & SQRL_TIF_PREVIOUS_ID_MATCH) );
+    str.clear();
+    str.append( &keys );
+    tif = run( "ident", sk2, sk1, str.cstring() );
+    REQUIRE( (tif & SQRL_TIF_ID_MATCH) );
+    REQUIRE( 0 == (tif & SQRL_TIF_COMMAND_FAILURE) );
+    REQUIRE( !store->find( srv.getSiteId(), pk1, NULL, NULL, NULL ) );
+    REQUIRE( store->find( srv.getSiteId(), pk2, NULL, NULL, NULL ) );
+
+    // Disabling sticks, and the reply then carries the suk.
+    REQUIRE( (run( "disable", sk2, NULL, NULL ) & SQRL_TIF_SQRL_DISABLED) );
+    REQUIRE( store->find( srv.getSiteId(), pk2, NULL, NULL, &flags ) );
+    REQUIRE( flags == SQRL_SERVER_USER_FLAG_DISABLED );
+    REQUIRE( (run( "query", sk2, NULL, NULL ) & SQRL_TIF_SQRL_DISABLED) );
+    struct Sqrl_Kv_View v;
+    const SqrlString *reply = request.getReply();
+    REQUIRE( server_find_value( reply->cstring(), reply->length(), "suk", &v ) );
+    REQUIRE( server_b64_decode_exact( got, SQRL_KEY_SIZE, reply->cstring() + v.offset, v.length ) );
+    REQUIRE( 0 == memcmp( got, suk, SQRL_KEY_SIZE ) );
+}
+
+#if defined(WITH_THREADS)
+TEST_CASE( "User store concurrent readers", "[server]" ) {
+    SqrlUserStore store( 1000 );
+    const uint32_t users = 500;
+    uint8_t idk[SQRL_KEY_SIZE], suk[SQRL_KEY_SIZE], vuk[SQRL_KEY_SIZE];
+    for( uint32_t i = 0; i < users; i++ ) {
+        testUser( i, idk, suk, vuk );
+        REQUIRE( store.create( 1, idk, suk, vuk, 0 ) );
+    }
+
+    // Readers must always see a whole record, while a writer churns the table.
+    std::atomic<bool> done( false );
+    std::atomic<int> bad( 0 );
+    std::vector<std::thread> readers;
+    for( int t = 0; t < 3; t++ ) {
+        readers.push_back( std::thread( [&, t]() {
+            uint8_t k[SQRL_KEY_SIZE], s[SQRL_KEY_SIZE], v[SQRL_KEY_SIZE], gs[SQRL_KEY_SIZE], gv[SQRL_KEY_SIZE];
+            uint16_t flags;
+            for( uint32_t n = t; !done; n += 7 ) {
+                testUser( n % users, k, s, v );
+                if( !store.find( 1, k, gs, gv, &flags ) ||
+                    memcmp( gs, s, SQRL_KEY_SIZE ) || memcmp( gv, v, SQRL_KEY_SIZE ) ) bad++;
+            }
+        } ) );
+    }
+    for( uint32_t n = 0; n < 20000; n++ ) {
+        testUser( n % users, idk, suk, vuk );
+        store.update( 1, idk, (uint16_t)n );
+        testUser( users + n % 300, idk, suk, vuk );
+        if( !store.remove( 1, idk ) ) store.create( 1, idk, suk, vuk, 0 );
+    }
+    done = true;
+    for( auto &t : readers ) t.join();
+    REQUIRE( bad == 0 );
+}
+#endif
+
+#if defined(WITH_THREADS)
+// A SqrlStoreServer whose store takes 'latency' to answer each call, as a remote database would.
+// handleQueryAsync() queues the calls for a thread of the server's own, which answers them in
+// turn; handleQuery() blocks for the latency instead.
+class SlowStoreServer : public SqrlStoreServer
+{
+public:
+    SlowStoreServer( std::chrono::microseconds latency ) :
+        SqrlStoreServer( TEST_SERVER_URI, "SQRLid", "test", 4 ),
+        latency( latency ), stopping( false ), sent( 0 ), peak( 0 ) {
+        this->worker = std::thread( [this]() { this->run(); } );
+    }
+
+    ~SlowStoreServer() {
+        {
+            std::lock_guard<std::mutex> lock( this->mutex );
+            this->stopping = true;
+        }
+        this->ready.notify_all();
+        this->worker.join();
+    }
+
+    // Waits until 'n' replies have been sent in all.
+    void waitSent( size_t n ) {
+        std::unique_lock<std::mutex> lock( this->mutex );
+        this->done.wait( lock, [&]() { return this->sent >= n; } );
+    }
+
+    // The most store calls that were waiting at once.
+    size_t getPeak() {
+        std::lock_guard<std::mutex> lock( this->mutex );
+        return this->peak;
+    }
+
+protected:
+    struct Call
+    {
+        SqrlServerRequest *request;
+        int op;
+        const SqrlString *host, *idk, *pidk;
+        std::chrono::steady_clock::time_point due;
+    };
+
+    void onUserAsync( SqrlServerRequest *request, int op, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) {
+        Call c = { request, op, host, idk, pidk, std::chrono::steady_clock::now() + this->latency };
+        {
+            std::lock_guard<std::mutex> lock( this->mutex );
+            this->calls.push_back( c );
+            if( this->calls.size() > this->peak ) this->peak = this->calls.size();
+        }
+        this->ready.notify_one();
+    }
+
+    bool onUserFind( SqrlServerRequest *request, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) {
+        std::this_thread::sleep_for( this->latency );
+        return SqrlStoreServer::onUserFind( request, host, idk, pidk );
+    }
+
+    bool onUserCreate( SqrlServerRequest *request, const SqrlString *host, const SqrlString *idk, const SqrlString *pidk ) {
+        std::this_thread::sleep_for( this->latency );
+        return SqrlStoreServer::onUserCreate( request, host, idk, pidk );
+    }
+
+    void onSend( SqrlServerRequest *request, const SqrlString *reply ) {
+        {
+            std::lock_guard<std::mutex> lock( this->mutex );
+            this->sent++;
+        }
+        this->done.notify_all();
+    }
+
+private:
+    bool call( const Call *c ) {
+        switch( c->op ) {
+        case SQRL_SERVER_USER_FIND: return SqrlStoreServer::onUserFind( c->request, c->host, c->idk, c->pidk );
+        case SQRL_SERVER_USER_CREATE: return SqrlStoreServer::onUserCreate( c->request, c->host, c->idk, c->pidk );
+        case SQRL_SERVER_USER_UPDATE: return this->onUserUpdate( c->request, c->host, c->idk, c->pidk );
+        case SQRL_SERVER_USER_DELETE: return this->onUserDelete( c->request, c->host, c->idk, c->pidk );
+        case SQRL_SERVER_USER_REKEYED: return this->onUserRekeyed( c->request, c->host, c->idk, c->pidk );
+        case SQRL_SERVER_USER_IDENTIFIED: return this->onUserIdentified( c->request, c->host, c->idk, c->pidk );
+        }
+        return false;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock( this->mutex );
+        for( ;; ) {
+            this->ready.wait( lock, [&]() { return this->stopping || !this->calls.empty(); } );
+            if( this->calls.empty() ) return;
+            // Calls all take the same time, so the oldest is always the next due.
+            Call c = this->calls.front();
+            if( std::chrono::steady_clock::now() < c.due ) {
+                this->ready.wait_until( lock, c.due );
+                continue;
+            }
+            this->calls.pop_front();
+            lock.unlock();
+            this->resumeQuery( c.request, this->call( &c ) );
+            lock.lock();
+        }
+    }
+
+    std::chrono::microseconds latency;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::condition_variable done;
+    std::deque<Call> calls;
+    bool stopping;
+    size_t sent;
+    size_t peak;
+};
+
+TEST_CASE( "Server async user store", "[server]" ) {
+    // The same commands, against a store answered in line and one that answers later, must come out
+    // as they do with handleQuery().
+    SqrlStoreServer sync( TEST_SERVER_URI, "SQRLid", "test", 4 );
+    SqrlStoreServer inlined( TEST_SERVER_URI, "SQRLid", "test", 4 );
+    SlowStoreServer slow( std::chrono::microseconds( 2000 ) );
+    uint8_t sk1[SQRL_KEY_SIZE], sk2[SQRL_KEY_SIZE], suk[SQRL_KEY_SIZE], vuk[SQRL_KEY_SIZE];
+    sqrl_randombytes( sk1, SQRL_KEY_SIZE );
+    sqrl_randombytes( sk2, SQRL_KEY_SIZE );
+    sqrl_randombytes( suk, SQRL_KEY_SIZE );
+    sqrl_randombytes( vuk, SQRL_KEY_SIZE );
+    SqrlString keys( "suk=" );
+    SqrlString sukStr( suk, SQRL_KEY_SIZE ), vukStr( vuk, SQRL_KEY_SIZE );
+    SqrlBase64().encode( &keys, &sukStr, true );
+    keys.append( "\r\nvuk=" );
+    SqrlBase64().encode( &keys, &vukStr, true );
+    keys.append( "\r\n" );
+
+    struct Step { const char *cmd; const uint8_t *sk; const uint8_t *psk; const char *extra; } steps[] = {
+        { "query", sk1, NULL, NULL },
+        { "ident", sk1, NULL, keys.cstring() },
+        { "query", sk1, NULL, NULL },
+        { "ident", sk1, NULL, NULL },
+        { "query", sk2, sk1, NULL },
+        { "ident", sk2, sk1, keys.cstring() },
+        { "disable", sk2, NULL, NULL },
+        { "query", sk2, NULL, NULL },
+        { "ident", sk2, NULL, NULL },
+        { "enable", sk2, NULL, NULL },
+        { "remove", sk2, NULL, NULL },
+        { "bogus", sk2, NULL, NULL },
+    };
+    SqrlServerRequest request( 0x0a000001 );
+    SqrlString query;
+    size_t sent = 0;
+    for( size_t i = 0; i < sizeof( steps ) / sizeof( steps[0] ); i++ ) {
+        Sqrl_Tif tif[3];
+        SqrlServer *servers[3] = { &sync, &inlined, &slow };
+        for( int k = 0; k < 3; k++ ) {
+            SqrlString *link = servers[k]->createLink( 0x0a000001 );
+            buildQuery( &query, link, steps[i].cmd, steps[i].sk, steps[i].psk, steps[i].extra );
+            delete link;
+            request.reset( 0x0a000001 );
+            if( k == 0 ) {
+                servers[k]->handleQuery( &request, query.cstring(), query.length() );
+            } else {
+                servers[k]->handleQueryAsync( &request, query.cstring(), query.length() );
+            }
+            if( k == 2 ) slow.waitSent( ++sent );
+            tif[k] = request.getTif();
+            REQUIRE( request.getReply()->length() > 0 );
+        }
+        INFO( "step " << i << ": " << steps[i].cmd );
+        REQUIRE( tif[1] == tif[0] );
+        REQUIRE( tif[2] == tif[0] );
+    }
+    REQUIRE( sync.getUserStore()->getSize() == slow.getUserStore()->getSize() );
+
+    // Many queries wait on the store at once, rather than one after another.
+    const int n = 16;
+    std::vector<SqrlServerRequest*> requests;
+    std::vector<SqrlString> queries( n );
+    for( int i = 0; i < n; i++ ) {
+        SqrlString *link = slow.createLink( 0x0a000001 );
+        buildQuery( &queries[i], link, "query", sk1 );
+        delete link;
+        requests.push_back( new SqrlServerRequest( 0x0a000001 ) );
+    }
+    for( int i = 0; i < n; i++ ) {
+        slow.handleQueryAsync( requests[i], queries[i].cstring(), queries[i].length() );
+    }
+    slow.waitSent( sent + n );
+    REQUIRE( slow.getPeak() > 1 );
+    for( int i = 0; i < n; i++ ) {
+        REQUIRE( 0 == (requests[i]->getTif() & SQRL_TIF_COMMAND_FAILURE) );
+        delete requests[i];
+    }
+}
+
+TEST_CASE( "Server throughput with a slow user store", "[.][benchmark]" ) {
+    const std::chrono::microseconds latency( 2000 );
+    const int n = 2000;
+    const int threads = 4;
+    uint8_t sk[SQRL_KEY_SIZE];
+    sqrl_randombytes( sk, SQRL_KEY_SIZE );
+
+    for( int async = 0; async < 2; async++ ) {
+        SlowStoreServer srv( latency );
+        std::vector<SqrlString> queries( n );
+        std::vector<SqrlServerRequest*> requests;
+        for( int i = 0; i < n; i++ ) {
+            SqrlString *link = srv.createLink( 0x0a000001 );
+            buildQuery( &queries[i], link, "query", sk );
+            delete link;
+            requests.push_back( new SqrlServerRequest( 0x0a000001 ) );
+        }
+
+        auto t0 = std::chrono::steady_clock::now();
+        if( async ) {
+            // One thread takes every query; the store answers as its calls come due.
+            for( int i = 0; i < n; i++ ) {
+                srv.handleQueryAsync( requests[i], queries[i].cstring(), queries[i].length() );
+            }
+        } else {
+            std::vector<std::thread> pool;
+            for( int t = 0; t < threads; t++ ) {
+                pool.push_back( std::thread( [&, t]() {
+                    for( int i = t; i < n; i += threads ) {
+                        srv.handleQuery( requests[i], queries[i].cstring(), queries[i].length() );
+                    }
+                } ) );
+            }
+            for( auto &t : pool ) t.join();
+        }
+        srv.waitSent( n );
+        double secs = std::chrono::duration<double>( std::chrono::steady_clock::now() - t0 ).count();
+        for( int i = 0; i < n; i++ ) {
+            REQUIRE( 0 == (requests[i]->getTif() & SQRL_TIF_COMMAND_FAILURE) );
+            delete requests[i];
+        }
+        if( async ) {
+            printf( "Slow store (%d us), handleQueryAsync() on 1 thread: %.0f queries/sec, %zu in flight at most\n",
+                (int)latency.count(), n / secs, srv.getPeak() );
+        } else {
+            printf( "Slow store (%d us), handleQuery() on %d threads: %.0f queries/sec\n",
+                (int)latency.count(), threads, n / secs );
+        }
+    }
+}
+#endif
+
+TEST_CASE( "User store lookups", "[.][benchmark]" ) {
+    const uint32_t sizes[2] = { 65536, 2000000 };
+    for( int z = 0; z < 2; z++ ) {
+        const uint32_t users = sizes[z];
+        SqrlUserStore store( users );
+        uint8_t idk[SQRL_KEY_SIZE], suk[SQRL_KEY_SIZE], vuk[SQRL_KEY_SIZE];
+        uint16_t flags;
+        uint64_t rnd;
+        sqrl_randombytes( &rnd, sizeof( rnd ) );
+
+        auto t0 = std::chrono::steady_clock::now();
+        for( uint32_t i = 0; i < users; i++ ) {
+            testUser( i, idk, suk, vuk );
+            store.create( 1, idk, suk, vuk, 0 );
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        const int reps = 2000000;
+        size_t found = 0;
+        for( int i = 0; i < reps; i++ ) {
+            rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+            testUser( (uint32_t)(rnd >> 33) % users, idk, suk, vuk );
+            found += store.find( 1, idk, suk, vuk, &flags );
+        }
+        auto t2 = std::chrono::steady_clock::now();
+        for( int i = 0; i < reps; i++ ) {
+            testUser( users + i, idk, suk, vuk );
+            found += store.find( 1, idk, suk, vuk, &flags );
+        }
+        auto t3 = std::chrono::steady_clock::now();
+        REQUIRE( found == (size_t)reps );
+
+        printf( "User store, %u users in %.0f MB: %.0f creates/sec, %.0f ns per hit, %.0f ns per miss\n",
+            users, store.getMemoryUsage() / 1048576.0, users / std::chrono::duration<double>( t1 - t0 ).count(),
+            std::chrono::duration<double, std::nano>( t2 - t1 ).count() / reps,
+            std::chrono::duration<double, std::nano>( t3 - t2 ).count() / reps );
+    }
 }
-*/